@@ -176,12 +176,30 @@ memory_write(lua_State *L) {
 	return 0;
 }
 
+// mem at the top of the stack
+static void
+memory_close(lua_State *L) {
+	struct memory *mem = (struct memory *)lua_touserdata(L, -1);
+	if (!mem->closeobj)
+		return;
+	mem->closeobj = 0;
+	lua_getiuservalue(L, -1, 1);
+	if (luaL_getmetafield(L, -1, "__close") == LUA_TFUNCTION) {
+		lua_insert(L, -2);
+		lua_call(L, 1, 0);
+	} else {
+		lua_pop(L, 1);
+	}
+}
+
 static int
 memory_keepalive(lua_State *L) {
 	lua_getuservalue(L, 1);
 	struct memory *mem = (struct memory *)lua_touserdata(L, -1);
-	if (mem->ref == 0)
+	if (mem->ref == 0) {
+		memory_close(L);
 		return 0;
+	}
 	// keep alive
 	lua_newuserdatauv(L, 0, 1);
 	luaL_getmetatable(L, "BGFX_MEMORY_REF");
@@ -194,8 +212,11 @@ memory_keepalive(lua_State *L) {
 static int
 memory_release(lua_State *L) {
 	struct memory *mem = (struct memory *)lua_touserdata(L, 1);
-	if (mem->ref == 0)
+	if (mem->ref == 0) {
+		lua_settop(L, 1);
+		memory_close(L);
 		return 0;
+	}
 	// keep self alive
 	lua_newuserdatauv(L, 0, 1);
 	if (luaL_newmetatable(L, "BGFX_MEMORY_REF")) {
@@ -216,6 +237,7 @@ memory_new(lua_State *L) {
 	mem->size = 0;
 	mem->ref = 0;
 	mem->constant = 0;
+	mem->closeobj = 0;
 	if (luaL_newmetatable(L, "BGFX_MEMORY")) {
 		luaL_Reg l[] = {
 			{ "__tostring", memory_tostring },
@@ -2661,6 +2683,9 @@ lvertexConvert(lua_State *L) {
 	return 1;
 }
 
+// the data smaller than it is copied, so the closeobj is closed at once
+#define MEMORY_REF_MINSIZE (64 * 1024)
+
 // 2 : offset
 // 3 : size
 static void *
@@ -2704,6 +2729,7 @@ get_offset_size(lua_State *L, void *str_, size_t *sz) {
 		object lifetime (opt) userdata/string/table
 	type 4 :
 		integer size
+		integer fill (opt), the byte to fill the memory, it's not initialized by default
 	type 5 :
 		userdata data
 		integer offset (opt)
@@ -2712,6 +2738,8 @@ get_offset_size(lua_State *L, void *str_, size_t *sz) {
 		function() returns lightuserdata, size, closeobj_or_closefunc(opt)
 		integer offset (opt)
 		integer size (opt)
+		the large data is referenced instead of copied if closeobj is a userdata with __close(fastio.wrap),
+		closeobj is closed after the memory object is collected and bgfx doesn't use it.
  */
 static int
 lmemoryBuffer(lua_State *L) {
@@ -2720,7 +2748,10 @@ lmemoryBuffer(lua_State *L) {
 	if (t == LUA_TNUMBER) {
 		// type 4
 		sz = luaL_checkinteger(L, 1);
-		newMemory(L, NULL, sz);
+		int fill = (int)luaL_optinteger(L, 2, -1);
+		void * buffer = newMemory(L, NULL, sz);
+		if (fill >= 0)
+			memset(buffer, fill, sz);
 		return 1;
 	}
 	if (t == LUA_TLIGHTUSERDATA) {
@@ -2757,6 +2788,14 @@ lmemoryBuffer(lua_State *L) {
 		void * data = lua_touserdata(L, 4);
 		size_t sz = luaL_checkinteger(L, 5);
 		data = get_offset_size(L, data, &sz);
+		if (sz >= MEMORY_REF_MINSIZE && lua_type(L, 6) == LUA_TUSERDATA && luaL_getmetafield(L, 6, "__close") == LUA_TFUNCTION) {
+			lua_settop(L, 6);
+			// mount closeobj -> mem
+			newMemory(L, data, sz);
+			struct memory *mem = (struct memory *)lua_touserdata(L, -1);
+			mem->closeobj = 1;
+			return 1;
+		}
 		void * buffer = newMemory(L, NULL, sz);
 		memcpy(buffer, data, sz);
 		int t = lua_type(L, 6);
@@ -38,6 +38,7 @@ struct memory {
 	size_t size;
 	int ref;
 	int constant;
+	int closeobj;	// call __close of the mounted object when it's released
 };
 
 #if LUA_VERSION_NUM < 504
@@ -22,6 +22,7 @@ struct bgfx_encoder_holder {
 };
 
 struct cull_cached;
+struct aabb_tree;
 
 struct ecs_world {
 	struct ecs_context*           ecs;
@@ -32,6 +33,7 @@ struct ecs_world {
 	struct render_material*       R;
 	uint64_t                      frame;
 	struct queue_container*       Q;
+	struct aabb_tree*             aabb_tree;
 };
 
 static inline struct ecs_world* getworld(lua_State* L) {
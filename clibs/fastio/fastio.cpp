@@ -200,6 +200,19 @@ static int readall_f(lua_State *L) {
     return 1;
 }
 
+// "archive.zip|index" is a read only slice of the archive if it's stored, the regular files are read
+template <bool RAISE>
+static int readall_m(lua_State *L) {
+    const char* filename = getfile(L);
+    lua_settop(L, 2);
+    auto cache = luazip_map(filename);
+    if (!cache) {
+        return raise_error<RAISE>(L, "map", getsymbol(L, filename));
+    }
+    lua_pushlightuserdata(L, cache);
+    return 1;
+}
+
 template <bool RAISE>
 static int readall_u(lua_State *L) {
     const char* filename = getfile(L);
@@ -388,6 +401,37 @@ static int tostring(lua_State *L) {
     return 1;
 }
 
+static int clone(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    zip_reader_cache* cache = (zip_reader_cache*)lua_touserdata(L, 1);
+    size_t len = 0;
+    void* buf = luazip_data(cache, &len);
+    auto c = luazip_new(len, NULL);
+    if (!c) {
+        return luaL_error(L, "not enough memory");
+    }
+    memcpy(luazip_data(c, nullptr), buf, len);
+    lua_pushlightuserdata(L, c);
+    return 1;
+}
+
+// n read only views of the memory, the memory is freed after all the views are freed
+static int share(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    zip_reader_cache* cache = (zip_reader_cache*)lua_touserdata(L, 1);
+    const int n = (int)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n > 0, 2, "need at least one view");
+    luaL_checkstack(L, n, NULL);
+    auto views = (zip_reader_cache**)lua_newuserdatauv(L, n * sizeof(zip_reader_cache*), 0);
+    if (!luazip_share(cache, n, views)) {
+        return luaL_error(L, "not enough memory");
+    }
+    for (int i = 0; i < n; ++i) {
+        lua_pushlightuserdata(L, views[i]);
+    }
+    return n;
+}
+
 static int free(lua_State *L) {
     luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
     zip_reader_cache* cache = (zip_reader_cache*)lua_touserdata(L, 1);
@@ -428,6 +472,8 @@ luaopen_fastio(lua_State* L) {
         {"readall_v", readall_v<true>},
         {"readall_v_noerr", readall_v<false>},
         {"readall_f", readall_f<true>},
+        {"readall_m", readall_m<true>},
+        {"readall_m_noerr", readall_m<false>},
         {"readall_u", readall_u<true>},
         {"readall_s", readall_s<true>},
         {"readall_s_noerr", readall_s<false>},
@@ -436,6 +482,8 @@ luaopen_fastio(lua_State* L) {
         {"str2sha1", str2sha1},
         {"wrap", wrap},
         {"tostring", tostring},
+        {"clone", clone},
+        {"share", share},
         {"free", free},
         {"loadlua", loadlua},
         {NULL, NULL},
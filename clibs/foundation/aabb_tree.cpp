@@ -0,0 +1,298 @@
+#include "aabb_tree.h"
+
+#include <cstring>
+#include <algorithm>
+
+// the fat box is the tight box expanded by LOOSE_RATIO of its size and LOOSE_MIN
+static constexpr float LOOSE_RATIO = 0.1f;
+static constexpr float LOOSE_MIN = 0.1f;
+
+static inline aabb_tree_box
+box_union(const aabb_tree_box &a, const aabb_tree_box &b){
+	aabb_tree_box r;
+	for (int ii=0; ii<3; ++ii){
+		r.min[ii] = std::min(a.min[ii], b.min[ii]);
+		r.max[ii] = std::max(a.max[ii], b.max[ii]);
+	}
+	return r;
+}
+
+// half of the surface area
+static inline float
+box_area(const aabb_tree_box &b){
+	const float x = b.max[0] - b.min[0];
+	const float y = b.max[1] - b.min[1];
+	const float z = b.max[2] - b.min[2];
+	return x * y + y * z + z * x;
+}
+
+static inline bool
+box_contains(const aabb_tree_box &outer, const aabb_tree_box &inner){
+	for (int ii=0; ii<3; ++ii){
+		if (inner.min[ii] < outer.min[ii] || inner.max[ii] > outer.max[ii])
+			return false;
+	}
+	return true;
+}
+
+static inline aabb_tree_box
+box_loose(const aabb_tree_box &b){
+	aabb_tree_box r;
+	for (int ii=0; ii<3; ++ii){
+		const float d = (b.max[ii] - b.min[ii]) * LOOSE_RATIO + LOOSE_MIN;
+		r.min[ii] = b.min[ii] - d;
+		r.max[ii] = b.max[ii] + d;
+	}
+	return r;
+}
+
+int32_t
+aabb_tree::alloc_node(){
+	int32_t idx;
+	if (freelist != NULL_NODE){
+		idx = freelist;
+		freelist = nodes[idx].parent;
+		--freecount;
+	} else {
+		idx = (int32_t)nodes.size();
+		nodes.emplace_back();
+	}
+	auto &n = nodes[idx];
+	n.key = 0;
+	n.parent = n.child1 = n.child2 = NULL_NODE;
+	n.height = 0;
+	n.user = NO_USER;
+	return idx;
+}
+
+void
+aabb_tree::free_node(int32_t idx){
+	auto &n = nodes[idx];
+	n.parent = freelist;
+	n.height = -1;
+	freelist = idx;
+	++freecount;
+}
+
+void
+aabb_tree::insert_leaf(int32_t leaf){
+	if (root == NULL_NODE){
+		root = leaf;
+		nodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	// find the best sibling, the cost is the area of the new parent and the increased area of the ancestors
+	const aabb_tree_box box = nodes[leaf].fat;
+	int32_t idx = root;
+	while (!nodes[idx].leaf()){
+		const auto &n = nodes[idx];
+		const float area = box_area(n.fat);
+		const float combined = box_area(box_union(n.fat, box));
+		const float cost = 2.f * combined;
+		const float inheritance = 2.f * (combined - area);
+
+		auto child_cost = [&](int32_t c){
+			const auto &cn = nodes[c];
+			const float a = box_area(box_union(box, cn.fat));
+			return (cn.leaf() ? a : a - box_area(cn.fat)) + inheritance;
+		};
+		const float cost1 = child_cost(n.child1);
+		const float cost2 = child_cost(n.child2);
+		if (cost < cost1 && cost < cost2)
+			break;
+		idx = cost1 < cost2 ? n.child1 : n.child2;
+	}
+
+	const int32_t sibling = idx;
+	const int32_t oldparent = nodes[sibling].parent;
+	const int32_t newparent = alloc_node();
+	{
+		auto &np = nodes[newparent];
+		np.parent = oldparent;
+		np.fat = box_union(box, nodes[sibling].fat);
+		np.height = nodes[sibling].height + 1;
+		np.child1 = sibling;
+		np.child2 = leaf;
+	}
+	if (oldparent != NULL_NODE){
+		auto &op = nodes[oldparent];
+		if (op.child1 == sibling)
+			op.child1 = newparent;
+		else
+			op.child2 = newparent;
+	} else {
+		root = newparent;
+	}
+	nodes[sibling].parent = newparent;
+	nodes[leaf].parent = newparent;
+
+	fix_upward(newparent);
+}
+
+void
+aabb_tree::remove_leaf(int32_t leaf){
+	if (leaf == root){
+		root = NULL_NODE;
+		return;
+	}
+	const int32_t parent = nodes[leaf].parent;
+	const int32_t grandparent = nodes[parent].parent;
+	const int32_t sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grandparent != NULL_NODE){
+		auto &g = nodes[grandparent];
+		if (g.child1 == parent)
+			g.child1 = sibling;
+		else
+			g.child2 = sibling;
+		nodes[sibling].parent = grandparent;
+		free_node(parent);
+		fix_upward(grandparent);
+	} else {
+		root = sibling;
+		nodes[sibling].parent = NULL_NODE;
+		free_node(parent);
+	}
+}
+
+void
+aabb_tree::fix_upward(int32_t idx){
+	while (idx != NULL_NODE){
+		idx = balance(idx);
+		auto &n = nodes[idx];
+		const auto &c1 = nodes[n.child1];
+		const auto &c2 = nodes[n.child2];
+		n.height = 1 + std::max(c1.height, c2.height);
+		n.fat = box_union(c1.fat, c2.fat);
+		idx = n.parent;
+	}
+}
+
+// rotate the higher grandchild up if a is imbalanced, return the root of the subtree
+int32_t
+aabb_tree::balance(int32_t ia){
+	auto &a = nodes[ia];
+	if (a.leaf() || a.height < 2)
+		return ia;
+
+	const int32_t ib = a.child1;
+	const int32_t ic = a.child2;
+	const int32_t diff = nodes[ic].height - nodes[ib].height;
+
+	auto rotate = [this](int32_t ia, int32_t iup, int32_t iother, bool upis2){
+		// iup goes up to the position of ia, ia becomes the child of iup
+		auto &a = nodes[ia];
+		auto &up = nodes[iup];
+		const int32_t ix = up.child1;
+		const int32_t iy = up.child2;
+
+		up.child1 = ia;
+		up.parent = a.parent;
+		a.parent = iup;
+		if (up.parent != NULL_NODE){
+			auto &p = nodes[up.parent];
+			if (p.child1 == ia)
+				p.child1 = iup;
+			else
+				p.child2 = iup;
+		} else {
+			root = iup;
+		}
+
+		// the higher one of x/y stays in up, the other one replaces up in a
+		int32_t keep = ix, give = iy;
+		if (nodes[ix].height <= nodes[iy].height){
+			keep = iy; give = ix;
+		}
+		up.child2 = keep;
+		if (upis2)
+			a.child2 = give;
+		else
+			a.child1 = give;
+		nodes[give].parent = ia;
+
+		const auto &o = nodes[iother];
+		a.fat = box_union(o.fat, nodes[give].fat);
+		a.height = 1 + std::max(o.height, nodes[give].height);
+		up.fat = box_union(a.fat, nodes[keep].fat);
+		up.height = 1 + std::max(a.height, nodes[keep].height);
+		return iup;
+	};
+
+	if (diff > 1)
+		return rotate(ia, ic, ib, true);
+	if (diff < -1)
+		return rotate(ia, ib, ic, false);
+	return ia;
+}
+
+bool
+aabb_tree::update(uint64_t key, const float *aabb){
+	if (aabb == nullptr){
+		remove(key);
+		return true;
+	}
+	aabb_tree_box tight;
+	for (int ii=0; ii<3; ++ii){
+		tight.min[ii] = aabb[ii];
+		tight.max[ii] = aabb[4+ii];
+	}
+
+	auto it = leaves.find(key);
+	if (it != leaves.end()){
+		auto &n = nodes[it->second];
+		if (0 == memcmp(&n.tight, &tight, sizeof(tight)))
+			return false;
+		n.tight = tight;
+		// keep the leaf if the fat box still contains it and isn't too large for it
+		const aabb_tree_box fat = box_loose(tight);
+		if (box_contains(n.fat, tight) && box_area(n.fat) <= 4.f * box_area(fat)){
+			++stat.refit;
+			return false;
+		}
+		++stat.reinsert;
+		const int32_t leaf = it->second;
+		remove_leaf(leaf);
+		nodes[leaf].fat = fat;
+		insert_leaf(leaf);
+		return true;
+	}
+
+	const int32_t leaf = alloc_node();
+	auto &n = nodes[leaf];
+	n.key = key;
+	n.tight = tight;
+	n.fat = box_loose(tight);
+	leaves.emplace(key, leaf);
+	insert_leaf(leaf);
+	return true;
+}
+
+void
+aabb_tree::remove(uint64_t key){
+	auto it = leaves.find(key);
+	if (it == leaves.end())
+		return;
+	const int32_t leaf = it->second;
+	leaves.erase(it);
+	remove_leaf(leaf);
+	free_node(leaf);
+}
+
+void
+aabb_tree::set_user(uint64_t key, uint32_t user){
+	auto it = leaves.find(key);
+	if (it != leaves.end()){
+		nodes[it->second].user = user;
+	}
+}
+
+void
+aabb_tree::clear(){
+	nodes.clear();
+	leaves.clear();
+	root = freelist = NULL_NODE;
+	freecount = 0;
+	stat = {0, 0};
+}
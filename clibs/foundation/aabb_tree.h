@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <bit>
+#include <vector>
+#include <unordered_map>
+
+/*
+	Dynamic AABB tree, the leaves are the world space aabbs of the entities keyed by eid.
+
+	A leaf keeps a loose(fat) box for the tree and the tight box of the entity. Moving inside the
+	fat box only updates the tight box, otherwise the leaf is removed and reinserted. The sibling
+	of a new leaf is chosen by the surface area heuristic, and the tree is kept balanced by rotations.
+
+	Queries reject a whole subtree when its box is out of the frustums or missed by the ray.
+*/
+
+struct aabb_tree_box {
+	float min[3];
+	float max[3];
+};
+
+struct aabb_tree {
+	static constexpr int32_t NULL_NODE = -1;
+	static constexpr uint32_t NO_USER = UINT32_MAX;
+	static constexpr uint32_t MAX_STACK = 128;
+
+	// the traversal stack is on the C stack, it moves to the heap when a degenerate tree is deeper
+	template<typename T>
+	struct traverse_stack {
+		T				fixed[MAX_STACK];
+		std::vector<T>	heap;
+		T *				data = fixed;
+		uint32_t		cap = MAX_STACK;
+		uint32_t		top = 0;
+
+		bool empty() const { return top == 0; }
+		T pop() { return data[--top]; }
+		void push(const T &v){
+			if (top == cap)
+				grow();
+			data[top++] = v;
+		}
+		void grow(){
+			if (data == fixed)
+				heap.assign(fixed, fixed + top);
+			cap *= 2;
+			heap.resize(cap);
+			data = heap.data();
+		}
+	};
+
+	struct node {
+		aabb_tree_box	fat;
+		aabb_tree_box	tight;		// leaf only
+		uint64_t		key;
+		int32_t			parent;		// next free node when it's in the free list
+		int32_t			child1;
+		int32_t			child2;
+		int32_t			height;		// leaf is 0, free node is -1
+		uint32_t		user;
+
+		bool leaf() const { return child1 == NULL_NODE; }
+	};
+
+	struct stat_t {
+		uint32_t refit;
+		uint32_t reinsert;
+	};
+
+	// aabb is math3d aabb value: min(vec4), max(vec4), nullptr removes the key.
+	// return true if the tree structure is changed
+	bool update(uint64_t key, const float *aabb);
+	void remove(uint64_t key);
+	bool contains(uint64_t key) const { return leaves.find(key) != leaves.end(); }
+	// user data is kept until the key is removed, it's NO_USER for the new leaf
+	void set_user(uint64_t key, uint32_t user);
+	void clear();
+
+	uint32_t size() const { return (uint32_t)leaves.size(); }
+	uint32_t node_count() const { return (uint32_t)(nodes.size() - freecount); }
+	int32_t height() const { return root == NULL_NODE ? 0 : nodes[root].height; }
+
+	// planes are nfrustum * 6 vec4, as math3d.frustum_planes, p is in the plane when dot(plane.xyz, p) + plane.w >= 0.
+	// visit(key, user, visible, inside) for the leaves whose fat box is not out of all the frustums,
+	// bit f of visible: the fat box is not out of frustum f, bit f of inside: the fat box is totally in frustum f
+	template<typename Visit>
+	void query_frustums(const float *planes, uint32_t nfrustum, Visit &&visit) const;
+
+	// visit(key, user, t) for the leaves whose tight box is hit by the ray in [0, maxt], t is the entry point in dir unit
+	template<typename Visit>
+	void raycast(const float origin[3], const float dir[3], float maxt, Visit &&visit) const;
+
+	stat_t stat = {0, 0};
+
+private:
+	int32_t alloc_node();
+	void free_node(int32_t idx);
+	void insert_leaf(int32_t leaf);
+	void remove_leaf(int32_t leaf);
+	int32_t balance(int32_t a);
+	void fix_upward(int32_t idx);
+
+	static inline bool
+	box_out_of_frustum(const aabb_tree_box &b, const float *planes, bool &inside){
+		const float cx = (b.min[0] + b.max[0]) * 0.5f, ex = (b.max[0] - b.min[0]) * 0.5f;
+		const float cy = (b.min[1] + b.max[1]) * 0.5f, ey = (b.max[1] - b.min[1]) * 0.5f;
+		const float cz = (b.min[2] + b.max[2]) * 0.5f, ez = (b.max[2] - b.min[2]) * 0.5f;
+		inside = true;
+		for (int ii=0; ii<6; ++ii){
+			const float *p = planes + ii * 4;
+			const float d = p[0] * cx + p[1] * cy + p[2] * cz + p[3];
+			const float r = (p[0] < 0 ? -p[0] : p[0]) * ex + (p[1] < 0 ? -p[1] : p[1]) * ey + (p[2] < 0 ? -p[2] : p[2]) * ez;
+			if (d + r < 0)
+				return true;
+			if (d - r < 0)
+				inside = false;
+		}
+		return false;
+	}
+
+	static inline bool
+	box_hit(const aabb_tree_box &b, const float origin[3], const float invdir[3], float maxt, float &t){
+		float tmin = 0, tmax = maxt;
+		for (int ii=0; ii<3; ++ii){
+			float t1 = (b.min[ii] - origin[ii]) * invdir[ii];
+			float t2 = (b.max[ii] - origin[ii]) * invdir[ii];
+			if (t1 > t2){
+				const float tt = t1; t1 = t2; t2 = tt;
+			}
+			// NaN(origin on the slab with 0 direction) keeps the old range
+			tmin = t1 > tmin ? t1 : tmin;
+			tmax = t2 < tmax ? t2 : tmax;
+			if (tmin > tmax)
+				return false;
+		}
+		t = tmin;
+		return true;
+	}
+
+	std::vector<node>	nodes;
+	std::unordered_map<uint64_t, int32_t>	leaves;
+	int32_t		root = NULL_NODE;
+	int32_t		freelist = NULL_NODE;
+	uint32_t	freecount = 0;
+};
+
+template<typename Visit>
+void
+aabb_tree::query_frustums(const float *planes, uint32_t nfrustum, Visit &&visit) const {
+	if (root == NULL_NODE || nfrustum == 0)
+		return;
+	assert(nfrustum <= 64);
+	struct item {
+		int32_t		idx;
+		uint64_t	test;		// frustums need to test
+		uint64_t	inside;		// frustums the parent is totally in
+	};
+	traverse_stack<item> stack;
+	stack.push(item{root, nfrustum == 64 ? ~0ull : (1ull << nfrustum) - 1, 0});
+	while (!stack.empty()){
+		const item it = stack.pop();
+		const node &n = nodes[it.idx];
+		uint64_t test = it.test;
+		uint64_t inside = it.inside;
+		for (uint64_t m = it.test; m; m &= m - 1){
+			const uint32_t f = (uint32_t)std::countr_zero(m);
+			bool in;
+			if (box_out_of_frustum(n.fat, planes + f * 24, in)){
+				test &= ~(1ull << f);
+			} else if (in){
+				test &= ~(1ull << f);
+				inside |= 1ull << f;
+			}
+		}
+		if (0 == (test | inside))
+			continue;
+		if (n.leaf()){
+			visit(n.key, n.user, test | inside, inside);
+		} else {
+			stack.push(item{n.child1, test, inside});
+			stack.push(item{n.child2, test, inside});
+		}
+	}
+}
+
+template<typename Visit>
+void
+aabb_tree::raycast(const float origin[3], const float dir[3], float maxt, Visit &&visit) const {
+	if (root == NULL_NODE)
+		return;
+	const float invdir[3] = { 1.f / dir[0], 1.f / dir[1], 1.f / dir[2] };
+	traverse_stack<int32_t> stack;
+	stack.push(root);
+	while (!stack.empty()){
+		const node &n = nodes[stack.pop()];
+		float t;
+		if (!box_hit(n.fat, origin, invdir, maxt, t))
+			continue;
+		if (n.leaf()){
+			if (box_hit(n.tight, origin, invdir, maxt, t))
+				visit(n.key, n.user, t);
+		} else {
+			stack.push(n.child1);
+			stack.push(n.child2);
+		}
+	}
+}
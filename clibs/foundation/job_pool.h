@@ -0,0 +1,116 @@
+#ifndef foundation_job_pool_h
+#define foundation_job_pool_h
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+/*
+	A tiny fork/join pool. run(f) calls f(idx) once on every thread of the pool,
+	the caller thread is idx 0 and the workers are 1..count()-1. It returns after
+	all of them finished, so per-thread data indexed by idx needs no locking.
+
+	Usage :
+
+	job_pool pool;
+	pool.start(3);	// 3 workers + caller
+	std::atomic<uint32_t> next(0);
+	pool.run([&](uint32_t idx){
+		for (uint32_t b; (b = next.fetch_add(BATCH)) < n; ) {
+			// do [b, min(b+BATCH, n)) with context[idx]
+		}
+	});
+*/
+
+struct job_pool {
+	~job_pool() {
+		stop();
+	}
+
+	void start(uint32_t workers) {
+		stop();
+		uint64_t seen;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			quit = false;
+			seen = generation;
+		}
+		// the new workers wait for the next run, generation is not reset by stop()
+		for (uint32_t ii=0; ii<workers; ++ii) {
+			threads.emplace_back([this, ii, seen](){ loop(ii+1, seen); });
+		}
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			quit = true;
+		}
+		wakeup.notify_all();
+		for (auto &t : threads) {
+			t.join();
+		}
+		threads.clear();
+	}
+
+	uint32_t count() const {
+		return (uint32_t)threads.size() + 1;
+	}
+
+	template<typename Func>
+	void run(Func &&f) {
+		if (threads.empty()) {
+			f(0);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			task = std::ref(f);
+			pending = (uint32_t)threads.size();
+			++generation;
+		}
+		wakeup.notify_all();
+		f(0);
+		std::unique_lock<std::mutex> lk(mtx);
+		finished.wait(lk, [this](){ return pending == 0; });
+		task = nullptr;
+	}
+
+private:
+	void loop(uint32_t idx, uint64_t seen) {
+		for (;;) {
+			std::function<void(uint32_t)> t;
+			{
+				std::unique_lock<std::mutex> lk(mtx);
+				wakeup.wait(lk, [this, seen](){ return quit || generation != seen; });
+				if (quit)
+					return;
+				seen = generation;
+				t = task;
+			}
+			if (!t)
+				continue;
+			t(idx);
+			{
+				std::lock_guard<std::mutex> lk(mtx);
+				if (--pending == 0)
+					finished.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread>	threads;
+	std::mutex					mtx;
+	std::condition_variable		wakeup;
+	std::condition_variable		finished;
+	std::function<void(uint32_t)> task;
+	uint64_t	generation = 0;
+	uint32_t	pending = 0;
+	bool		quit = false;
+};
+
+#endif //foundation_job_pool_h
@@ -0,0 +1,643 @@
+#include <lua.hpp>
+
+#include "meshopt.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+	The vertex conversion of the glTF primitives, it was model/pack_vertex_data.lua:
+
+	* change from right hand to left hand: z of the float vectors(pnTbc) is negated, the winding is reversed.
+	* the tangents are calculated from the uv if the primitive has normal and TEXCOORD_0 but no tangent.
+	* normal and tangent are packed into a quaternion(tangent frame) of 4 int16.
+	* uint8 joints are converted to uint16, weights to int16, uint16 colors to uint8.
+
+	Then the indices are optimized for the vertex cache and overdraw, and the vertices are reordered for fetching.
+*/
+
+static constexpr float ZERO_THRESHOLD = 10e-6f;
+static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+struct attrib {
+	std::string name;		// glTF name, as POSITION
+	std::string layout;		// as "p30NIf"
+	std::string new_layout;
+	const uint8_t *data;	// the first element
+	size_t stride;
+	size_t size;
+
+	char shortname() const { return layout[0]; }
+	int count() const { return layout[1] - '0'; }
+	char type() const { return layout[5]; }
+	bool is_vec() const { return strchr("pnTbc", shortname()) != nullptr; }
+	// the raw value of the component(not normalized), as string.unpack
+	double component(uint32_t v, int idx) const {
+		const uint8_t *p = data + stride * v;
+		switch (type()) {
+		case 'f': { float f; memcpy(&f, p + idx * 4, 4); return f; }
+		case 'i': { uint16_t i; memcpy(&i, p + idx * 2, 2); return i; }
+		default: return p[idx];
+		}
+	}
+	// right hand to left hand
+	void load(uint32_t v, float r[4]) const {
+		r[0] = r[1] = r[2] = r[3] = 0.f;
+		const int n = count() < 4 ? count() : 4;
+		for (int ii=0; ii<n; ++ii) {
+			r[ii] = (float)component(v, ii);
+		}
+		if (n >= 3 && type() == 'f' && is_vec())
+			r[2] = -r[2];
+	}
+};
+
+struct stream {
+	std::vector<attrib> attribs;
+	std::string declname;
+	std::string bin;
+	size_t vertex_size = 0;
+
+	int find(const char *name) const {
+		for (size_t ii=0; ii<attribs.size(); ++ii) {
+			if (attribs[ii].name == name)
+				return (int)ii;
+		}
+		return -1;
+	}
+};
+
+static inline float
+vec_dot(const float *a, const float *b) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void
+vec_cross(float *r, const float *a, const float *b) {
+	const float x = a[1] * b[2] - a[2] * b[1];
+	const float y = a[2] * b[0] - a[0] * b[2];
+	const float z = a[0] * b[1] - a[1] * b[0];
+	r[0] = x; r[1] = y; r[2] = z;
+}
+
+static inline bool
+vec_invalid(const float *v) {
+	for (int ii=0; ii<3; ++ii) {
+		if (v[ii] != v[ii])
+			return true;
+	}
+	return fabsf(v[0]) <= ZERO_THRESHOLD && fabsf(v[1]) <= ZERO_THRESHOLD && fabsf(v[2]) <= ZERO_THRESHOLD;
+}
+
+static inline int16_t
+f2i(float v) {
+	if (v != v)
+		v = 0.f;
+	return (int16_t)floorf(v * 32767.f + 0.5f);
+}
+
+// see: http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-13-normal-mapping/#tangent-and-bitangent
+static void
+calc_tangents(std::vector<float> &tangents, const uint32_t *tris, size_t index_count, size_t numv, const attrib &pos, const attrib &normal, const attrib &uv) {
+	std::vector<float> tanu(numv * 3, 0.f), tanv(numv * 3, 0.f);
+	for (size_t ii=0; ii<index_count; ii+=3) {
+		float p[3][4], t[3][4];
+		for (int jj=0; jj<3; ++jj) {
+			pos.load(tris[ii+jj], p[jj]);
+			t[jj][0] = (float)uv.component(tris[ii+jj], 0);
+			t[jj][1] = (float)uv.component(tris[ii+jj], 1);
+		}
+		const float ba[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+		const float ca[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+		const float bau = t[1][0] - t[0][0], bav = t[1][1] - t[0][1];
+		const float cau = t[2][0] - t[0][0], cav = t[2][1] - t[0][1];
+		const float det = bau * cav - bav * cau;
+		float tu[3], tv[3];
+		if (fabsf(det) <= ZERO_THRESHOLD) {
+			tu[0] = 1.f; tu[1] = 0.f; tu[2] = 0.f;
+			tv[0] = 0.f; tv[1] = 0.f; tv[2] = 1.f;
+		} else {
+			const float invdet = 1.f / det;
+			for (int kk=0; kk<3; ++kk) {
+				tu[kk] = (ba[kk] * cav - ca[kk] * bav) * invdet;
+				tv[kk] = (ca[kk] * bau - ba[kk] * cau) * invdet;
+			}
+		}
+		for (int jj=0; jj<3; ++jj) {
+			float *u = &tanu[tris[ii+jj] * 3], *v = &tanv[tris[ii+jj] * 3];
+			for (int kk=0; kk<3; ++kk) {
+				u[kk] += tu[kk];
+				v[kk] += tv[kk];
+			}
+		}
+	}
+	tangents.resize(numv * 4);
+	for (size_t v=0; v<numv; ++v) {
+		float n[4];
+		normal.load((uint32_t)v, n);
+		const float *u = &tanu[v * 3], *bv = &tanv[v * 3];
+		const float ndu = vec_dot(u, n), ndv = vec_dot(bv, n);
+		float tangent[3] = {u[0] - n[0] * ndu, u[1] - n[1] * ndu, u[2] - n[2] * ndu};
+		const float bitangent[3] = {bv[0] - n[0] * ndv, bv[1] - n[1] * ndv, bv[2] - n[2] * ndv};
+		if (vec_invalid(tangent)) {
+			if (vec_invalid(bitangent)) {
+				tangent[0] = 1.f; tangent[1] = 0.f; tangent[2] = 0.f;
+			} else {
+				vec_cross(tangent, bitangent, n);
+			}
+		}
+		const float l = sqrtf(vec_dot(tangent, tangent));
+		float *r = &tangents[v * 4];
+		for (int kk=0; kk<3; ++kk) {
+			r[kk] = tangent[kk] / l;
+		}
+		float nxt[3];
+		vec_cross(nxt, n, r);
+		r[3] = vec_dot(nxt, bitangent) < 0.f ? 1.f : -1.f;
+	}
+}
+
+// as glm::quat_cast, the columns of the matrix are tangent, cross(normal, tangent), normal. q is xyzw
+static void
+pack_tangent_frame(float q[4], const float *normal, const float *tangent) {
+	float b[3];
+	vec_cross(b, normal, tangent);
+	const float *m[3] = {tangent, b, normal};
+	const float four_x = m[0][0] - m[1][1] - m[2][2];
+	const float four_y = m[1][1] - m[0][0] - m[2][2];
+	const float four_z = m[2][2] - m[0][0] - m[1][1];
+	const float four_w = m[0][0] + m[1][1] + m[2][2];
+	int biggest = 0;
+	float four_biggest = four_w;
+	if (four_x > four_biggest) { four_biggest = four_x; biggest = 1; }
+	if (four_y > four_biggest) { four_biggest = four_y; biggest = 2; }
+	if (four_z > four_biggest) { four_biggest = four_z; biggest = 3; }
+	const float biggest_val = sqrtf(four_biggest + 1.f) * 0.5f;
+	const float mult = 0.25f / biggest_val;
+	switch (biggest) {
+	case 0:
+		q[3] = biggest_val;
+		q[0] = (m[1][2] - m[2][1]) * mult;
+		q[1] = (m[2][0] - m[0][2]) * mult;
+		q[2] = (m[0][1] - m[1][0]) * mult;
+		break;
+	case 1:
+		q[3] = (m[1][2] - m[2][1]) * mult;
+		q[0] = biggest_val;
+		q[1] = (m[0][1] + m[1][0]) * mult;
+		q[2] = (m[2][0] + m[0][2]) * mult;
+		break;
+	case 2:
+		q[3] = (m[2][0] - m[0][2]) * mult;
+		q[0] = (m[0][1] + m[1][0]) * mult;
+		q[1] = biggest_val;
+		q[2] = (m[1][2] + m[2][1]) * mult;
+		break;
+	default:
+		q[3] = (m[0][1] - m[1][0]) * mult;
+		q[0] = (m[2][0] + m[0][2]) * mult;
+		q[1] = (m[1][2] + m[2][1]) * mult;
+		q[2] = biggest_val;
+		break;
+	}
+	const float l = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	for (int ii=0; ii<4; ++ii) {
+		q[ii] /= l;
+	}
+	// w is positive, the sign of the quaternion tells the shader the tangent frame is reflected or not
+	if (q[3] < 0.f) {
+		for (int ii=0; ii<4; ++ii) {
+			q[ii] = -q[ii];
+		}
+	}
+	// w is never 0, the bias of int16 is 1/(2^15-1)
+	const float bias = 1.f / 32767.f;
+	if (q[3] < bias) {
+		const float factor = sqrtf(1.f - bias * bias);
+		q[0] *= factor; q[1] *= factor; q[2] *= factor;
+		q[3] = bias;
+	}
+	if (tangent[3] < 0.f) {
+		for (int ii=0; ii<4; ++ii) {
+			q[ii] = -q[ii];
+		}
+	}
+}
+
+// vsrc: the source vertex of each output vertex. tangents: the generated tangents of the source vertices
+static void
+pack_stream(stream &s, const std::vector<uint32_t> &vsrc, const std::vector<float> *tangents) {
+	const int normal_idx = s.find("NORMAL");
+	const int tangent_idx = s.find("TANGENT");
+	const bool pack_tangent = normal_idx >= 0 && (tangent_idx >= 0 || tangents);
+	std::string decl;
+	s.vertex_size = 0;
+	for (size_t ii=0; ii<s.attribs.size(); ++ii) {
+		attrib &a = s.attribs[ii];
+		a.new_layout = a.layout;
+		size_t size = a.size;
+		if (pack_tangent && (int)ii == normal_idx) {
+			continue;
+		} else if (pack_tangent && (int)ii == tangent_idx) {
+			a.new_layout = "T40nii";
+			size = 8;
+		} else if (a.name.compare(0, 6, "JOINTS") == 0 && a.type() == 'u') {
+			a.new_layout = a.layout.substr(0, 5) + "i";
+			size = a.count() * 2;
+		} else if (a.name.compare(0, 7, "WEIGHTS") == 0) {
+			a.new_layout = "w40nii";
+			size = 8;
+		} else if (a.name.compare(0, 5, "COLOR") == 0 && a.type() == 'i') {
+			a.new_layout = a.layout.substr(0, 5) + "u";
+			size = a.count();
+		}
+		if (!decl.empty())
+			decl += "|";
+		decl += a.new_layout;
+		s.vertex_size += size;
+	}
+	if (pack_tangent && tangent_idx < 0) {
+		decl += "|T40nii";
+		s.vertex_size += 8;
+	}
+	s.declname = decl;
+	s.bin.resize(s.vertex_size * vsrc.size());
+
+	uint8_t *out = (uint8_t *)s.bin.data();
+	for (uint32_t v : vsrc) {
+		for (size_t ii=0; ii<s.attribs.size(); ++ii) {
+			const attrib &a = s.attribs[ii];
+			if (pack_tangent && (int)ii == normal_idx)
+				continue;
+			if (pack_tangent && (int)ii == tangent_idx) {
+				float n[4], t[4], q[4];
+				s.attribs[normal_idx].load(v, n);
+				a.load(v, t);
+				pack_tangent_frame(q, n, t);
+				const int16_t r[4] = {f2i(q[0]), f2i(q[1]), f2i(q[2]), f2i(q[3])};
+				memcpy(out, r, sizeof(r));
+				out += sizeof(r);
+			} else if (a.new_layout.compare(0, 6, "w40nii") == 0) {
+				const float scale = a.type() == 'f' ? 1.f : a.type() == 'i' ? 1.f / 65535.f : 1.f / 255.f;
+				int16_t r[4] = {0, 0, 0, 0};
+				for (int kk=0; kk<a.count() && kk<4; ++kk) {
+					r[kk] = f2i((float)a.component(v, kk) * scale);
+				}
+				memcpy(out, r, sizeof(r));
+				out += sizeof(r);
+			} else if (a.new_layout != a.layout && a.shortname() == 'i') {
+				for (int kk=0; kk<a.count(); ++kk) {
+					const uint16_t j = (uint16_t)a.component(v, kk);
+					memcpy(out, &j, sizeof(j));
+					out += sizeof(j);
+				}
+			} else if (a.new_layout != a.layout && a.shortname() == 'c') {
+				for (int kk=0; kk<a.count(); ++kk) {
+					*out++ = (uint8_t)floor(a.component(v, kk) / 65535.0 * 255 + 0.5);
+				}
+			} else {
+				const uint8_t *src = a.data + a.stride * v;
+				memcpy(out, src, a.size);
+				if (a.count() >= 3 && a.type() == 'f' && a.is_vec()) {
+					float z;
+					memcpy(&z, out + 8, sizeof(z));
+					z = -z;
+					memcpy(out + 8, &z, sizeof(z));
+				}
+				out += a.size;
+			}
+		}
+		if (pack_tangent && tangent_idx < 0) {
+			float n[4], q[4];
+			s.attribs[normal_idx].load(v, n);
+			pack_tangent_frame(q, n, &(*tangents)[v * 4]);
+			const int16_t r[4] = {f2i(q[0]), f2i(q[1]), f2i(q[2]), f2i(q[3])};
+			memcpy(out, r, sizeof(r));
+			out += sizeof(r);
+		}
+	}
+}
+
+/*
+	The lua errors longjmp over the destructors, so the inputs are checked by check_stream and
+	check_indices before any C++ container is built, and load_stream doesn't raise error.
+*/
+
+// returns true if the stream has the attrib named need
+static bool
+check_stream(lua_State *L, int idx, const char *field, size_t binsize, size_t numv, const char *need) {
+	bool found = false;
+	if (lua_getfield(L, idx, field) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		return found;
+	}
+	const lua_Integer n = luaL_len(L, -1);
+	for (lua_Integer ii=1; ii<=n; ++ii) {
+		luaL_checkstack(L, 6, NULL);
+		if (lua_geti(L, -1, ii) != LUA_TTABLE)
+			luaL_error(L, "Invalid %s[%d]", field, (int)ii);
+		lua_getfield(L, -1, "name");
+		const char *name = luaL_checkstring(L, -1);
+		lua_getfield(L, -2, "layout");
+		size_t len;
+		const char *layout = luaL_checklstring(L, -1, &len);
+		lua_getfield(L, -3, "offset");
+		const size_t offset = (size_t)luaL_checkinteger(L, -1);
+		lua_getfield(L, -4, "stride");
+		const size_t stride = (size_t)luaL_checkinteger(L, -1);
+		lua_getfield(L, -5, "size");
+		const size_t size = (size_t)luaL_checkinteger(L, -1);
+		if (len != 6 || layout[1] < '1' || layout[1] > '4')
+			luaL_error(L, "Invalid layout %s of %s", layout, name);
+		if (numv > 0 && offset + stride * (numv - 1) + size > binsize)
+			luaL_error(L, "%s is out of the buffer", name);
+		if (need && strcmp(name, need) == 0)
+			found = true;
+		lua_pop(L, 6);
+	}
+	lua_pop(L, 1);
+	return found;
+}
+
+// the stream is checked by check_stream
+static void
+load_stream(lua_State *L, int idx, const char *field, const std::string_view &bin, stream &s) {
+	if (lua_getfield(L, idx, field) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		return;
+	}
+	const lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+	for (lua_Integer ii=1; ii<=n; ++ii) {
+		lua_geti(L, -1, ii);
+		attrib a;
+		lua_getfield(L, -1, "name");
+		a.name = lua_tostring(L, -1);
+		lua_getfield(L, -2, "layout");
+		a.layout = lua_tostring(L, -1);
+		lua_getfield(L, -3, "offset");
+		const size_t offset = (size_t)lua_tointeger(L, -1);
+		lua_getfield(L, -4, "stride");
+		a.stride = (size_t)lua_tointeger(L, -1);
+		lua_getfield(L, -5, "size");
+		a.size = (size_t)lua_tointeger(L, -1);
+		lua_pop(L, 6);
+		a.data = (const uint8_t *)bin.data() + offset;
+		s.attribs.push_back(a);
+	}
+	lua_pop(L, 1);
+}
+
+static inline uint32_t
+read_index(const uint8_t *p, size_t elemsize, size_t ii) {
+	if (elemsize == 2) {
+		uint16_t v;
+		memcpy(&v, p + ii * 2, 2);
+		return v;
+	}
+	uint32_t v;
+	memcpy(&v, p + ii * 4, 4);
+	return v;
+}
+
+static void
+check_indices(lua_State *L, const uint8_t *p, size_t elemsize, size_t count, size_t numv) {
+	for (size_t ii=0; ii<count; ++ii) {
+		const uint32_t v = read_index(p, elemsize, ii);
+		if (v >= numv)
+			luaL_error(L, "Invalid index %d", (int)v);
+	}
+}
+
+static void
+push_stream(lua_State *L, const stream &s, const char *field) {
+	if (s.attribs.empty())
+		return;
+	lua_createtable(L, 0, 2);
+	lua_pushlstring(L, s.bin.data(), s.bin.size());
+	lua_setfield(L, -2, "bin");
+	lua_pushlstring(L, s.declname.data(), s.declname.size());
+	lua_setfield(L, -2, "declname");
+	lua_setfield(L, -2, field);
+}
+
+/*
+	{
+		bin = gltf binary data,
+		numv = vertex count,
+		indices = { offset = , elemsize = 2 or 4, count = } or nil,
+		layouts1 = { { name = "POSITION", layout = "p30NIf", offset = , stride = , size = }, ... },
+		layouts2 = { ... },
+		optimize = true,
+	}
+	returns { vb = { bin = , declname = }, vb2 = ..., ib = , index32 = , numv = , numi = , pack_tangent_frame = , acmr = {before, after} }
+*/
+static int
+lbuild(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_getfield(L, 1, "bin");
+	size_t binsize;
+	const char *bindata = luaL_checklstring(L, -1, &binsize);
+	const std::string_view bin(bindata, binsize);
+	lua_getfield(L, 1, "numv");
+	const size_t numv = (size_t)luaL_checkinteger(L, -1);
+	lua_getfield(L, 1, "optimize");
+	const bool optimize = lua_toboolean(L, -1);
+	lua_pop(L, 2);
+
+	size_t index_offset = 0, index_elemsize = 0, index_count = 0;
+	if (lua_getfield(L, 1, "indices") == LUA_TTABLE) {
+		lua_getfield(L, -1, "offset");
+		index_offset = (size_t)luaL_checkinteger(L, -1);
+		lua_getfield(L, -2, "elemsize");
+		index_elemsize = (size_t)luaL_checkinteger(L, -1);
+		lua_getfield(L, -3, "count");
+		index_count = (size_t)luaL_checkinteger(L, -1);
+		lua_pop(L, 3);
+		if (index_elemsize != 2 && index_elemsize != 4)
+			return luaL_error(L, "Invalid index size %d", (int)index_elemsize);
+		if (index_offset + index_elemsize * index_count > bin.size())
+			return luaL_error(L, "Indices are out of the buffer");
+		index_count -= index_count % 3;
+		check_indices(L, (const uint8_t *)bin.data() + index_offset, index_elemsize, index_count, numv);
+	} else if (numv % 3 != 0) {
+		return luaL_error(L, "Invalid vertex count %d of triangle list", (int)numv);
+	}
+	lua_pop(L, 1);
+	if (!check_stream(L, 1, "layouts1", bin.size(), numv, "POSITION"))
+		return luaL_error(L, "Need POSITION");
+	check_stream(L, 1, "layouts2", bin.size(), numv, nullptr);
+
+	stream s1, s2;
+	load_stream(L, 1, "layouts1", bin, s1);
+	load_stream(L, 1, "layouts2", bin, s2);
+	lua_pop(L, 1);	// bin
+	const int pos_idx = s1.find("POSITION");
+
+	// reverse the winding: v0, v2, v1
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> vsrc;
+	if (index_elemsize) {
+		indices.resize(index_count);
+		const uint8_t *p = (const uint8_t *)bin.data() + index_offset;
+		for (size_t ii=0; ii<index_count; ++ii) {
+			const size_t src = ii - ii % 3 + (3 - ii % 3) % 3;
+			indices[ii] = read_index(p, index_elemsize, src);
+		}
+		vsrc.resize(numv);
+		for (size_t v=0; v<numv; ++v) {
+			vsrc[v] = (uint32_t)v;
+		}
+	} else {
+		vsrc.resize(numv);
+		for (size_t v=0; v<numv; ++v) {
+			vsrc[v] = (uint32_t)(v - v % 3 + (3 - v % 3) % 3);
+		}
+	}
+
+	std::vector<float> tangents;
+	const int normal_idx = s1.find("NORMAL");
+	const int uv_idx = s2.find("TEXCOORD_0");
+	const bool gen_tangent = s1.find("TANGENT") < 0 && normal_idx >= 0 && uv_idx >= 0;
+	if (gen_tangent) {
+		const std::vector<uint32_t> &tris = index_elemsize ? indices : vsrc;
+		calc_tangents(tangents, tris.data(), tris.size(), numv, s1.attribs[pos_idx], s1.attribs[normal_idx], s2.attribs[uv_idx]);
+	}
+
+	float acmr_before = 0.f, acmr_after = 0.f;
+	size_t outv = numv;
+	const attrib &pos = s1.attribs[pos_idx];
+	if (index_elemsize && optimize && index_count > 0) {
+		acmr_before = meshopt_acmr(indices.data(), index_count, numv, MESHOPT_CACHE_SIZE);
+		std::vector<uint32_t> tmp(index_count);
+		meshopt_optimize_vertex_cache(tmp.data(), indices.data(), index_count, numv);
+		if (pos.type() == 'f' && pos.count() >= 3) {
+			std::vector<float> positions(numv * 3);
+			for (size_t v=0; v<numv; ++v) {
+				float p[4];
+				pos.load((uint32_t)v, p);
+				memcpy(&positions[v * 3], p, sizeof(float) * 3);
+			}
+			meshopt_optimize_overdraw(indices.data(), tmp.data(), index_count, positions.data(), sizeof(float) * 3, numv, OVERDRAW_THRESHOLD);
+		} else {
+			indices.swap(tmp);
+		}
+		std::vector<uint32_t> remap(numv);
+		outv = meshopt_optimize_vertex_fetch_remap(remap.data(), indices.data(), index_count, numv);
+		vsrc.resize(outv);
+		for (size_t v=0; v<numv; ++v) {
+			if (remap[v] != UINT32_MAX)
+				vsrc[remap[v]] = (uint32_t)v;
+		}
+		for (auto &i : indices) {
+			i = remap[i];
+		}
+		acmr_after = meshopt_acmr(indices.data(), index_count, outv, MESHOPT_CACHE_SIZE);
+	}
+
+	pack_stream(s1, vsrc, gen_tangent ? &tangents : nullptr);
+	if (!s2.attribs.empty())
+		pack_stream(s2, vsrc, nullptr);
+
+	lua_createtable(L, 0, 8);
+	push_stream(L, s1, "vb");
+	push_stream(L, s2, "vb2");
+	if (index_elemsize) {
+		std::string ib(index_count * index_elemsize, '\0');
+		for (size_t ii=0; ii<index_count; ++ii) {
+			if (index_elemsize == 2) {
+				const uint16_t v = (uint16_t)indices[ii];
+				memcpy(&ib[ii * 2], &v, 2);
+			} else {
+				memcpy(&ib[ii * 4], &indices[ii], 4);
+			}
+		}
+		lua_pushlstring(L, ib.data(), ib.size());
+		lua_setfield(L, -2, "ib");
+		lua_pushboolean(L, index_elemsize == 4);
+		lua_setfield(L, -2, "index32");
+		lua_pushinteger(L, index_count);
+		lua_setfield(L, -2, "numi");
+	}
+	lua_pushinteger(L, outv);
+	lua_setfield(L, -2, "numv");
+	lua_pushboolean(L, normal_idx >= 0 && (gen_tangent || s1.find("TANGENT") >= 0));
+	lua_setfield(L, -2, "pack_tangent_frame");
+	if (acmr_before > 0.f) {
+		lua_createtable(L, 2, 0);
+		lua_pushnumber(L, acmr_before);
+		lua_rawseti(L, -2, 1);
+		lua_pushnumber(L, acmr_after);
+		lua_rawseti(L, -2, 2);
+		lua_setfield(L, -2, "acmr");
+	}
+	return 1;
+}
+
+/*
+	ib : string, index buffer
+	index32 : boolean
+	vb : string, position(float3) is at offset of each vertex
+	stride : integer
+	ratio : number, the target index count is ratio * #indices
+	error : number, the max error relative to the mesh extent
+	offset : integer(opt), 0 by default
+	returns the new index buffer, index count and the error
+*/
+static int
+lsimplify(lua_State *L) {
+	size_t ibsize, vbsize;
+	const char *ib = luaL_checklstring(L, 1, &ibsize);
+	const bool index32 = lua_toboolean(L, 2);
+	const char *vb = luaL_checklstring(L, 3, &vbsize);
+	const size_t stride = (size_t)luaL_checkinteger(L, 4);
+	const double ratio = luaL_checknumber(L, 5);
+	const float target_error = (float)luaL_checknumber(L, 6);
+	const size_t offset = (size_t)luaL_optinteger(L, 7, 0);
+	if (stride == 0 || offset + sizeof(float) * 3 > stride)
+		return luaL_error(L, "Invalid stride %d", (int)stride);
+	const size_t numv = vbsize / stride;
+	const size_t elemsize = index32 ? 4 : 2;
+	const size_t index_count = ibsize / elemsize / 3 * 3;
+	check_indices(L, (const uint8_t *)ib, elemsize, index_count, numv);
+	std::vector<uint32_t> indices(index_count);
+	for (size_t ii=0; ii<index_count; ++ii) {
+		indices[ii] = read_index((const uint8_t *)ib, elemsize, ii);
+	}
+	std::vector<float> positions(numv * 3);
+	for (size_t v=0; v<numv; ++v) {
+		memcpy(&positions[v * 3], vb + v * stride + offset, sizeof(float) * 3);
+	}
+	const size_t target = (size_t)(index_count * ratio) / 3 * 3;
+	std::vector<uint32_t> result(index_count);
+	float error = 0.f;
+	const size_t n = meshopt_simplify(result.data(), indices.data(), index_count, positions.data(), sizeof(float) * 3, numv, target, target_error, &error);
+	// the vertex cache order is broken by the collapses
+	meshopt_optimize_vertex_cache(indices.data(), result.data(), n, numv);
+	std::string out(n * elemsize, '\0');
+	for (size_t ii=0; ii<n; ++ii) {
+		if (index32) {
+			memcpy(&out[ii * 4], &indices[ii], 4);
+		} else {
+			const uint16_t v = (uint16_t)indices[ii];
+			memcpy(&out[ii * 2], &v, 2);
+		}
+	}
+	lua_pushlstring(L, out.data(), out.size());
+	lua_pushinteger(L, n);
+	lua_pushnumber(L, error);
+	return 3;
+}
+
+extern "C" int
+luaopen_meshopt(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "build", lbuild },
+		{ "simplify", lsimplify },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
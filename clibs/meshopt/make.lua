@@ -0,0 +1,8 @@
+local lm = require "luamake"
+
+lm:lua_source "meshopt" {
+    sources = {
+        "meshopt.cpp",
+        "luameshopt.cpp",
+    },
+}
@@ -0,0 +1,540 @@
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+static inline const float *
+vertex_position(const float *positions, size_t stride, uint32_t v) {
+	return (const float *)((const uint8_t *)positions + stride * v);
+}
+
+// vertex -> triangles
+struct adjacency {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> counts;
+	std::vector<uint32_t> data;
+
+	void build(const uint32_t *indices, size_t index_count, size_t vertex_count) {
+		counts.assign(vertex_count, 0);
+		offsets.resize(vertex_count);
+		data.resize(index_count);
+		for (size_t ii=0; ii<index_count; ++ii) {
+			++counts[indices[ii]];
+		}
+		uint32_t offset = 0;
+		for (size_t v=0; v<vertex_count; ++v) {
+			offsets[v] = offset;
+			offset += counts[v];
+		}
+		std::fill(counts.begin(), counts.end(), 0);
+		for (size_t ii=0; ii<index_count; ++ii) {
+			const uint32_t v = indices[ii];
+			data[offsets[v] + counts[v]++] = (uint32_t)(ii / 3);
+		}
+	}
+};
+
+// Forsyth's vertex scores
+static constexpr float CACHE_DECAY_POWER = 1.5f;
+static constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+static constexpr float VALENCE_BOOST_SCALE = 2.0f;
+static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+static float
+vertex_score(int32_t cache_pos, uint32_t live) {
+	if (live == 0)
+		return -1.f;
+	float score = 0.f;
+	if (cache_pos >= 0) {
+		if (cache_pos < 3) {
+			score = LAST_TRIANGLE_SCORE;
+		} else {
+			const float scaler = 1.f / (MESHOPT_CACHE_SIZE - 3);
+			score = powf(1.f - (cache_pos - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+	return score + VALENCE_BOOST_SCALE * powf((float)live, -VALENCE_BOOST_POWER);
+}
+
+void
+meshopt_optimize_vertex_cache(uint32_t *dst, const uint32_t *indices, size_t index_count, size_t vertex_count) {
+	assert(index_count % 3 == 0);
+	const size_t face_count = index_count / 3;
+	if (face_count == 0)
+		return;
+	std::vector<uint32_t> src(indices, indices + index_count);
+	adjacency adj;
+	adj.build(src.data(), index_count, vertex_count);
+
+	std::vector<int32_t> cache_pos(vertex_count, -1);
+	std::vector<float> vscore(vertex_count);
+	for (size_t v=0; v<vertex_count; ++v) {
+		vscore[v] = vertex_score(-1, adj.counts[v]);
+	}
+	std::vector<float> tscore(face_count);
+	std::vector<uint8_t> emitted(face_count, 0);
+	uint32_t best = 0;
+	for (size_t f=0; f<face_count; ++f) {
+		const uint32_t *tri = &src[f * 3];
+		tscore[f] = vscore[tri[0]] + vscore[tri[1]] + vscore[tri[2]];
+		if (tscore[f] > tscore[best])
+			best = (uint32_t)f;
+	}
+
+	uint32_t cache[MESHOPT_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+	size_t cursor = 0;
+	for (size_t out=0; out<face_count; ++out) {
+		if (best == INVALID_INDEX) {
+			// dead end, take the next triangle in the input order
+			while (emitted[cursor])
+				++cursor;
+			best = (uint32_t)cursor;
+		}
+		const uint32_t *tri = &src[best * 3];
+		memcpy(dst + out * 3, tri, sizeof(uint32_t) * 3);
+		emitted[best] = 1;
+
+		// the triangle's vertices go to the front of the cache
+		uint32_t newcache[MESHOPT_CACHE_SIZE + 3];
+		uint32_t n = 0;
+		for (int ii=0; ii<3; ++ii) {
+			newcache[n++] = tri[ii];
+		}
+		for (uint32_t ii=0; ii<cache_count; ++ii) {
+			const uint32_t v = cache[ii];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newcache[n++] = v;
+		}
+
+		// remove the triangle from the live lists
+		for (int ii=0; ii<3; ++ii) {
+			const uint32_t v = tri[ii];
+			uint32_t *list = &adj.data[adj.offsets[v]];
+			uint32_t &count = adj.counts[v];
+			for (uint32_t jj=0; jj<count; ++jj) {
+				if (list[jj] == best) {
+					list[jj] = list[--count];
+					break;
+				}
+			}
+		}
+
+		// update the scores of the vertices in the cache, and the evicted ones
+		best = INVALID_INDEX;
+		float best_score = 0.f;
+		for (uint32_t ii=0; ii<n; ++ii) {
+			const uint32_t v = newcache[ii];
+			const int32_t pos = ii < MESHOPT_CACHE_SIZE ? (int32_t)ii : -1;
+			cache_pos[v] = pos;
+			const float score = vertex_score(pos, adj.counts[v]);
+			const float delta = score - vscore[v];
+			vscore[v] = score;
+			const uint32_t *list = &adj.data[adj.offsets[v]];
+			for (uint32_t jj=0; jj<adj.counts[v]; ++jj) {
+				const uint32_t f = list[jj];
+				tscore[f] += delta;
+				if (tscore[f] > best_score) {
+					best_score = tscore[f];
+					best = f;
+				}
+			}
+		}
+		cache_count = n < MESHOPT_CACHE_SIZE ? n : MESHOPT_CACHE_SIZE;
+		memcpy(cache, newcache, sizeof(uint32_t) * cache_count);
+	}
+}
+
+// fifo cache, a vertex is in the cache if it's inserted in the last cache_size misses
+struct fifo_cache {
+	std::vector<uint32_t> timestamps;
+	uint32_t timestamp;
+	uint32_t size;
+
+	fifo_cache(size_t vertex_count, uint32_t cache_size)
+		: timestamps(vertex_count, 0)
+		, timestamp(cache_size + 1)
+		, size(cache_size)
+	{}
+	void reset() {
+		timestamp += size + 1;
+	}
+	uint32_t update(const uint32_t *tri) {
+		uint32_t misses = 0;
+		for (int ii=0; ii<3; ++ii) {
+			const uint32_t v = tri[ii];
+			if (timestamp - timestamps[v] > size) {
+				timestamps[v] = timestamp++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+};
+
+float
+meshopt_acmr(const uint32_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size) {
+	const size_t face_count = index_count / 3;
+	if (face_count == 0)
+		return 0.f;
+	fifo_cache cache(vertex_count, cache_size);
+	size_t misses = 0;
+	for (size_t f=0; f<face_count; ++f) {
+		misses += cache.update(&indices[f * 3]);
+	}
+	return (float)misses / (float)face_count;
+}
+
+struct cluster {
+	uint32_t start;
+	uint32_t end;	// in triangles
+	float sortkey;
+};
+
+void
+meshopt_optimize_overdraw(uint32_t *dst, const uint32_t *indices, size_t index_count, const float *positions, size_t stride, size_t vertex_count, float threshold) {
+	assert(index_count % 3 == 0);
+	const size_t face_count = index_count / 3;
+	if (face_count == 0)
+		return;
+	std::vector<uint32_t> src(indices, indices + index_count);
+
+	// hard boundaries: all the vertices of the triangle miss the cache
+	std::vector<uint32_t> hard;
+	fifo_cache cache(vertex_count, MESHOPT_CACHE_SIZE);
+	for (uint32_t f=0; f<face_count; ++f) {
+		if (cache.update(&src[f * 3]) == 3 || f == 0)
+			hard.push_back(f);
+	}
+	hard.push_back((uint32_t)face_count);
+
+	// soft boundaries: split the cluster when its ACMR is good enough
+	std::vector<cluster> clusters;
+	for (size_t c=0; c+1<hard.size(); ++c) {
+		const uint32_t s = hard[c], e = hard[c+1];
+		cache.reset();
+		uint32_t misses = 0;
+		for (uint32_t f=s; f<e; ++f) {
+			misses += cache.update(&src[f * 3]);
+		}
+		const float limit = threshold * (float)misses / (float)(e - s);
+		cache.reset();
+		misses = 0;
+		uint32_t start = s;
+		for (uint32_t f=s; f<e; ++f) {
+			misses += cache.update(&src[f * 3]);
+			if (f + 1 < e && (float)misses / (float)(f - start + 1) <= limit) {
+				clusters.push_back(cluster{start, f + 1, 0.f});
+				start = f + 1;
+				misses = 0;
+				cache.reset();
+			}
+		}
+		clusters.push_back(cluster{start, e, 0.f});
+	}
+
+	// mesh centroid
+	float mc[3] = {0, 0, 0};
+	for (size_t ii=0; ii<index_count; ++ii) {
+		const float *p = vertex_position(positions, stride, src[ii]);
+		mc[0] += p[0]; mc[1] += p[1]; mc[2] += p[2];
+	}
+	for (int ii=0; ii<3; ++ii) {
+		mc[ii] /= (float)index_count;
+	}
+
+	// the clusters facing outward are drawn first, they occlude the others more likely
+	for (auto &c : clusters) {
+		float cc[3] = {0, 0, 0}, cn[3] = {0, 0, 0};
+		float area_sum = 0.f;
+		for (uint32_t f=c.start; f<c.end; ++f) {
+			const float *p0 = vertex_position(positions, stride, src[f * 3 + 0]);
+			const float *p1 = vertex_position(positions, stride, src[f * 3 + 1]);
+			const float *p2 = vertex_position(positions, stride, src[f * 3 + 2]);
+			const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			const float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0],
+			};
+			const float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int ii=0; ii<3; ++ii) {
+				cc[ii] += (p0[ii] + p1[ii] + p2[ii]) / 3.f * area;
+				cn[ii] += n[ii];
+			}
+			area_sum += area;
+		}
+		const float inv_area = area_sum == 0.f ? 0.f : 1.f / area_sum;
+		const float nl = sqrtf(cn[0] * cn[0] + cn[1] * cn[1] + cn[2] * cn[2]);
+		const float inv_nl = nl == 0.f ? 0.f : 1.f / nl;
+		c.sortkey = 0.f;
+		for (int ii=0; ii<3; ++ii) {
+			c.sortkey += (cc[ii] * inv_area - mc[ii]) * cn[ii] * inv_nl;
+		}
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const cluster &a, const cluster &b){
+		return a.sortkey > b.sortkey;
+	});
+
+	size_t out = 0;
+	for (const auto &c : clusters) {
+		const size_t n = (c.end - c.start) * 3;
+		memcpy(dst + out, &src[c.start * 3], sizeof(uint32_t) * n);
+		out += n;
+	}
+	assert(out == index_count);
+}
+
+size_t
+meshopt_optimize_vertex_fetch_remap(uint32_t *remap, const uint32_t *indices, size_t index_count, size_t vertex_count) {
+	std::fill(remap, remap + vertex_count, INVALID_INDEX);
+	uint32_t next = 0;
+	for (size_t ii=0; ii<index_count; ++ii) {
+		const uint32_t v = indices[ii];
+		if (remap[v] == INVALID_INDEX)
+			remap[v] = next++;
+	}
+	return next;
+}
+
+// plane quadric: a * p.p + 2 * b.p + c, weighted by the triangle area
+struct quadric {
+	double a00, a11, a22, a01, a02, a12;
+	double b0, b1, b2;
+	double c;
+	double w;
+
+	void add(const quadric &q) {
+		a00 += q.a00; a11 += q.a11; a22 += q.a22;
+		a01 += q.a01; a02 += q.a02; a12 += q.a12;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		w += q.w;
+	}
+	// squared distance to the planes
+	double error(const float *p) const {
+		const double x = p[0], y = p[1], z = p[2];
+		const double r =
+			a00 * x * x + a11 * y * y + a22 * z * z +
+			2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+			2 * (b0 * x + b1 * y + b2 * z) + c;
+		return w > 0 ? fabs(r) / w : 0;
+	}
+};
+
+static quadric
+plane_quadric(const float *p0, const float *p1, const float *p2) {
+	const double e1[3] = {(double)p1[0] - p0[0], (double)p1[1] - p0[1], (double)p1[2] - p0[2]};
+	const double e2[3] = {(double)p2[0] - p0[0], (double)p2[1] - p0[1], (double)p2[2] - p0[2]};
+	double n[3] = {
+		e1[1] * e2[2] - e1[2] * e2[1],
+		e1[2] * e2[0] - e1[0] * e2[2],
+		e1[0] * e2[1] - e1[1] * e2[0],
+	};
+	const double l = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	quadric q;
+	memset(&q, 0, sizeof(q));
+	if (l == 0)
+		return q;
+	n[0] /= l; n[1] /= l; n[2] /= l;
+	const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+	const double w = l * 0.5;
+	q.a00 = w * n[0] * n[0]; q.a11 = w * n[1] * n[1]; q.a22 = w * n[2] * n[2];
+	q.a01 = w * n[0] * n[1]; q.a02 = w * n[0] * n[2]; q.a12 = w * n[1] * n[2];
+	q.b0 = w * n[0] * d; q.b1 = w * n[1] * d; q.b2 = w * n[2] * d;
+	q.c = w * d * d;
+	q.w = w;
+	return q;
+}
+
+static void
+triangle_normal(float *n, const float *p0, const float *p1, const float *p2) {
+	const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+	const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+struct collapse {
+	uint32_t from;
+	uint32_t to;
+	double error;
+};
+
+// the vertices at the same position(the attribute seams) share one id
+static void
+position_ids(std::vector<uint32_t> &ids, std::vector<uint32_t> &group_size, const float *positions, size_t stride, size_t vertex_count) {
+	struct key {
+		float p[3];
+		bool operator==(const key &o) const { return memcmp(p, o.p, sizeof(p)) == 0; }
+	};
+	struct hasher {
+		size_t operator()(const key &k) const {
+			uint32_t h[3];
+			memcpy(h, k.p, sizeof(h));
+			return (size_t)(h[0] * 73856093u ^ h[1] * 19349663u ^ h[2] * 83492791u);
+		}
+	};
+	std::unordered_map<key, uint32_t, hasher> map;
+	map.reserve(vertex_count);
+	ids.resize(vertex_count);
+	group_size.clear();
+	for (size_t v=0; v<vertex_count; ++v) {
+		key k;
+		memcpy(k.p, vertex_position(positions, stride, (uint32_t)v), sizeof(k.p));
+		auto it = map.emplace(k, (uint32_t)group_size.size());
+		if (it.second)
+			group_size.push_back(0);
+		ids[v] = it.first->second;
+		++group_size[ids[v]];
+	}
+}
+
+size_t
+meshopt_simplify(uint32_t *dst, const uint32_t *indices, size_t index_count, const float *positions, size_t stride, size_t vertex_count, size_t target_index_count, float target_error, float *result_error) {
+	assert(index_count % 3 == 0);
+	std::vector<uint32_t> result(indices, indices + index_count);
+	if (result_error)
+		*result_error = 0.f;
+
+	float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for (size_t v=0; v<vertex_count; ++v) {
+		const float *p = vertex_position(positions, stride, (uint32_t)v);
+		for (int ii=0; ii<3; ++ii) {
+			bmin[ii] = std::min(bmin[ii], p[ii]);
+			bmax[ii] = std::max(bmax[ii], p[ii]);
+		}
+	}
+	const float extent = std::max(std::max(bmax[0] - bmin[0], bmax[1] - bmin[1]), bmax[2] - bmin[2]);
+	const double error_limit = (double)target_error * extent * (double)target_error * extent;
+
+	// the vertices on the border or the seams are locked
+	std::vector<uint32_t> pid, group_size;
+	position_ids(pid, group_size, positions, stride, vertex_count);
+	std::vector<uint8_t> locked(vertex_count, 0);
+	{
+		std::unordered_map<uint64_t, uint32_t> edges;
+		edges.reserve(index_count);
+		for (size_t ii=0; ii<index_count; ++ii) {
+			const uint32_t a = pid[result[ii]];
+			const uint32_t b = pid[result[ii - ii % 3 + (ii + 1) % 3]];
+			++edges[(uint64_t)a << 32 | b];
+		}
+		for (size_t ii=0; ii<index_count; ++ii) {
+			const uint32_t va = result[ii], vb = result[ii - ii % 3 + (ii + 1) % 3];
+			const uint32_t a = pid[va], b = pid[vb];
+			if (edges.find((uint64_t)b << 32 | a) == edges.end()) {
+				locked[va] = locked[vb] = 1;
+			}
+		}
+		for (size_t v=0; v<vertex_count; ++v) {
+			if (group_size[pid[v]] > 1)
+				locked[v] = 1;
+		}
+	}
+
+	std::vector<quadric> quadrics(vertex_count);
+	memset(quadrics.data(), 0, sizeof(quadric) * vertex_count);
+	for (size_t f=0; f<index_count/3; ++f) {
+		const uint32_t *tri = &result[f * 3];
+		const quadric q = plane_quadric(
+			vertex_position(positions, stride, tri[0]),
+			vertex_position(positions, stride, tri[1]),
+			vertex_position(positions, stride, tri[2]));
+		for (int ii=0; ii<3; ++ii) {
+			quadrics[tri[ii]].add(q);
+		}
+	}
+
+	adjacency adj;
+	std::vector<collapse> candidates;
+	std::vector<uint8_t> touched(vertex_count);
+	std::vector<uint32_t> remap(vertex_count);
+	double max_error = 0;
+	size_t count = index_count;
+	while (count > target_index_count) {
+		adj.build(result.data(), count, vertex_count);
+		candidates.clear();
+		for (size_t ii=0; ii<count; ++ii) {
+			const uint32_t a = result[ii], b = result[ii - ii % 3 + (ii + 1) % 3];
+			if (!locked[a])
+				candidates.push_back(collapse{a, b, quadrics[a].error(vertex_position(positions, stride, b))});
+			if (!locked[b])
+				candidates.push_back(collapse{b, a, quadrics[b].error(vertex_position(positions, stride, a))});
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const collapse &x, const collapse &y){
+			return x.error < y.error;
+		});
+
+		// a collapse removes 2 triangles usually
+		const size_t collapse_goal = (count - target_index_count) / 6 + 1;
+		size_t collapses = 0;
+		std::fill(touched.begin(), touched.end(), 0);
+		for (size_t v=0; v<vertex_count; ++v) {
+			remap[v] = (uint32_t)v;
+		}
+		for (const auto &c : candidates) {
+			if (collapses >= collapse_goal || c.error > error_limit)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+			// reject the collapse flipping a triangle
+			const float *pto = vertex_position(positions, stride, c.to);
+			const uint32_t *list = &adj.data[adj.offsets[c.from]];
+			bool flip = false;
+			for (uint32_t jj=0; jj<adj.counts[c.from] && !flip; ++jj) {
+				const uint32_t *tri = &result[list[jj] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					continue;
+				const float *p[3], *q[3];
+				for (int ii=0; ii<3; ++ii) {
+					p[ii] = vertex_position(positions, stride, tri[ii]);
+					q[ii] = tri[ii] == c.from ? pto : p[ii];
+				}
+				float n0[3], n1[3];
+				triangle_normal(n0, p[0], p[1], p[2]);
+				triangle_normal(n1, q[0], q[1], q[2]);
+				flip = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.f;
+			}
+			if (flip)
+				continue;
+			remap[c.from] = c.to;
+			// the vertices of the changed triangles can't collapse in this pass
+			for (uint32_t jj=0; jj<adj.counts[c.from]; ++jj) {
+				const uint32_t *tri = &result[list[jj] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+			quadrics[c.to].add(quadrics[c.from]);
+			max_error = std::max(max_error, c.error);
+			++collapses;
+		}
+		if (collapses == 0)
+			break;
+
+		size_t n = 0;
+		for (size_t f=0; f<count/3; ++f) {
+			const uint32_t a = remap[result[f * 3 + 0]];
+			const uint32_t b = remap[result[f * 3 + 1]];
+			const uint32_t c = remap[result[f * 3 + 2]];
+			if (a != b && b != c && a != c) {
+				result[n++] = a;
+				result[n++] = b;
+				result[n++] = c;
+			}
+		}
+		count = n;
+	}
+	memcpy(dst, result.data(), sizeof(uint32_t) * count);
+	if (result_error)
+		*result_error = extent > 0 ? (float)(sqrt(max_error) / extent) : 0.f;
+	return count;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+	Mesh processing of the model compiler, the same steps as meshoptimizer(https://github.com/zeux/meshoptimizer):
+
+	1. optimize_vertex_cache: reorder the triangles for the post transform vertex cache(Forsyth's scores).
+	2. optimize_overdraw: split the triangles into clusters at the cache resets, and draw the clusters
+	   facing outward first(Sander et al, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+	3. optimize_vertex_fetch_remap: reorder the vertices by the first use, the unused vertices are removed.
+	4. simplify: collapse the edges by the quadric error, the vertices are kept(collapsed to another vertex),
+	   so the LOD index buffers share the vertex buffers. The border and the attribute seams are locked.
+
+	All the index buffers are triangle lists of 32 bit indices, positions are 3 floats with stride(in bytes).
+*/
+
+static constexpr uint32_t MESHOPT_CACHE_SIZE = 16;
+
+void meshopt_optimize_vertex_cache(uint32_t *dst, const uint32_t *indices, size_t index_count, size_t vertex_count);
+// indices should be optimized by meshopt_optimize_vertex_cache first, threshold is the ACMR allowed to be worse(1.05 is 5%)
+void meshopt_optimize_overdraw(uint32_t *dst, const uint32_t *indices, size_t index_count, const float *positions, size_t stride, size_t vertex_count, float threshold);
+// remap[old] = new or UINT32_MAX for the unused vertices, return the new vertex count
+size_t meshopt_optimize_vertex_fetch_remap(uint32_t *remap, const uint32_t *indices, size_t index_count, size_t vertex_count);
+// dst can hold index_count indices, target_error is relative to the mesh extent, return the new index count
+size_t meshopt_simplify(uint32_t *dst, const uint32_t *indices, size_t index_count, const float *positions, size_t stride, size_t vertex_count, size_t target_index_count, float target_error, float *result_error);
+// average cache miss ratio(misses per triangle) of a fifo cache
+float meshopt_acmr(const uint32_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size);
@@ -2,9 +2,18 @@
 #include <bee/lua/binding.h>
 
 #include "ozz.h"
+#include "job_pool.h"
 
 #include <ozz/animation/runtime/sampling_job.h>
 #include <ozz/animation/runtime/local_to_model_job.h>
+#include <ozz/base/maths/simd_math.h>
+#include <ozz/base/maths/soa_float4x4.h>
+#include <ozz/base/maths/soa_transform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 namespace ozzlua::SamplingJobContext {
     static void metatable(lua_State* L) {
@@ -106,10 +115,392 @@ static int LocalToModelJob(lua_State* L) {
     return 0;
 }
 
+/*
+    The animations of all the changed entities in one frame. The instances and their layers are added
+    from Lua, then run() does sampling, blending, local to model and the skinning matrices of each
+    instance in the job pool, the results are written into the MatrixVectors of the instances.
+
+    The locals(SoA transforms of each layer and the blended one) and the blending layers are the
+    scratch of each thread. A layer may bring its own SamplingJob::Context(it keeps the keyframe
+    cursors of one animation, and it's only touched by the thread runs its instance), or the thread
+    one is used.
+
+    The instances of the animation LOD skip the leaf joints: they are held in the rest pose relative to
+    their parents, so the SoA to matrix conversion of the locals is skipped for the groups of leaves.
+    The models and the skinning matrices of them are still valid. ozz samples and blends all the tracks,
+    so the sampling cost is not changed, the LOD scheduler(animation.lua) throttles the update rate.
+
+    All the userdata added are referenced by pointers, they must be alive until run() returns.
+*/
+struct ozzAnimationBatch {
+    static constexpr uint32_t MAX_WORKER = 7;
+    static constexpr uint32_t DEFAULT_WORKER = 3;
+    // instances count that each thread fetch in one time
+    static constexpr uint32_t BATCH = 8;
+    // less than this, run in the caller thread
+    static constexpr uint32_t PARALLEL_THRESHOLD = BATCH * 4;
+
+    struct layer {
+        const ozzAnimation* animation;
+        ozzSamplingJobContext* context; // nullptr: the scratch context of the thread
+        float ratio;
+        float weight;
+    };
+    struct instance {
+        const ozzSkeleton* skeleton;
+        ozzMatrixVector* models;
+        ozzMatrixVector* skinning; // nullptr: no skinning matrices
+        const ozzMatrixVector* inverse_bind;
+        const ozzUint16Verctor* joint_remap; // nullptr: the joints of skeleton
+        float threshold;
+        uint32_t first_layer;
+        uint32_t nlayer;
+        bool skip_leaves;
+        uint32_t leaves; // index of skeleton_leaves, set in reserve()
+    };
+    struct skeleton_leaves {
+        const ozzSkeleton* skeleton;
+        std::vector<uint8_t> leaf;
+        std::vector<uint8_t> group; // 1: the soa group of 4 joints has a joint which is not a leaf
+        ozz::vector<ozz::math::Float4x4> rest; // local matrices of the rest pose
+    };
+    struct scratch {
+        ozz::animation::SamplingJob::Context context;
+        ozz::vector<ozz::math::SoaTransform> locals; // (nlayer + 1) * soa joints
+        ozz::vector<ozz::animation::BlendingJob::Layer> layers;
+        const char* err = nullptr;
+    };
+
+    std::vector<instance> instances;
+    std::vector<layer> layers;
+    std::vector<skeleton_leaves> leaves;
+    scratch scratches[MAX_WORKER+1];
+    job_pool pool;
+
+    ozzAnimationBatch() {
+        const uint32_t cores = std::thread::hardware_concurrency();
+        workers(cores > 1 ? std::min(cores - 1, DEFAULT_WORKER) : 0);
+    }
+
+    void workers(uint32_t n) {
+        if (n != workers())
+            pool.start(n);
+    }
+    uint32_t workers() const {
+        return pool.count() - 1;
+    }
+
+    void clear() {
+        instances.clear();
+        layers.clear();
+        leaves.clear();
+    }
+
+    static void soa_to_matrices(const ozz::math::SoaTransform& t, ozz::math::Float4x4 out[4]) {
+        const auto m = ozz::math::SoaFloat4x4::FromAffine(t.translation, t.rotation, t.scale);
+        ozz::math::Transpose16x16(&m.cols[0].x, out->cols);
+    }
+
+    // the skeletons are few, they are built in each run to avoid holding the pointers of the freed ones
+    uint32_t find_leaves(const ozzSkeleton* skeleton) {
+        for (uint32_t ii = 0; ii < (uint32_t)leaves.size(); ++ii) {
+            if (leaves[ii].skeleton == skeleton)
+                return ii;
+        }
+        const int n = skeleton->num_joints();
+        const auto parents = skeleton->joint_parents();
+        skeleton_leaves sl;
+        sl.skeleton = skeleton;
+        sl.leaf.assign(n, 1);
+        for (int ii = 0; ii < n; ++ii) {
+            if (parents[ii] != ozz::animation::Skeleton::kNoParent)
+                sl.leaf[parents[ii]] = 0;
+        }
+        sl.group.assign(skeleton->num_soa_joints(), 0);
+        for (int ii = 0; ii < n; ++ii) {
+            if (!sl.leaf[ii])
+                sl.group[ii / 4] = 1;
+        }
+        sl.rest.resize(skeleton->num_soa_joints() * 4);
+        const auto rest = skeleton->joint_rest_poses();
+        for (size_t ii = 0; ii < rest.size(); ++ii) {
+            soa_to_matrices(rest[ii], &sl.rest[ii * 4]);
+        }
+        leaves.push_back(std::move(sl));
+        return (uint32_t)leaves.size() - 1;
+    }
+
+    // as LocalToModelJob, the leaf joints are in the rest pose
+    void local_to_model_lod(const instance& inst, ozz::span<const ozz::math::SoaTransform> input) {
+        const auto& sl = leaves[inst.leaves];
+        const auto parents = inst.skeleton->joint_parents();
+        const int n = inst.skeleton->num_joints();
+        auto& models = *inst.models;
+        ozz::math::Float4x4 locals[4];
+        for (int g = 0; g * 4 < n; ++g) {
+            if (sl.group[g])
+                soa_to_matrices(input[g], locals);
+            const int e = std::min(g * 4 + 4, n);
+            for (int ii = g * 4; ii < e; ++ii) {
+                const auto& local = sl.leaf[ii] ? sl.rest[ii] : locals[ii - g * 4];
+                const int16_t p = parents[ii];
+                models[ii] = (p == ozz::animation::Skeleton::kNoParent) ? local : models[p] * local;
+            }
+        }
+    }
+
+    // the scratch is allocated in the caller thread before the workers start
+    void reserve(uint32_t nthread) {
+        int max_tracks = 0;
+        size_t max_locals = 0;
+        size_t max_layers = 0;
+        for (auto& inst : instances) {
+            if (inst.skip_leaves)
+                inst.leaves = find_leaves(inst.skeleton);
+            const size_t soa = (size_t)inst.skeleton->num_soa_joints();
+            max_locals = std::max(max_locals, soa * (inst.nlayer > 1 ? inst.nlayer + 1 : inst.nlayer));
+            max_layers = std::max(max_layers, (size_t)inst.nlayer);
+            for (uint32_t ii = 0; ii < inst.nlayer; ++ii) {
+                const auto& l = layers[inst.first_layer + ii];
+                if (!l.context)
+                    max_tracks = std::max(max_tracks, l.animation->num_tracks());
+            }
+        }
+        for (uint32_t ii = 0; ii < nthread; ++ii) {
+            auto& s = scratches[ii];
+            s.err = nullptr;
+            if (s.context.max_tracks() < max_tracks)
+                s.context.Resize(max_tracks);
+            if (s.locals.size() < max_locals)
+                s.locals.resize(max_locals);
+            if (s.layers.size() < max_layers)
+                s.layers.resize(max_layers);
+        }
+    }
+
+    bool sample(scratch& s, const instance& inst) {
+        const auto& skeleton = *inst.skeleton;
+        const size_t soa = (size_t)skeleton.num_soa_joints();
+        ozz::animation::LocalToModelJob ltm;
+        ltm.skeleton = &skeleton;
+        ltm.output = ozz::make_span(*inst.models);
+        if (inst.nlayer == 0) {
+            ltm.input = skeleton.joint_rest_poses();
+        } else {
+            for (uint32_t ii = 0; ii < inst.nlayer; ++ii) {
+                const auto& l = layers[inst.first_layer + ii];
+                ozz::animation::SamplingJob job;
+                job.animation = l.animation;
+                job.context = l.context ? l.context : &s.context;
+                job.ratio = l.ratio;
+                job.output = ozz::span<ozz::math::SoaTransform>(s.locals.data() + soa * ii, soa);
+                if (!job.Run()) {
+                    s.err = "SamplingJob failed!";
+                    return false;
+                }
+            }
+            if (inst.nlayer == 1) {
+                ltm.input = ozz::span<const ozz::math::SoaTransform>(s.locals.data(), soa);
+            } else {
+                for (uint32_t ii = 0; ii < inst.nlayer; ++ii) {
+                    auto& bl = s.layers[ii];
+                    bl.transform = ozz::span<const ozz::math::SoaTransform>(s.locals.data() + soa * ii, soa);
+                    bl.weight = layers[inst.first_layer + ii].weight;
+                }
+                auto output = ozz::span<ozz::math::SoaTransform>(s.locals.data() + soa * inst.nlayer, soa);
+                ozz::animation::BlendingJob job;
+                job.layers = ozz::span<const ozz::animation::BlendingJob::Layer>(s.layers.data(), inst.nlayer);
+                job.output = output;
+                job.threshold = inst.threshold;
+                job.rest_pose = skeleton.joint_rest_poses();
+                if (!job.Run()) {
+                    s.err = "BlendingJob failed!";
+                    return false;
+                }
+                ltm.input = output;
+            }
+        }
+        if (inst.skip_leaves) {
+            local_to_model_lod(inst, ltm.input);
+        } else if (!ltm.Run()) {
+            s.err = "LocalToModelJob failed!";
+            return false;
+        }
+        if (inst.skinning) {
+            build_skinning(inst);
+        }
+        return true;
+    }
+
+    // as BuildSkinningMatrices
+    static void build_skinning(const instance& inst) {
+        auto& skinning = *inst.skinning;
+        const auto& models = *inst.models;
+        const auto& ibp = *inst.inverse_bind;
+        if (inst.joint_remap) {
+            const auto& remap = *inst.joint_remap;
+            for (size_t ii = 0; ii < remap.size(); ++ii) {
+                skinning[ii] = models[remap[ii]] * ibp[ii];
+            }
+        } else {
+            for (size_t ii = 0; ii < ibp.size(); ++ii) {
+                skinning[ii] = models[ii] * ibp[ii];
+            }
+        }
+    }
+
+    const char* run() {
+        const uint32_t n = (uint32_t)instances.size();
+        const uint32_t nthread = (pool.count() == 1 || n < PARALLEL_THRESHOLD) ? 1 : pool.count();
+        reserve(nthread);
+        if (nthread == 1) {
+            for (const auto& inst : instances) {
+                if (!sample(scratches[0], inst))
+                    break;
+            }
+        } else {
+            std::atomic<uint32_t> next(0);
+            pool.run([this, n, &next](uint32_t idx) {
+                auto& s = scratches[idx];
+                for (uint32_t b; (b = next.fetch_add(BATCH)) < n; ) {
+                    const uint32_t e = std::min(b + BATCH, n);
+                    for (uint32_t ii = b; ii < e; ++ii) {
+                        if (!sample(s, instances[ii]))
+                            return;
+                    }
+                }
+            });
+        }
+        for (uint32_t ii = 0; ii < nthread; ++ii) {
+            if (scratches[ii].err)
+                return scratches[ii].err;
+        }
+        return nullptr;
+    }
+};
+
+namespace ozzlua::AnimationBatch {
+    // add(skeleton, models, threshold [, skinning_matrices, inverse_bind_matrices, joint_remap])
+    static int add(lua_State* L) {
+        auto& batch = bee::lua::checkudata<ozzAnimationBatch>(L, 1);
+        auto& ske = bee::lua::checkudata<ozzSkeleton>(L, 2);
+        auto& models = bee::lua::checkudata<ozzMatrixVector>(L, 3);
+        if (models.size() < (size_t)ske.num_joints()) {
+            return luaL_error(L, "models are less than the joints: %d < %d", (int)models.size(), ske.num_joints());
+        }
+        ozzAnimationBatch::instance inst;
+        inst.skeleton = &ske;
+        inst.models = &models;
+        inst.threshold = (float)luaL_optnumber(L, 4, 0.1);
+        inst.skinning = nullptr;
+        inst.inverse_bind = nullptr;
+        inst.joint_remap = nullptr;
+        inst.first_layer = (uint32_t)batch.layers.size();
+        inst.nlayer = 0;
+        inst.skip_leaves = false;
+        inst.leaves = 0;
+        if (!lua_isnoneornil(L, 5)) {
+            inst.skinning = &bee::lua::checkudata<ozzMatrixVector>(L, 5);
+            inst.inverse_bind = &bee::lua::checkudata<ozzMatrixVector>(L, 6);
+            if (!lua_isnoneornil(L, 7)) {
+                inst.joint_remap = &bee::lua::checkudata<ozzUint16Verctor>(L, 7);
+                if (inst.joint_remap->size() != inst.inverse_bind->size()) {
+                    return luaL_error(L, "joint remap and inverse bind matrices are mismatch");
+                }
+                for (auto j : *inst.joint_remap) {
+                    if (j >= models.size())
+                        return luaL_error(L, "invalid joint remap : %d", j);
+                }
+            } else if (inst.inverse_bind->size() > models.size()) {
+                return luaL_error(L, "inverse bind matrices are more than the joints");
+            }
+            if (inst.skinning->size() < inst.inverse_bind->size()) {
+                return luaL_error(L, "invalid skinning matrices and inverse bind matrices, skinning matrices must larger than inverse bind matrices");
+            }
+        }
+        batch.instances.push_back(inst);
+        return 0;
+    }
+    // layer(animation, context, ratio, weight) : the layer of the last added instance, context can be nil
+    static int layer(lua_State* L) {
+        auto& batch = bee::lua::checkudata<ozzAnimationBatch>(L, 1);
+        if (batch.instances.empty()) {
+            return luaL_error(L, "add an instance first");
+        }
+        auto& inst = batch.instances.back();
+        ozzAnimationBatch::layer l;
+        l.animation = &bee::lua::checkudata<ozzAnimation>(L, 2);
+        l.context = lua_isnil(L, 3) ? nullptr : &bee::lua::checkudata<ozzSamplingJobContext>(L, 3);
+        l.ratio = (float)luaL_checknumber(L, 4);
+        l.weight = (float)luaL_optnumber(L, 5, 1.0);
+        if (l.animation->num_soa_tracks() > inst.skeleton->num_soa_joints()) {
+            return luaL_error(L, "animation has more tracks than the skeleton");
+        }
+        if (l.context && l.context->max_tracks() < l.animation->num_tracks()) {
+            return luaL_error(L, "SamplingJobContext is too small");
+        }
+        batch.layers.push_back(l);
+        ++inst.nlayer;
+        return 0;
+    }
+    // skip_leaves() : the leaf joints of the last added instance are kept in the rest pose, for the animation LOD
+    static int skip_leaves(lua_State* L) {
+        auto& batch = bee::lua::checkudata<ozzAnimationBatch>(L, 1);
+        if (batch.instances.empty()) {
+            return luaL_error(L, "add an instance first");
+        }
+        batch.instances.back().skip_leaves = true;
+        return 0;
+    }
+    // run() : return the instances count, the batch is cleared
+    static int run(lua_State* L) {
+        auto& batch = bee::lua::checkudata<ozzAnimationBatch>(L, 1);
+        const char* err = batch.run();
+        const size_t n = batch.instances.size();
+        batch.clear();
+        if (err) {
+            return luaL_error(L, "%s", err);
+        }
+        lua_pushinteger(L, (lua_Integer)n);
+        return 1;
+    }
+    // workers([n]) : the threads besides the caller, return the count
+    static int workers(lua_State* L) {
+        auto& batch = bee::lua::checkudata<ozzAnimationBatch>(L, 1);
+        if (!lua_isnoneornil(L, 2)) {
+            const lua_Integer n = luaL_checkinteger(L, 2);
+            if (n < 0 || n > (lua_Integer)ozzAnimationBatch::MAX_WORKER) {
+                return luaL_error(L, "Invalid worker count: %d, should be : 0 <= n <= %d", (int)n, (int)ozzAnimationBatch::MAX_WORKER);
+            }
+            batch.workers((uint32_t)n);
+        }
+        lua_pushinteger(L, batch.workers());
+        return 1;
+    }
+    static void metatable(lua_State* L) {
+        static luaL_Reg lib[] = {
+            { "add", add },
+            { "layer", layer },
+            { "skip_leaves", skip_leaves },
+            { "run", run },
+            { "workers", workers },
+            { nullptr, nullptr }
+        };
+        luaL_newlibtable(L, lib);
+        luaL_setfuncs(L, lib, 0);
+        lua_setfield(L, -2, "__index");
+    }
+    static int create(lua_State* L) {
+        bee::lua::newudata<ozzAnimationBatch>(L);
+        return 1;
+    }
+}
+
 void init_job(lua_State* L) {
     static luaL_Reg lib[] = {
         { "SamplingJobContext", ozzlua::SamplingJobContext::create },
         { "BlendingJobLayerVector", ozzlua::BlendingJobLayerVector::create },
+        { "AnimationBatch", ozzlua::AnimationBatch::create },
         { "SamplingJob", SamplingJob },
         { "BlendingJob", BlendingJob },
         { "LocalToModelJob", LocalToModelJob },
@@ -129,4 +520,9 @@ namespace bee::lua {
         static inline auto name = "ozzBlendingJobLayerVector";
         static inline auto metatable = ozzlua::BlendingJobLayerVector::metatable;
     };
+    template <>
+    struct udata<ozzAnimationBatch> {
+        static inline auto name = "ozzAnimationBatch";
+        static inline auto metatable = ozzlua::AnimationBatch::metatable;
+    };
 }
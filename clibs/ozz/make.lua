@@ -12,6 +12,7 @@ lm:lua_source "ozz" {
     includes = {
         lm.AntDir .. "/3rd/ozz-animation/include",
         lm.AntDir .. "/3rd/bee.lua",
+        lm.AntDir .. "/clibs/foundation",
         "../luabind",
     },
     sources = {
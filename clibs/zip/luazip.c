@@ -665,9 +665,23 @@ struct zip_reader_cache {
 	size_t length;
 	size_t offset;
 	uint8_t active;
-	char buffer[7];
+	uint8_t mapped;
+	char buffer[6];
 };
 
+// the cache of luazip_map and luazip_share, the data is read only and owned by the others instead of the buffer
+struct zip_reader_map {
+	struct zip_reader_cache c;
+	char *data;		// the slice of the archive mapping, or the shared data
+	struct zip_archive *archive;	// the owner of the mapping, released in luazip_close
+	struct zip_reader_shared *shared;	// the owner of the shared data if archive is NULL
+};
+
+static inline char *
+cache_buffer(struct zip_reader_cache *f) {
+	return f->mapped ? ((struct zip_reader_map *)f)->data : f->buffer;
+}
+
 static inline struct zip_reader_cache *
 advance_ptr(struct zip_reader_cache *C, size_t sz) {
 	return (struct zip_reader_cache*)((char *)C + sz);
@@ -796,6 +810,7 @@ zipreader_handle(lua_State *L) {
 	C->length = sz;
 	C->offset = 0;
 	C->active = 1;
+	C->mapped = 0;
 	close_file(L, zf);
 	lua_pushlightuserdata(L, C);
 	return 1;
@@ -812,6 +827,7 @@ lreader(lua_State *L) {
 	C->length = 0;
 	C->offset = 0;
 	C->active = 0;
+	C->mapped = 0;
 	lua_pushvalue(L, 1);
 	lua_setiuservalue(L, -2, 1);
 	lua_pushlightuserdata(L, C);
@@ -868,13 +884,24 @@ luazip_new(size_t sz, struct zip_reader_cache *old) {
 	C->size = 0;
 	C->length = sz;
 	C->active = 1;
+	C->mapped = 0;
 	return C;
 }
 
+static void archive_release(struct zip_archive *a);
+static void shared_release(struct zip_reader_shared *s);
+
 void
 luazip_close(struct zip_reader_cache *f) {
 	f->active = 0;
-	if (f->size == 0) {
+	if (f->mapped) {
+		struct zip_reader_map *m = (struct zip_reader_map *)f;
+		if (m->archive)
+			archive_release(m->archive);
+		else
+			shared_release(m->shared);
+		free(m);
+	} else if (f->size == 0) {
 		free(f);
 	}
 }
@@ -884,12 +911,12 @@ luazip_data(struct zip_reader_cache *f, size_t *sz) {
 	if (sz) {
 		*sz = f->length;
 	}
-	return f->buffer;
+	return cache_buffer(f);
 }
 
 size_t
 luazip_read(struct zip_reader_cache *f, void *buf, size_t sz) {
-	void * src = f->buffer + f->offset;
+	void * src = cache_buffer(f) + f->offset;
 	size_t len = f->length - f->offset;
 	if (len >= sz) {
 		memcpy(buf, src, sz);
@@ -955,53 +982,594 @@ goto_file(unzFile zf, int n) {
 	return UNZ_OK;
 }
 
-struct zip_reader_cache *
-luazip_open(const char *filename) {
-	int i;
-	for (i=0;filename[i];i++) {
-		if (filename[i] == '|') {
-			// zip file
-			char *endptr;
-			long idx = strtol(filename+i+1, &endptr, 10);
-			if (*endptr != '\0')
-				return NULL;	// invalid id
-			char tmp[4096];
-			if (i >= 4096)
-				return NULL;
-			memcpy(tmp, filename, i);
-			tmp[i] = '\0';
-			unzFile uzf = unzip_open(NULL, tmp);
-			if (uzf == NULL)
-				return NULL;
-			if (goto_file(uzf, idx) != UNZ_OK) {
-				unzClose(uzf);
-				return NULL;
-			}
-			unz_file_info info;
-			int err = unzGetCurrentFileInfo(uzf, &info, NULL, 0, NULL, 0, NULL, 0);
-			if (err != UNZ_OK) {
-				unzClose(uzf);
-				return NULL;
+/*
+	The archives of luazip_open("archive.zip|index") are opened once and cached by the path,
+	index is the order in the central directory(unz_file_pos.num_of_file). The central
+	directory is parsed into an offset table when the archive is first opened, the stored and
+	deflated entries are read by offset(pread), so the ltask services can read one archive at
+	the same time without a lock. The other entries(encrypted, or other methods) fall back to
+	minizip.
+
+	The size and mtime of the file are checked for each open, the archive is reopened when the
+	bundle is replaced at runtime. The replaced archive is deleted when the last reader(or the
+	mapped slice) releases it.
+
+	luazip_map maps the stored entries of the archives instead of reading them, they are the
+	slices of the mapping of the archive(the archive is mapped once when it's opened). The mapping
+	is shared by all the readers, so it's read only.
+	The regular files are always read, the editor may rewrite(truncate) them while they are
+	mapped. The small entries, and the entries need inflate, are read as luazip_open.
+*/
+
+// the entries smaller than it are read, the mapping costs more than the copy
+#define MAP_MIN_SIZE				(64 * 1024)
+
+#define ARCHIVE_LOCAL_HEADER_SIG	0x04034b50
+#define ARCHIVE_CENTRAL_SIG			0x02014b50
+#define ARCHIVE_END_SIG				0x06054b50
+#define ARCHIVE64_LOCATOR_SIG		0x07064b50
+#define ARCHIVE64_END_SIG			0x06064b50
+#define ARCHIVE_LOCAL_HEADER_SIZE	30
+#define ARCHIVE_CENTRAL_SIZE		46
+#define ARCHIVE_END_SIZE			22
+#define ARCHIVE64_LOCATOR_SIZE		20
+#define ARCHIVE64_END_SIZE			56
+#define ARCHIVE_MAX_COMMENT			0xffff
+
+#define ARCHIVE_METHOD_STORE		0
+#define ARCHIVE_METHOD_DEFLATE		8
+#define ARCHIVE_FLAG_ENCRYPTED		1
+
+#ifdef _WIN32
+
+typedef HANDLE archive_file;
+#define INVALID_ARCHIVE_FILE INVALID_HANDLE_VALUE
+
+static SRWLOCK ARCHIVE_LOCK = SRWLOCK_INIT;
+#define archive_lock() AcquireSRWLockExclusive(&ARCHIVE_LOCK)
+#define archive_unlock() ReleaseSRWLockExclusive(&ARCHIVE_LOCK)
+
+static archive_file
+archive_fopen(const char *filename) {
+	struct filename_convert tmp;
+	if (MultiByteToWideChar(CP_UTF8, 0, filename, -1, tmp.tmp, sizeof(tmp) / sizeof(tmp.tmp[0])) == 0)
+		return INVALID_ARCHIVE_FILE;
+	// the file may be replaced(renamed or deleted) while it's opened, see archive_open
+	return CreateFileW(tmp.tmp, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+static void
+archive_fclose(archive_file f) {
+	CloseHandle(f);
+}
+
+static void *
+archive_map(archive_file f, uint64_t sz) {
+	HANDLE m = CreateFileMappingW(f, NULL, PAGE_READONLY, (DWORD)(sz >> 32), (DWORD)sz, NULL);
+	if (m == NULL)
+		return NULL;
+	void *view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, (SIZE_T)sz);
+	// the view keeps the mapping object
+	CloseHandle(m);
+	return view;
+}
+
+static void
+archive_unmap(const void *view, size_t sz) {
+	(void)sz;
+	UnmapViewOfFile(view);
+}
+
+static int
+archive_fsize(archive_file f, uint64_t *sz) {
+	LARGE_INTEGER li;
+	if (!GetFileSizeEx(f, &li))
+		return 0;
+	*sz = (uint64_t)li.QuadPart;
+	return 1;
+}
+
+static int
+archive_stat(const char *filename, uint64_t *sz, uint64_t *mtime) {
+	struct filename_convert tmp;
+	if (MultiByteToWideChar(CP_UTF8, 0, filename, -1, tmp.tmp, sizeof(tmp) / sizeof(tmp.tmp[0])) == 0)
+		return 0;
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (!GetFileAttributesExW(tmp.tmp, GetFileExInfoStandard, &attr))
+		return 0;
+	*sz = (uint64_t)attr.nFileSizeHigh << 32 | attr.nFileSizeLow;
+	*mtime = (uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32 | attr.ftLastWriteTime.dwLowDateTime;
+	return 1;
+}
+
+static int
+archive_pread(archive_file f, uint64_t offset, void *buf, size_t sz) {
+	char *ptr = (char *)buf;
+	while (sz > 0) {
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD n = sz > 0x40000000 ? 0x40000000 : (DWORD)sz;
+		DWORD bytes;
+		if (!ReadFile(f, ptr, n, &bytes, &ov) || bytes == 0)
+			return 0;
+		ptr += bytes;
+		offset += bytes;
+		sz -= bytes;
+	}
+	return 1;
+}
+
+#else
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef int archive_file;
+#define INVALID_ARCHIVE_FILE (-1)
+
+static pthread_mutex_t ARCHIVE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+#define archive_lock() pthread_mutex_lock(&ARCHIVE_LOCK)
+#define archive_unlock() pthread_mutex_unlock(&ARCHIVE_LOCK)
+
+static archive_file
+archive_fopen(const char *filename) {
+	return open(filename, O_RDONLY);
+}
+
+static void
+archive_fclose(archive_file f) {
+	close(f);
+}
+
+static void *
+archive_map(archive_file f, uint64_t sz) {
+	void *view = mmap(NULL, (size_t)sz, PROT_READ, MAP_PRIVATE, f, 0);
+	return view == MAP_FAILED ? NULL : view;
+}
+
+static void
+archive_unmap(const void *view, size_t sz) {
+	munmap((void *)view, sz);
+}
+
+static int
+archive_fsize(archive_file f, uint64_t *sz) {
+	struct stat st;
+	if (fstat(f, &st) != 0)
+		return 0;
+	*sz = (uint64_t)st.st_size;
+	return 1;
+}
+
+static int
+archive_stat(const char *filename, uint64_t *sz, uint64_t *mtime) {
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return 0;
+	*sz = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+	*mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	*mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return 1;
+}
+
+static int
+archive_pread(archive_file f, uint64_t offset, void *buf, size_t sz) {
+	char *ptr = (char *)buf;
+	while (sz > 0) {
+		ssize_t bytes = pread(f, ptr, sz, (off_t)offset);
+		if (bytes <= 0)
+			return 0;
+		ptr += bytes;
+		offset += bytes;
+		sz -= bytes;
+	}
+	return 1;
+}
+
+#endif
+
+static inline uint16_t
+le16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+le32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t
+le64(const uint8_t *p) {
+	return (uint64_t)le32(p) | ((uint64_t)le32(p+4) << 32);
+}
+
+struct zip_entry {
+	uint64_t offset;	// local file header
+	uint64_t compressed_size;
+	uint64_t uncompressed_size;
+	uint16_t method;
+	uint16_t flag;
+};
+
+struct zip_archive {
+	struct zip_archive *next;
+	archive_file f;
+	uint32_t n;
+	struct zip_entry *entry;
+	const uint8_t *view;	// the mapping of the whole archive, NULL if it can't be mapped
+	uint64_t view_size;
+	uint64_t size;		// the size and mtime of the file when it's opened
+	uint64_t mtime;
+	int ref;			// the readers and the slices using it, guarded by ARCHIVE_LOCK
+	int stale;			// the file is replaced, delete it when the last reference is released
+	char filename[1];
+};
+
+static struct zip_archive *ARCHIVES = NULL;
+
+// zip64 extended information extra field, only the fields of 0xffffffff are in it
+static int
+read_zip64_extra(const uint8_t *extra, size_t sz, struct zip_entry *e) {
+	while (sz >= 4) {
+		uint16_t id = le16(extra);
+		uint16_t n = le16(extra + 2);
+		if (n + 4 > sz)
+			return 0;
+		if (id == 0x0001) {
+			const uint8_t *p = extra + 4;
+			const uint8_t *endptr = p + n;
+			if (e->uncompressed_size == 0xffffffff) {
+				if (p + 8 > endptr)
+					return 0;
+				e->uncompressed_size = le64(p);
+				p += 8;
 			}
-			err = unzOpenCurrentFile(uzf);
-			if (err != UNZ_OK) {
-				unzClose(uzf);
-				return NULL;
+			if (e->compressed_size == 0xffffffff) {
+				if (p + 8 > endptr)
+					return 0;
+				e->compressed_size = le64(p);
+				p += 8;
 			}
-			struct zip_reader_cache * c = luazip_new(info.uncompressed_size, NULL);
-			void * data = luazip_data(c, NULL);
-			if (info.uncompressed_size != 0) {
-				int bytes = unzReadCurrentFile(uzf, data, info.uncompressed_size);
-				if (bytes != info.uncompressed_size) {
-					luazip_close(c);
-					unzClose(uzf);
-					return NULL;
-				}
+			if (e->offset == 0xffffffff) {
+				if (p + 8 > endptr)
+					return 0;
+				e->offset = le64(p);
 			}
+			return 1;
+		}
+		extra += n + 4;
+		sz -= n + 4;
+	}
+	return 1;
+}
+
+// find the central directory from the end of central directory record, and the zip64 one
+static int
+find_central_directory(archive_file f, uint64_t *offset, uint64_t *size, uint64_t *n) {
+	uint64_t filesize;
+	if (!archive_fsize(f, &filesize) || filesize < ARCHIVE_END_SIZE)
+		return 0;
+	size_t tail = (size_t)(filesize < ARCHIVE_END_SIZE + ARCHIVE_MAX_COMMENT ? filesize : ARCHIVE_END_SIZE + ARCHIVE_MAX_COMMENT);
+	uint8_t *buf = (uint8_t *)malloc(tail);
+	if (buf == NULL)
+		return 0;
+	uint64_t base = filesize - tail;
+	if (!archive_pread(f, base, buf, tail)) {
+		free(buf);
+		return 0;
+	}
+	const uint8_t *eocd = NULL;
+	size_t i;
+	for (i = tail - ARCHIVE_END_SIZE + 1; i > 0; i--) {
+		if (le32(buf + i - 1) == ARCHIVE_END_SIG) {
+			eocd = buf + i - 1;
+			break;
+		}
+	}
+	if (eocd == NULL) {
+		free(buf);
+		return 0;
+	}
+	uint64_t eocd_pos = base + (eocd - buf);
+	*n = le16(eocd + 10);
+	*size = le32(eocd + 12);
+	*offset = le32(eocd + 16);
+	free(buf);
+
+	if (*n == 0xffff || *size == 0xffffffff || *offset == 0xffffffff) {
+		uint8_t locator[ARCHIVE64_LOCATOR_SIZE];
+		uint8_t eocd64[ARCHIVE64_END_SIZE];
+		if (eocd_pos < ARCHIVE64_LOCATOR_SIZE
+			|| !archive_pread(f, eocd_pos - ARCHIVE64_LOCATOR_SIZE, locator, ARCHIVE64_LOCATOR_SIZE)
+			|| le32(locator) != ARCHIVE64_LOCATOR_SIG
+			|| !archive_pread(f, le64(locator + 8), eocd64, ARCHIVE64_END_SIZE)
+			|| le32(eocd64) != ARCHIVE64_END_SIG)
+			return 0;
+		*n = le64(eocd64 + 32);
+		*size = le64(eocd64 + 40);
+		*offset = le64(eocd64 + 48);
+	}
+	return *offset + *size <= filesize;
+}
+
+static int
+read_central_directory(archive_file f, struct zip_archive *a, uint64_t offset, uint64_t size) {
+	uint8_t *cd = (uint8_t *)malloc(size + 1);
+	if (cd == NULL)
+		return 0;
+	if (!archive_pread(f, offset, cd, size)) {
+		free(cd);
+		return 0;
+	}
+	const uint8_t *p = cd;
+	const uint8_t *endptr = cd + size;
+	uint32_t i;
+	for (i = 0; i < a->n; i++) {
+		if (p + ARCHIVE_CENTRAL_SIZE > endptr || le32(p) != ARCHIVE_CENTRAL_SIG)
+			break;
+		struct zip_entry *e = &a->entry[i];
+		e->flag = le16(p + 8);
+		e->method = le16(p + 10);
+		e->compressed_size = le32(p + 20);
+		e->uncompressed_size = le32(p + 24);
+		e->offset = le32(p + 42);
+		const uint16_t name_sz = le16(p + 28);
+		const uint16_t extra_sz = le16(p + 30);
+		const uint16_t comment_sz = le16(p + 32);
+		const uint8_t *extra = p + ARCHIVE_CENTRAL_SIZE + name_sz;
+		p = extra + extra_sz + comment_sz;
+		if (p > endptr || !read_zip64_extra(extra, extra_sz, e))
+			break;
+	}
+	free(cd);
+	return i == a->n;
+}
+
+static struct zip_archive *
+archive_new(const char *filename, uint64_t file_size, uint64_t file_mtime) {
+	archive_file f = archive_fopen(filename);
+	if (f == INVALID_ARCHIVE_FILE)
+		return NULL;
+	uint64_t offset, size, n;
+	if (!find_central_directory(f, &offset, &size, &n) || n > UINT32_MAX) {
+		archive_fclose(f);
+		return NULL;
+	}
+	size_t len = strlen(filename);
+	struct zip_archive *a = (struct zip_archive *)malloc(sizeof(*a) + len);
+	if (a == NULL) {
+		archive_fclose(f);
+		return NULL;
+	}
+	a->next = NULL;
+	a->f = f;
+	a->n = (uint32_t)n;
+	a->entry = (struct zip_entry *)malloc(sizeof(struct zip_entry) * (n + 1));
+	a->view = NULL;
+	a->view_size = 0;
+	a->size = file_size;
+	a->mtime = file_mtime;
+	a->ref = 0;
+	a->stale = 0;
+	memcpy(a->filename, filename, len + 1);
+	if (a->entry == NULL || !read_central_directory(f, a, offset, size)) {
+		free(a->entry);
+		free(a);
+		archive_fclose(f);
+		return NULL;
+	}
+	uint64_t filesize;
+	if (archive_fsize(f, &filesize) && filesize <= SIZE_MAX) {
+		a->view = (const uint8_t *)archive_map(f, filesize);
+		a->view_size = filesize;
+	}
+	return a;
+}
+
+static void
+archive_delete(struct zip_archive *a) {
+	if (a->view)
+		archive_unmap(a->view, (size_t)a->view_size);
+	archive_fclose(a->f);
+	free(a->entry);
+	free(a);
+}
+
+// the archive of the filename, the stale one(the file is replaced) is dropped from ARCHIVES. call it with ARCHIVE_LOCK
+static struct zip_archive *
+archive_find(const char *filename, uint64_t size, uint64_t mtime) {
+	struct zip_archive **prev = &ARCHIVES;
+	struct zip_archive *a = ARCHIVES;
+	while (a) {
+		if (strcmp(a->filename, filename) == 0)
+			break;
+		prev = &a->next;
+		a = a->next;
+	}
+	if (a && (a->size != size || a->mtime != mtime)) {
+		*prev = a->next;
+		a->stale = 1;
+		if (a->ref == 0)
+			archive_delete(a);
+		a = NULL;
+	}
+	return a;
+}
+
+// the archive is referenced until archive_release, it's reopened if the file is replaced.
+// the central directory is read without ARCHIVE_LOCK, the other archives are not blocked by a large one
+static struct zip_archive *
+archive_open(const char *filename) {
+	uint64_t size, mtime;
+	if (!archive_stat(filename, &size, &mtime))
+		return NULL;
+	archive_lock();
+	struct zip_archive *a = archive_find(filename, size, mtime);
+	if (a)
+		++a->ref;
+	archive_unlock();
+	if (a)
+		return a;
+	struct zip_archive *n = archive_new(filename, size, mtime);
+	if (n == NULL)
+		return NULL;
+	archive_lock();
+	// another thread may open it at the same time
+	a = archive_find(filename, size, mtime);
+	if (a == NULL) {
+		a = n;
+		a->next = ARCHIVES;
+		ARCHIVES = a;
+		n = NULL;
+	}
+	++a->ref;
+	archive_unlock();
+	if (n)
+		archive_delete(n);
+	return a;
+}
+
+static void
+archive_release(struct zip_archive *a) {
+	archive_lock();
+	if (--a->ref == 0 && a->stale)
+		archive_delete(a);
+	archive_unlock();
+}
+
+static struct zip_reader_cache *
+archive_read(struct zip_archive *a, const struct zip_entry *e) {
+	uint8_t header[ARCHIVE_LOCAL_HEADER_SIZE];
+	if (!archive_pread(a->f, e->offset, header, ARCHIVE_LOCAL_HEADER_SIZE) || le32(header) != ARCHIVE_LOCAL_HEADER_SIG)
+		return NULL;
+	const uint64_t data = e->offset + ARCHIVE_LOCAL_HEADER_SIZE + le16(header + 26) + le16(header + 28);
+	struct zip_reader_cache * c = luazip_new(e->uncompressed_size, NULL);
+	if (c == NULL)
+		return NULL;
+	if (e->uncompressed_size == 0)
+		return c;
+	void * buf = luazip_data(c, NULL);
+	if (e->method == ARCHIVE_METHOD_STORE) {
+		if (e->compressed_size != e->uncompressed_size || !archive_pread(a->f, data, buf, e->uncompressed_size)) {
+			luazip_close(c);
+			return NULL;
+		}
+		return c;
+	}
+	// deflate
+	if (e->compressed_size > UINT32_MAX || e->uncompressed_size > UINT32_MAX) {
+		luazip_close(c);
+		return NULL;
+	}
+	void * src = malloc(e->compressed_size + 1);
+	if (src == NULL || !archive_pread(a->f, data, src, e->compressed_size)) {
+		free(src);
+		luazip_close(c);
+		return NULL;
+	}
+	zng_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	int err = zng_inflateInit2(&zs, -MAX_WBITS);
+	if (err == Z_OK) {
+		zs.next_in = (const uint8_t *)src;
+		zs.avail_in = (uint32_t)e->compressed_size;
+		zs.next_out = (uint8_t *)buf;
+		zs.avail_out = (uint32_t)e->uncompressed_size;
+		err = zng_inflate(&zs, Z_FINISH);
+		zng_inflateEnd(&zs);
+	}
+	free(src);
+	if (err != Z_STREAM_END || zs.total_out != e->uncompressed_size) {
+		luazip_close(c);
+		return NULL;
+	}
+	return c;
+}
+
+// open the archive and read the file one time, for the entries not supported by archive_read
+static struct zip_reader_cache *
+unzip_read(const char *filename, long idx) {
+	unzFile uzf = unzip_open(NULL, filename);
+	if (uzf == NULL)
+		return NULL;
+	if (goto_file(uzf, idx) != UNZ_OK) {
+		unzClose(uzf);
+		return NULL;
+	}
+	unz_file_info info;
+	int err = unzGetCurrentFileInfo(uzf, &info, NULL, 0, NULL, 0, NULL, 0);
+	if (err != UNZ_OK) {
+		unzClose(uzf);
+		return NULL;
+	}
+	err = unzOpenCurrentFile(uzf);
+	if (err != UNZ_OK) {
+		unzClose(uzf);
+		return NULL;
+	}
+	struct zip_reader_cache * c = luazip_new(info.uncompressed_size, NULL);
+	void * data = luazip_data(c, NULL);
+	if (info.uncompressed_size != 0) {
+		int bytes = unzReadCurrentFile(uzf, data, info.uncompressed_size);
+		if (bytes != info.uncompressed_size) {
+			luazip_close(c);
 			unzClose(uzf);
-			return c;
+			return NULL;
 		}
 	}
+	unzClose(uzf);
+	return c;
+}
+
+// "archive.zip|index", sep is the position of '|'
+static struct zip_archive *
+open_entry(const char *filename, size_t sep, long *idx) {
+	char *endptr;
+	*idx = strtol(filename+sep+1, &endptr, 10);
+	if (*endptr != '\0')
+		return NULL;	// invalid id
+	char tmp[4096];
+	if (sep >= 4096)
+		return NULL;
+	memcpy(tmp, filename, sep);
+	tmp[sep] = '\0';
+	struct zip_archive *a = archive_open(tmp);
+	if (a == NULL)
+		return NULL;
+	if (*idx < 0 || *idx >= (long)a->n) {
+		archive_release(a);
+		return NULL;
+	}
+	return a;
+}
+
+static inline int
+archive_supported(const struct zip_entry *e) {
+	return !(e->flag & ARCHIVE_FLAG_ENCRYPTED) && (e->method == ARCHIVE_METHOD_STORE || e->method == ARCHIVE_METHOD_DEFLATE);
+}
+
+struct zip_reader_cache *
+luazip_open(const char *filename) {
+	const char *sep = strchr(filename, '|');
+	if (sep) {
+		// zip file
+		long idx;
+		struct zip_archive *a = open_entry(filename, sep - filename, &idx);
+		if (a == NULL)
+			return NULL;
+		const struct zip_entry *e = &a->entry[idx];
+		struct zip_reader_cache *c = archive_supported(e) ? archive_read(a, e) : unzip_read(a->filename, idx);
+		archive_release(a);
+		return c;
+	}
 	// regular file
 	struct filename_convert tmp;
 	FILE *f = file_open(NULL, filename, "rb", &tmp);
@@ -1024,6 +1592,93 @@ luazip_open(const char *filename) {
 	return c;
 }
 
+static struct zip_reader_cache *
+map_cache(struct zip_archive *a, const void *data, size_t sz) {
+	struct zip_reader_map *m = (struct zip_reader_map *)malloc(sizeof(*m));
+	if (m == NULL)
+		return NULL;
+	m->c.size = 0;
+	m->c.length = sz;
+	m->c.offset = 0;
+	m->c.active = 1;
+	m->c.mapped = 1;
+	m->data = (char *)data;
+	m->archive = a;
+	m->shared = NULL;
+	return &m->c;
+}
+
+// the slice of the archive mapping(it keeps the reference of the archive), NULL if the entry isn't stored
+static struct zip_reader_cache *
+map_entry(struct zip_archive *a, const struct zip_entry *e) {
+	if (a->view == NULL || e->method != ARCHIVE_METHOD_STORE || (e->flag & ARCHIVE_FLAG_ENCRYPTED)
+		|| e->uncompressed_size < MAP_MIN_SIZE || e->compressed_size != e->uncompressed_size)
+		return NULL;
+	if (e->offset + ARCHIVE_LOCAL_HEADER_SIZE > a->view_size)
+		return NULL;
+	const uint8_t *header = a->view + e->offset;
+	if (le32(header) != ARCHIVE_LOCAL_HEADER_SIG)
+		return NULL;
+	const uint64_t data = e->offset + ARCHIVE_LOCAL_HEADER_SIZE + le16(header + 26) + le16(header + 28);
+	if (data + e->uncompressed_size > a->view_size)
+		return NULL;
+	return map_cache(a, a->view + data, (size_t)e->uncompressed_size);
+}
+
+struct zip_reader_cache *
+luazip_map(const char *filename) {
+	const char *sep = strchr(filename, '|');
+	if (sep) {
+		long idx;
+		struct zip_archive *a = open_entry(filename, sep - filename, &idx);
+		if (a == NULL)
+			return NULL;
+		struct zip_reader_cache *c = map_entry(a, &a->entry[idx]);
+		if (c)
+			return c;
+		archive_release(a);
+	}
+	return luazip_open(filename);
+}
+
+struct zip_reader_shared {
+	struct zip_reader_cache *origin;
+	int ref;	// the views not closed, guarded by ARCHIVE_LOCK
+};
+
+static void
+shared_release(struct zip_reader_shared *s) {
+	archive_lock();
+	const int ref = --s->ref;
+	archive_unlock();
+	if (ref == 0) {
+		luazip_close(s->origin);
+		free(s);
+	}
+}
+
+int
+luazip_share(struct zip_reader_cache *f, int n, struct zip_reader_cache *views[]) {
+	struct zip_reader_shared *s = (struct zip_reader_shared *)malloc(sizeof(*s));
+	if (s == NULL)
+		return 0;
+	s->origin = f;
+	s->ref = n;
+	int i;
+	for (i = 0; i < n; i++) {
+		struct zip_reader_cache *c = map_cache(NULL, cache_buffer(f), f->length);
+		if (c == NULL) {
+			while (i > 0)
+				free(views[--i]);
+			free(s);
+			return 0;
+		}
+		((struct zip_reader_map *)c)->shared = s;
+		views[i] = c;
+	}
+	return 1;
+}
+
 static int
 lreader_open(lua_State *L) {
 	const char * filename = luaL_checkstring(L, 1);
@@ -1051,4 +1706,3 @@ luaopen_zip(lua_State *L) {
 	luaL_newlib(L, l);
 	return 1;
 }
-
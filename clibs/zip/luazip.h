@@ -8,6 +8,10 @@ int luaopen_zip(lua_State *L);
 struct zip_reader_cache;
 
 struct zip_reader_cache * luazip_open(const char *filename);
+// as luazip_open, but the large stored entries of archives are mapped instead of read, the data is read only
+struct zip_reader_cache * luazip_map(const char *filename);
+// n read only views of the cache, the cache is owned by the views and closed with the last one. 0 if out of memory
+int luazip_share(struct zip_reader_cache *f, int n, struct zip_reader_cache *views[]);
 struct zip_reader_cache * luazip_new(size_t sz, struct zip_reader_cache *);
 void luazip_close(struct zip_reader_cache *f);
 void* luazip_data(struct zip_reader_cache *f, size_t *sz);
@@ -442,6 +442,31 @@ function CMD.VERSION(id)
 	response_id(id, repo.root or "RUNTIME")
 end
 
+-- the local path of a downloaded file, nil for the files in the bundle, read them by READ
+function CMD.REALPATH(id, fullpath)
+	fullpath = fullpath:gsub("|", "/")
+	local path, name = fullpath:match "^(.*/)([^/]*)$"
+	local dir, r, hash = repo:list(path)
+	if not dir then
+		if r == ListNeedGet then
+			request_file(id, "GET", hash, "REALPATH", fullpath)
+			return
+		end
+		if r == ListNeedResource then
+			request_file(id, "RESOURCE", hash, "REALPATH", fullpath)
+			return
+		end
+		response_id(id, nil)
+		return
+	end
+	local v = dir[name]
+	if not v or v.type ~= 'f' then
+		response_id(id, nil)
+		return
+	end
+	response_id(id, repo:realpath(v.hash))
+end
+
 function CMD.quit(id)
 	QUIT = true
 	response_id(id)
@@ -108,7 +108,17 @@ function vfs:open(hash)
 			return c
 		end
 	end
-	return fastio.readall_v_noerr(self.localpath .. "/" .. hash)
+	return fastio.readall_m_noerr(self.localpath .. "/" .. hash)
+end
+
+-- the downloaded files only, the files in the bundle have no local path
+function vfs:realpath(hash)
+	local path = self.localpath .. hash
+	local f = io.open(path, "rb")
+	if f then
+		f:close()
+		return path
+	end
 end
 
 local function get_cachepath(setting, name)
@@ -94,6 +94,7 @@ lm:runlua "compile_ecs" {
 }
 
 if EnableEditor then
+    lm:import "test/bench/make.lua"
     lm:phony "tools" {
         deps = {
             "gltf2ozz",
@@ -3,11 +3,42 @@ local world = ecs.world
 local w = world.w
 
 local assetmgr = import_package "ant.asset"
+local setting = import_package "ant.settings"
 local ozz = require "ozz"
+local math3d = require "math3d"
 local skinning = ecs.require "skinning"
+local queuemgr = ecs.require "ant.render|queue_mgr"
+
+local Q = world:clibs "render.queue"
+
+local ENABLE_LOD = setting:get "animation/lod/enable"
+local LOD_DISTANCES <const> = setting:get "animation/lod/distances" or {10, 30}
+local LOD_BUDGET = setting:get "animation/lod/budget" or 16384
+local LOD_OFFSCREEN <const> = #LOD_DISTANCES + 1
 
 local m = ecs.system "animation_system"
 
+-- sampling, blending, local to model and the skinning matrices of all the changed entities run in C
+local batch = ozz.AnimationBatch()
+
+--[[
+    Animation LOD: the LOD of an entity comes from the camera distance and the cull result of its skinned
+    meshes in main queue(of the last frame). LOD n updates every 2^n frames, the offscreen ones are the
+    last LOD. The entities of the same period are spread over the frames by their phase(round robin),
+    and the ones beyond LOD 0 skip the leaf joints.
+
+    The changed entities are sampled in their slots, the most overdue first, until the joints sampled
+    in this frame are over LOD_BUDGET(one is sampled at least). The deferred ones keep dirty, and
+    animation_changed is cleared for them, so the skinning matrices of the last sampling are used.
+]]
+local frame = 0
+local lod_stat = {
+    sampled = 0,
+    deferred = 0,
+    joints = 0,
+}
+local candidates = {}
+
 local function create(filename)
     local data = assetmgr.resource(filename)
     local skeleton = data.skeleton
@@ -23,9 +54,13 @@ local function create(filename)
     local obj = {
         skeleton = skeleton,
         status = status,
-        blending_layers = ozz.BlendingJobLayerVector(),
         blending_threshold = 0.1,
-        locals_pool = {},
+        lod = 0,
+        dirty = false,
+        skip_leaves = false,
+        phase = 0,
+        sampled_frame = nil, -- the frame of the last sampling
+        scheduled_frame = nil,
         models = ozz.MatrixVector(skeleton:num_joints()),
         skinning = skinning.create(data.meshskin, skeleton),
     }
@@ -38,9 +73,11 @@ function m:component_init()
         if e.skinning ~= nil then
             local obj = assert(animations[e.scene.parent])
             e.skinning = obj.skinning
+            obj.has_mesh = true
             animations[e.eid] = obj
         elseif e.animation ~= nil then
             local obj = create(e.animation)
+            obj.phase = e.eid
             e.animation = obj
             e.animation_changed = true
             animations[e.eid] = obj
@@ -48,55 +85,157 @@ function m:component_init()
     end
 end
 
-local function resize_locals(ani, n)
-    local locals = ani.locals_pool
-    if #locals < n then
-        local size = ani.skeleton:num_soa_joints()
-        for i = #locals + 1, n do
-            locals[i] = ozz.SoaTransformVector(size)
+local function add_instance(obj)
+    local sk = obj.skinning
+    if sk then
+        sk.dirty = true
+        batch:add(obj.skeleton, obj.models, obj.blending_threshold, sk.matrices, sk.inverse_bind_pose, sk.joint_remap)
+    else
+        batch:add(obj.skeleton, obj.models, obj.blending_threshold)
+    end
+    obj.skip_leaves = obj.lod > 0
+    if obj.skip_leaves then
+        batch:skip_leaves()
+    end
+    for _, status in pairs(obj.status) do
+        if status.weight > 0 then
+            batch:layer(status.handle, status.sampling, status.ratio, status.weight)
+        end
+    end
+end
+
+local function update_visible()
+    local mqidx = queuemgr.queue_index "main_queue"
+    for e in w:select "skinning:in render_object:in" do
+        local ro = e.render_object
+        if Q.check(ro.visible_idx, mqidx) and not Q.check(ro.cull_idx, mqidx) then
+            e.skinning.visible_frame = frame
         end
     end
 end
 
-local function sampling(ani)
-    local skeleton = ani.skeleton
-    local layer = {}
-    for _, status in pairs(ani.status) do
+local function camera_position()
+    local mq = w:first "main_queue camera_ref:in"
+    if mq then
+        local ce <close> = world:entity(mq.camera_ref, "scene:in")
+        return math3d.index(ce.scene.worldmat, 4)
+    end
+end
+
+local function animation_lod(obj, worldmat, eyepos)
+    if obj.has_mesh and obj.skinning.visible_frame ~= frame then
+        return LOD_OFFSCREEN
+    end
+    if not eyepos then
+        return 0
+    end
+    local distance = math3d.length(math3d.sub(math3d.index(worldmat, 4), eyepos))
+    for lod, d in ipairs(LOD_DISTANCES) do
+        if distance < d then
+            return lod - 1
+        end
+    end
+    return #LOD_DISTANCES
+end
+
+local function joints_cost(obj)
+    local n = 0
+    for _, status in pairs(obj.status) do
         if status.weight > 0 then
-            layer[#layer+1] = status
+            n = n + 1
         end
     end
-    if #layer == 0 then
-        ozz.LocalToModelJob(skeleton, nil, ani.models)
-        return
-    elseif #layer == 1 then
-        resize_locals(ani, 1)
-        local status = layer[1]
-        local locals = ani.locals_pool[1]
-        ozz.SamplingJob(status.handle, status.sampling, locals, status.ratio)
-        ozz.LocalToModelJob(skeleton, locals, ani.models)
-        return
-    end
-    local layers = ani.blending_layers
-    layers:resize(#layer)
-    resize_locals(ani, #layer + 1)
-    for i = 1, #layer do
-        local status = layer[i]
-        local locals = ani.locals_pool[i]
-        ozz.SamplingJob(status.handle, status.sampling, locals, status.ratio)
-        layers:set(i, locals, status.weight)
-    end
-    local locals = ani.locals_pool[#layer + 1]
-    ozz.BlendingJob(layers, locals, skeleton, ani.blending_threshold)
-    ozz.LocalToModelJob(skeleton, locals, ani.models)
+    return obj.skeleton:num_joints() * math.max(n, 1)
 end
 
-function m:animation_sample()
-    for e in w:select "animation_changed animation:in" do
+local function overdue(obj)
+    if obj.sampled_frame == nil then
+        return math.huge
+    end
+    return (frame - obj.sampled_frame) / (1 << obj.lod)
+end
+
+local function sort_candidates(a, b)
+    local oa, ob = overdue(a), overdue(b)
+    if oa ~= ob then
+        return oa > ob
+    end
+    return a.lod < b.lod
+end
+
+local function schedule()
+    update_visible()
+    local eyepos = camera_position()
+    local n = 0
+    for e in w:select "animation:in scene:in animation_changed?in" do
         local obj = e.animation
-        sampling(obj)
-        skinning.build(obj.models, obj.skinning)
+        if e.animation_changed then
+            obj.dirty = true
+        end
+        if obj.dirty or obj.skip_leaves then
+            obj.lod = animation_lod(obj, e.scene.worldmat, eyepos)
+            if obj.lod == 0 and obj.skip_leaves then
+                -- the leaves are restored when it comes near
+                obj.dirty = true
+            end
+            local period = 1 << obj.lod
+            if obj.dirty and (obj.sampled_frame == nil
+                or (frame + obj.phase) % period == 0
+                or frame - obj.sampled_frame > period) then
+                n = n + 1
+                candidates[n] = obj
+            end
+        end
+    end
+    table.sort(candidates, sort_candidates)
+    local joints = 0
+    local sampled = 0
+    for i = 1, n do
+        local obj = candidates[i]
+        local cost = joints_cost(obj)
+        if sampled > 0 and joints + cost > LOD_BUDGET then
+            break
+        end
+        joints = joints + cost
+        sampled = sampled + 1
+        obj.scheduled_frame = frame
+    end
+    for i = 1, n do
+        candidates[i] = nil
+    end
+    lod_stat.sampled = sampled
+    lod_stat.joints = joints
+    lod_stat.deferred = 0
+    for e in w:select "animation:in animation_changed?out" do
+        local obj = e.animation
+        if obj.scheduled_frame == frame then
+            obj.dirty = false
+            obj.sampled_frame = frame
+            e.animation_changed = true
+            add_instance(obj)
+        else
+            if obj.dirty then
+                lod_stat.deferred = lod_stat.deferred + 1
+            end
+            e.animation_changed = false
+        end
+    end
+end
+
+function m:animation_sample()
+    frame = frame + 1
+    if ENABLE_LOD then
+        schedule()
+    else
+        for e in w:select "animation_changed animation:in" do
+            local obj = e.animation
+            obj.lod = 0
+            obj.dirty = false
+            obj.sampled_frame = frame
+            add_instance(obj)
+        end
     end
+    batch:run()
 end
 
 function m:final()
@@ -105,6 +244,36 @@ end
 
 local api = {}
 
+-- workers([n]) : the threads to sample the animations besides the main thread, return the count
+function api.workers(n)
+    return batch:workers(n)
+end
+
+-- lod(enable) : switch the animation LOD, all the entities are updated every frame in full joints when it's disabled
+function api.lod(enable)
+    if ENABLE_LOD and not enable then
+        for e in w:select "animation:in animation_changed?out" do
+            if e.animation.dirty then
+                e.animation_changed = true
+            end
+        end
+    end
+    ENABLE_LOD = enable
+end
+
+-- lod_budget([n]) : the joints sampled in one frame, return the budget
+function api.lod_budget(n)
+    if n then
+        LOD_BUDGET = n
+    end
+    return LOD_BUDGET
+end
+
+-- lod_stat() : the entities sampled and deferred, and the joints sampled in the last frame
+function api.lod_stat()
+    return lod_stat
+end
+
 function api.set_status(e, name, ratio, weight)
     w:extend(e, "animation:in animation_changed?out")
     local status = e.animation.status[name]
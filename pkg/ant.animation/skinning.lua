@@ -12,48 +12,136 @@ local ENABLE_TAA <const> = setting:get "graphic/postprocess/taa/enable"
 local imaterial = ecs.require "ant.asset|material"
 local mathpkg = import_package "ant.math"
 local assetmgr = import_package "ant.asset"
+local layoutmgr = import_package "ant.render".layoutmgr
 local ozz = require "ozz"
 local math3d = require "math3d"
+local bgfx = require "bgfx"
 
 local r2l_mat <const> = mathpkg.constant.R2L_MAT
 
 local m = ecs.system "skinning_system"
 local api = {}
 
+--[[
+	The skinning palettes(the model space skinning matrices) of all the skinned meshes are in one dynamic
+	buffer(b_skinning_palette), each skinning has a range of it. Only the palettes sampled in this frame
+	are uploaded, and all the queues(pre depth, shadows, main, ...) read the same buffer, so there is no
+	joint limit of the uniforms.
+
+	The worldmat of a skinned mesh is an array of matrices:
+		1: the world matrix
+		2: [0][0] is the palette offset(in matrices), [1][1] is the palette offset of the last frame
+		3: the world matrix of the last frame, only for TAA
+	With TAA, each skinning has two ranges, the palette of the last frame is kept in the other one. The
+	first upload(and the one after the buffer is resized) writes the same matrices into both ranges, so
+	the palette of the last frame is never the uninitialized one.
+]]
+local MATRIX_SIZE <const> = 64 -- 16 floats
+local palette_buffer = bgfx.create_dynamic_vertex_buffer(1, layoutmgr.get "t40".handle, "ra")
+local palette_capacity = 0	-- in matrices
+local palette_size = 0
+local palette_freelist = {}	-- count -> offsets
+local palette_resized = false
+local skinnings = {}
+
+local function palette_alloc(count)
+	local list = palette_freelist[count]
+	if list and #list > 0 then
+		return table.remove(list)
+	end
+	local offset = palette_size
+	palette_size = palette_size + count
+	if palette_size > palette_capacity then
+		-- the buffer is recreated when it's resized, all the palettes are uploaded again
+		palette_capacity = math.max(palette_size, palette_capacity * 2, 1024)
+		bgfx.update(palette_buffer, 0, bgfx.memory_buffer(palette_capacity * MATRIX_SIZE, 0))
+		palette_resized = true
+	end
+	return offset
+end
+
+local function palette_dealloc(offset, count)
+	local list = palette_freelist[count]
+	if list == nil then
+		list = {}
+		palette_freelist[count] = list
+	end
+	list[#list+1] = offset
+end
+
+local function palette_upload(skinning, offset)
+	local sm = skinning.matrices
+	bgfx.update(palette_buffer, offset * 4, bgfx.memory_buffer(sm:pointer(), sm:count() * MATRIX_SIZE))
+end
+
+local function palette_param(offset, prev_offset)
+	return math3d.matrix {
+		offset, 0, 0, 0,
+		0, prev_offset, 0, 0,
+		0, 0, 0, 0,
+		0, 0, 0, 0,
+	}
+end
+
+function m:init()
+	imaterial.system_attrib_update("b_skinning_palette", palette_buffer)
+end
+
 function m:follow_scene_update()
+	if palette_resized then
+		palette_resized = false
+		for skinning in pairs(skinnings) do
+			skinning.dirty = true
+			skinning.uploaded = false
+		end
+		for e in w:select "animation animation_changed?out" do
+			e.animation_changed = true
+		end
+	end
 	for e in w:select "scene_changed animation animation_changed?out" do
 		e.animation_changed = true
 	end
 	for e in w:select "animation_changed animation:in scene:in" do
 		local skinning = e.animation.skinning
-		local sm = skinning.matrices
-		local matrices = math3d.array_matrix_ref(sm:pointer(), sm:count())
+		local prev_palette = skinning.palette
+		if skinning.dirty then
+			skinning.dirty = false
+			if ENABLE_TAA then
+				if skinning.uploaded then
+					skinning.palette, skinning.back_palette = skinning.back_palette, skinning.palette
+				else
+					palette_upload(skinning, skinning.back_palette)
+				end
+			end
+			palette_upload(skinning, skinning.palette)
+			skinning.uploaded = true
+		end
 		local mat = math3d.mul(e.scene.worldmat, r2l_mat)
+		local param = palette_param(skinning.palette, prev_palette)
 		math3d.unmark(skinning.matrices_id)
-		skinning.matrices_id = math3d.mark(math3d.mul_array(mat, matrices))
+		if ENABLE_TAA then
+			local prev = skinning.prev_worldmat
+			skinning.matrices_id = math3d.mark(math3d.array_matrix {mat, param, prev or mat})
+			if prev then
+				math3d.unmark(prev)
+			end
+			skinning.prev_worldmat = math3d.mark(mat)
+		else
+			skinning.matrices_id = math3d.mark(math3d.array_matrix {mat, param})
+		end
 	end
 	w:propagate("scene", "animation_changed")
 end
 
-if ENABLE_TAA then
-	function m:skin_mesh()
-		for e in w:select "animation_changed skinning:in render_object:update visible_state:in" do
-			local skinning = e.skinning
-			if e.visible_state["velocity_queue"] then
-				imaterial.set_property(e, "u_prev_model", skinning.prev_matrices_id or skinning.matrices_id, "velocity_queue")
-			end
-			if skinning.prev_matrices_id ~= nil then
-				math3d.unmark(skinning.prev_matrices_id)
-			end
-			skinning.prev_matrices_id = math3d.mark(skinning.matrices_id)
-			e.render_object.worldmat = skinning.matrices_id
-		end
+function m:skin_mesh()
+	for e in w:select "animation_changed skinning:in render_object:update" do
+		e.render_object.worldmat = e.skinning.matrices_id
 	end
-else
-	function m:skin_mesh()
-		for e in w:select "animation_changed skinning:in render_object:update" do
-			e.render_object.worldmat = e.skinning.matrices_id
-		end
+end
+
+function m:entity_remove()
+	for e in w:select "REMOVED animation:in" do
+		api.destroy(e.animation.skinning)
 	end
 end
 
@@ -62,19 +150,38 @@ function api.create(filename, skeleton)
 	local count = skin.joint_remap
 		and #skin.joint_remap
 		or skeleton:num_joints()
-	if count > 64 then
-		error(("skinning matrices are too large, max is 128, %d needed"):format(count))
-	end
-	return {
+	local skinning = {
 		inverse_bind_pose = skin.inverse_bind_pose,
 		joint_remap = skin.joint_remap,
 		matrices = ozz.MatrixVector(count),
 		matrices_id = mathpkg.constant.NULL,
+		palette = palette_alloc(count),
+		dirty = false,
+		uploaded = false,
 	}
+	if ENABLE_TAA then
+		skinning.back_palette = palette_alloc(count)
+	end
+	skinnings[skinning] = true
+	return skinning
 end
 
-function api.build(models, skinning)
-	ozz.BuildSkinningMatrices(skinning.matrices, models, skinning.inverse_bind_pose, skinning.joint_remap)
+function api.destroy(skinning)
+	if not skinnings[skinning] then
+		return
+	end
+	skinnings[skinning] = nil
+	local count = skinning.matrices:count()
+	palette_dealloc(skinning.palette, count)
+	if skinning.back_palette then
+		palette_dealloc(skinning.back_palette, count)
+	end
+	math3d.unmark(skinning.matrices_id)
+	skinning.matrices_id = mathpkg.constant.NULL
+	if skinning.prev_worldmat then
+		math3d.unmark(skinning.prev_worldmat)
+		skinning.prev_worldmat = nil
+	end
 end
 
 return api
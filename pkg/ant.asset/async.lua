@@ -29,6 +29,11 @@ function m.material_unmark(pid)
 	return ltask.call(ServiceResource, "material_unmark", pid)
 end
 
+-- hit/miss/recreate/evict of the programs, for profiling
+function m.material_stat()
+	return ltask.call(ServiceResource, "material_stat")
+end
+
 function m.material_isvalid(pid)
 	local h = PM.program_get(pid)
 	return (0xffff&h) ~= 0xffff
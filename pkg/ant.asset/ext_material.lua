@@ -39,6 +39,9 @@ local function loader(filename)
 			systems = ad.systems,
 			object = MA.material_load(filename .. "|di", material.state, material.stencil, material.fx.di.prog, ad.systems, ad.attribs)
 		}
+		if material.object then
+			MA.material_instanced(material.object, material.di.object)
+		end
 	end
     return material
 end
@@ -57,6 +57,7 @@ assetmgr.material_check		= async.material_check
 assetmgr.material_mark		= async.material_mark
 assetmgr.material_unmark	= async.material_unmark
 assetmgr.material_isvalid	= async.material_isvalid
+assetmgr.material_stat		= async.material_stat
 
 assetmgr.textures 			= texture_mgr.textures
 assetmgr.default_textureid	= texture_mgr.default_textureid
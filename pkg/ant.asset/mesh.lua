@@ -17,10 +17,10 @@ function imesh.build_meshes(files)
 	for _, mf in ipairs(files) do
 		local mesh = assetmgr.resource(mf)
 
-		local function update_buffer(b, ob)
+		local function update_buffer(b, ob, size)
 			if b then
 				local om 	= ob.memory
-				local str 	= b.str
+				local str 	= size and b.str:sub(1, size) or b.str
 				om.list[#om.list+1] = str
 				om[3]		= om[3] + #str
 
@@ -32,7 +32,9 @@ function imesh.build_meshes(files)
 
 		update_buffer(mesh.vb, vb)
 		update_buffer(mesh.vb2,vb2)
-		update_buffer(mesh.ib, ib)
+		-- the LOD indices follow LOD 0 in the ib of meshbin, they are dropped
+		local ibsize = mesh.ib and mesh.lod and mesh.ib.num * (mesh.ib.flag == 'd' and 4 or 2) or nil
+		update_buffer(mesh.ib, ib, ibsize)
 
 		vbnums[#vbnums+1] = mesh.vb.num
 		ibnums[#ibnums+1] = mesh.ib.num
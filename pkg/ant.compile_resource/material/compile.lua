@@ -459,6 +459,16 @@ local function add_lighting_sv(systems, lighting)
     end
 end
 
+-- the skinning palettes of all the skinned meshes are in one buffer, see ant.animation/skinning.lua
+local function add_skinning_sv(systems, inputs)
+    for _, input in ipairs(inputs) do
+        if input == "a_indices" then
+            systems[#systems+1] = "b_skinning_palette"
+            return
+        end
+    end
+end
+
 local STAGES<const> = {
     vs = "vs",
     fs = "fs",
@@ -519,6 +529,7 @@ local function create_shader_cfg(setting, post_tasks, inputfolder, output, mat,
             if stages.vs then
                 local s = load_shader_uniforms(setting, output, "vs", ao)
                 check_vs_inputs(setting, inputfolder, mat, s.inputs)
+                add_skinning_sv(ao.systems, s.inputs)
             end
             if stages.fs then
                 load_shader_uniforms(setting, output, "fs", ao)
@@ -529,13 +540,15 @@ local function create_shader_cfg(setting, post_tasks, inputfolder, output, mat,
         check_material_properties(properties, ao.attribs)
         if stages.depth then
             ao.depth = attrib_obj()
-            load_shader_uniforms(setting, output, "depth", ao.depth)
+            local s = load_shader_uniforms(setting, output, "depth", ao.depth)
+            add_skinning_sv(ao.depth.systems, s.inputs)
             check_material_properties(properties, ao.depth.attribs)
         end
 
         if stages.di then
             ao.di = attrib_obj()
-            load_shader_uniforms(setting, output, "di", ao.di)
+            local s = load_shader_uniforms(setting, output, "di", ao.di)
+            add_skinning_sv(ao.di.systems, s.inputs)
             check_material_properties(properties, ao.di.attribs)
         end
 
@@ -1 +1 @@
-return 13
+return 14
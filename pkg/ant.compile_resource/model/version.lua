@@ -1 +1 @@
-return 19
+return 21
@@ -6,4 +6,14 @@ function m.import(path)
     bgfx.fontimport(path)
 end
 
+-- map a sdf cache file shipped with the app(the font.sdfcache written back at shutdown), the glyphs in it are not rasterized
+function m.cache(path)
+    return bgfx.fontcache(path)
+end
+
+-- rasterize the glyphs of the text into the cache, the cache is written back at shutdown
+function m.bake(fontname, text)
+    return bgfx.fontbake(fontname, text)
+end
+
 return m
@@ -27,7 +27,8 @@ lm:lua_source "font" {
         lm.AntDir .. "/3rd/bgfx/include",
         lm.AntDir .. "/3rd/bx/include",
         lm.AntDir .. "/3rd/bgfx/3rdparty",
-        lm.AntDir .. "/clibs/bgfx"
+        lm.AntDir .. "/clibs/bgfx",
+        lm.AntDir .. "/clibs/zip",
     },
     sources = {
         "src/*.c",
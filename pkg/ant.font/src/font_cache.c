@@ -0,0 +1,268 @@
+#include "font_cache.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define CACHE_MAGIC 0x43465341	// "ASFC"
+#define CACHE_VERSION 1
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t params;	// the sdf parameters of the rasterizer
+	uint32_t count;
+};
+
+struct cache_glyph {
+	uint64_t font;
+	uint32_t codepoint;
+	uint32_t offset;	// of the sdf, from the beginning of the file
+	uint16_t size;
+	uint16_t reserved[3];
+};
+
+struct cache_item {
+	uint64_t font;
+	uint32_t codepoint;
+	uint16_t size;
+	const uint8_t *bitmap;
+};
+
+static inline uint16_t
+read_u16(const uint8_t *p) {
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+uint64_t
+font_cache_hash(const uint8_t *fontdata, int fontstart) {
+	// FNV-1a of the table directory
+	const uint8_t *dir = fontdata + fontstart;
+	const size_t n = 12 + read_u16(dir + 4) * 16;
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i;
+	for (i=0;i<n;i++) {
+		h ^= dir[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+static inline int
+compare_key(uint64_t font_a, uint32_t cp_a, uint64_t font_b, uint32_t cp_b) {
+	if (font_a != font_b)
+		return font_a < font_b ? -1 : 1;
+	if (cp_a != cp_b)
+		return cp_a < cp_b ? -1 : 1;
+	return 0;
+}
+
+// the glyphs may be unaligned in the mapped file(the slice of an archive)
+static inline void
+file_glyph(const struct font_cache_file *f, uint32_t i, struct cache_glyph *g) {
+	memcpy(g, f->data + sizeof(struct cache_header) + i * sizeof(struct cache_glyph), sizeof(*g));
+}
+
+int
+font_cache_map(struct font_cache *C, const void *data, size_t size, void *ud, uint32_t params) {
+	if (C->files >= FONT_CACHE_FILES || size < sizeof(struct cache_header))
+		return 0;
+	struct cache_header header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.params != params)
+		return 0;
+	if ((size - sizeof(header)) / sizeof(struct cache_glyph) < header.count)
+		return 0;
+	struct font_cache_file *f = &C->file[C->files++];
+	f->data = (const uint8_t *)data;
+	f->size = size;
+	f->count = header.count;
+	f->ud = ud;
+	return 1;
+}
+
+static const uint8_t *
+file_find(const struct font_cache_file *f, uint64_t font, uint32_t codepoint, int size) {
+	uint32_t begin = 0;
+	uint32_t end = f->count;
+	while (begin < end) {
+		const uint32_t mid = (begin + end) / 2;
+		struct cache_glyph g;
+		file_glyph(f, mid, &g);
+		const int c = compare_key(font, codepoint, g.font, g.codepoint);
+		if (c == 0) {
+			if (g.size != size || g.offset > f->size || (size_t)size * size > f->size - g.offset)
+				return NULL;
+			return f->data + g.offset;
+		}
+		if (c < 0)
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+	return NULL;
+}
+
+// the position of the learned glyph, or the position to insert (-position-1)
+static int
+learned_find(const struct font_cache *C, uint64_t font, uint32_t codepoint) {
+	int begin = 0;
+	int end = C->learned_n;
+	while (begin < end) {
+		const int mid = (begin + end) / 2;
+		const struct font_cache_learned *g = &C->learned[mid];
+		const int c = compare_key(font, codepoint, g->font, g->codepoint);
+		if (c == 0)
+			return mid;
+		if (c < 0)
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+	return -begin - 1;
+}
+
+const uint8_t *
+font_cache_find(struct font_cache *C, uint64_t font, uint32_t codepoint, int size) {
+	int i;
+	for (i=0;i<C->files;i++) {
+		const uint8_t *bitmap = file_find(&C->file[i], font, codepoint, size);
+		if (bitmap)
+			return bitmap;
+	}
+	const int pos = learned_find(C, font, codepoint);
+	if (pos >= 0 && C->learned[pos].size == size)
+		return C->learned[pos].bitmap;
+	return NULL;
+}
+
+int
+font_cache_add(struct font_cache *C, uint64_t font, uint32_t codepoint, int size, uint8_t *bitmap) {
+	if (C->learned_n >= FONT_CACHE_LEARN)
+		return 0;
+	int pos = learned_find(C, font, codepoint);
+	if (pos >= 0)
+		return 0;
+	pos = -pos - 1;
+	if (C->learned_n >= C->learned_cap) {
+		const int cap = C->learned_cap == 0 ? 256 : C->learned_cap * 2;
+		struct font_cache_learned *learned = (struct font_cache_learned *)realloc(C->learned, cap * sizeof(*learned));
+		if (learned == NULL)
+			return 0;
+		C->learned = learned;
+		C->learned_cap = cap;
+	}
+	memmove(&C->learned[pos+1], &C->learned[pos], (C->learned_n - pos) * sizeof(C->learned[0]));
+	struct font_cache_learned *g = &C->learned[pos];
+	g->font = font;
+	g->codepoint = codepoint;
+	g->size = (uint16_t)size;
+	g->bitmap = bitmap;
+	++C->learned_n;
+	return 1;
+}
+
+static int
+compare_item(const void *a, const void *b) {
+	const struct cache_item *ia = (const struct cache_item *)a;
+	const struct cache_item *ib = (const struct cache_item *)b;
+	return compare_key(ia->font, ia->codepoint, ib->font, ib->codepoint);
+}
+
+void *
+font_cache_save(struct font_cache *C, uint32_t params, size_t *size) {
+	if (C->learned_n == 0)
+		return NULL;
+	size_t n = C->learned_n;
+	int i;
+	for (i=0;i<C->files;i++) {
+		n += C->file[i].count;
+	}
+	struct cache_item *items = (struct cache_item *)malloc(n * sizeof(*items));
+	if (items == NULL)
+		return NULL;
+	// the learned glyphs first, they are kept when the file is full
+	n = 0;
+	for (i=0;i<C->learned_n;i++) {
+		const struct font_cache_learned *g = &C->learned[i];
+		struct cache_item *item = &items[n++];
+		item->font = g->font;
+		item->codepoint = g->codepoint;
+		item->size = g->size;
+		item->bitmap = g->bitmap;
+	}
+	for (i=0;i<C->files;i++) {
+		const struct font_cache_file *f = &C->file[i];
+		uint32_t j;
+		for (j=0;j<f->count;j++) {
+			struct cache_glyph g;
+			file_glyph(f, j, &g);
+			if (g.offset > f->size || (size_t)g.size * g.size > f->size - g.offset)
+				continue;
+			struct cache_item *item = &items[n++];
+			item->font = g.font;
+			item->codepoint = g.codepoint;
+			item->size = g.size;
+			item->bitmap = f->data + g.offset;
+		}
+	}
+	if (n > FONT_CACHE_MAX)
+		n = FONT_CACHE_MAX;
+	// the same glyph in different files is the same sdf, keep any of them
+	size_t count = 0;
+	size_t j;
+	qsort(items, n, sizeof(*items), compare_item);
+	size_t bytes = sizeof(struct cache_header);
+	for (j=0;j<n;j++) {
+		if (count > 0 && compare_item(&items[count-1], &items[j]) == 0)
+			continue;
+		items[count++] = items[j];
+		bytes += sizeof(struct cache_glyph) + (size_t)items[j].size * items[j].size;
+	}
+	if (bytes > UINT32_MAX) {
+		free(items);
+		return NULL;
+	}
+	uint8_t *data = (uint8_t *)malloc(bytes);
+	if (data == NULL) {
+		free(items);
+		return NULL;
+	}
+	struct cache_header header;
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.params = params;
+	header.count = (uint32_t)count;
+	memcpy(data, &header, sizeof(header));
+	uint8_t *glyphs = data + sizeof(header);
+	size_t offset = sizeof(header) + count * sizeof(struct cache_glyph);
+	for (j=0;j<count;j++) {
+		const struct cache_item *item = &items[j];
+		struct cache_glyph g;
+		memset(&g, 0, sizeof(g));
+		g.font = item->font;
+		g.codepoint = item->codepoint;
+		g.offset = (uint32_t)offset;
+		g.size = item->size;
+		memcpy(glyphs + j * sizeof(g), &g, sizeof(g));
+		const size_t sz = (size_t)item->size * item->size;
+		memcpy(data + offset, item->bitmap, sz);
+		offset += sz;
+	}
+	free(items);
+	*size = bytes;
+	return data;
+}
+
+void
+font_cache_release(struct font_cache *C, void (*unmap)(void *ud)) {
+	int i;
+	for (i=0;i<C->files;i++) {
+		if (unmap)
+			unmap(C->file[i].ud);
+	}
+	for (i=0;i<C->learned_n;i++) {
+		free(C->learned[i].bitmap);
+	}
+	free(C->learned);
+	memset(C, 0, sizeof(*C));
+}
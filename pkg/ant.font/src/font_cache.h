@@ -0,0 +1,58 @@
+#ifndef font_cache_h
+#define font_cache_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FONT_CACHE_FILES 4
+#define FONT_CACHE_LEARN 4096	// the glyphs rasterized in this run, at most
+#define FONT_CACHE_MAX 16384	// the glyphs in the saved file, at most
+
+/*
+	The sdf of the glyphs are persistent in the cache files, they are memory mapped and the glyph is
+	searched by [font hash, codepoint] before rasterizing. The font hash is the hash of the table
+	directory(with the checksums of all tables), so the file is valid for the same font in any path.
+
+	The file is :
+		header (magic, version, sdf parameters, count)
+		glyphs[count], sorted by [font, codepoint]
+		sdf of the glyphs, size * size for each
+
+	The glyphs rasterized in this run are learned, the files and the learned glyphs are merged into a
+	new file by font_cache_save.
+*/
+
+struct font_cache_learned {
+	uint64_t font;
+	uint32_t codepoint;
+	uint16_t size;
+	uint8_t *bitmap;
+};
+
+struct font_cache_file {
+	const uint8_t *data;
+	size_t size;
+	uint32_t count;
+	void *ud;
+};
+
+struct font_cache {
+	int files;
+	int learned_n;
+	int learned_cap;
+	struct font_cache_file file[FONT_CACHE_FILES];
+	struct font_cache_learned *learned;	// sorted by [font, codepoint]
+};
+
+uint64_t font_cache_hash(const uint8_t *fontdata, int fontstart);
+// 0 if the file is invalid or the version doesn't match, the data is kept until font_cache_release
+int font_cache_map(struct font_cache *C, const void *data, size_t size, void *ud, uint32_t params);
+// the sdf of the cell, NULL if it's not cached
+const uint8_t * font_cache_find(struct font_cache *C, uint64_t font, uint32_t codepoint, int size);
+// take the bitmap(malloc) if it returns 1
+int font_cache_add(struct font_cache *C, uint64_t font, uint32_t codepoint, int size, uint8_t *bitmap);
+// the file with all the glyphs(malloc), NULL if nothing is learned
+void * font_cache_save(struct font_cache *C, uint32_t params, size_t *size);
+void font_cache_release(struct font_cache *C, void (*unmap)(void *ud));
+
+#endif //font_cache_h
@@ -2,6 +2,7 @@
 
 #define FONT_MANAGER_TEXSIZE 2048
 #define FONT_MANAGER_GLYPHSIZE 48
+#define FONT_MANAGER_PAGES 4
 #define FONT_POSTION_FIX_POINT  8
 
 #define MAX_FONT_NUM 64
@@ -16,6 +17,7 @@ struct font_glyph {
 	uint16_t h;
 	uint16_t u;
 	uint16_t v;
+	uint16_t page;	// the layer of the font texture
 };
 
 #define IMAGE_FONT_MASK 0x40    //7 bit
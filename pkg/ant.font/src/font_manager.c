@@ -13,8 +13,25 @@
 #include <stb/stb_truetype.h>
 
 /*
-	F->priority is a circular linked list for the LRU cache.
-	F->hash is for lookup with [font, codepoint].
+	The glyphs are cached in the layers(pages) of the font texture. A glyph takes a square cell of the
+	smallest bucket it fits in, the cells of a bucket are allocated row by row in the pages, and the
+	cell not used in this frame and the last frame is evicted by the clock of the bucket when there is
+	no space. The kept text geometries don't look up the glyphs, the renderer touches their cells with
+	font_manager_touch when they are drawn or replayed. The last frame is kept too, the new text may be
+	generated before the old one is drawn in the frame.
+
+	The sdf of a missing glyph is rasterized by the workers, it's a blank placeholder with the right
+	metrics until font_manager_flush uploads it. F->glyph_version is changed when the glyphs are ready,
+	the geometries with placeholders should be generated again. F->evict_version is changed when a cell
+	is evicted, and F->slot_evict keeps it for the cell, so a geometry generated before can find out
+	whether its cells are evicted. The glyph without a cell in this frame(GLYPH_BUSY) changes nothing,
+	the one who gets it tries again in the next frame.
+
+	The lookup of the cached glyphs is lock free : F->hash is for lookup with [font, codepoint], and the
+	slot is read with the seqlock F->slot_seq. F->mutex is taken only when the glyph is missing.
+
+	The missing glyph is searched in F->cache(the mapped sdf cache files and the glyphs rasterized
+	before) first, it's uploaded in the next flush without rasterizing if it's cached.
 */
 
 #define COLLISION_STEP 7
@@ -22,6 +39,8 @@
 #define ORIGINAL_SIZE (FONT_MANAGER_GLYPHSIZE - DISTANCE_OFFSET * 2)
 #define ONEDGE_VALUE	180
 #define PIXEL_DIST_SCALE (ONEDGE_VALUE/(float)(DISTANCE_OFFSET))
+// the cache file is invalid when the parameters are changed
+#define CACHE_PARAMS ((ORIGINAL_SIZE << 16) | (DISTANCE_OFFSET << 8) | ONEDGE_VALUE)
 
 static const int SAPCE_CODEPOINT[] = {
     ' ', '\t', '\n', '\r',
@@ -74,18 +93,56 @@ ttf_with_family(struct font_manager *F, const char* family){
 	#endif //TEST_CASE
 }
 
-static inline int
-hash(int value) {
+static const uint16_t BUCKET_SIZE[FONT_MANAGER_BUCKETS] = {
+	24, 32, 40, FONT_MANAGER_GLYPHSIZE,
+};
+
+#define SLOT_EMPTY 0xffffffffu
+#define HASH_EMPTY (-1)
+#define HASH_REMOVED (-2)
+
+static inline uint32_t
+hash(uint32_t value) {
 	return (value * 0xdeece66d + 0xb) % FONT_MANAGER_HASHSLOTS;
 }
 
+// copy the slot without lock, 0 if the slot is changing or it's not the key
 static int
-hash_lookup(struct font_manager *F, int cp) {
-	int slot;
-	int position = hash(cp);
-	while ((slot = F->hash[position]) >= 0) {
-		struct font_slot * s = &F->slots[slot];
-		if (s->codepoint_key == cp)
+slot_read(struct font_manager *F, int slot, uint32_t key, struct font_slot *s) {
+	const int32_t seq = atom_load(&F->slot_seq[slot]);
+	if (seq & 1)
+		return 0;
+	*s = F->slots[slot];
+	atom_acquire_fence();
+	if (atom_load(&F->slot_seq[slot]) != seq)
+		return 0;
+	return s->codepoint_key == key;
+}
+
+static inline void
+slot_write(struct font_manager *F, int slot, const struct font_slot *s) {
+	atom_inc(&F->slot_seq[slot]);
+	F->slots[slot] = *s;
+	atom_inc(&F->slot_seq[slot]);
+}
+
+static inline void
+slot_touch(struct font_manager *F, int slot) {
+	const int32_t version = atom_load(&F->version);
+	if (atom_load(&F->slot_version[slot]) != version)
+		atom_store(&F->slot_version[slot], version);
+}
+
+// it may miss while the writer is changing the hash, look up again with the lock
+static int
+hash_lookup(struct font_manager *F, uint32_t key, struct font_slot *s) {
+	uint32_t position = hash(key);
+	int i;
+	for (i=0;i<FONT_MANAGER_HASHSLOTS;i++) {
+		const int32_t slot = atom_load(&F->hash[position]);
+		if (slot == HASH_EMPTY)
+			return -1;
+		if (slot >= 0 && slot_read(F, slot, key, s))
 			return slot;
 		position = (position + COLLISION_STEP) % FONT_MANAGER_HASHSLOTS;
 	}
@@ -95,99 +152,137 @@ hash_lookup(struct font_manager *F, int cp) {
 static void rehash(struct font_manager *F);
 
 static void
-hash_insert(struct font_manager *F, int cp, int slotid) {
-	++F->count;
-	if (F->count > FONT_MANAGER_SLOTS + FONT_MANAGER_SLOTS/2) {
+hash_insert(struct font_manager *F, uint32_t key, int slotid) {
+	if (F->hash_count >= FONT_MANAGER_HASHSLOTS - FONT_MANAGER_HASHSLOTS / 4) {
 		rehash(F);
 	}
-	int position = hash(cp);
-	int slot;
+	uint32_t position = hash(key);
+	int32_t slot;
 	while ((slot = F->hash[position]) >= 0) {
-		struct font_slot * s = &F->slots[slot];
-		if (s->codepoint_key < 0)
-			break;
-		assert(s->codepoint_key != cp);
+		position = (position + COLLISION_STEP) % FONT_MANAGER_HASHSLOTS;
+	}
+	if (slot == HASH_EMPTY)
+		++F->hash_count;
+	atom_store(&F->hash[position], slotid);
+}
 
+static void
+hash_remove(struct font_manager *F, uint32_t key, int slotid) {
+	uint32_t position = hash(key);
+	int32_t slot;
+	while ((slot = F->hash[position]) != HASH_EMPTY) {
+		if (slot == slotid) {
+			atom_store(&F->hash[position], HASH_REMOVED);
+			return;
+		}
 		position = (position + COLLISION_STEP) % FONT_MANAGER_HASHSLOTS;
 	}
-	F->hash[position] = slotid;
-	F->slots[slotid].codepoint_key = cp;
 }
 
+// drop the removed positions
 static void
 rehash(struct font_manager *F) {
 	int i;
 	for (i=0;i<FONT_MANAGER_HASHSLOTS;i++) {
-		F->hash[i] = -1;	// reset slots
-	}
-	F->count = 0;
-	int count = 0;
-	(void)count;
-	for (i=0;i<FONT_MANAGER_SLOTS;i++) {
-		int cp = F->slots[i].codepoint_key;
-		if (cp >= 0) {
-			assert(++count <= FONT_MANAGER_SLOTS);
-			hash_insert(F, cp, i);
+		atom_store(&F->hash[i], HASH_EMPTY);
+	}
+	F->hash_count = 0;
+	for (i=0;i<F->slot_count;i++) {
+		const uint32_t key = F->slots[i].codepoint_key;
+		if (key != SLOT_EMPTY) {
+			hash_insert(F, key, i);
 		}
 	}
 }
 
-static void
-remove_node(struct font_manager *F, struct priority_list *node) {
-	struct priority_list *prev_node = &F->priority[node->prev];
-	struct priority_list *next_node = &F->priority[node->next];
-	prev_node->next = node->next;
-	next_node->prev = node->prev;
+static int
+bucket_index(int w, int h) {
+	const int size = w > h ? w : h;
+	int i;
+	for (i=0;i<FONT_MANAGER_BUCKETS-1;i++) {
+		if (size <= BUCKET_SIZE[i])
+			return i;
+	}
+	return FONT_MANAGER_BUCKETS-1;
 }
 
-static void
-touch_slot(struct font_manager *F, int slotid) {
-	struct priority_list *node = &F->priority[slotid];
-	node->version = F->version;
-	if (slotid == F->list_head)
-		return;
-	remove_node(F, node);
-	// insert before head
-	int head = F->list_head;
-	int tail = F->priority[head].prev;
-	node->prev = tail;
-	node->next = head;
-	struct priority_list *head_node = &F->priority[head];
-	struct priority_list *tail_node = &F->priority[tail];
-	head_node->prev = slotid;
-	tail_node->next = slotid;
-	F->list_head = slotid;
-}
-
-// 1 exist in cache. 0 not exist in cache , call font_manager_update. -1 failed.
-int
-font_manager_touch_unsafe(struct font_manager *F, int font, int codepoint, struct font_glyph *glyph) {
-	int cp = codepoint_key(font, codepoint);
-	int slot = hash_lookup(F, cp);
-	if (slot >= 0) {
-		touch_slot(F, slot);
-		struct font_slot *s = &F->slots[slot];
-		glyph->offset_x = s->offset_x;
-		glyph->offset_y = s->offset_y;
-		glyph->advance_x = s->advance_x;
-		glyph->advance_y = s->advance_y;
-		glyph->w = s->w;
-		glyph->h = s->h;
-		glyph->u = (slot % FONT_MANAGER_SLOTLINE) * FONT_MANAGER_GLYPHSIZE;
-		glyph->v = (slot / FONT_MANAGER_SLOTLINE) * FONT_MANAGER_GLYPHSIZE;
-
-		return 1;
-	}
-	int last_slot = F->priority[F->list_head].prev;
-	struct priority_list *last_node = &F->priority[last_slot];
-	if (font_index(font) <= 0) {
-		// invalid font
-		memset(glyph, 0, sizeof(*glyph));
-		return -1;
+// a new row of cells for the bucket, in the first page with space
+static int
+bucket_addrow(struct font_manager *F, int bi) {
+	const int size = BUCKET_SIZE[bi];
+	const int n = FONT_MANAGER_TEXSIZE / size;
+	if (F->slot_count + n > FONT_MANAGER_SLOTS)
+		return 0;
+	int page;
+	for (page=0;page<FONT_MANAGER_PAGES;page++) {
+		if (F->page_top[page] + size <= FONT_MANAGER_TEXSIZE)
+			break;
 	}
+	if (page == FONT_MANAGER_PAGES)
+		return 0;
+	struct font_bucket *b = &F->bucket[bi];
+	const int first = F->slot_count;
+	int i;
+	for (i=0;i<n;i++) {
+		struct font_slot *s = &F->slots[first + i];
+		s->codepoint_key = SLOT_EMPTY;
+		s->u = (uint16_t)(i * size);
+		s->v = F->page_top[page];
+		s->page = (uint8_t)page;
+		s->bucket = (uint8_t)bi;
+		s->ready = 0;
+		s->next = first + i + 1;
+	}
+	// insert the row into the circle after the hand
+	if (b->hand < 0) {
+		F->slots[first + n - 1].next = first;
+		b->hand = first;
+	} else {
+		F->slots[first + n - 1].next = F->slots[b->hand].next;
+		F->slots[b->hand].next = first;
+	}
+	b->fresh = first;
+	b->fresh_end = first + n;
+	b->count += n;
+	F->slot_count += n;
+	F->page_row[page][F->page_top[page]] = (int16_t)first;
+	F->page_top[page] += size;
+	return 1;
+}
 
-	const struct stbtt_fontinfo *fi = get_ttf_unsafe(F, font);
+static int
+bucket_evict(struct font_manager *F, int bi) {
+	struct font_bucket *b = &F->bucket[bi];
+	const int32_t version = F->version;
+	int slot = b->hand;
+	int i;
+	for (i=0;i<b->count;i++) {
+		const struct font_slot *s = &F->slots[slot];
+		const int next = s->next;
+		if (s->ready && s->codepoint_key != SLOT_EMPTY && version - F->slot_version[slot] > 1) {
+			b->hand = next;
+			hash_remove(F, s->codepoint_key, slot);
+			const int32_t evict = F->evict_version + 1;
+			atom_store(&F->slot_evict[slot], evict);
+			atom_store(&F->evict_version, evict);
+			return slot;
+		}
+		slot = next;
+	}
+	return -1;
+}
 
+static int
+bucket_alloc(struct font_manager *F, int bi) {
+	struct font_bucket *b = &F->bucket[bi];
+	if (b->fresh < b->fresh_end || bucket_addrow(F, bi))
+		return b->fresh++;
+	return bucket_evict(F, bi);
+}
+
+// the metrics in ORIGINAL_SIZE, 0 if the glyph is blank
+static int
+glyph_metrics(const stbtt_fontinfo *fi, int codepoint, struct font_slot *s) {
 	float scale = stbtt_ScaleForMappingEmToPixels(fi, ORIGINAL_SIZE);
 	int ascent, descent, lineGap;
 	int advance, lsb;
@@ -199,27 +294,196 @@ font_manager_touch_unsafe(struct font_manager *F, int font, int codepoint, struc
 	stbtt_GetCodepointHMetrics(fi, codepoint, &advance, &lsb);
 	stbtt_GetCodepointBitmapBox(fi, codepoint, scale, scale, &ix0, &iy0, &ix1, &iy1);
 
-	glyph->w = ix1-ix0 + DISTANCE_OFFSET * 2;
-	glyph->h = iy1-iy0 + DISTANCE_OFFSET * 2;
-	glyph->offset_x = (short)(lsb * scale) - DISTANCE_OFFSET;
-	glyph->offset_y = iy0 - DISTANCE_OFFSET;
-	glyph->advance_x = (short)(((float)advance) * scale + 0.5f);
-	glyph->advance_y = (short)((ascent - descent) * scale + 0.5f);
-	glyph->u = 0;
-	glyph->v = 0;
+	const int w = ix1-ix0 + DISTANCE_OFFSET * 2;
+	const int h = iy1-iy0 + DISTANCE_OFFSET * 2;
+	s->w = w < FONT_MANAGER_GLYPHSIZE ? w : FONT_MANAGER_GLYPHSIZE;
+	s->h = h < FONT_MANAGER_GLYPHSIZE ? h : FONT_MANAGER_GLYPHSIZE;
+	s->offset_x = (short)(lsb * scale) - DISTANCE_OFFSET;
+	s->offset_y = iy0 - DISTANCE_OFFSET;
+	s->advance_x = (short)(((float)advance) * scale + 0.5f);
+	s->advance_y = (short)((ascent - descent) * scale + 0.5f);
+	return ix1 > ix0 && iy1 > iy0;
+}
 
-	if (last_node->version == F->version)	// full ?
-		return -1;
+static void
+glyph_rasterize(struct font_job *job) {
+	const int size = job->size;
+	uint8_t *bitmap = (uint8_t *)calloc(size * size, 1);
+	float scale = stbtt_ScaleForMappingEmToPixels(job->fi, ORIGINAL_SIZE);
+	int width, height, xoff, yoff;
+	unsigned char *sdf = stbtt_GetCodepointSDF(job->fi, scale, job->codepoint, DISTANCE_OFFSET, ONEDGE_VALUE, PIXEL_DIST_SCALE, &width, &height, &xoff, &yoff);
+	if (sdf) {
+		const int w = width < size ? width : size;
+		const int h = height < size ? height : size;
+		int y;
+		for (y=0;y<h;y++) {
+			memcpy(bitmap + y * size, sdf + y * width, w);
+		}
+		stbtt_FreeSDF(sdf, job->fi->userdata);
+	}
+	job->bitmap = bitmap;
+}
 
-	return 0;
+static void
+worker_main(void *ud) {
+	struct font_manager *F = (struct font_manager *)ud;
+	struct font_worker *W = &F->worker;
+	mutex_acquire(W->mutex);
+	for (;;) {
+		while (W->request_head == W->request_tail && !W->quit) {
+			cond_wait(W->cond, W->mutex);
+		}
+		if (W->quit)
+			break;
+		const int slot = W->request[W->request_head++ % FONT_MANAGER_QUEUE];
+		mutex_release(W->mutex);
+		glyph_rasterize(&F->jobs[slot]);
+		mutex_acquire(W->mutex);
+		W->done[W->done_tail++ % FONT_MANAGER_QUEUE] = slot;
+	}
+	mutex_release(W->mutex);
 }
 
-int
-font_manager_touch(struct font_manager *F, int font, int codepoint, struct font_glyph *glyph) {
-	lock(F);
-	int r = font_manager_touch_unsafe(F, font, codepoint, glyph);
-	unlock(F);
-	return r;
+static void
+worker_done(struct font_manager *F, int slot) {
+	struct font_worker *W = &F->worker;
+	mutex_acquire(W->mutex);
+	W->done[W->done_tail++ % FONT_MANAGER_QUEUE] = slot;
+	mutex_release(W->mutex);
+}
+
+static void
+worker_push(struct font_manager *F, int slot) {
+	struct font_worker *W = &F->worker;
+	if (W->thread[0] == NULL) {
+		// no worker, rasterize it now
+		glyph_rasterize(&F->jobs[slot]);
+		worker_done(F, slot);
+		return;
+	}
+	mutex_acquire(W->mutex);
+	W->request[W->request_tail++ % FONT_MANAGER_QUEUE] = slot;
+	mutex_release(W->mutex);
+	cond_signal(W->cond);
+}
+
+static void
+worker_start(struct font_manager *F) {
+	struct font_worker *W = &F->worker;
+	W->mutex = mutex_create();
+	W->cond = cond_create();
+	W->quit = 0;
+	int i;
+	for (i=0;i<FONT_MANAGER_WORKERS;i++) {
+		W->thread[i] = thread_create(worker_main, F);
+	}
+}
+
+static void
+worker_stop(struct font_manager *F) {
+	struct font_worker *W = &F->worker;
+	if (W->mutex == NULL)
+		return;
+	mutex_acquire(W->mutex);
+	W->quit = 1;
+	mutex_release(W->mutex);
+	cond_broadcast(W->cond);
+	int i;
+	for (i=0;i<FONT_MANAGER_WORKERS;i++) {
+		if (W->thread[i]) {
+			thread_join(W->thread[i]);
+			W->thread[i] = NULL;
+		}
+	}
+	for (; W->done_head != W->done_tail; ++W->done_head) {
+		struct font_job *job = &F->jobs[W->done[W->done_head % FONT_MANAGER_QUEUE]];
+		if (!job->cached)
+			free(job->bitmap);
+		job->bitmap = NULL;
+	}
+	cond_destroy(W->cond);
+	free(W->cond);
+	mutex_destroy(W->mutex);
+	free(W->mutex);
+	W->cond = NULL;
+	W->mutex = NULL;
+}
+
+#define GLYPH_FAILED (-1)
+#define GLYPH_BUSY (-2)
+
+// the slot of the glyph, the glyph is rasterizing if it's not ready. s has the metrics for GLYPH_BUSY
+static int
+glyph_request(struct font_manager *F, int font, int codepoint, struct font_slot *s) {
+	const uint32_t key = codepoint_key(font, codepoint);
+	int slot = hash_lookup(F, key, s);
+	if (slot >= 0)
+		return slot;
+	const stbtt_fontinfo *fi = get_ttf_unsafe(F, font);
+	if (fi == NULL)
+		return GLYPH_FAILED;
+	if (!glyph_metrics(fi, codepoint, s) || is_space_codepoint(codepoint)) {
+		// only the metrics, it has no cell
+		if (F->slot_count >= FONT_MANAGER_SLOTS)
+			return GLYPH_BUSY;
+		slot = F->slot_count++;
+		s->w = s->h = 0;
+		s->u = s->v = 0;
+		s->page = 0;
+		s->bucket = FONT_MANAGER_BUCKETS;
+		s->ready = 1;
+		s->next = -1;
+	} else {
+		if (F->pending >= FONT_MANAGER_QUEUE)
+			return GLYPH_BUSY;
+		slot = bucket_alloc(F, bucket_index(s->w, s->h));
+		if (slot < 0) {
+			// all the cells are used in this frame, try again in the next frame
+			return GLYPH_BUSY;
+		}
+		const struct font_slot *cell = &F->slots[slot];
+		s->u = cell->u;
+		s->v = cell->v;
+		s->page = cell->page;
+		s->bucket = cell->bucket;
+		s->ready = 0;
+		s->next = cell->next;
+	}
+	s->codepoint_key = key;
+	slot_write(F, slot, s);
+	hash_insert(F, key, slot);
+	if (!s->ready) {
+		struct font_job *job = &F->jobs[slot];
+		job->fi = fi;
+		job->font = font_cache_hash(fi->data, fi->fontstart);
+		job->codepoint = codepoint;
+		job->size = BUCKET_SIZE[s->bucket];
+		job->bitmap = (uint8_t *)font_cache_find(&F->cache, job->font, codepoint, job->size);
+		job->cached = job->bitmap != NULL;
+		++F->pending;
+		if (job->cached)
+			worker_done(F, slot);
+		else
+			worker_push(F, slot);
+	}
+	return slot;
+}
+
+static void
+glyph_upload(struct font_manager *F, int slot) {
+	struct font_job *job = &F->jobs[slot];
+	struct font_slot s = F->slots[slot];
+	// upload the whole cell, clear the last glyph in it
+	bgfx_texture_handle_t th = { F->texture };
+	const bgfx_memory_t* m = BGFX(copy)(job->bitmap, job->size * job->size);
+	BGFX(update_texture_2d)(th, s.page, 0, s.u, s.v, job->size, job->size, m, job->size);
+	// the rasterized one is kept in the cache for the next time
+	if (!job->cached && !font_cache_add(&F->cache, job->font, job->codepoint, job->size, job->bitmap))
+		free(job->bitmap);
+	job->bitmap = NULL;
+	s.ready = 1;
+	slot_write(F, slot, &s);
+	--F->pending;
 }
 
 static inline int
@@ -295,98 +559,107 @@ font_manager_scale(struct font_manager *F, struct font_glyph *glyph, int size) {
 	uscale(&glyph->h, size);
 }
 
-static void
-release_char_memory(void *d, void *u){
-	free(d);
-}
-
-const char *
+int
 font_manager_glyph(struct font_manager *F, int fontid, int codepoint, int size, struct font_glyph *g, struct font_glyph *og) {
-	int updated = font_manager_touch(F, fontid, codepoint, g);
-	*og = *g;
-	if (is_space_codepoint(codepoint)){
-		updated = 1;	// not need update
+	struct font_slot s;
+	int slot = hash_lookup(F, codepoint_key(fontid, codepoint), &s);
+	if (slot < 0) {
+		if (font_index(fontid) <= 0) {
+			// invalid font
+			memset(g, 0, sizeof(*g));
+			memset(og, 0, sizeof(*og));
+			return -1;
+		}
+		lock(F);
+		slot = glyph_request(F, fontid, codepoint, &s);
+		unlock(F);
+		if (slot == GLYPH_FAILED) {
+			memset(g, 0, sizeof(*g));
+			memset(og, 0, sizeof(*og));
+			return -1;
+		}
+	}
+	if (slot >= 0) {
+		slot_touch(F, slot);
+	}
+	const int ready = slot == GLYPH_BUSY ? GLYPH_BUSY : (slot >= 0 && s.ready);
+	og->offset_x = s.offset_x;
+	og->offset_y = s.offset_y;
+	og->advance_x = s.advance_x;
+	og->advance_y = s.advance_y;
+	if (ready > 0) {
+		og->w = s.w;
+		og->h = s.h;
+		og->u = s.u;
+		og->v = s.v;
+		og->page = s.page;
+	} else {
+		// the placeholder is blank
 		og->w = og->h = 0;
+		og->u = og->v = 0;
+		og->page = 0;
 	}
+	*g = *og;
 	font_manager_scale(F, g, size);
-	if (updated == 0) {
-		uint8_t *mem = malloc(og->w * og->h);
-		const char * err = font_manager_update(F, fontid, codepoint, og, mem);
-		if (err) {
-			return err;
-		}
-		bgfx_texture_handle_t th = { F->texture };
-		const bgfx_memory_t* m = BGFX(make_ref_release)(mem, og->w * og->h, release_char_memory, NULL);
-		BGFX(update_texture_2d)(th, 0, 0, og->u, og->v, og->w, og->h, m, og->w);
-	}
-	return NULL;
+	return ready;
 }
 
-static const char *
-font_manager_update_unsafe(struct font_manager *F, int fontid, int codepoint, struct font_glyph *glyph, uint8_t *buffer) {
-	if (fontid <= 0)
-		return "Invalid font";
-	int cp = codepoint_key(fontid, codepoint);
-	int slot = hash_lookup(F, cp);
-	if (slot < 0) {
-		// move last node to head
-		slot = F->priority[F->list_head].prev;
-		struct priority_list *last_node = &F->priority[slot];
-		if (last_node->version == F->version) {	// full ?
-			return "Too many glyph";
+void
+font_manager_flush(struct font_manager *F) {
+	struct font_worker *W = &F->worker;
+	lock(F);
+	int changed = 0;
+	if (W->mutex) {
+		mutex_acquire(W->mutex);
+		const uint32_t tail = W->done_tail;
+		mutex_release(W->mutex);
+		for (; W->done_head != tail; ++W->done_head) {
+			glyph_upload(F, W->done[W->done_head % FONT_MANAGER_QUEUE]);
+			changed = 1;
 		}
-		last_node->version = F->version;
-		F->list_head = slot;
-		F->slots[slot].codepoint_key = -1;
-		hash_insert(F, cp, slot);
 	}
-
-	const struct stbtt_fontinfo *fi = get_ttf_unsafe(F, fontid);
-	float scale = stbtt_ScaleForMappingEmToPixels(fi, ORIGINAL_SIZE);
-
-	int width, height, xoff, yoff;
-
-	unsigned char *tmp = stbtt_GetCodepointSDF(fi, scale, codepoint, DISTANCE_OFFSET, ONEDGE_VALUE, PIXEL_DIST_SCALE, &width, &height, &xoff, &yoff);
-	if (tmp == NULL){
-		return NULL;
-	}
-	int size = width * height;
-	int gsize = glyph->w * glyph->h; 
-	if (size > gsize) {
-		size = gsize;
+	atom_store(&F->version, F->version + 1);
+	if (changed) {
+		atom_store(&F->glyph_version, F->glyph_version + 1);
 	}
-	memcpy(buffer, tmp, size);
+	unlock(F);
+}
 
-	stbtt_FreeSDF(tmp, fi->userdata);
+// the slot of the cell at (u, v) of the page, -1 if it's not a cell
+static int
+cell_slot(struct font_manager *F, int page, int u, int v) {
+	if (page < 0 || page >= FONT_MANAGER_PAGES || u < 0 || v < 0 || v >= FONT_MANAGER_TEXSIZE)
+		return -1;
+	const int first = F->page_row[page][v];
+	if (first < 0)
+		return -1;
+	const int size = BUCKET_SIZE[F->slots[first].bucket];
+	if (u % size != 0 || u / size >= FONT_MANAGER_TEXSIZE / size)
+		return -1;
+	return first + u / size;
+}
 
-	struct font_slot *s = &F->slots[slot];
-	s->codepoint_key = cp;
-	s->offset_x = glyph->offset_x;
-	s->offset_y = glyph->offset_y;
-	s->advance_x = glyph->advance_x;
-	s->advance_y = glyph->advance_y;
-	s->w = glyph->w;
-	s->h = glyph->h;
+void
+font_manager_touch(struct font_manager *F, int page, int u, int v) {
+	const int slot = cell_slot(F, page, u, v);
+	if (slot >= 0)
+		slot_touch(F, slot);
+}
 
-	glyph->u = (slot % FONT_MANAGER_SLOTLINE) * FONT_MANAGER_GLYPHSIZE;
-	glyph->v = (slot / FONT_MANAGER_SLOTLINE) * FONT_MANAGER_GLYPHSIZE;
-	return NULL;
+int
+font_manager_version(struct font_manager *F) {
+	return atom_load(&F->glyph_version);
 }
 
-const char *
-font_manager_update(struct font_manager *F, int fontid, int codepoint, struct font_glyph *glyph, uint8_t *buffer) {
-	lock(F);
-	const char *r = font_manager_update_unsafe(F, fontid, codepoint, glyph, buffer);
-	unlock(F);
-	return r;
+int
+font_manager_evict_version(struct font_manager *F) {
+	return atom_load(&F->evict_version);
 }
 
-void
-font_manager_flush(struct font_manager *F) {
-	// todo : atomic inc
-	lock(F);
-	++F->version;
-	unlock(F);
+int
+font_manager_cell_evict(struct font_manager *F, int page, int u, int v) {
+	const int slot = cell_slot(F, page, u, v);
+	return slot < 0 ? 0 : atom_load(&F->slot_evict[slot]);
 }
 
 static void
@@ -429,32 +702,79 @@ font_manager_sdf_distance(struct font_manager *F, uint8_t numpixel){
 	return (numpixel * PIXEL_DIST_SCALE) / 255.f;
 }
 
+int
+font_manager_cache_map(struct font_manager *F, const void *data, size_t size, void *ud) {
+	lock(F);
+	int r = font_cache_map(&F->cache, data, size, ud, CACHE_PARAMS);
+	unlock(F);
+	return r;
+}
+
+void*
+font_manager_cache_save(struct font_manager *F, size_t *size) {
+	lock(F);
+	void *data = font_cache_save(&F->cache, CACHE_PARAMS, size);
+	unlock(F);
+	return data;
+}
+
+// call it after font_manager_release_lua, the cached bitmaps are not used by the jobs
+void
+font_manager_cache_release(struct font_manager *F, void (*unmap)(void *ud)) {
+	lock(F);
+	font_cache_release(&F->cache, unmap);
+	unlock(F);
+}
+
+int
+font_manager_bake(struct font_manager *F, int fontid, int codepoint) {
+	struct font_slot s;
+	struct font_job job;
+	lock(F);
+	const stbtt_fontinfo *fi = get_ttf_unsafe(F, fontid);
+	if (fi == NULL) {
+		unlock(F);
+		return -1;
+	}
+	if (!glyph_metrics(fi, codepoint, &s) || is_space_codepoint(codepoint)) {
+		unlock(F);
+		return 0;
+	}
+	job.fi = fi;
+	job.font = font_cache_hash(fi->data, fi->fontstart);
+	job.codepoint = codepoint;
+	job.size = BUCKET_SIZE[bucket_index(s.w, s.h)];
+	job.cached = 0;
+	job.bitmap = NULL;
+	if (font_cache_find(&F->cache, job.font, codepoint, job.size)) {
+		unlock(F);
+		return 0;
+	}
+	unlock(F);
+	// rasterize it without the lock, as the workers
+	glyph_rasterize(&job);
+	lock(F);
+	int r = font_cache_add(&F->cache, job.font, codepoint, job.size, job.bitmap);
+	unlock(F);
+	if (!r)
+		free(job.bitmap);
+	return r;
+}
+
 void
 font_manager_init(struct font_manager *F) {
-	F->mutex = mutex_create();	
+	memset(F, 0, sizeof(*F));
+	memset(F->page_row, 0xff, sizeof(F->page_row));
+	F->mutex = mutex_create();
 	F->version = 1;
-	F->count = 0;
-	F->ttf = NULL;
-	F->L = NULL;
-	F->dpi_perinch = 0;
-// init priority list
 	int i;
-	for (i=0;i<FONT_MANAGER_SLOTS;i++) {
-		F->priority[i].prev = i+1;
-		F->priority[i].next = i-1;
-	}
-	int lastslot = FONT_MANAGER_SLOTS-1;
-	F->priority[0].next = lastslot;
-	F->priority[lastslot].prev = 0;
-	F->list_head = lastslot;
-// init hash
-	for (i=0;i<FONT_MANAGER_SLOTS;i++) {
-		F->slots[i].codepoint_key = -1;
+	for (i=0;i<FONT_MANAGER_BUCKETS;i++) {
+		F->bucket[i].hand = -1;
 	}
 	for (i=0;i<FONT_MANAGER_HASHSLOTS;i++) {
-		F->hash[i] = -1;	// empty slot
+		F->hash[i] = HASH_EMPTY;
 	}
-	bgfx_texture_handle_t th = BGFX(create_texture_2d)(FONT_MANAGER_TEXSIZE, FONT_MANAGER_TEXSIZE, false, 1, BGFX_TEXTURE_FORMAT_A8, BGFX_TEXTURE_NONE | BGFX_SAMPLER_NONE, NULL);
+	bgfx_texture_handle_t th = BGFX(create_texture_2d)(FONT_MANAGER_TEXSIZE, FONT_MANAGER_TEXSIZE, false, FONT_MANAGER_PAGES, BGFX_TEXTURE_FORMAT_A8, BGFX_TEXTURE_NONE | BGFX_SAMPLER_NONE, NULL);
 	F->texture = th.idx;
 }
 
@@ -470,20 +790,24 @@ font_manager_init_lua(struct font_manager *F, void *L) {
 	SETAPI(font_manager_fontheight);
 	SETAPI(font_manager_pixelsize);
 	SETAPI(font_manager_glyph);
-	SETAPI(font_manager_touch);
-	SETAPI(font_manager_update);
 	SETAPI(font_manager_flush);
+	SETAPI(font_manager_version);
 	SETAPI(font_manager_scale);
+	SETAPI(font_manager_touch);
+	SETAPI(font_manager_evict_version);
+	SETAPI(font_manager_cell_evict);
 	SETAPI(font_manager_underline);
 	SETAPI(font_manager_sdf_mask);
 	SETAPI(font_manager_sdf_distance);
 	#undef SETAPI
+	worker_start(F);
 	unlock(F);
 }
 
 void*
 font_manager_release_lua(struct font_manager *F) {
 	lock(F);
+	worker_stop(F);
 	void *L = F->L;
 	F->ttf = NULL;
 	F->L = NULL;
@@ -492,85 +816,3 @@ font_manager_release_lua(struct font_manager *F) {
 	unlock(F);
 	return L;
 }
-
-#ifdef TEST_CASE
-#include <stdlib.h>
-#include <stdio.h>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb/stb_image_write.h>
-static void
-add_font(void *ttfbuffer, struct truetype_font *ttf, int fontid){
-	stbtt_InitFont(&ttf->fontinfo[fontid - 1], ttfbuffer, stbtt_GetFontOffsetForIndex(ttfbuffer, 0));
-}
-
-int
-main() {
-	FILE* f = NULL;
-	fopen_s(&f, "simsun.ttc", "rb");
-	fseek(f, 0, SEEK_END);
-	int sz = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	void * ttfbuffer = malloc(sz);
-	int read = (int)fread(ttfbuffer, 1, sz, f);
-	fprintf(stderr, "read %d %d\n", sz, read);
-	fclose(f);
-
-	struct truetype_font ttf;
-
-	const int fontid = 1;
-	add_font(ttfbuffer, &ttf, fontid);
-	struct font_manager F;
-	font_manager_init(&F, &ttf, NULL);
-
-	fprintf(stderr,"load font %d\n", fontid);
-
-	int bufsize = FONT_MANAGER_GLYPHSIZE * FONT_MANAGER_GLYPHSIZE * 5;
-	uint8_t* buffer = malloc(bufsize);
-	memset(buffer, 0, bufsize);
-
-	uint8_t *p = buffer;
-	const char* s = "ABC";
-	int x = 0, y = 0;
-	for (const char* ss=s; *ss; ++ss){
-		struct font_glyph g;
-		int codepoint = *ss;	//0x6C49
-		font_manager_touch(&F, fontid, codepoint, &g);
-
-		uint8_t *p = malloc(g.w * g.h);
-		const char * err = font_manager_update(&F, fontid, codepoint, &g, p);
-		if (err != NULL) {
-			fprintf(stderr, "Error : %s\n", err);
-		} else {
-			fprintf(stderr, "x=%d y=%d (%d x %d) (%d x %d), u=%d v=%d\n",
-				g.offset_x, g.offset_y,
-				g.advance_x, g.advance_y,
-				g.w, g.h,
-				g.u, g.v);
-			
-			uint8_t *pp = buffer + x;
-			const uint8_t* p1 = p;
-			for (int ii=0; ii<g.h; ++ii){
-				memcpy(pp, p1, g.w);
-				pp += FONT_MANAGER_GLYPHSIZE * 5;
-				p1 += g.w;
-			}
-
-			x += g.w;
-		}
-	}
-	
-	stbi_write_bmp("sdf.bmp", FONT_MANAGER_GLYPHSIZE * 5, FONT_MANAGER_GLYPHSIZE, 1, buffer);
-	// printf("P2\n%d %d\n255\n", g.w, g.h);
-	// int i,j;
-	// for (i=0;i<g.h;i++) {
-	// 	for (j=0;j<g.w;j++) {
-	// 		printf("%d ", buffer[i*g.w+j]);
-	// 	}
-	// 	printf("\n");
-	// }
-
-	free(buffer);
-
-	return 0;
-}
-#endif //TEST_CASE
\ No newline at end of file
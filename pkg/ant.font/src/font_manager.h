@@ -5,10 +5,13 @@
 #include <stdint.h>
 #include "fontmutex.h"
 #include "font_define.h"
+#include "font_cache.h"
 
-#define FONT_MANAGER_SLOTLINE (FONT_MANAGER_TEXSIZE/FONT_MANAGER_GLYPHSIZE)
-#define FONT_MANAGER_SLOTS (FONT_MANAGER_SLOTLINE*FONT_MANAGER_SLOTLINE)
+#define FONT_MANAGER_SLOTS 16384
 #define FONT_MANAGER_HASHSLOTS (FONT_MANAGER_SLOTS * 2)
+#define FONT_MANAGER_BUCKETS 4
+#define FONT_MANAGER_QUEUE 1024	// glyphs rasterizing at most
+#define FONT_MANAGER_WORKERS 2
 
 // --------------
 //
@@ -49,23 +52,64 @@ struct font_slot {
 	int16_t advance_y;
 	uint16_t w;
 	uint16_t h;
+	uint16_t u;
+	uint16_t v;
+	uint8_t page;
+	uint8_t bucket;		// FONT_MANAGER_BUCKETS for the blank glyph without a cell
+	uint8_t ready;		// 0 while it's rasterizing
+	int32_t next;		// the next slot of the bucket, a circle for the clock
 };
 
-struct priority_list {
-	int version;
-	int16_t prev;
-	int16_t next;
+// the cells of a bucket are squares of the same size, they are allocated row by row in the pages
+struct font_bucket {
+	int32_t fresh;		// the cells never used in the last row, [fresh, fresh_end)
+	int32_t fresh_end;
+	int32_t hand;		// the clock hand for eviction
+	int32_t count;
+};
+
+struct font_job {
+	const stbtt_fontinfo *fi;
+	uint64_t font;		// the hash of the font, for the cache
+	int codepoint;
+	int size;			// the cell size
+	int cached;			// the bitmap is in F->cache, not owned by the job
+	uint8_t *bitmap;	// the sdf of the cell, set by the worker
+};
+
+struct font_worker {
+	struct mutex_t* mutex;
+	struct cond_t* cond;
+	struct thread_t* thread[FONT_MANAGER_WORKERS];
+	int quit;
+	uint32_t request_head;
+	uint32_t request_tail;
+	uint32_t done_head;
+	uint32_t done_tail;
+	int32_t request[FONT_MANAGER_QUEUE];
+	int32_t done[FONT_MANAGER_QUEUE];
 };
 
 struct truetype_font;
 
 struct font_manager {
-	int version;
-	int count;
-	int16_t list_head;
+	volatile int32_t version;		// the frame, for eviction
+	volatile int32_t glyph_version;	// changed when the glyphs are ready
+	volatile int32_t evict_version;	// changed when a cell is evicted
+	int32_t slot_count;
+	int32_t hash_count;
+	int32_t pending;
+	uint16_t page_top[FONT_MANAGER_PAGES];
+	int16_t page_row[FONT_MANAGER_PAGES][FONT_MANAGER_TEXSIZE];	// the first slot of the row at v, -1 for none
+	struct font_bucket bucket[FONT_MANAGER_BUCKETS];
 	struct font_slot slots[FONT_MANAGER_SLOTS];
-	struct priority_list priority[FONT_MANAGER_SLOTS];
-	int16_t hash[FONT_MANAGER_HASHSLOTS];
+	volatile int32_t slot_seq[FONT_MANAGER_SLOTS];		// odd while the slot is changing
+	volatile int32_t slot_version[FONT_MANAGER_SLOTS];	// the last frame used
+	volatile int32_t slot_evict[FONT_MANAGER_SLOTS];	// the evict_version when the cell is evicted last time
+	volatile int32_t hash[FONT_MANAGER_HASHSLOTS];
+	struct font_job jobs[FONT_MANAGER_SLOTS];
+	struct font_worker worker;
+	struct font_cache cache;
 	struct truetype_font* ttf;
 	void *L;
 	int dpi_perinch;
@@ -78,15 +122,18 @@ struct font_manager {
 
 	void (*font_manager_fontheight)(struct font_manager *F, int fontid, int size, int *ascent, int *descent, int *lineGap);
 	int  (*font_manager_pixelsize)(struct font_manager *F, int fontid, int pointsize);
-	// return 0 for need updated
-	const char* (*font_manager_glyph)(struct font_manager *F, int fontid, int codepoint, int size, struct font_glyph *g, struct font_glyph *og);
-
-	// 1 exist in cache. 0 not exist in cache, call font_manager_update. -1 failed.
-	int  (*font_manager_touch)(struct font_manager *, int font, int codepoint, struct font_glyph *glyph);
-	// buffer size should be [ glyph->w * glyph->h ] ,  NULL succ , otherwise returns error msg
-	const char* (*font_manager_update)(struct font_manager *, int font, int codepoint, struct font_glyph *glyph, uint8_t *buffer);
+	// 1 ready. 0 rasterizing, g and og are the placeholder with the metrics. -1 failed. -2 no cell in this frame, the placeholder too.
+	int  (*font_manager_glyph)(struct font_manager *F, int fontid, int codepoint, int size, struct font_glyph *g, struct font_glyph *og);
+	// upload the rasterized glyphs, call it once per frame
 	void (*font_manager_flush)(struct font_manager *);
+	// changed when the glyphs are ready, the geometries with placeholders should be generated again
+	int  (*font_manager_version)(struct font_manager *);
 	void (*font_manager_scale)(struct font_manager *F, struct font_glyph *glyph, int size);
+	// keep the glyph at (u, v) of the page in this frame, for the geometries kept without font_manager_glyph
+	void (*font_manager_touch)(struct font_manager *F, int page, int u, int v);
+	// changed when a cell is evicted, and the version of the last eviction of the cell at (u, v), 0 for never
+	int  (*font_manager_evict_version)(struct font_manager *);
+	int  (*font_manager_cell_evict)(struct font_manager *F, int page, int u, int v);
 	int (*font_manager_underline)(struct font_manager *F, int fontid, int size, float *underline_position, float *thickness);
 
 	float (*font_manager_sdf_mask)(struct font_manager *F);
@@ -102,13 +149,22 @@ uint16_t font_manager_texture(struct font_manager *F);
 int font_manager_addfont_with_family(struct font_manager *F, const char* family);
 void font_manager_fontheight(struct font_manager *F, int fontid, int size, int *ascent, int *descent, int *lineGap);
 int font_manager_pixelsize(struct font_manager *F, int fontid, int pointsize);
-const char* font_manager_glyph(struct font_manager *F, int fontid, int codepoint, int size, struct font_glyph *g, struct font_glyph *og);
-int font_manager_touch(struct font_manager *, int font, int codepoint, struct font_glyph *glyph);
-const char * font_manager_update(struct font_manager *, int font, int codepoint, struct font_glyph *glyph, uint8_t *buffer);
+int font_manager_glyph(struct font_manager *F, int fontid, int codepoint, int size, struct font_glyph *g, struct font_glyph *og);
 void font_manager_flush(struct font_manager *);
+int font_manager_version(struct font_manager *);
 void font_manager_scale(struct font_manager *F, struct font_glyph *glyph, int size);
+void font_manager_touch(struct font_manager *F, int page, int u, int v);
+int font_manager_evict_version(struct font_manager *);
+int font_manager_cell_evict(struct font_manager *F, int page, int u, int v);
 int font_manager_underline(struct font_manager *F, int fontid, int size, float *underline_position, float *thickness);
 float font_manager_sdf_mask(struct font_manager *F);
 float font_manager_sdf_distance(struct font_manager *F, uint8_t numpixel);
 
+// the sdf cache, see font_cache.h
+int font_manager_cache_map(struct font_manager *F, const void *data, size_t size, void *ud);
+void* font_manager_cache_save(struct font_manager *F, size_t *size);
+void font_manager_cache_release(struct font_manager *F, void (*unmap)(void *ud));
+// rasterize the glyph into the cache if it's not cached, for warming up. 1 baked, 0 cached or blank, -1 failed
+int font_manager_bake(struct font_manager *F, int fontid, int codepoint);
+
 #endif //font_manager_h
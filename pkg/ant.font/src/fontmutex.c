@@ -8,6 +8,18 @@
     void mutex_destroy(struct mutex_t* m) { DeleteCriticalSection(&m->cs); }
     void mutex_acquire(struct mutex_t* m) { EnterCriticalSection(&m->cs); }
     void mutex_release(struct mutex_t* m) { LeaveCriticalSection(&m->cs); }
+
+    struct cond_t { CONDITION_VARIABLE cv; };
+    static void cond_init(struct cond_t* c) { InitializeConditionVariable(&c->cv); }
+    void cond_destroy(struct cond_t* c) { (void)c; }
+    void cond_wait(struct cond_t* c, struct mutex_t* m) { SleepConditionVariableCS(&c->cv, &m->cs, INFINITE); }
+    void cond_signal(struct cond_t* c) { WakeConditionVariable(&c->cv); }
+    void cond_broadcast(struct cond_t* c) { WakeAllConditionVariable(&c->cv); }
+
+    struct thread_t { HANDLE handle; void (*func)(void*); void* ud; };
+    static DWORD WINAPI thread_main(LPVOID p) { struct thread_t* t = (struct thread_t*)p; t->func(t->ud); return 0; }
+    static int thread_start(struct thread_t* t) { t->handle = CreateThread(NULL, 0, thread_main, t, 0, NULL); return t->handle != NULL; }
+    static void thread_wait(struct thread_t* t) { WaitForSingleObject(t->handle, INFINITE); CloseHandle(t->handle); }
 #else
     #include <pthread.h>
     struct mutex_t { pthread_mutex_t mutex; };
@@ -15,6 +27,18 @@
     void mutex_destroy(struct mutex_t* m) { pthread_mutex_destroy(&m->mutex); }
     void mutex_acquire(struct mutex_t* m) { pthread_mutex_lock(&m->mutex); }
     void mutex_release(struct mutex_t* m) { pthread_mutex_unlock(&m->mutex); }
+
+    struct cond_t { pthread_cond_t cond; };
+    static void cond_init(struct cond_t* c) { pthread_cond_init(&c->cond, NULL); }
+    void cond_destroy(struct cond_t* c) { pthread_cond_destroy(&c->cond); }
+    void cond_wait(struct cond_t* c, struct mutex_t* m) { pthread_cond_wait(&c->cond, &m->mutex); }
+    void cond_signal(struct cond_t* c) { pthread_cond_signal(&c->cond); }
+    void cond_broadcast(struct cond_t* c) { pthread_cond_broadcast(&c->cond); }
+
+    struct thread_t { pthread_t handle; void (*func)(void*); void* ud; };
+    static void* thread_main(void* p) { struct thread_t* t = (struct thread_t*)p; t->func(t->ud); return NULL; }
+    static int thread_start(struct thread_t* t) { return pthread_create(&t->handle, NULL, thread_main, t) == 0; }
+    static void thread_wait(struct thread_t* t) { pthread_join(t->handle, NULL); }
 #endif
 
 struct mutex_t* mutex_create() {
@@ -22,3 +46,25 @@ struct mutex_t* mutex_create() {
     mutex_init(m);
     return m;
 }
+
+struct cond_t* cond_create() {
+    struct cond_t* c = (struct cond_t*)malloc(sizeof(struct cond_t));
+    cond_init(c);
+    return c;
+}
+
+struct thread_t* thread_create(void (*func)(void*), void* ud) {
+    struct thread_t* t = (struct thread_t*)malloc(sizeof(struct thread_t));
+    t->func = func;
+    t->ud = ud;
+    if (!thread_start(t)) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void thread_join(struct thread_t* t) {
+    thread_wait(t);
+    free(t);
+}
@@ -1,10 +1,38 @@
 #ifndef __fontmutex_h_
 #define __fontmutex_h_
 
+#include <stdint.h>
+
 struct mutex_t;
 struct mutex_t* mutex_create();
 void mutex_destroy(struct mutex_t* m);
 void mutex_acquire(struct mutex_t* m);
 void mutex_release(struct mutex_t* m);
 
+struct cond_t;
+struct cond_t* cond_create();
+void cond_destroy(struct cond_t* c);
+void cond_wait(struct cond_t* c, struct mutex_t* m);
+void cond_signal(struct cond_t* c);
+void cond_broadcast(struct cond_t* c);
+
+struct thread_t;
+struct thread_t* thread_create(void (*func)(void*), void* ud);
+void thread_join(struct thread_t* t);
+
+// the atomic operations of int32_t, load is acquire, store is release, inc is a full barrier
+#if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    static inline int32_t atom_load(volatile int32_t* p) { return (int32_t)_InterlockedCompareExchange((volatile long*)p, 0, 0); }
+    static inline void atom_store(volatile int32_t* p, int32_t v) { _InterlockedExchange((volatile long*)p, (long)v); }
+    static inline int32_t atom_inc(volatile int32_t* p) { return (int32_t)_InterlockedIncrement((volatile long*)p); }
+    // atom_load is a full barrier on msvc
+    static inline void atom_acquire_fence() { _ReadWriteBarrier(); }
+#else
+    static inline int32_t atom_load(volatile int32_t* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    static inline void atom_store(volatile int32_t* p, int32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+    static inline int32_t atom_inc(volatile int32_t* p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+    static inline void atom_acquire_fence() { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+#endif
+
 #endif
@@ -9,6 +9,7 @@
 #include "font_manager.h"
 
 #include "truetype.h"
+#include "luazip.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -57,6 +58,89 @@ lname(lua_State *L) {
 	return 0;
 }
 
+// the memory of fastio.readall_m, it's owned by the font manager if it's a valid cache file
+static int
+lcache(lua_State *L) {
+	struct font_manager *F = getF(L);
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	struct zip_reader_cache *cache = (struct zip_reader_cache *)lua_touserdata(L, 1);
+	size_t size = 0;
+	void *data = luazip_data(cache, &size);
+	if (!font_manager_cache_map(F, data, size, cache)) {
+		luazip_close(cache);
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int
+lcache_save(lua_State *L) {
+	struct font_manager *F = getF(L);
+	size_t size = 0;
+	void *data = font_manager_cache_save(F, &size);
+	if (data == NULL)
+		return 0;
+	lua_pushlstring(L, (const char *)data, size);
+	free(data);
+	return 1;
+}
+
+static int
+utf8_decode(const char *s, size_t sz, size_t *pos) {
+	const unsigned char *p = (const unsigned char *)s + *pos;
+	const size_t left = sz - *pos;
+	int n, c;
+	if (p[0] < 0x80) {
+		n = 1; c = p[0];
+	} else if ((p[0] & 0xe0) == 0xc0) {
+		n = 2; c = p[0] & 0x1f;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		n = 3; c = p[0] & 0x0f;
+	} else if ((p[0] & 0xf8) == 0xf0) {
+		n = 4; c = p[0] & 0x07;
+	} else {
+		*pos += 1;
+		return -1;
+	}
+	if ((size_t)n > left) {
+		*pos = sz;
+		return -1;
+	}
+	int i;
+	for (i=1;i<n;i++) {
+		if ((p[i] & 0xc0) != 0x80) {
+			*pos += i;
+			return -1;
+		}
+		c = (c << 6) | (p[i] & 0x3f);
+	}
+	*pos += n;
+	return c;
+}
+
+// bake the glyphs of the utf8 text into the cache, returns the number of the glyphs baked
+static int
+lbake(lua_State *L) {
+	struct font_manager *F = getF(L);
+	const char* family = luaL_checkstring(L, 1);
+	size_t sz;
+	const char* text = luaL_checklstring(L, 2, &sz);
+	const int fontid = font_manager_addfont_with_family(F, family);
+	if (fontid <= 0)
+		return luaL_error(L, "Unknown font : %s", family);
+	int n = 0;
+	size_t pos = 0;
+	while (pos < sz) {
+		const int codepoint = utf8_decode(text, sz, &pos);
+		if (codepoint > 0 && font_manager_bake(F, fontid, codepoint) > 0)
+			++n;
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
 static int
 initfont(lua_State *L) {
 	luaL_checktype(L, 2, LUA_TLIGHTUSERDATA);
@@ -65,6 +149,9 @@ initfont(lua_State *L) {
 		{ "import",				limport },
 		{ "name",				lname },
 		{ "submit",				lsubmit },
+		{ "cache",				lcache },
+		{ "cache_save",			lcache_save },
+		{ "bake",				lbake },
 		{ NULL, 				NULL },
 	};
 	lua_settop(L, 2);
@@ -124,10 +211,16 @@ fontm_init(lua_State *L) {
 	return 1;
 }
 
+static void
+cache_unmap(void *ud) {
+	luazip_close((struct zip_reader_cache *)ud);
+}
+
 static int
 fontm_shutdown(lua_State *L) {
 	struct font_manager *F = (struct font_manager*)lua_touserdata(L, lua_upvalueindex(1));
 	void* managerL = font_manager_release_lua(F);
+	font_manager_cache_release(F, cache_unmap);
 	if (managerL) {
 		lua_close(managerL);
 	}
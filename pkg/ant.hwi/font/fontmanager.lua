@@ -1,6 +1,8 @@
 local manager = require "font.manager"
 local fontutil = require "font.util"
 local vfs = require "vfs"
+local fastio = require "fastio"
+local directory = require "directory"
 
 local fontvm = [[
     local dbg = assert(loadfile '/engine/debugger.lua')()
@@ -18,6 +20,29 @@ local lfont = require "font" (instance)
 
 local imported = {}
 
+-- the sdf of the glyphs rasterized are written back to it at shutdown
+local CACHE_PATH <const> = (directory.app_path() / "font.sdfcache"):string()
+
+do
+    local memory = fastio.readall_m_noerr(CACHE_PATH)
+    if memory and not lfont.cache(memory) then
+        log.warn(("Invalid font cache `%s`, it's rebuilt."):format(CACHE_PATH))
+    end
+end
+
+local function write_cache(path, data)
+    local tmp = path .. ".tmp"
+    local f = io.open(tmp, "wb")
+    if not f then
+        log.warn(("Write font cache `%s` failed."):format(path))
+        return
+    end
+    f:write(data)
+    f:close()
+    os.remove(path)
+    os.rename(tmp, path)
+end
+
 function m.instance()
     return instance
 end
@@ -36,9 +61,25 @@ function m.import(path)
     end
 end
 
+-- map the sdf cache file shipped with the app
+function m.cache(path)
+    local memory = vfs.read(path) or error(("`read font cache `%s` failed."):format(path))
+    return lfont.cache(memory)
+end
+
+-- warm up the cache with the glyphs of the text
+function m.bake(fontname, text)
+    return lfont.bake(fontname, text)
+end
+
 function m.shutdown()
+    -- the mapped cache file is closed by manager.shutdown, write it after that
+    local data = lfont.cache_save()
     manager.shutdown()
     instance = nil
+    if data then
+        write_cache(CACHE_PATH, data)
+    end
 end
 
 return m
@@ -22,6 +22,8 @@ local CALL = {
     "maxfps",
     "fontmanager",
     "fontimport",
+    "fontcache",
+    "fontbake",
     "show_profile",
     "event_suspend",
 
@@ -152,6 +154,10 @@ local function profile_print()
         if next(ss) then
             add_text(format_text("simple|hitch|efk", (" | %d %d %d"):format(ss.simple_submit, ss.hitch_submit, ss.efk_hitch_submit)))
             add_text(format_text("hitch_count", (" | %d"):format(ss.hitch_count)))
+            add_text(format_text("draw cache rebuild|replay|update", (" | %d %d %d"):format(ss.cache_rebuild, ss.cache_replay, ss.cache_update)))
+            for i, worker in ipairs(ss.workers) do
+                add_text(format_text(("submit worker(%d)"):format(i-1), (" | %d %.02fms"):format(worker.submit, worker.time / 1000)))
+            end
         end
     end
     for i = 1, profile_printtext.n do
@@ -404,6 +410,14 @@ function S.fontimport(path)
     return fontmanager.import(path)
 end
 
+function S.fontcache(path)
+    return fontmanager.cache(path)
+end
+
+function S.fontbake(fontname, text)
+    return fontmanager.bake(fontname, text)
+end
+
 local viewidmgr = require "viewid_mgr"
 
 local function mainloop()
@@ -1,6 +1,9 @@
 local vfs = require "vfs"
 local fastio = require "fastio"
 
+local ltask
+local ServiceAIO
+
 local m = {}
 
 local function readall(path)
@@ -8,6 +11,21 @@ local function readall(path)
     return memory
 end
 
+local function aio()
+    if not ServiceAIO then
+        ltask = require "ltask"
+        ServiceAIO = ltask.uniqueservice "ant.io|aio"
+    end
+    return ServiceAIO
+end
+
+-- priority: "now"(default), "prefetch" or "background", only the calling coroutine waits
+local function readall_async(path, priority)
+    local service = aio()
+    local memory = ltask.call(service, "read", path, priority) or error(("`read `%s` failed."):format(path))
+    return memory
+end
+
 function m.readall(path)
     return fastio.wrap(readall(path))
 end
@@ -20,4 +38,23 @@ function m.readall_v(path)
     return readall(path)
 end
 
+function m.readall_async(path, priority)
+    return fastio.wrap(readall_async(path, priority))
+end
+
+function m.readall_v_async(path, priority)
+    return readall_async(path, priority)
+end
+
+-- read the file in background, the next readall_async(path) gets it at once
+function m.prefetch(path, priority)
+    local service = aio()
+    ltask.send(service, "prefetch", path, priority)
+end
+
+function m.aio_stat()
+    local service = aio()
+    return ltask.call(service, "stat")
+end
+
 return m
@@ -0,0 +1,206 @@
+local ltask  = require "ltask"
+local fastio = require "fastio"
+
+-- the requests are read by a bounded pool of workers, the higher priority first.
+-- the same path is read once for all the requests in flight.
+
+local WORKER_N <const> = 3
+-- the prefetched files not requested yet
+local MAX_READY <const> = 64
+
+local PRIORITY <const> = {
+    now = 1,
+    prefetch = 2,
+    background = 3,
+}
+
+-- the queues of the priorities, q[head..tail] are the requests in order, false for the removed one
+local queue = {
+    { head = 1, tail = 0 },
+    { head = 1, tail = 0 },
+    { head = 1, tail = 0 },
+}
+local pending = 0       -- the requests in the queues
+local requests = {}     -- path -> request in flight
+local ready = {}        -- path -> memory prefetched
+local ready_list = {}
+local idle = {}
+
+local stat = {
+    request = 0,
+    read = 0,
+    coalesce = 0,
+    prefetch_hit = 0,
+    prefetch_drop = 0,
+}
+
+local function push(req)
+    local q = queue[req.priority]
+    local tail = q.tail + 1
+    q.tail = tail
+    q[tail] = req
+    req.index = tail
+    local token = table.remove(idle)
+    if token then
+        ltask.wakeup(token)
+    end
+end
+
+-- move the queued request to a higher priority queue
+local function raise(req, priority)
+    queue[req.priority][req.index] = false
+    req.priority = priority
+    push(req)
+end
+
+local function pop()
+    for p = 1, #queue do
+        local q = queue[p]
+        local head = q.head
+        while head <= q.tail do
+            local req = q[head]
+            q[head] = nil
+            head = head + 1
+            if req then
+                q.head = head
+                pending = pending - 1
+                return req
+            end
+        end
+        q.head = head
+    end
+end
+
+local function add_ready(path, mem)
+    if ready[path] then
+        fastio.free(mem)
+        return
+    end
+    if #ready_list >= MAX_READY then
+        local old = table.remove(ready_list, 1)
+        fastio.free(ready[old])
+        ready[old] = nil
+        stat.prefetch_drop = stat.prefetch_drop + 1
+    end
+    ready[path] = mem
+    ready_list[#ready_list+1] = path
+end
+
+local function take_ready(path)
+    local mem = ready[path]
+    if mem then
+        ready[path] = nil
+        for i = 1, #ready_list do
+            if ready_list[i] == path then
+                table.remove(ready_list, i)
+                break
+            end
+        end
+        stat.prefetch_hit = stat.prefetch_hit + 1
+    end
+    return mem
+end
+
+local function finish(req, mem)
+    requests[req.path] = nil
+    local waiting = req.waiting
+    if mem == nil then
+        for i = 1, #waiting do
+            ltask.wakeup(waiting[i])
+        end
+        return
+    end
+    if #waiting == 0 then
+        add_ready(req.path, mem)
+        return
+    end
+    if #waiting == 1 then
+        ltask.wakeup(waiting[1], mem)
+        return
+    end
+    -- every waiting one owns a read only view of the memory, it's freed after the last one
+    local views = { fastio.share(mem, #waiting) }
+    for i = 1, #waiting do
+        ltask.wakeup(waiting[i], views[i])
+    end
+end
+
+local function request(path, priority)
+    stat.request = stat.request + 1
+    local p = PRIORITY[priority or "now"] or error("Invalid priority " .. tostring(priority))
+    local req = requests[path]
+    if req then
+        stat.coalesce = stat.coalesce + 1
+        if p < req.priority and not req.reading then
+            raise(req, p)
+        end
+        return req
+    end
+    req = {
+        path = path,
+        priority = p,
+        waiting = {},
+    }
+    requests[path] = req
+    pending = pending + 1
+    push(req)
+    return req
+end
+
+local function worker_loop(worker)
+    while true do
+        local req = pop()
+        if req then
+            req.reading = true
+            stat.read = stat.read + 1
+            local ok, mem = pcall(ltask.call, worker, "read", req.path)
+            if not ok then
+                log.warn("[aio] read " .. req.path .. " failed: " .. tostring(mem))
+                mem = nil
+            end
+            finish(req, mem)
+        else
+            local token = {}
+            idle[#idle+1] = token
+            ltask.wait(token)
+        end
+    end
+end
+
+for _ = 1, WORKER_N do
+    local worker = ltask.spawn "ant.io|aio_worker"
+    ltask.fork(worker_loop, worker)
+end
+
+local S = {}
+
+function S.read(path, priority)
+    local mem = take_ready(path)
+    if mem then
+        return mem
+    end
+    local req = request(path, priority)
+    local token = {}
+    local waiting = req.waiting
+    waiting[#waiting+1] = token
+    return ltask.wait(token)
+end
+
+function S.prefetch(path, priority)
+    if ready[path] then
+        return
+    end
+    request(path, priority or "prefetch")
+end
+
+function S.stat()
+    local r = {}
+    for k, v in pairs(stat) do
+        r[k] = v
+    end
+    r.pending = pending
+    r.ready = #ready_list
+    return r
+end
+
+return S
@@ -0,0 +1,16 @@
+local vfs    = require "vfs"
+local fastio = require "fastio"
+
+-- the blocking read runs in the worker, the io service only resolves the path
+
+local S = {}
+
+function S.read(path)
+    local lpath = vfs.call("REALPATH", path)
+    if lpath then
+        return fastio.readall_m_noerr(lpath, path)
+    end
+    return vfs.read(path)
+end
+
+return S
@@ -63,4 +63,9 @@ function M.material_load(name, state, stencil, prog, system, attrib)
 	return m
 end
 
+-- the draws of material m are merged into instanced draws with the variant, it must read the worldmat from the instance data
+function M.material_instanced(m, variant)
+	arena.instanced(m, variant)
+end
+
 return M
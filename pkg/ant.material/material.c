@@ -8,6 +8,7 @@
 #include "programan.h"
 
 #include "material_arena.h"
+#include "render_material.h"
 
 #include <bgfx/c99/bgfx.h>
 #include <luabgfx.h>
@@ -28,6 +29,7 @@ struct material {
 	uint64_t				global[MATERIAL_SYSTEM_ATTRIB_CHUNK];
 	attrib_id				attrib;
 	int 					prog;
+	struct material			*instanced;	// the variant reads the worldmat from the instance data, NULL if it has no
 };
 
 struct material_instance {
@@ -387,6 +389,7 @@ lmaterial_new(lua_State *L) {
 	lua_settop(L, 6);
 	struct material *m = (struct material *)lua_newuserdatauv(L, sizeof(*m), 0);
 	m->A = A;
+	m->instanced = NULL;
 
 	fetch_material_state(L, 2, &m->state);
 	fetch_material_stencil(L, 3, &m->state);
@@ -435,6 +438,18 @@ lmaterial_new(lua_State *L) {
 	return 1;
 }
 
+// 1: material
+// 2: instanced variant of the material, it shares the attribs and states with 1
+static int
+lmaterial_instanced(lua_State *L) {
+	struct material *m = (struct material *)lua_touserdata(L, 1);
+	struct material *v = (struct material *)lua_touserdata(L, 2);
+	if (m == NULL || v == NULL)
+		return luaL_error(L, "Invalid material");
+	m->instanced = v;
+	return 0;
+}
+
 int
 luaopen_material_arena(lua_State *L) {
 	luaL_checkversion(L);
@@ -442,6 +457,7 @@ luaopen_material_arena(lua_State *L) {
 		{ "arena",			larena_new },
 		{ "system_attrib",  larena_system_attrib},
 		{ "material",       lmaterial_new},
+		{ "instanced",      lmaterial_instanced},
 		{ NULL, 			NULL },
 	};
 	luaL_newlib(L, l);
@@ -520,6 +536,14 @@ set_attrib(lua_State *L, struct attrib_arena *A, int id, int index) {
 	}
 }
 
+// the render system creates w->R, it starts with unknown changes
+static inline void
+add_state_change(lua_State *L, struct material_instance *mi) {
+	struct ecs_world *w = getworld(L);
+	if (w->R)
+		render_material_instance_changed(w->R, mi);
+}
+
 static int
 linstance_set_attrib(lua_State *L) {
 	lua_pushvalue(L, 2);
@@ -542,6 +566,8 @@ linstance_set_attrib(lua_State *L) {
 				attrib_id next = attrib_arena_delete(A, prev, id);
 				if (prev == INVALID_ATTRIB) {
 					mi->patch_attrib = next;
+					if (next == INVALID_ATTRIB)
+						add_state_change(L, mi);
 				}
 			} else {
 				set_attrib(L, A, id, 3);
@@ -560,45 +586,121 @@ linstance_set_attrib(lua_State *L) {
 	attrib_id patch = attrib_arena_clone(A, prev, mi->patch_attrib, id);
 	if (patch == INVALID_ATTRIB)
 		return luaL_error(L, "Clone attrib %s fail", lua_tostring(L, 2));
-	if (prev == INVALID_ATTRIB)
+	if (prev == INVALID_ATTRIB) {
+		if (mi->patch_attrib == INVALID_ATTRIB)
+			add_state_change(L, mi);
 		mi->patch_attrib = patch;
+	}
 	set_attrib(L, A, patch, 3);
 	return 0;
 }
 
 #define BGFX(api) w->bgfx->api
 
-void
-apply_material_instance(lua_State *L, struct material_instance *mi, struct ecs_world *w) {
-	BGFX(encoder_set_state)(w->holder->encoder, 
+static inline const char *
+apply_attribs(struct material_instance *mi, struct attrib_arena_apply_context *ctx) {
+	const char * err = attrib_arena_apply_list(mi->m->A, mi->m->attrib, mi->patch_attrib, ctx);
+	if (err)
+		return err;
+
+	int ii;
+	for (ii = 0; ii < MATERIAL_SYSTEM_ATTRIB_CHUNK; ++ii) {
+		err = attrib_arena_apply_global(mi->m->A, mi->m->global[ii], ii * 64, ctx);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+const char *
+material_apply(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder) {
+	BGFX(encoder_set_state)(encoder, 
 		(mi->patch_state.state == 0 ? mi->m->state.state : mi->patch_state.state), 
 		(mi->patch_state.rgba == 0 ? mi->m->state.rgba : mi->patch_state.rgba));
 
 	const uint64_t stencil = mi->patch_state.stencil == 0 ? mi->m->state.stencil : mi->patch_state.stencil;
-	BGFX(encoder_set_stencil)(w->holder->encoder,
+	BGFX(encoder_set_stencil)(encoder,
 		(uint32_t)(stencil & 0xffffffff), (uint32_t)(stencil >> 32)
 	);
 
 	struct attrib_arena_apply_context ctx = {
 		w->bgfx,
-		w->holder->encoder,
+		encoder,
 		w->math3d->M,
 		math_value,
 		math_size,
 		texture_get,
 	};
 
-	const char * err = attrib_arena_apply_list(mi->m->A, mi->m->attrib, mi->patch_attrib, &ctx);
-	if (err)
-		luaL_error(L, "Apply error : %s", err);
+	return apply_attribs(mi, &ctx);
+}
 
-	int ii;
-	for (ii = 0; ii < MATERIAL_SYSTEM_ATTRIB_CHUNK; ++ii) {
-		err = attrib_arena_apply_global(mi->m->A, mi->m->global[ii], ii * 64, &ctx);
-		if (err)
-			luaL_error(L, "Apply global error : %s", err);
+void
+material_apply_cache_reset(struct material_apply_cache *c) {
+	c->material = NULL;
+}
+
+const char *
+material_apply_cached(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder, struct material_apply_cache *c, int uniforms) {
+	const uint64_t state = mi->patch_state.state == 0 ? mi->m->state.state : mi->patch_state.state;
+	const uint32_t rgba = mi->patch_state.rgba == 0 ? mi->m->state.rgba : mi->patch_state.rgba;
+	const uint64_t stencil = mi->patch_state.stencil == 0 ? mi->m->state.stencil : mi->patch_state.stencil;
+	const int kept = c->material != NULL;
+	// the blend state is a part of the bgfx sort key
+	const int same_state = kept && c->state == state && c->rgba == rgba;
+
+	if (same_state) {
+		++c->skipped;
+	} else {
+		BGFX(encoder_set_state)(encoder, state, rgba);
+		c->state = state;
+		c->rgba = rgba;
+		++c->applied;
+	}
+
+	if (kept && c->stencil == stencil) {
+		++c->skipped;
+	} else {
+		BGFX(encoder_set_stencil)(encoder, (uint32_t)(stencil & 0xffffffff), (uint32_t)(stencil >> 32));
+		c->stencil = stencil;
+		++c->applied;
+	}
+
+	const int same = kept && c->material == mi->m && c->patch == mi->patch_attrib && c->version == attrib_arena_global_version(mi->m->A);
+	if (same && same_state && uniforms) {
+		c->skipped += c->attribs;
+		return NULL;
 	}
 
+	struct attrib_arena_apply_context ctx = {
+		w->bgfx,
+		encoder,
+		w->math3d->M,
+		math_value,
+		math_size,
+		texture_get,
+		same,
+	};
+
+	c->material = NULL;
+	const char * err = apply_attribs(mi, &ctx);
+	c->applied += ctx.applied;
+	c->skipped += ctx.skipped;
+	if (err)
+		return err;
+
+	c->material = mi->m;
+	c->patch = mi->patch_attrib;
+	c->version = attrib_arena_global_version(mi->m->A);
+	c->attribs = ctx.applied + ctx.skipped;
+	return NULL;
+}
+
+void
+apply_material_instance(lua_State *L, struct material_instance *mi, struct ecs_world *w) {
+	const char * err = material_apply(mi, w, w->holder->encoder);
+	if (err)
+		luaL_error(L, "%s", err);
 }
 
 static int
@@ -661,6 +763,7 @@ static int
 linstance_set_state(lua_State *L) {
 	struct material_instance* mi = to_instance(L, 1);
 	fetch_material_state(L, 2, &mi->patch_state);
+	add_state_change(L, mi);
 	return 0;
 }
 
@@ -675,6 +778,7 @@ static int
 linstance_set_stencil(lua_State *L) {
 	struct material_instance* mi = to_instance(L, 1);
 	fetch_material_stencil(L, 2, &mi->patch_state);
+	add_state_change(L, mi);
 	return 0;
 }
 
@@ -759,6 +863,7 @@ lsystem_attrib_update(lua_State *L) {
 	}
 	struct attrib_arena *A = (struct attrib_arena *)lua_touserdata(L, lua_upvalueindex(3));
 	set_attrib(L, A, -id, 2);
+	attrib_arena_global_changed(A);
 	return 0;
 }
 
@@ -794,3 +899,49 @@ material_prog(lua_State *L, struct material_instance *mi){
 	(void)L;
 	return program_get(mi->m->prog);
 }
+
+void
+material_get_sortinfo(struct material_instance *mi, struct material_sortinfo *si) {
+	si->material = mi->m;
+	si->state = mi->patch_state.state == 0 ? mi->m->state.state : mi->patch_state.state;
+	si->progid = mi->m->prog;
+}
+
+int
+material_get_batchinfo(struct material_instance *mi, struct material_batchinfo *bi) {
+	if (mi->m->instanced == NULL || mi->patch_attrib != INVALID_ATTRIB)
+		return 0;
+	bi->material = mi->m;
+	bi->state = mi->patch_state.state == 0 ? mi->m->state.state : mi->patch_state.state;
+	bi->stencil = mi->patch_state.stencil == 0 ? mi->m->state.stencil : mi->patch_state.stencil;
+	bi->rgba = mi->patch_state.rgba == 0 ? mi->m->state.rgba : mi->patch_state.rgba;
+	return 1;
+}
+
+const char *
+material_apply_instanced(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder) {
+	struct material_instance v = { mi->m->instanced, mi->patch_state, INVALID_ATTRIB };
+	return material_apply(&v, w, encoder);
+}
+
+void
+material_request_textures(struct material_instance *mi, int size) {
+	attrib_arena_request_textures(mi->m->A, mi->m->attrib, mi->patch_attrib, texture_request, size);
+}
+
+bgfx_program_handle_t
+material_instanced_prog(struct material_instance *mi) {
+	return program_get(mi->m->instanced->prog);
+}
+
+int
+material_state_changes(struct ecs_world *w, struct material_instance *changes[MATERIAL_STATE_CHANGES_MAX]) {
+	void * const *mi;
+	int n = render_material_instance_changes(w->R, &mi);
+	if (n > MATERIAL_STATE_CHANGES_MAX)
+		n = -1;
+	else if (n > 0)
+		memcpy(changes, mi, n * sizeof(struct material_instance *));
+	render_material_clear_instance_changes(w->R);
+	return n;
+}
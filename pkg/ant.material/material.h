@@ -7,5 +7,57 @@ struct material_instance;
 struct ecs_world;
 struct lua_State;
 void apply_material_instance(struct lua_State *L, struct material_instance *mi, struct ecs_world *w);
+// doesn't raise lua error, so it can be called from the submit workers; returns the error message("Apply error : ..." or "Apply global error : ...") or NULL
+const char * material_apply(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder);
 bgfx_program_handle_t material_prog(struct lua_State *L, struct material_instance *mi);
+
+/*
+	The material applied by the last draw of an encoder. When the draw is submitted without
+	discarding the state and the bindings, the next draw skips the same state, stencil and
+	samplers. The uniforms are skipped only if the caller knows the two draws are adjacent in
+	the bgfx sorted order(the same view, program and depth in one encoder), because bgfx keeps
+	the uniform values in the render order, not per draw.
+	Reset it after the state or the bindings are discarded.
+*/
+struct material_apply_cache {
+	const void *material;	// NULL: nothing is kept in the encoder
+	uint16_t patch;
+	uint64_t state;
+	uint64_t stencil;
+	uint32_t rgba;
+	int version;			// system attrib version
+	uint32_t attribs;		// attribs of the last material, include the global attribs
+	// counters of the bgfx calls: state, stencil and attribs
+	uint32_t applied;
+	uint32_t skipped;
+};
+void material_apply_cache_reset(struct material_apply_cache *c);
+// uniforms: 1 if the uniforms of the last draw are still in effect for this draw
+const char * material_apply_cached(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder, struct material_apply_cache *c, int uniforms);
+
+struct material_sortinfo {
+	const void *material;	// instances of the same material share the same attribs
+	uint64_t state;
+	int progid;				// programan id, it's stable even the program handle is evicted
+};
+void material_get_sortinfo(struct material_instance *mi, struct material_sortinfo *si);
+
+// the instances of the same batchinfo can be drawn by one instanced draw call
+struct material_batchinfo {
+	const void *material;
+	uint64_t state;
+	uint64_t stencil;
+	uint32_t rgba;
+};
+// returns 0 if the instance can't be drawn instanced: the material has no instanced variant, or the instance has attrib patches
+int material_get_batchinfo(struct material_instance *mi, struct material_batchinfo *bi);
+// apply the instanced variant with the states of the instance, the worldmat is read from the instance data
+const char * material_apply_instanced(struct material_instance *mi, struct ecs_world *w, bgfx_encoder_t *encoder);
+bgfx_program_handle_t material_instanced_prog(struct material_instance *mi);
+// texture_request for the textures of the instance, size is the projected size of the draw in pixels. it's thread safe
+void material_request_textures(struct material_instance *mi, int size);
+
+#define MATERIAL_STATE_CHANGES_MAX 256
+// the instances which state, stencil or attrib patches(the first one added or the last one removed) changed since the last call, returns -1 when there were too many
+int material_state_changes(struct ecs_world *w, struct material_instance *changes[MATERIAL_STATE_CHANGES_MAX]);
 #endif //_MATERIAL_H_
\ No newline at end of file
@@ -66,6 +66,7 @@ struct attrib_arena {
 	attrib_id freelist;
 	int vec_n;
 	int attrib_n;
+	int global_version;
 	struct vec v[MAX_VEC];
 	attrib_type g[MAX_GLOBAL_COUNT];
 	attrib_type a[MAX_ATTRIB_COUNT];
@@ -76,11 +77,22 @@ attrib_arena_size() {
 	return sizeof(struct attrib_arena);
 }
 
+int
+attrib_arena_global_version(struct attrib_arena *A) {
+	return A->global_version;
+}
+
+void
+attrib_arena_global_changed(struct attrib_arena *A) {
+	++A->global_version;
+}
+
 void
 attrib_arena_init(struct attrib_arena *A) {
 	A->freelist = INVALID_ATTRIB;
 	A->vec_n = 0;
 	A->attrib_n = 0;
+	A->global_version = 0;
 	int i;
 	for (i=0;i<MAX_GLOBAL_COUNT;i++) {
 		A->g[i].h.next = INVALID_ATTRIB;
@@ -348,11 +360,19 @@ check_get_texture_handle(struct attrib_arena_apply_context *ctx, uint32_t handle
 	return r;
 }
 
+// the global attribs(id < 0) are shared by all the materials, their errors are reported apart
+#define APPLY_ERROR(id, msg) ((id) < 0 ? "Apply global error : " msg : "Apply error : " msg)
+
 const char *
 attrib_arena_apply(struct attrib_arena *A, int id, struct attrib_arena_apply_context *ctx) {
 	attrib_type *a = get_attrib_from_id(A, id);
 	if (a == NULL)
-		return "Invalid attrib";
+		return APPLY_ERROR(id, "Invalid attrib");
+	if (ctx->uniform_only && a->h.type != ATTRIB_UNIFORM && a->h.type != ATTRIB_UNIFORM_INSTANCE) {
+		++ctx->skipped;
+		return NULL;
+	}
+	++ctx->applied;
 	switch(a->h.type){
 		case ATTRIB_SAMPLER: {
 			const bgfx_texture_handle_t tex = check_get_texture_handle(ctx, a->u.u.t.handle);
@@ -398,7 +418,7 @@ attrib_arena_apply(struct attrib_arena *A, int id, struct attrib_arena_apply_con
 				break;
 			}
 			default:
-				return "Invalid buffer type";
+				return APPLY_ERROR(id, "Invalid buffer type");
 			}
 		}	break;
 		case ATTRIB_UNIFORM : {
@@ -419,7 +439,7 @@ attrib_arena_apply(struct attrib_arena *A, int id, struct attrib_arena_apply_con
 			BGFX(encoder_set_uniform)(ctx->encoder, a->u.handle, ctx->math_value(ctx->math3d, a->u.u.m), n);
 		}	break;
 		default:
-			return "Invalid attrib type";
+			return APPLY_ERROR(id, "Invalid attrib type");
 	}
 	return NULL;
 }
@@ -467,6 +487,17 @@ attrib_arena_apply_list(struct attrib_arena *A, attrib_id head, attrib_id patch,
 	return NULL;
 }
 
+void
+attrib_arena_request_textures(struct attrib_arena *A, attrib_id head, attrib_id patch, void (*request)(int id, int size), int size) {
+	attrib_id id;
+	while ((id = get_next_attrib(A, &patch, &head)) != INVALID_ATTRIB) {
+		const attrib_type *a = get_attrib(A, id);
+		// the textureman ids, not the bgfx handles
+		if (a->h.type == ATTRIB_SAMPLER && (0xffff0000 & a->u.u.t.handle) == 0)
+			request((int)a->u.u.t.handle, size);
+	}
+}
+
 static inline const char *
 apply_global8(struct attrib_arena *A, uint8_t mask, int base, struct attrib_arena_apply_context *ctx) {
 	int i;
@@ -22,6 +22,9 @@ struct attrib_arena;
 
 size_t attrib_arena_size();
 void attrib_arena_init(struct attrib_arena *A);
+// bumped by system_attrib_update, the global attribs applied with an older version are stale
+int attrib_arena_global_version(struct attrib_arena *A);
+void attrib_arena_global_changed(struct attrib_arena *A);
 const char * attrib_arena_init_uniform(struct attrib_arena *A, int id, bgfx_uniform_handle_t h, const float *v, int n, int elem);
 const char * attrib_arena_init_sampler(struct attrib_arena *A, int id, bgfx_uniform_handle_t h, uint32_t handle, uint8_t stage);
 const char * attrib_arena_init_image(struct attrib_arena *A, int id, uint32_t handle, uint8_t stage, bgfx_access_t access, uint8_t mip);
@@ -45,10 +48,15 @@ struct attrib_arena_apply_context {
 	const float * (*math_value)(struct math_context *, math_t id);
 	int (*math_size)(struct math_context *ctx, math_t id);
 	bgfx_texture_handle_t (*texture_get)(int id);
+	int uniform_only;	// skip the samplers, images and buffers, they are kept in the encoder bindings
+	int applied;		// counters of the attribs
+	int skipped;
 };
 
 const char * attrib_arena_apply(struct attrib_arena *A, int id, struct attrib_arena_apply_context *ctx);
 const char * attrib_arena_apply_list(struct attrib_arena *A, attrib_id head, attrib_id patch, struct attrib_arena_apply_context *ctx);
+// call request(id, size) for the textureman textures of the samplers in the list
+void attrib_arena_request_textures(struct attrib_arena *A, attrib_id head, attrib_id patch, void (*request)(int id, int size), int size);
 const char * attrib_arena_apply_global(struct attrib_arena *A, uint64_t mask, int base, struct attrib_arena_apply_context *ctx);
 
 #endif
@@ -13,12 +13,19 @@ struct material_tuple {
 	void * mat[TUPLE_N];
 };
 
+#define MAX_CHANGES 1024
+#define MAX_INSTANCE_CHANGES 256
+
 struct render_material {
 	int max_type;
 	int freelist;
 	int n;
 	int cap;
 	struct material_tuple *arena;
+	int changes_n;	// < 0 : unknown changes, treat all of them as changed
+	int changes[MAX_CHANGES];
+	int instance_changes_n;	// < 0 : unknown changes
+	void * instance_changes[MAX_INSTANCE_CHANGES];
 };
 
 #define MAX_CHUNK ((RENDER_MATERIAL_TYPE_MAX + TUPLE_N - 1) / TUPLE_N)
@@ -73,6 +80,8 @@ render_material_create() {
 	struct render_material *R = (struct render_material *)malloc(sizeof(*R));
 	memset(R, 0, sizeof(*R));
 	R->freelist = -1;
+	R->changes_n = -1;
+	R->instance_changes_n = -1;
 	return R;
 }
 
@@ -170,8 +179,62 @@ close_chunk(struct material_chunk *C, int n) {
 	}
 }
 
+static inline void
+add_change(struct render_material *R, int index) {
+	if (R->changes_n < 0)
+		return;
+	int i;
+	for (i=R->changes_n-1;i>=0 && i>=R->changes_n-TUPLE_N;i--) {
+		// usually several types of one index are set together
+		if (R->changes[i] == index)
+			return;
+	}
+	if (R->changes_n >= MAX_CHANGES) {
+		R->changes_n = -1;
+		return;
+	}
+	R->changes[R->changes_n++] = index;
+}
+
+int
+render_material_changes(struct render_material *R, const int **changes) {
+	*changes = R->changes;
+	return R->changes_n;
+}
+
+void
+render_material_clear_changes(struct render_material *R) {
+	R->changes_n = 0;
+}
+
+void
+render_material_instance_changed(struct render_material *R, void *mi) {
+	int n = R->instance_changes_n;
+	if (n < 0)
+		return;
+	if (n > 0 && R->instance_changes[n-1] == mi)
+		return;
+	if (n >= MAX_INSTANCE_CHANGES) {
+		R->instance_changes_n = -1;
+		return;
+	}
+	R->instance_changes[R->instance_changes_n++] = mi;
+}
+
+int
+render_material_instance_changes(struct render_material *R, void * const **changes) {
+	*changes = R->instance_changes;
+	return R->instance_changes_n;
+}
+
+void
+render_material_clear_instance_changes(struct render_material *R) {
+	R->instance_changes_n = 0;
+}
+
 void
 render_material_set(struct render_material *R, int index, int type, void *mat) {
+	add_change(R, index);
 	struct material_chunk C;
 	int n = fetch_chunk(R, index, &C);
 	int i;
@@ -223,6 +286,7 @@ render_material_set(struct render_material *R, int index, int type, void *mat) {
 
 int
 render_material_alloc(struct render_material *R) {
+	R->changes_n = -1;
 	int index = allocnode(R);
 	struct material_tuple *node = &R->arena[index];
 	node->next = -1;
@@ -232,6 +296,7 @@ render_material_alloc(struct render_material *R) {
 
 void
 render_material_dealloc(struct render_material *R, int index) {
+	R->changes_n = -1;
 	while (index >= 0) {
 		struct material_tuple *node = &R->arena[index];
 		int next = node->next;
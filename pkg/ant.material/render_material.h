@@ -15,5 +15,12 @@ size_t render_material_memsize(struct render_material *R);
 int render_material_alloc(struct render_material *R);
 void render_material_dealloc(struct render_material *R, int index);
 void render_material_set(struct render_material *R, int index, int type, void *mat);
+// the indices set since the last clear, returns -1 when unknown(alloc/dealloc or too many changes)
+int render_material_changes(struct render_material *R, const int **changes);
+void render_material_clear_changes(struct render_material *R);
+// the material instances which states changed since the last clear, returns -1 when unknown(too many changes)
+void render_material_instance_changed(struct render_material *R, void *mi);
+int render_material_instance_changes(struct render_material *R, void * const **changes);
+void render_material_clear_instance_changes(struct render_material *R);
 
 #endif
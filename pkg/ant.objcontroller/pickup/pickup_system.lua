@@ -18,6 +18,7 @@ local RM		= ecs.require "ant.material|material"
 local hwi		= import_package "ant.hwi"
 
 local queuemgr  = ecs.require "ant.render|queue_mgr"
+local scenecore = world:clibs "scene.core"
 
 local INV_Z<const> = true
 local INF_F<const> = true
@@ -353,4 +354,23 @@ local ipu = {}
 function ipu.pick(x, y, cb)
 	open_pickup(x, y, cb)
 end
+
+-- pick with the scene aabbs in the aabb tree, it's not pixel exact, but no need to wait the pickup queue.
+-- return the eids hit by the ray of the screen point, front to back, and their distances
+function ipu.raycast(x, y)
+	local mq = w:first "main_queue camera_ref:in render_target:in"
+	local main_vr = mq.render_target.view_rect
+
+	local ndc2D = mu.pt2D_to_NDC(cvt_clickpt({x, y}, main_vr.ratio), main_vr)
+	local eye, at = mu.NDC_near_far_pt(ndc2D)
+
+	if INV_Z then
+		eye, at = at, eye
+	end
+
+	local ivp = math3d.inverse(find_camera(mq.camera_ref).viewprojmat)
+	eye = math3d.transformH(ivp, eye, 1)
+	at = math3d.transformH(ivp, at, 1)
+	return scenecore.raycast(eye, math3d.sub(at, eye))
+end
 return ipu
@@ -61,6 +61,9 @@ local SYS_ATTRIBS = {
 	u_indirect_modulate_color=uniform_value(matutil.ONE_PT),
 	u_time					= uniform_value(ZERO),
 
+	--skinning
+	b_skinning_palette		= buffer_value(13, "r"),
+
 	--IBL
 	u_ibl_param				= uniform_value(ZERO),
 	u_irradianceSH			= uniform_value(default_irradiance_SH_value(), default_irradiance_SH_utype()),
@@ -8,6 +8,10 @@ extern "C"{
 }
 
 #include "../render/queue.h"
+#include "../render/mesh_lod.h"
+#include "frustum_cull.h"
+#include "occlusion_cull.h"
+#include "aabb_tree.h"
 
 #include <cassert>
 #include <cstring>
@@ -15,28 +19,225 @@ extern "C"{
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <bit>
+#include <cmath>
 
 
-using tags = std::vector<int>;
-using cull_infos = std::unordered_map<uint64_t, tags>;
+constexpr uint8_t MAX_QUEUE_COUNT = 64;
 
 struct cullinfo{
 	math_t	mid;
+	math_t	viewproj;
 	uint8_t n;
 	uint8_t	queue_indices[256];
 };
 
+struct cull_entity {
+	uint64_t	eid;
+	int			cull_idx;
+	uint64_t	aabb;	// scene_aabb id, it can be replaced without scene_changed, ex: skinning
+	bool		indexed;	// in the aabb tree, it's false for the null scene_aabb which is never culled
+};
+
+// user data of the aabb tree leaf: the index in the cull_set, HITCH_SET_BIT for hitch_set
+static constexpr uint32_t HITCH_SET_BIT = 0x80000000;
+
+// the scene_aabb of the cullable entities in SoA, the bounds are only updated when they changed
+struct cull_set {
+	std::vector<cull_entity>	entities;
+	cull_bounds					bounds;
+	std::unordered_map<uint64_t, uint32_t>	index;	// eid -> entities index
+	std::vector<uint32_t>		dirty;
+	std::vector<uint64_t>		culled;		// bit f: out of frustums[f]
+	std::vector<uint8_t>		occluded;	// behind the occluders, for occlusion_queues
+
+	void mark(uint64_t eid){
+		auto it = index.find(eid);
+		if (it != index.end()){
+			dirty.push_back(it->second);
+		}
+	}
+};
+
+// the projected radius of a bounding sphere is r * sy / w, in the half height of the viewport
+struct lod_frustum {
+	float	wrow[4];	// the 4th row of viewprojmat, w in clip space
+	float	sy;			// the length of the 2nd row(xyz), 0 if the frustum has no viewprojmat
+};
+
 struct cull_cached {
 	cull_cached(struct ecs_context* ctx) : render_obj(ctx), hitch_obj(ctx){}
-	ecs::cached_context<component::render_object_visible, component::render_object, component::bounding> render_obj;
-	ecs::cached_context<component::hitch_visible, component::hitch, component::bounding> hitch_obj;
-}; 
+	ecs::cached_context<component::render_object_visible, component::eid, component::render_object, component::bounding> render_obj;
+	ecs::cached_context<component::hitch_visible, component::eid, component::hitch, component::bounding> hitch_obj;
+
+	cull_set	render_set;
+	cull_set	hitch_set;
+
+	// cull_args are rebuilt when camera changed, keep the planes for the moved entities in the other frames
+	cull_frustum	frustums[MAX_CULL_FRUSTUM];
+	uint64_t		frustum_queues[MAX_CULL_FRUSTUM];
+	uint64_t		all_queues = 0;
+	uint8_t			nfrustum = 0;
+
+	bool simd = true;
+	bool spatial = true;
+
+	// occlusion culling is enabled when occlusion_queues isn't 0
+	occlusion_buffer	occlusion;
+	uint64_t		occlusion_queues = 0;
+	uint32_t		occluder_count = 0;
+	bool			occlusion_dirty = true;
+
+	// LOD selection of the mesh_lod entities, see select_lod
+	lod_frustum		lod_frustums[MAX_CULL_FRUSTUM];
+	float			lod_threshold[MAX_QUEUE_COUNT] = {};
+	float			lod_view_height[MAX_QUEUE_COUNT] = {};	// pixels, for the projected size of mesh_lod
+	float			lod_hysteresis = 0.25f;
+	bool			lod = true;
+	uint32_t		lod_selected = 0;	// the entities selected in the last frame
+	uint32_t		lod_changed = 0;	// the entities which LOD changed in the last frame
+};
+
+static inline const float*
+aabb_value(struct ecs_world *w, const component::bounding &b){
+	return math_isnull(b.scene_aabb) ? nullptr : math_value(w->math3d->M, b.scene_aabb);
+}
+
+// the aabb tree is refitted in bounding_update, the scene_aabb replaced out of it is updated here,
+// and the leaves are tagged with the indices of the cull_set
+template<typename ObjType, typename Cached>
+static void
+sync_entities(struct ecs_world *w, cull_set &s, Cached &cached, uint32_t setbit){
+	auto tree = w->aabb_tree;
+	uint32_t n = 0;
+	bool moved = false;
+	for (auto& e : ecs::cached_select(cached)) {
+		const auto eid = e.template get<component::eid>();
+		const auto &o = e.template get<ObjType>();
+		const auto &b = e.template get<component::bounding>();
+		if (n == s.entities.size()){
+			s.entities.push_back(cull_entity{UINT64_MAX, -1, 0, false});
+			s.bounds.resize(n+1);
+			s.culled.push_back(0);
+			s.occluded.push_back(0);
+		}
+		auto &ce = s.entities[n];
+		if (ce.eid != eid || ce.cull_idx != o.cull_idx || ce.aabb != b.scene_aabb.idx){
+			if (ce.eid != eid){
+				moved = true;
+				s.occluded[n] = 0;
+				if (tree && ce.indexed)
+					tree->set_user(ce.eid, aabb_tree::NO_USER);
+			}
+			const float *aabb = aabb_value(w, b);
+			ce = cull_entity{(uint64_t)eid, o.cull_idx, b.scene_aabb.idx, aabb != nullptr};
+			s.bounds.set(n, aabb);
+			s.dirty.push_back(n);
+			if (tree){
+				tree->update(eid, aabb);
+				tree->set_user(eid, n | setbit);
+			}
+		}
+		++n;
+	}
+	if (n != s.entities.size()){
+		moved = true;
+		if (tree){
+			for (size_t ii=n; ii<s.entities.size(); ++ii){
+				if (s.entities[ii].indexed)
+					tree->set_user(s.entities[ii].eid, aabb_tree::NO_USER);
+			}
+		}
+		s.entities.resize(n);
+		s.bounds.resize(n);
+		s.culled.resize(n);
+		s.occluded.resize(n);
+	}
+	if (moved){
+		s.index.clear();
+		for (uint32_t ii=0; ii<n; ++ii){
+			s.index[s.entities[ii].eid] = ii;
+			if (tree && s.entities[ii].indexed)
+				tree->set_user(s.entities[ii].eid, ii | setbit);
+		}
+	}
+}
+
+static inline uint64_t
+culled_queues(struct cull_cached *cc, uint64_t culled){
+	uint64_t value = 0;
+	for (uint8_t f=0; f<cc->nfrustum; ++f){
+		if (culled & (1ull << f)){
+			value |= cc->frustum_queues[f];
+		}
+	}
+	return value;
+}
+
+static inline void
+write_culled(struct cull_cached *cc, struct ecs_world *w, const cull_set &s, uint32_t idx){
+	const auto &ce = s.entities[idx];
+	if (ce.cull_idx < 0)
+		return;
+	uint64_t value = culled_queues(cc, s.culled[idx]);
+	if (s.occluded[idx]){
+		value |= cc->occlusion_queues;
+	}
+	queue_set_mask(w->Q, ce.cull_idx, cc->all_queues | cc->occlusion_queues, value);
+}
+
+static void
+cull_all(struct cull_cached *cc, struct ecs_world *w, cull_set &s){
+	const uint32_t n = (uint32_t)s.entities.size();
+	frustum_cull(s.bounds, 0, n, cc->frustums, cc->nfrustum, s.culled.data());
+	for (uint32_t ii=0; ii<n; ++ii){
+		write_culled(cc, w, s, ii);
+	}
+}
 
 static inline void
-set_mark(int64_t &s, uint64_t m, bool set){
-	s = set ? (s|m) : (s&(~m));
+init_tree_culled(cull_set &s, uint64_t all){
+	const uint32_t n = (uint32_t)s.entities.size();
+	for (uint32_t ii=0; ii<n; ++ii){
+		s.culled[ii] = s.entities[ii].indexed ? all : 0;
+	}
 }
 
+// the subtrees out of all the frustums are skipped, the leaves totally in the frustums need not be tested
+static void
+cull_tree(struct cull_cached *cc, struct ecs_world *w){
+	auto &rs = cc->render_set;
+	auto &hs = cc->hitch_set;
+	const uint64_t all = cc->nfrustum == 64 ? ~0ull : (1ull << cc->nfrustum) - 1;
+	init_tree_culled(rs, all);
+	init_tree_culled(hs, all);
+
+	static_assert(sizeof(cull_frustum) == sizeof(float) * 24);
+	w->aabb_tree->query_frustums(cc->frustums[0].planes[0], cc->nfrustum, [cc, &rs, &hs, all](uint64_t, uint32_t user, uint64_t visible, uint64_t inside){
+		if (user == aabb_tree::NO_USER)
+			return;
+		cull_set &s = (user & HITCH_SET_BIT) ? hs : rs;
+		const uint32_t idx = user & ~HITCH_SET_BIT;
+		s.culled[idx] = (visible == inside) ? (all & ~inside) : frustum_cull_one(s.bounds, idx, cc->frustums, cc->nfrustum);
+	});
+
+	for (auto s : {&rs, &hs}){
+		const uint32_t n = (uint32_t)s->entities.size();
+		for (uint32_t ii=0; ii<n; ++ii){
+			write_culled(cc, w, *s, ii);
+		}
+	}
+}
+
+static void
+cull_dirty(struct cull_cached *cc, struct ecs_world *w, cull_set &s){
+	for (auto idx : s.dirty){
+		s.culled[idx] = frustum_cull_one(s.bounds, idx, cc->frustums, cc->nfrustum);
+		write_culled(cc, w, s, idx);
+	}
+}
+
+// the old path, one math3d call for each entity and frustum, it's kept for comparing
 template<typename ObjType>
 struct cull_operation{
 	template<typename EntityType>
@@ -50,7 +251,6 @@ struct cull_operation{
 				for (uint8_t iq=0; iq<ci[ii].n; ++iq){
 					queue_set(w->Q, o.cull_idx, ci[ii].queue_indices[iq], isculled);
 				}
-				//set_mark(o.cull_masks, ci[ii].masks, isculled);
 			}
 		}
 	}
@@ -70,16 +270,10 @@ lexit(lua_State *L) {
 	return 0;
 }
 
-constexpr uint8_t MAX_QUEUE_COUNT = 64;
-
-static int
-lcull(lua_State *L) {
-	auto w = getworld(L);
-
+static uint8_t
+fetch_cull_info(struct ecs_world *w, struct cullinfo *ci){
 	uint8_t c = 0;
-	struct cullinfo ci[MAX_QUEUE_COUNT];
-
-	auto add_cull_info = [&ci, &c](math_t mid, uint8_t queue_index){
+	auto add_cull_info = [ci, &c](math_t mid, math_t viewproj, uint8_t queue_index){
 		assert(c < MAX_QUEUE_COUNT);
 
 		uint8_t idx = MAX_QUEUE_COUNT;
@@ -92,6 +286,7 @@ lcull(lua_State *L) {
 		if (idx == MAX_QUEUE_COUNT){
 			struct cullinfo i;
 			i.mid = mid;
+			i.viewproj = viewproj;
 			i.queue_indices[0] = queue_index;
 			i.n = 1;
 			ci[c++] = i;
@@ -102,24 +297,359 @@ lcull(lua_State *L) {
 		}
 	};
 
+	auto cc = w->cull_cached;
 	for (auto& i : ecs::array<component::cull_args>(w->ecs)){
-		add_cull_info(i.frustum_planes, i.queue_index);
+		add_cull_info(i.frustum_planes, i.viewprojmat, i.queue_index);
+		cc->lod_threshold[i.queue_index] = i.lod_threshold;
+		cc->lod_view_height[i.queue_index] = i.view_height;
+	}
+	return c;
+}
+
+static void
+update_frustums(struct ecs_world *w, const struct cullinfo *ci, uint8_t c){
+	auto cc = w->cull_cached;
+	cc->nfrustum = c;
+	cc->all_queues = 0;
+	for (uint8_t ii=0; ii<c; ++ii){
+		const float *planes = math_value(w->math3d->M, ci[ii].mid);
+		memcpy(cc->frustums[ii].planes, planes, sizeof(cc->frustums[ii].planes));
+		uint64_t queues = 0;
+		for (uint8_t iq=0; iq<ci[ii].n; ++iq){
+			queues |= 1ull << ci[ii].queue_indices[iq];
+		}
+		cc->frustum_queues[ii] = queues;
+		cc->all_queues |= queues;
+
+		auto &lf = cc->lod_frustums[ii];
+		lf.sy = 0.f;
+		if (!math_isnull(ci[ii].viewproj)){
+			const float *m = math_value(w->math3d->M, ci[ii].viewproj);
+			lf.wrow[0] = m[3]; lf.wrow[1] = m[7]; lf.wrow[2] = m[11]; lf.wrow[3] = m[15];
+			lf.sy = std::sqrt(m[1] * m[1] + m[5] * m[5] + m[9] * m[9]);
+		}
+	}
+}
+
+// LOD n is good when error(n) * size <= 1, size is the projected radius divided by the threshold of the queue.
+// the next coarser LOD needs error * size <= 1 - hysteresis, the current one is kept until error * size > 1 + hysteresis
+static inline uint8_t
+select_lod(const component::mesh_lod &l, float size, uint8_t cur, float hysteresis){
+	if (cur > l.levels)
+		cur = 0;
+	uint8_t target = 0;
+	for (uint8_t n=1; n<=l.levels; ++n){
+		if (mesh_lod_error(l, n) * size <= 1.f)
+			target = n;
+	}
+	if (target > cur){
+		while (target > cur && mesh_lod_error(l, target) * size > 1.f - hysteresis)
+			--target;
+	} else if (target < cur && mesh_lod_error(l, cur) * size <= 1.f + hysteresis){
+		target = cur;
+	}
+	return target;
+}
+
+// return true if the selection changed. the projected size(l.size) is updated even if the LOD selection is disabled
+static bool
+update_lod(struct cull_cached *cc, const float *aabb, component::mesh_lod &l){
+	const component::mesh_lod old = l;
+	l.select0 = l.select1 = 0;
+	l.size = 0;
+	if (aabb){
+		const float c[3] = {(aabb[0] + aabb[4]) * 0.5f, (aabb[1] + aabb[5]) * 0.5f, (aabb[2] + aabb[6]) * 0.5f};
+		const float e[3] = {(aabb[4] - aabb[0]) * 0.5f, (aabb[5] - aabb[1]) * 0.5f, (aabb[6] - aabb[2]) * 0.5f};
+		const float r = std::sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+		float pixels = 0.f;
+		for (uint8_t f=0; f<cc->nfrustum; ++f){
+			const auto &lf = cc->lod_frustums[f];
+			if (lf.sy == 0.f)
+				continue;
+			const float w = lf.wrow[0] * c[0] + lf.wrow[1] * c[1] + lf.wrow[2] * c[2] + lf.wrow[3];
+			// the viewpoint is in the bounding sphere, keep LOD 0 and the full size
+			if (w <= r){
+				pixels = MESH_LOD_SIZE_FULL;
+				continue;
+			}
+			const float size = r * lf.sy / w;
+			for (uint64_t m = cc->frustum_queues[f]; m; m &= m - 1){
+				const uint8_t q = (uint8_t)std::countr_zero(m);
+				// the diameter in pixels, the viewport is 2 in ndc
+				pixels = std::max(pixels, size * cc->lod_view_height[q]);
+				if (cc->lod)
+					mesh_lod_set(l, q, select_lod(l, size / cc->lod_threshold[q], mesh_lod_get(old, q), cc->lod_hysteresis));
+			}
+		}
+		l.size = (uint16_t)std::min(std::ceil(pixels), (float)MESH_LOD_SIZE_FULL);
+	}
+	return l.select0 != old.select0 || l.select1 != old.select1;
+}
+
+// all the mesh_lod entities when the frustums changed, or the moved ones
+static void
+select_lods(struct cull_cached *cc, struct ecs_world *w, bool frustum_changed){
+	uint32_t selected = 0, changed = 0;
+	auto update = [&](auto &e){
+		++selected;
+		if (update_lod(cc, aabb_value(w, e.template get<component::bounding>()), e.template get<component::mesh_lod>()))
+			++changed;
+	};
+	if (frustum_changed){
+		for (auto& e : ecs::select<component::mesh_lod, component::bounding>(w->ecs)) {
+			update(e);
+		}
+	} else {
+		for (auto& e : ecs::select<component::scene_changed, component::mesh_lod, component::bounding>(w->ecs)) {
+			update(e);
+		}
+	}
+	cc->lod_selected = selected;
+	cc->lod_changed = changed;
+}
+
+// cull(frustum_changed) : cull_args are valid only when frustum_changed, it's called every frame
+// for the moved/created entities
+static int
+lcull(lua_State *L) {
+	auto w = getworld(L);
+	auto cc = w->cull_cached;
+	const bool frustum_changed = lua_toboolean(L, 1) != 0;
+
+	struct cullinfo ci[MAX_QUEUE_COUNT];
+	const uint8_t c = frustum_changed ? fetch_cull_info(w, ci) : 0;
+
+	if (!cc->simd){
+		if (0 == c)
+			return 0;
+		for (auto e : ecs::cached_select(cc->render_obj)) {
+			cull_operation<component::render_object>::cull(w, e, ci, c);
+		}
+
+		for (auto& e : ecs::cached_select(cc->hitch_obj)) {
+			cull_operation<component::hitch>::cull(w, e, ci, c);
+		}
+		return 0;
+	}
+
+	if (frustum_changed){
+		update_frustums(w, ci, c);
+	}
+
+	auto &rs = cc->render_set;
+	auto &hs = cc->hitch_set;
+	rs.dirty.clear();
+	hs.dirty.clear();
+	sync_entities<component::render_object>(w, rs, cc->render_obj, 0);
+	sync_entities<component::hitch>(w, hs, cc->hitch_obj, HITCH_SET_BIT);
+
+	for (auto& e : ecs::select<component::scene_changed, component::eid, component::bounding>(w->ecs)) {
+		const uint64_t eid = (uint64_t)e.get<component::eid>();
+		const size_t rn = rs.dirty.size(), hn = hs.dirty.size();
+		rs.mark(eid);
+		hs.mark(eid);
+		if (rn != rs.dirty.size() || hn != hs.dirty.size()){
+			const float *aabb = aabb_value(w, e.get<component::bounding>());
+			if (rn != rs.dirty.size())
+				rs.bounds.set(rs.dirty.back(), aabb);
+			if (hn != hs.dirty.size())
+				hs.bounds.set(hs.dirty.back(), aabb);
+		}
+	}
+
+	if (frustum_changed || !rs.dirty.empty() || !hs.dirty.empty()){
+		cc->occlusion_dirty = true;
+	}
+
+	if (0 == cc->nfrustum)
+		return 0;
+
+	if (frustum_changed){
+		if (cc->spatial && w->aabb_tree){
+			cull_tree(cc, w);
+		} else {
+			cull_all(cc, w, rs);
+			cull_all(cc, w, hs);
+		}
+	} else {
+		cull_dirty(cc, w, rs);
+		cull_dirty(cc, w, hs);
+	}
+	select_lods(cc, w, frustum_changed);
+	return 0;
+}
+
+// simd(enable) : false to use the old path, for comparing. return the simd instruction set name
+static int
+lsimd(lua_State *L) {
+	auto w = getworld(L);
+	if (!lua_isnoneornil(L, 1)){
+		w->cull_cached->simd = lua_toboolean(L, 1) != 0;
+	}
+	lua_pushstring(L, w->cull_cached->simd ? frustum_cull_simd() : "math3d");
+	return 1;
+}
+
+static void
+occlusion_test(struct cull_cached *cc, struct ecs_world *w, cull_set &s){
+	auto &ob = cc->occlusion;
+	const uint32_t n = (uint32_t)s.entities.size();
+	for (uint32_t ii=0; ii<n; ++ii){
+		const auto &ce = s.entities[ii];
+		bool occluded = false;
+		// the entities culled by the frustums of the occlusion queues need not be tested
+		if (ce.indexed && ce.cull_idx >= 0 &&
+			(culled_queues(cc, s.culled[ii]) & cc->occlusion_queues) != cc->occlusion_queues){
+			const float c[3] = {s.bounds.cx[ii], s.bounds.cy[ii], s.bounds.cz[ii]};
+			const float e[3] = {s.bounds.ex[ii], s.bounds.ey[ii], s.bounds.ez[ii]};
+			occluded = ob.test(c, e);
+		}
+		if (occluded != (s.occluded[ii] != 0)){
+			s.occluded[ii] = occluded ? 1 : 0;
+			write_culled(cc, w, s, ii);
+		}
+	}
+}
+
+static void
+clear_occluded(struct cull_cached *cc, struct ecs_world *w, cull_set &s){
+	const uint32_t n = (uint32_t)s.entities.size();
+	for (uint32_t ii=0; ii<n; ++ii){
+		if (s.occluded[ii]){
+			s.occluded[ii] = 0;
+			write_culled(cc, w, s, ii);
+		}
 	}
+}
 
-	if (0 == c)
+// occlusion(viewprojmat, queues) : it's called after cull, the occluders are rasterized with viewprojmat,
+// the entities behind them are culled in the queues(bit mask of the queue indices). occlusion() to disable it.
+// the buffer is rebuilt only when the camera, the occluders or the entities changed
+static int
+locclusion(lua_State *L) {
+	auto w = getworld(L);
+	auto cc = w->cull_cached;
+	auto &rs = cc->render_set;
+	auto &hs = cc->hitch_set;
+	if (lua_isnoneornil(L, 1) || !cc->simd){
+		if (cc->occlusion_queues){
+			clear_occluded(cc, w, rs);
+			clear_occluded(cc, w, hs);
+			cc->occlusion_queues = 0;
+		}
 		return 0;
+	}
+	auto math3d = w->math3d->M;
+	const float *viewproj = math_value(math3d, math3d_from_lua_id(L, w->math3d, 1));
+	const uint64_t queues = (uint64_t)luaL_checkinteger(L, 2);
+	if (queues != cc->occlusion_queues){
+		clear_occluded(cc, w, rs);
+		clear_occluded(cc, w, hs);
+		cc->occlusion_queues = queues;
+		cc->occlusion_dirty = true;
+	}
 
-	for (auto e : ecs::cached_select(w->cull_cached->render_obj)) {
-		cull_operation<component::render_object>::cull(w, e, ci, c);
+	uint32_t occluder_count = 0;
+	for (auto& e : ecs::select<component::occluder, component::scene>(w->ecs)) {
+		(void)e;
+		++occluder_count;
+	}
+	if (occluder_count != cc->occluder_count){
+		cc->occluder_count = occluder_count;
+		cc->occlusion_dirty = true;
+	}
+	for (auto& e : ecs::select<component::occluder, component::scene_changed>(w->ecs)) {
+		(void)e;
+		cc->occlusion_dirty = true;
+		break;
 	}
 
-	for (auto& e : ecs::cached_select(w->cull_cached->hitch_obj)) {
-		cull_operation<component::hitch>::cull(w, e, ci, c);
+	auto &ob = cc->occlusion;
+	if (!cc->occlusion_dirty && !ob.depth.empty() && 0 == memcmp(ob.viewproj, viewproj, sizeof(ob.viewproj)))
+		return 0;
+	cc->occlusion_dirty = false;
+
+	ob.begin(viewproj);
+	// only the inner boxes of occluder, the bounding aabb is bigger than the mesh so it would cull the visible ones
+	for (auto& e : ecs::select<component::occluder, component::scene>(w->ecs)) {
+		const auto &o = e.get<component::occluder>();
+		if (math_isnull(o.aabb))
+			continue;
+		ob.rasterize_box(math_value(math3d, e.get<component::scene>().worldmat), math_value(math3d, o.aabb));
 	}
+	ob.end();
 
+	occlusion_test(cc, w, rs);
+	occlusion_test(cc, w, hs);
 	return 0;
 }
 
+static int
+locclusion_stat(lua_State *L) {
+	auto w = getworld(L);
+	const auto &s = w->cull_cached->occlusion.stat;
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, s.occluders);
+	lua_setfield(L, -2, "occluders");
+	lua_pushinteger(L, s.faces);
+	lua_setfield(L, -2, "faces");
+	lua_pushinteger(L, s.tested);
+	lua_setfield(L, -2, "tested");
+	lua_pushinteger(L, s.occluded);
+	lua_setfield(L, -2, "occluded");
+	return 1;
+}
+
+// spatial(enable) : false to test all the entities instead of traversing the aabb tree
+static int
+lspatial(lua_State *L) {
+	auto w = getworld(L);
+	if (!lua_isnoneornil(L, 1)){
+		w->cull_cached->spatial = lua_toboolean(L, 1) != 0;
+	}
+	lua_pushboolean(L, w->cull_cached->spatial && w->aabb_tree);
+	return 1;
+}
+
+// lod(enable) : false to draw LOD 0 in all the queues. return whether the LOD selection is enabled
+static int
+llod(lua_State *L) {
+	auto w = getworld(L);
+	auto cc = w->cull_cached;
+	if (!lua_isnoneornil(L, 1)){
+		const bool enable = lua_toboolean(L, 1) != 0;
+		if (enable != cc->lod){
+			cc->lod = enable;
+			// the selection is cleared or rebuilt with the last frustums
+			select_lods(cc, w, true);
+		}
+	}
+	lua_pushboolean(L, cc->lod);
+	return 1;
+}
+
+// lod_hysteresis(h) : the ratio of the threshold, see select_lod
+static int
+llod_hysteresis(lua_State *L) {
+	auto w = getworld(L);
+	const float h = (float)luaL_checknumber(L, 1);
+	luaL_argcheck(L, h >= 0.f && h < 1.f, 1, "hysteresis should be in [0, 1)");
+	w->cull_cached->lod_hysteresis = h;
+	return 0;
+}
+
+static int
+llod_stat(lua_State *L) {
+	auto w = getworld(L);
+	auto cc = w->cull_cached;
+	lua_createtable(L, 0, 2);
+	lua_pushinteger(L, cc->lod_selected);
+	lua_setfield(L, -2, "selected");
+	lua_pushinteger(L, cc->lod_changed);
+	lua_setfield(L, -2, "changed");
+	return 1;
+}
+
 extern "C" int
 luaopen_system_cull(lua_State *L) {
 	luaL_checkversion(L);
@@ -127,6 +657,13 @@ luaopen_system_cull(lua_State *L) {
 		{ "init", linit },
 		{ "exit", lexit },
 		{ "cull", lcull },
+		{ "simd", lsimd },
+		{ "spatial", lspatial },
+		{ "occlusion", locclusion },
+		{ "occlusion_stat", locclusion_stat },
+		{ "lod", llod },
+		{ "lod_hysteresis", llod_hysteresis },
+		{ "lod_stat", llod_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlibtable(L,l);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+// the SIMD operations of the culling, CULL_SIMD is not defined for the scalar path, define CULL_NO_SIMD to force it.
+// NEON needs aarch64 for vdivq_f32, the division must be exact to get the same result as the scalar path
+
+#if defined(CULL_NO_SIMD)
+#elif defined(__AVX__)
+#	include <immintrin.h>
+#	define CULL_SIMD "avx"
+using vfloat = __m256;
+using vbool = __m256;
+static constexpr uint32_t LANES = 8;
+static inline vfloat vload(const float *p)	{ return _mm256_loadu_ps(p); }
+static inline void vstore(float *p, vfloat a)	{ _mm256_storeu_ps(p, a); }
+static inline vfloat vsplat(float f)		{ return _mm256_set1_ps(f); }
+static inline vfloat vadd(vfloat a, vfloat b)	{ return _mm256_add_ps(a, b); }
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c)	{ return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+static inline vfloat vmul(vfloat a, vfloat b)	{ return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)	{ return _mm256_div_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)	{ return _mm256_max_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)	{ return _mm256_min_ps(a, b); }
+static inline vbool vfalse()				{ return _mm256_setzero_ps(); }
+static inline vbool vless0(vfloat a)		{ return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ); }
+static inline vbool vgreater0(vfloat a)		{ return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ); }
+static inline vbool vor(vbool a, vbool b)	{ return _mm256_or_ps(a, b); }
+static inline vbool vnot(vbool a)			{ return _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+static inline vfloat vselect(vbool m, vfloat a, vfloat b)	{ return _mm256_blendv_ps(b, a, m); }
+static inline uint32_t vmask(vbool a)		{ return (uint32_t)_mm256_movemask_ps(a); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define CULL_SIMD "sse"
+using vfloat = __m128;
+using vbool = __m128;
+static constexpr uint32_t LANES = 4;
+static inline vfloat vload(const float *p)	{ return _mm_loadu_ps(p); }
+static inline void vstore(float *p, vfloat a)	{ _mm_storeu_ps(p, a); }
+static inline vfloat vsplat(float f)		{ return _mm_set1_ps(f); }
+static inline vfloat vadd(vfloat a, vfloat b)	{ return _mm_add_ps(a, b); }
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c)	{ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline vfloat vmul(vfloat a, vfloat b)	{ return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)	{ return _mm_div_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)	{ return _mm_max_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)	{ return _mm_min_ps(a, b); }
+static inline vbool vfalse()				{ return _mm_setzero_ps(); }
+static inline vbool vless0(vfloat a)		{ return _mm_cmplt_ps(a, _mm_setzero_ps()); }
+static inline vbool vgreater0(vfloat a)		{ return _mm_cmpgt_ps(a, _mm_setzero_ps()); }
+static inline vbool vor(vbool a, vbool b)	{ return _mm_or_ps(a, b); }
+static inline vbool vnot(vbool a)			{ return _mm_xor_ps(a, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+static inline vfloat vselect(vbool m, vfloat a, vfloat b)	{ return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+static inline uint32_t vmask(vbool a)		{ return (uint32_t)_mm_movemask_ps(a); }
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && (defined(__aarch64__) || defined(_M_ARM64))
+#	include <arm_neon.h>
+#	define CULL_SIMD "neon"
+using vfloat = float32x4_t;
+using vbool = uint32x4_t;
+static constexpr uint32_t LANES = 4;
+static inline vfloat vload(const float *p)	{ return vld1q_f32(p); }
+static inline void vstore(float *p, vfloat a)	{ vst1q_f32(p, a); }
+static inline vfloat vsplat(float f)		{ return vdupq_n_f32(f); }
+static inline vfloat vadd(vfloat a, vfloat b)	{ return vaddq_f32(a, b); }
+static inline vfloat vmadd(vfloat a, vfloat b, vfloat c)	{ return vaddq_f32(vmulq_f32(a, b), c); }
+static inline vfloat vmul(vfloat a, vfloat b)	{ return vmulq_f32(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b)	{ return vdivq_f32(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)	{ return vmaxq_f32(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)	{ return vminq_f32(a, b); }
+static inline vbool vfalse()				{ return vdupq_n_u32(0); }
+static inline vbool vless0(vfloat a)		{ return vcltq_f32(a, vdupq_n_f32(0.f)); }
+static inline vbool vgreater0(vfloat a)		{ return vcgtq_f32(a, vdupq_n_f32(0.f)); }
+static inline vbool vor(vbool a, vbool b)	{ return vorrq_u32(a, b); }
+static inline vbool vnot(vbool a)			{ return vmvnq_u32(a); }
+static inline vfloat vselect(vbool m, vfloat a, vfloat b)	{ return vbslq_f32(m, a, b); }
+static inline uint32_t vmask(vbool a) {
+	return	(vgetq_lane_u32(a, 0) & 1) | (vgetq_lane_u32(a, 1) & 2) |
+			(vgetq_lane_u32(a, 2) & 4) | (vgetq_lane_u32(a, 3) & 8);
+}
+#endif
@@ -6,13 +6,25 @@ local math3d				= require "math3d"
 local queuemgr				= ecs.require "queue_mgr"
 local setting				= import_package "ant.settings"
 local disable_cull<const>	= setting:get "graphic/disable_cull"
+local occlusion_cull		= setting:get "graphic/occlusion_cull"
+local LOD_THRESHOLD<const>	= setting:get "graphic/lod/threshold" or 0.001
+local LOD_HYSTERESIS<const>	= setting:get "graphic/lod/hysteresis" or 0.25
+local LOD_DEPTH_SCALE<const>= setting:get "graphic/lod/depth_scale" or 1.0
 
 local cullcore = world:clibs "cull.core"
 
+-- the depth only queues accept coarser LODs
+local function is_depth_queue(qn)
+	return qn == "pre_depth_queue" or qn:match "^csm%d+_queue$" ~= nil
+end
+
 local CULL_ARGS = setmetatable({}, {__index = function (t, k)
 	local v = {
 		queue_index		= queuemgr.queue_index(k),
 		frustum_planes	= nil,
+		viewprojmat		= nil,
+		view_height		= 0,
+		lod_threshold	= is_depth_queue(k) and LOD_THRESHOLD * LOD_DEPTH_SCALE or LOD_THRESHOLD,
 	}
 	t[k] = v
 	return v
@@ -20,27 +32,79 @@ end})
 
 
 local cull_sys = ecs.system "cull_system"
+local icull = {}
 
-cull_sys.init = cullcore.init
+function cull_sys:init()
+	cullcore.init()
+	cullcore.lod_hysteresis(LOD_HYSTERESIS)
+end
 cull_sys.exit = cullcore.exit
 
 local function build_cull_args()
 	w:clear "cull_args"
-	for qe in w:select "visible queue_name:in camera_ref:in cull_args:new" do
+	for qe in w:select "visible queue_name:in camera_ref:in render_target?in cull_args:new" do
 		local ce <close> = world:entity(qe.camera_ref, "camera:in")
 		local ca = CULL_ARGS[qe.queue_name]
 		ca.frustum_planes = math3d.frustum_planes(ce.camera.viewprojmat)
+		ca.viewprojmat = ce.camera.viewprojmat
+		ca.view_height = qe.render_target and qe.render_target.view_rect.h or 0
 		qe.cull_args = ca
 	end
 end
 
+-- the occluders are rasterized with the main camera, the queues share the camera are culled by them
+local function occlusion()
+	local mq = w:first "main_queue camera_ref:in"
+	if not mq then
+		return
+	end
+	local queues = 0
+	for qe in w:select "visible queue_name:in camera_ref:in" do
+		if qe.camera_ref == mq.camera_ref then
+			queues = queues | (1 << queuemgr.queue_index(qe.queue_name))
+		end
+	end
+	local ce <close> = world:entity(mq.camera_ref, "camera:in")
+	cullcore.occlusion(ce.camera.viewprojmat, queues)
+end
+
 function cull_sys:cull()
 	if disable_cull then
 		return
 	end
 
-	if w:check "camera_changed" then
+	local camera_changed = w:check "camera_changed"
+	if camera_changed then
 		build_cull_args()
-		cullcore.cull()
+	end
+	-- the moved entities are culled even the camera is not changed
+	cullcore.cull(camera_changed)
+	if occlusion_cull then
+		occlusion()
 	end
 end
+
+function icull.occlusion(enable)
+	if enable ~= nil and enable ~= occlusion_cull then
+		occlusion_cull = enable
+		if not enable then
+			cullcore.occlusion()
+		end
+	end
+	return occlusion_cull
+end
+
+function icull.occlusion_stat()
+	return cullcore.occlusion_stat()
+end
+
+-- lod(enable) : false to draw LOD 0 in all the queues, return whether LOD selection is enabled
+function icull.lod(enable)
+	return cullcore.lod(enable)
+end
+
+function icull.lod_stat()
+	return cullcore.lod_stat()
+end
+
+return icull
@@ -0,0 +1,135 @@
+#include "frustum_cull.h"
+#include "cull_simd.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+// the extents of the box which is never culled, |plane.xyz| is normalized, so it's always in front of the planes
+static constexpr float NEVER_CULLED_EXTENT = 1e30f;
+
+void
+cull_bounds::resize(uint32_t n){
+	cx.resize(n); cy.resize(n); cz.resize(n);
+	ex.resize(n); ey.resize(n); ez.resize(n);
+}
+
+void
+cull_bounds::set(uint32_t idx, const float *aabb){
+	assert(idx < size());
+	if (nullptr == aabb){
+		cx[idx] = cy[idx] = cz[idx] = 0.f;
+		ex[idx] = ey[idx] = ez[idx] = NEVER_CULLED_EXTENT;
+		return;
+	}
+	const float *minv = aabb, *maxv = aabb + 4;
+	cx[idx] = (minv[0] + maxv[0]) * 0.5f;	ex[idx] = (maxv[0] - minv[0]) * 0.5f;
+	cy[idx] = (minv[1] + maxv[1]) * 0.5f;	ey[idx] = (maxv[1] - minv[1]) * 0.5f;
+	cz[idx] = (minv[2] + maxv[2]) * 0.5f;	ez[idx] = (maxv[2] - minv[2]) * 0.5f;
+}
+
+// keep the same order of the operations as the SIMD version, so they get the same result
+static inline float
+plane_distance(const float *p, float cx, float cy, float cz, float ex, float ey, float ez){
+	float d = p[0] * cx + p[3];
+	d = p[1] * cy + d;
+	d = p[2] * cz + d;
+	d = std::fabs(p[0]) * ex + d;
+	d = std::fabs(p[1]) * ey + d;
+	d = std::fabs(p[2]) * ez + d;
+	return d;
+}
+
+uint64_t
+frustum_cull_one(const cull_bounds &b, uint32_t idx, const cull_frustum *frustums, uint32_t nfrustum){
+	assert(nfrustum <= MAX_CULL_FRUSTUM && idx < b.size());
+	uint64_t culled = 0;
+	for (uint32_t f=0; f<nfrustum; ++f){
+		for (const auto &p : frustums[f].planes){
+			if (plane_distance(p, b.cx[idx], b.cy[idx], b.cz[idx], b.ex[idx], b.ey[idx], b.ez[idx]) < 0.f){
+				culled |= 1ull << f;
+				break;
+			}
+		}
+	}
+	return culled;
+}
+
+#ifdef CULL_SIMD
+// splat the planes once, FRUSTUM_GROUP frustums for each pass over the boxes
+static constexpr uint32_t FRUSTUM_GROUP = 8;
+
+struct splat_plane {
+	vfloat n[3];
+	vfloat absn[3];
+	vfloat w;
+};
+
+static void
+cull_group(const cull_bounds &b, uint32_t first, uint32_t count, const cull_frustum *frustums, uint32_t fbase, uint32_t fn, uint64_t *culled){
+	splat_plane planes[FRUSTUM_GROUP][6];
+	for (uint32_t f=0; f<fn; ++f){
+		for (int ip=0; ip<6; ++ip){
+			const float *p = frustums[fbase+f].planes[ip];
+			auto &sp = planes[f][ip];
+			for (int ii=0; ii<3; ++ii){
+				sp.n[ii]	= vsplat(p[ii]);
+				sp.absn[ii]	= vsplat(std::fabs(p[ii]));
+			}
+			sp.w = vsplat(p[3]);
+		}
+	}
+
+	for (uint32_t ii=0; ii + LANES <= count; ii += LANES){
+		const uint32_t idx = first + ii;
+		const vfloat cx = vload(&b.cx[idx]), cy = vload(&b.cy[idx]), cz = vload(&b.cz[idx]);
+		const vfloat ex = vload(&b.ex[idx]), ey = vload(&b.ey[idx]), ez = vload(&b.ez[idx]);
+		for (uint32_t f=0; f<fn; ++f){
+			vbool out = vfalse();
+			for (const auto &sp : planes[f]){
+				vfloat d = vmadd(sp.n[0], cx, sp.w);
+				d = vmadd(sp.n[1], cy, d);
+				d = vmadd(sp.n[2], cz, d);
+				d = vmadd(sp.absn[0], ex, d);
+				d = vmadd(sp.absn[1], ey, d);
+				d = vmadd(sp.absn[2], ez, d);
+				out = vor(out, vless0(d));
+			}
+			const uint32_t m = vmask(out);
+			if (m){
+				const uint64_t bit = 1ull << (fbase + f);
+				for (uint32_t l=0; l<LANES; ++l){
+					if (m & (1u << l))
+						culled[ii+l] |= bit;
+				}
+			}
+		}
+	}
+}
+#endif //CULL_SIMD
+
+void
+frustum_cull(const cull_bounds &b, uint32_t first, uint32_t count, const cull_frustum *frustums, uint32_t nfrustum, uint64_t *culled){
+	assert(nfrustum <= MAX_CULL_FRUSTUM && first + count <= b.size());
+	memset(culled, 0, count * sizeof(*culled));
+	uint32_t ii = 0;
+#ifdef CULL_SIMD
+	for (uint32_t f=0; f<nfrustum; f += FRUSTUM_GROUP){
+		const uint32_t fn = (nfrustum - f) < FRUSTUM_GROUP ? (nfrustum - f) : FRUSTUM_GROUP;
+		cull_group(b, first, count, frustums, f, fn, culled);
+	}
+	ii = count - count % LANES;
+#endif //CULL_SIMD
+	for (; ii<count; ++ii){
+		culled[ii] = frustum_cull_one(b, first+ii, frustums, nfrustum);
+	}
+}
+
+const char*
+frustum_cull_simd(){
+#ifdef CULL_SIMD
+	return CULL_SIMD;
+#else
+	return "scalar";
+#endif
+}
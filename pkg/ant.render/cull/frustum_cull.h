@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+	AABBs are kept in SoA layout(center/extents), so 4(SSE/NEON) or 8(AVX) boxes are tested
+	against all the frustums at once.
+
+	A box is out of a plane when: dot(plane.xyz, center) + plane.w + dot(|plane.xyz|, extents) < 0,
+	it's the same test as math3d_frustum_intersect_aabb() < 0.
+*/
+
+static constexpr uint32_t MAX_CULL_FRUSTUM = 64;
+
+struct cull_frustum {
+	float planes[6][4];		// math3d.frustum_planes, left/right/bottom/top/near/far
+};
+
+struct cull_bounds {
+	std::vector<float> cx, cy, cz;
+	std::vector<float> ex, ey, ez;
+
+	uint32_t size() const { return (uint32_t)cx.size(); }
+	void resize(uint32_t n);
+	// aabb is math3d aabb value: min(vec4), max(vec4). nullptr for never culled
+	void set(uint32_t idx, const float *aabb);
+};
+
+// culled[ii] bit f is set if box [first+ii] is out of frustums[f]
+void frustum_cull(const cull_bounds &b, uint32_t first, uint32_t count, const cull_frustum *frustums, uint32_t nfrustum, uint64_t *culled);
+uint64_t frustum_cull_one(const cull_bounds &b, uint32_t idx, const cull_frustum *frustums, uint32_t nfrustum);
+
+// "avx", "sse", "neon" or "scalar"
+const char* frustum_cull_simd();
@@ -0,0 +1,34 @@
+local ecs = ...
+local math3d = require "math3d"
+local serialization = require "bee.serialization"
+
+-- the box rasterized into the occlusion buffer, in local space. it must be inside the mesh(an inner box),
+-- the entities behind it are culled, so a box bigger than the mesh culls the visible ones
+local o = ecs.component "occluder"
+
+function o.init(v)
+	if not (v and v.aabb) then
+		error "occluder needs an inner box: occluder = { aabb = {{minx, miny, minz}, {maxx, maxy, maxz}} }"
+	end
+	v.aabb = math3d.marked_aabb(v.aabb[1], v.aabb[2])
+	return v
+end
+
+function o.remove(v)
+	math3d.unmark(v.aabb)
+end
+
+function o.marshal(v)
+	return serialization.packstring(v)
+end
+
+function o.demarshal(s)
+	local occluder = serialization.unpack(s)
+	math3d.unmark(occluder.aabb)
+end
+
+function o.unmarshal(v)
+	local occluder = serialization.unpack(v)
+	math3d.mark(occluder.aabb)
+	return occluder
+end
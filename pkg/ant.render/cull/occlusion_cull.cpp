@@ -0,0 +1,528 @@
+#include "occlusion_cull.h"
+#include "cull_simd.h"
+
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// the occluders are clipped by w = NEAR_W, the boxes cross it are never occluded
+static constexpr float NEAR_W = 1e-3f;
+static constexpr float BUFFER_W = (float)OCCLUSION_WIDTH;
+static constexpr float BUFFER_H = (float)OCCLUSION_HEIGHT;
+static constexpr uint32_t TILE_X = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+static constexpr uint32_t TILE_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+static_assert(OCCLUSION_WIDTH % OCCLUSION_TILE_WIDTH == 0 && OCCLUSION_HEIGHT % OCCLUSION_TILE_HEIGHT == 0);
+// a quad clipped by the near plane, the silhouette is the hull of the front faces
+static constexpr int MAX_FACE_VERTEX = 5;
+static constexpr int MAX_HULL_VERTEX = 6 * MAX_FACE_VERTEX;
+// the coverage margin in pixels and the depth bias, the float errors never make the occluders bigger or nearer
+static constexpr float COVER_MARGIN = 1.f / 64.f;
+static constexpr float DEPTH_BIAS = 0.9999f;
+// the scratch value of the pixels no face overlaps
+static constexpr float NO_DEPTH = FLT_MAX;
+
+#ifdef CULL_SIMD
+static_assert(OCCLUSION_WIDTH % LANES == 0);
+#endif //CULL_SIMD
+
+struct clip_vertex {
+	float x, y, w;
+};
+
+struct screen_vertex {
+	float x, y, iw;
+};
+
+// the corners of the faces are counter clockwise seen from outside, (p1-p0) x (p2-p0) is the normal
+static const uint8_t BOX_FACES[6][4] = {
+	{0, 4, 6, 2},	// -x
+	{1, 3, 7, 5},	// +x
+	{0, 1, 5, 4},	// -y
+	{2, 6, 7, 3},	// +y
+	{0, 2, 3, 1},	// -z
+	{4, 5, 7, 6},	// +z
+};
+
+// the signs of the extents for the box corners, as box_corner
+static const float CORNER_SIGNS[3][8] = {
+	{-1.f, 1.f,-1.f, 1.f,-1.f, 1.f,-1.f, 1.f},
+	{-1.f,-1.f, 1.f, 1.f,-1.f,-1.f, 1.f, 1.f},
+	{-1.f,-1.f,-1.f,-1.f, 1.f, 1.f, 1.f, 1.f},
+};
+
+// r = a * b, column major
+static void
+mul_matrix(const float *a, const float *b, float *r){
+	for (int c=0; c<4; ++c){
+		for (int row=0; row<4; ++row){
+			r[c*4+row] = a[row] * b[c*4] + a[4+row] * b[c*4+1] + a[8+row] * b[c*4+2] + a[12+row] * b[c*4+3];
+		}
+	}
+}
+
+static inline clip_vertex
+transform(const float *m, float x, float y, float z){
+	return clip_vertex {
+		m[0] * x + m[4] * y + m[8]  * z + m[12],
+		m[1] * x + m[5] * y + m[9]  * z + m[13],
+		m[3] * x + m[7] * y + m[11] * z + m[15],
+	};
+}
+
+static inline screen_vertex
+to_screen(const clip_vertex &c){
+	const float iw = 1.f / c.w;
+	return screen_vertex {
+		(c.x * iw * 0.5f + 0.5f) * BUFFER_W,
+		(c.y * iw * 0.5f + 0.5f) * BUFFER_H,
+		iw,
+	};
+}
+
+// the aabb corner ii, bit 0/1/2 select the max of x/y/z
+static inline void
+box_corner(const float *aabb, int ii, float v[3]){
+	v[0] = aabb[(ii & 1) ? 4 : 0];
+	v[1] = aabb[(ii & 2) ? 5 : 1];
+	v[2] = aabb[(ii & 4) ? 6 : 2];
+}
+
+// the pixels whose center in [minv, maxv], clamped by [0, size)
+static inline bool
+pixel_range(float minv, float maxv, float size, int &first, int &last){
+	minv = std::max(minv - 0.5f, 0.f);
+	maxv = std::min(maxv - 0.5f, size - 1.f);
+	if (minv > maxv)
+		return false;
+	first = (int)std::ceil(minv);
+	last = (int)std::floor(maxv);
+	return first <= last;
+}
+
+struct edge {
+	float a, b, c;		// a * x + b * y + c
+};
+
+static inline edge
+make_edge(const screen_vertex &v0, const screen_vertex &v1){
+	const float a = v0.y - v1.y;
+	const float b = v1.x - v0.x;
+	return edge { a, b, -(a * v0.x + b * v0.y) };
+}
+
+// the edges of the convex polygon, positive inside. h is how much an edge changes in half a pixel(and the margin),
+// so e + h >= 0 at the center of the pixels overlap the polygon, and e - h >= 0 at the pixels inside it
+static int
+polygon_edges(const screen_vertex *v, int n, edge *e, float *h){
+	float area = 0.f;
+	for (int ii=0; ii<n; ++ii){
+		const screen_vertex &v0 = v[ii], &v1 = v[(ii+1) % n];
+		area += v0.x * v1.y - v1.x * v0.y;
+	}
+	if (!(std::fabs(area) > 1e-6f))
+		return 0;
+	for (int ii=0; ii<n; ++ii){
+		e[ii] = make_edge(v[ii], v[(ii+1) % n]);
+		if (area < 0){
+			e[ii].a = -e[ii].a; e[ii].b = -e[ii].b; e[ii].c = -e[ii].c;
+		}
+		h[ii] = (std::fabs(e[ii].a) + std::fabs(e[ii].b)) * (0.5f + COVER_MARGIN);
+	}
+	return n;
+}
+
+// 1/w on the plane of the polygon, from the largest triangle of the fan
+static bool
+depth_plane(const screen_vertex *v, int n, edge &z){
+	float best = 0.f;
+	int k = 0;
+	for (int ii=1; ii+1<n; ++ii){
+		const edge e = make_edge(v[ii], v[ii+1]);
+		const float area = std::fabs(e.a * v[0].x + e.b * v[0].y + e.c);
+		if (area > best){
+			best = area;
+			k = ii;
+		}
+	}
+	if (!(best > 1e-6f))
+		return false;
+	const screen_vertex &v0 = v[0], &v1 = v[k], &v2 = v[k+1];
+	// e0 is 0 on edge v1-v2, and it's the area at v0
+	const edge e0 = make_edge(v1, v2), e1 = make_edge(v2, v0), e2 = make_edge(v0, v1);
+	const float inv = 1.f / (e0.a * v0.x + e0.b * v0.y + e0.c);
+	z = edge {
+		(e0.a * v0.iw + e1.a * v1.iw + e2.a * v2.iw) * inv,
+		(e0.b * v0.iw + e1.b * v1.iw + e2.b * v2.iw) * inv,
+		(e0.c * v0.iw + e1.c * v1.iw + e2.c * v2.iw) * inv,
+	};
+	return true;
+}
+
+// the pixels overlap the bounds of the polygon
+static inline bool
+polygon_range(const screen_vertex *v, int n, int &x0, int &x1, int &y0, int &y1){
+	float minx = v[0].x, maxx = v[0].x, miny = v[0].y, maxy = v[0].y;
+	for (int ii=1; ii<n; ++ii){
+		minx = std::min(minx, v[ii].x); maxx = std::max(maxx, v[ii].x);
+		miny = std::min(miny, v[ii].y); maxy = std::max(maxy, v[ii].y);
+	}
+	return pixel_range(minx - 0.5f, maxx + 0.5f, BUFFER_W, x0, x1) && pixel_range(miny - 0.5f, maxy + 0.5f, BUFFER_H, y0, y1);
+}
+
+// the farthest 1/w of the face in the pixels it overlaps, the min of the faces is kept in scratch
+static void
+raster_face(float *scratch, const screen_vertex *v, int n){
+	edge e[MAX_FACE_VERTEX];
+	float h[MAX_FACE_VERTEX];
+	edge z;
+	int x0, x1, y0, y1;
+	if (!polygon_edges(v, n, e, h) || !depth_plane(v, n, z) || !polygon_range(v, n, x0, x1, y0, y1))
+		return;
+	const float hz = (std::fabs(z.a) + std::fabs(z.b)) * 0.5f;
+
+#ifdef CULL_SIMD
+	float offsets[LANES];
+	for (uint32_t l=0; l<LANES; ++l)
+		offsets[l] = (float)l + 0.5f;
+	const vfloat voffset = vload(offsets);
+	vfloat va[MAX_FACE_VERTEX];
+	for (int k=0; k<n; ++k)
+		va[k] = vsplat(e[k].a);
+	const vfloat vza = vsplat(z.a);
+	// the lanes out of [x0, x1] are masked, so they are the same as the scalar path
+	const vfloat vleft = vsplat(-((float)x0 + 0.5f)), vright = vsplat(-((float)x1 + 0.5f));
+	const int xs = x0 - x0 % (int)LANES;
+#endif //CULL_SIMD
+
+	for (int y=y0; y<=y1; ++y){
+		const float py = (float)y + 0.5f;
+		float r[MAX_FACE_VERTEX];
+		for (int k=0; k<n; ++k)
+			r[k] = e[k].b * py + e[k].c + h[k];
+		const float rz = z.b * py + z.c - hz;
+		float *row = scratch + y * OCCLUSION_WIDTH;
+#ifdef CULL_SIMD
+		vfloat vr[MAX_FACE_VERTEX];
+		for (int k=0; k<n; ++k)
+			vr[k] = vsplat(r[k]);
+		const vfloat vrz = vsplat(rz);
+		for (int x=xs; x<=x1; x += LANES){
+			const vfloat px = vadd(vsplat((float)x), voffset);
+			vbool out = vor(vless0(vadd(px, vleft)), vgreater0(vadd(px, vright)));
+			for (int k=0; k<n; ++k)
+				out = vor(out, vless0(vmadd(va[k], px, vr[k])));
+			const vfloat s = vload(row + x);
+			vstore(row + x, vselect(out, s, vmin(s, vmadd(vza, px, vrz))));
+		}
+#else
+		for (int x=x0; x<=x1; ++x){
+			const float px = (float)x + 0.5f;
+			bool out = false;
+			for (int k=0; k<n; ++k)
+				out = out || e[k].a * px + r[k] < 0;
+			if (!out)
+				row[x] = std::min(row[x], z.a * px + rz);
+		}
+#endif //CULL_SIMD
+	}
+}
+
+// the pixels inside the silhouette of the box are covered by the faces, they get the depth kept in scratch.
+// scratch is reset to NO_DEPTH in the bounds of the silhouette for the next box
+static void
+raster_silhouette(float *depth, float *scratch, const screen_vertex *v, int n){
+	int x0, x1, y0, y1;
+	if (!polygon_range(v, n, x0, x1, y0, y1))
+		return;
+	edge e[MAX_HULL_VERTEX];
+	float h[MAX_HULL_VERTEX];
+	if (!polygon_edges(v, n, e, h)){
+		for (int y=y0; y<=y1; ++y)
+			std::fill(scratch + y * OCCLUSION_WIDTH + x0, scratch + y * OCCLUSION_WIDTH + x1 + 1, NO_DEPTH);
+		return;
+	}
+
+#ifdef CULL_SIMD
+	float offsets[LANES];
+	for (uint32_t l=0; l<LANES; ++l)
+		offsets[l] = (float)l + 0.5f;
+	const vfloat voffset = vload(offsets);
+	vfloat va[MAX_HULL_VERTEX];
+	for (int k=0; k<n; ++k)
+		va[k] = vsplat(e[k].a);
+	const vfloat vleft = vsplat(-((float)x0 + 0.5f)), vright = vsplat(-((float)x1 + 0.5f));
+	const vfloat vnodepth = vsplat(NO_DEPTH), vbias = vsplat(DEPTH_BIAS);
+	const int xs = x0 - x0 % (int)LANES;
+#endif //CULL_SIMD
+
+	for (int y=y0; y<=y1; ++y){
+		const float py = (float)y + 0.5f;
+		float r[MAX_HULL_VERTEX];
+		for (int k=0; k<n; ++k)
+			r[k] = e[k].b * py + e[k].c - h[k];
+		float *row = depth + y * OCCLUSION_WIDTH;
+		float *srow = scratch + y * OCCLUSION_WIDTH;
+#ifdef CULL_SIMD
+		vfloat vr[MAX_HULL_VERTEX];
+		for (int k=0; k<n; ++k)
+			vr[k] = vsplat(r[k]);
+		for (int x=xs; x<=x1; x += LANES){
+			const vfloat px = vadd(vsplat((float)x), voffset);
+			const vfloat s = vload(srow + x);
+			vbool out = vor(vless0(vadd(px, vleft)), vgreater0(vadd(px, vright)));
+			out = vor(out, vnot(vless0(vadd(s, vsplat(-NO_DEPTH)))));
+			for (int k=0; k<n; ++k)
+				out = vor(out, vless0(vmadd(va[k], px, vr[k])));
+			const vfloat d = vload(row + x);
+			vstore(row + x, vselect(out, d, vmax(d, vmul(s, vbias))));
+			// the lanes out of [x0, x1] are NO_DEPTH too, no face is out of the silhouette
+			vstore(srow + x, vnodepth);
+		}
+#else
+		for (int x=x0; x<=x1; ++x){
+			const float px = (float)x + 0.5f;
+			const float s = srow[x];
+			srow[x] = NO_DEPTH;
+			bool out = !(s + -NO_DEPTH < 0);
+			for (int k=0; k<n; ++k)
+				out = out || e[k].a * px + r[k] < 0;
+			if (!out)
+				row[x] = std::max(row[x], s * DEPTH_BIAS);
+		}
+#endif //CULL_SIMD
+	}
+}
+
+static inline float
+cross(const screen_vertex &o, const screen_vertex &a, const screen_vertex &b){
+	return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// the convex hull of the points(they are sorted), counter clockwise. h has n+1 vertices at least
+static int
+convex_hull(screen_vertex *p, int n, screen_vertex *h){
+	std::sort(p, p + n, [](const screen_vertex &a, const screen_vertex &b){
+		return a.x < b.x || (a.x == b.x && a.y < b.y);
+	});
+	int k = 0;
+	for (int ii=0; ii<n; ++ii){
+		while (k >= 2 && cross(h[k-2], h[k-1], p[ii]) <= 0)
+			--k;
+		h[k++] = p[ii];
+	}
+	const int lower = k + 1;
+	for (int ii=n-2; ii>=0; --ii){
+		while (k >= lower && cross(h[k-2], h[k-1], p[ii]) <= 0)
+			--k;
+		h[k++] = p[ii];
+	}
+	return std::max(k - 1, 0);
+}
+
+static inline float
+det3(float ax, float ay, float aw, float bx, float by, float bw, float cx, float cy, float cw){
+	return ax * (by * cw - bw * cy) - bx * (ay * cw - aw * cy) + cx * (ay * bw - aw * by);
+}
+
+// clip the polygon by w >= NEAR_W, return the vertex count of the result
+static int
+clip_near(const clip_vertex *in, int n, clip_vertex *out){
+	int m = 0;
+	for (int ii=0; ii<n; ++ii){
+		const clip_vertex &a = in[ii];
+		const clip_vertex &b = in[(ii+1) % n];
+		const bool ain = a.w >= NEAR_W, bin = b.w >= NEAR_W;
+		if (ain)
+			out[m++] = a;
+		if (ain != bin){
+			const float t = (NEAR_W - a.w) / (b.w - a.w);
+			out[m++] = clip_vertex { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, NEAR_W };
+		}
+	}
+	return m;
+}
+
+void
+occlusion_buffer::begin(const float *vp){
+	memcpy(viewproj, vp, sizeof(viewproj));
+	depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0.f);
+	tiles.assign(TILE_X * TILE_Y, 0.f);
+	scratch.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, NO_DEPTH);
+	stat = occlusion_stat{0, 0, 0, 0};
+}
+
+void
+occlusion_buffer::end(){
+	for (uint32_t ty=0; ty<TILE_Y; ++ty){
+		for (uint32_t tx=0; tx<TILE_X; ++tx){
+			const float *p = depth.data() + ty * OCCLUSION_TILE_HEIGHT * OCCLUSION_WIDTH + tx * OCCLUSION_TILE_WIDTH;
+			float m = p[0];
+			for (uint32_t y=0; y<OCCLUSION_TILE_HEIGHT; ++y, p += OCCLUSION_WIDTH){
+				for (uint32_t x=0; x<OCCLUSION_TILE_WIDTH; ++x)
+					m = std::min(m, p[x]);
+			}
+			tiles[ty * TILE_X + tx] = m;
+		}
+	}
+}
+
+// true if any pixel in [x0, x1] is not nearer than iw
+static inline bool
+row_visible(const float *row, int x0, int x1, float iw){
+	int x = x0;
+#ifdef CULL_SIMD
+	const vfloat vz = vsplat(-iw);
+	for (; x + (int)LANES <= x1 + 1; x += LANES){
+		if (vmask(vnot(vgreater0(vadd(vload(row + x), vz)))))
+			return true;
+	}
+#endif //CULL_SIMD
+	for (; x<=x1; ++x){
+		if (!(row[x] + -iw > 0.f))
+			return true;
+	}
+	return false;
+}
+
+void
+occlusion_buffer::rasterize_box(const float *worldmat, const float *aabb){
+	assert(!depth.empty());
+	float m[16];
+	mul_matrix(viewproj, worldmat, m);
+
+	clip_vertex c[8];
+	bool allnear = true;
+	for (int ii=0; ii<8; ++ii){
+		float v[3];
+		box_corner(aabb, ii, v);
+		c[ii] = transform(m, v[0], v[1], v[2]);
+		allnear = allnear && c[ii].w < NEAR_W;
+	}
+	if (allnear)
+		return;
+
+	// the eye is (0, 0, 0) in (x, y, w). a face is front facing when [p1-p0, p2-p0, p0] has the opposite sign
+	// of the box space to (x, y, w) transform
+	const float orient = det3(m[0], m[1], m[3], m[4], m[5], m[7], m[8], m[9], m[11]);
+	screen_vertex faces[6][MAX_FACE_VERTEX];
+	int nvertex[6];
+	int nface = 0;
+	screen_vertex points[MAX_HULL_VERTEX];
+	int npoint = 0;
+	for (const auto &f : BOX_FACES){
+		const clip_vertex q[4] = {c[f[0]], c[f[1]], c[f[2]], c[f[3]]};
+		const float facing = det3(
+			q[1].x - q[0].x, q[1].y - q[0].y, q[1].w - q[0].w,
+			q[2].x - q[0].x, q[2].y - q[0].y, q[2].w - q[0].w,
+			q[0].x, q[0].y, q[0].w);
+		if (!(orient * facing < 0))
+			continue;
+		clip_vertex poly[MAX_FACE_VERTEX];
+		const int n = clip_near(q, 4, poly);
+		if (n < 3)
+			continue;
+		for (int ii=0; ii<n; ++ii){
+			faces[nface][ii] = points[npoint++] = to_screen(poly[ii]);
+		}
+		nvertex[nface++] = n;
+	}
+	if (nface == 0)
+		return;
+	++stat.occluders;
+
+	for (int ii=0; ii<nface; ++ii){
+		raster_face(scratch.data(), faces[ii], nvertex[ii]);
+		++stat.faces;
+	}
+	screen_vertex hull[MAX_HULL_VERTEX + 1];
+	const int nhull = convex_hull(points, npoint, hull);
+	raster_silhouette(depth.data(), scratch.data(), hull, nhull);
+}
+
+bool
+occlusion_buffer::test(const float c[3], const float e[3]){
+	assert(!tiles.empty());
+	++stat.tested;
+
+	// the corners are center +/- the columns of the extents
+	const clip_vertex cc = transform(viewproj, c[0], c[1], c[2]);
+	clip_vertex axis[3];
+	for (int ii=0; ii<3; ++ii){
+		axis[ii] = clip_vertex { viewproj[ii*4] * e[ii], viewproj[ii*4+1] * e[ii], viewproj[ii*4+3] * e[ii] };
+	}
+	if (cc.w - std::fabs(axis[0].w) - std::fabs(axis[1].w) - std::fabs(axis[2].w) < NEAR_W)
+		return false;
+
+	float minx = BUFFER_W, maxx = 0.f, miny = BUFFER_H, maxy = 0.f, maxiw = 0.f;
+#ifdef CULL_SIMD
+	static_assert(8 % LANES == 0);
+	for (uint32_t ii=0; ii<8; ii += LANES){
+		vfloat x = vsplat(cc.x), y = vsplat(cc.y), w = vsplat(cc.w);
+		for (int jj=0; jj<3; ++jj){
+			const vfloat s = vload(CORNER_SIGNS[jj] + ii);
+			x = vmadd(s, vsplat(axis[jj].x), x);
+			y = vmadd(s, vsplat(axis[jj].y), y);
+			w = vmadd(s, vsplat(axis[jj].w), w);
+		}
+		const vfloat half = vsplat(0.5f);
+		const vfloat iw = vdiv(vsplat(1.f), w);
+		float sx[LANES], sy[LANES], siw[LANES];
+		vstore(sx, vmul(vmadd(vmul(x, iw), half, half), vsplat(BUFFER_W)));
+		vstore(sy, vmul(vmadd(vmul(y, iw), half, half), vsplat(BUFFER_H)));
+		vstore(siw, iw);
+		for (uint32_t l=0; l<LANES; ++l){
+			minx = std::min(minx, sx[l]); maxx = std::max(maxx, sx[l]);
+			miny = std::min(miny, sy[l]); maxy = std::max(maxy, sy[l]);
+			maxiw = std::max(maxiw, siw[l]);
+		}
+	}
+#else
+	for (int ii=0; ii<8; ++ii){
+		clip_vertex v = cc;
+		for (int jj=0; jj<3; ++jj){
+			const float s = CORNER_SIGNS[jj][ii];
+			v.x = s * axis[jj].x + v.x;
+			v.y = s * axis[jj].y + v.y;
+			v.w = s * axis[jj].w + v.w;
+		}
+		const screen_vertex sv = to_screen(v);
+		minx = std::min(minx, sv.x); maxx = std::max(maxx, sv.x);
+		miny = std::min(miny, sv.y); maxy = std::max(maxy, sv.y);
+		maxiw = std::max(maxiw, sv.iw);
+	}
+#endif //CULL_SIMD
+	// one more pixel around the box, the occluders only cover the pixels whose center is in
+	int x0, x1, y0, y1;
+	if (!pixel_range(minx - 1.f, maxx + 1.f, BUFFER_W, x0, x1) ||
+		!pixel_range(miny - 1.f, maxy + 1.f, BUFFER_H, y0, y1))
+		return false;
+
+	const int tx0 = x0 / OCCLUSION_TILE_WIDTH, tx1 = x1 / OCCLUSION_TILE_WIDTH;
+	const int ty0 = y0 / OCCLUSION_TILE_HEIGHT, ty1 = y1 / OCCLUSION_TILE_HEIGHT;
+	for (int ty=ty0; ty<=ty1; ++ty){
+		for (int tx=tx0; tx<=tx1; ++tx){
+			if (tiles[ty * TILE_X + tx] + -maxiw > 0.f)
+				continue;
+			const int px0 = std::max(x0, tx * (int)OCCLUSION_TILE_WIDTH), px1 = std::min(x1, (tx+1) * (int)OCCLUSION_TILE_WIDTH - 1);
+			const int py0 = std::max(y0, ty * (int)OCCLUSION_TILE_HEIGHT), py1 = std::min(y1, (ty+1) * (int)OCCLUSION_TILE_HEIGHT - 1);
+			for (int y=py0; y<=py1; ++y){
+				if (row_visible(depth.data() + y * OCCLUSION_WIDTH, px0, px1, maxiw))
+					return false;
+			}
+		}
+	}
+	++stat.occluded;
+	return true;
+}
+
+uint64_t
+occlusion_buffer::checksum() const {
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *p = (const uint8_t *)depth.data();
+	for (size_t ii=0; ii<depth.size() * sizeof(float); ++ii){
+		h = (h ^ p[ii]) * 0x100000001b3ull;
+	}
+	return h;
+}
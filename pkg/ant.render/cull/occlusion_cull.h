@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+	Software occlusion culling: the occluder boxes are rasterized into a low resolution depth buffer,
+	then the aabbs of the objects are tested against it.
+
+	The buffer keeps 1/w(w is the view depth of the perspective projection) of the nearest occluder,
+	0 for empty. 1/w is linear in screen space, so it's interpolated exactly from the vertices.
+
+	The buffer is conservative: a pixel gets the depth of an occluder only when it's totally inside
+	the silhouette of the box, and the depth is the farthest one of the front faces in the pixel.
+	So a box is never occluded through a gap, whatever the resolution is.
+
+	The results only depend on the input: the scalar and the SIMD paths run the same operations
+	in the same order(no fused multiply-add), so they get the same buffer.
+*/
+
+static constexpr uint32_t OCCLUSION_WIDTH = 256;
+static constexpr uint32_t OCCLUSION_HEIGHT = 128;
+// the farthest depth of the tiles, most of the occluded boxes are decided by the tiles
+static constexpr uint32_t OCCLUSION_TILE_WIDTH = 8;
+static constexpr uint32_t OCCLUSION_TILE_HEIGHT = 4;
+
+struct occlusion_stat {
+	uint32_t occluders;
+	uint32_t faces;
+	uint32_t tested;
+	uint32_t occluded;
+};
+
+struct occlusion_buffer {
+	float viewproj[16];		// column major, as math3d matrix
+	std::vector<float> depth;	// OCCLUSION_WIDTH * OCCLUSION_HEIGHT, row major
+	std::vector<float> tiles;	// min depth of the tiles
+	std::vector<float> scratch;	// the depth of the faces of the box in rasterizing
+	occlusion_stat stat;
+
+	// clear the buffer for the new viewproj
+	void begin(const float *viewproj);
+	// aabb: local space box inside the occluder, math3d aabb value: min(vec4), max(vec4). worldmat: column major matrix
+	void rasterize_box(const float *worldmat, const float *aabb);
+	// build the tiles after all the occluders are rasterized
+	void end();
+	// world space box, true if it's totally behind the occluders
+	bool test(const float center[3], const float extents[3]);
+	// hash of the depth buffer, for checking the results on different platforms
+	uint64_t checksum() const;
+};
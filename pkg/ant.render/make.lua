@@ -22,6 +22,7 @@ lm:lua_source "render_core"{
     sources = {
         "render/render.cpp",
         "render/queue.cpp",
+        "render/draw_sort.cpp",
     },
 }
 
@@ -32,15 +33,19 @@ lm:lua_source "render" {
         lm.AntDir .. "/3rd/luaecs",
         lm.AntDir .. "/3rd/glm",
         lm.AntDir .. "/clibs/ecs",
+        lm.AntDir .. "/clibs/foundation",
     },
     defines = {
         "GLM_FORCE_QUAT_DATA_XYZW",
     },
     sources = {
         "cull/cull.cpp",
+        "cull/frustum_cull.cpp",
+        "cull/occlusion_cull.cpp",
     },
     objdeps = "compile_ecs",
     deps = {
+        "foundation",
         "material_core",
         "render_core",
     }
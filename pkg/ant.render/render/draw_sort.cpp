@@ -0,0 +1,91 @@
+#include "draw_sort.h"
+
+#include <cstring>
+#include <cassert>
+#include <utility>
+
+static constexpr uint32_t DEPTH_BITS = 20;
+static constexpr uint32_t LAYER_DEPTH_SHIFT = 24;
+
+// the bits of a positive float keep the order of the value, keep the high bits as a log-like quantization
+static inline uint32_t
+quantize_depth(float depth){
+	if (!(depth > 0.f))
+		return 0;
+	uint32_t u;
+	memcpy(&u, &depth, sizeof(u));
+	return (u >> (31 - DEPTH_BITS)) & ((1u << DEPTH_BITS) - 1);
+}
+
+uint64_t
+draw_sortkey(const draw_sortkey_info &info){
+	assert(info.queue < 64 && info.layer < 64);
+	const uint64_t d = quantize_depth(info.depth);
+	uint64_t key = ((uint64_t)info.queue << 58) | ((uint64_t)(info.layer & 0x3f) << 52);
+	if (info.blend){
+		const uint64_t invd = ((1ull << DEPTH_BITS) - 1) - d;
+		key |= (1ull << 51) | (invd << 31) | ((uint64_t)(info.progid & 0x7fff) << 16) | info.material;
+	} else {
+		key |= ((uint64_t)(info.progid & 0x7fff) << 36) | ((uint64_t)info.material << 20) | d;
+	}
+	return key;
+}
+
+uint32_t
+draw_submit_depth(uint32_t layer, bool blend, float depth){
+	const uint32_t base = layer << LAYER_DEPTH_SHIFT;
+	if (!blend)
+		return base;
+	static_assert(DEPTH_BITS <= LAYER_DEPTH_SHIFT);
+	return base | (((1u << DEPTH_BITS) - 1) - quantize_depth(depth));
+}
+
+uint16_t
+draw_material_hash(const void *material){
+	uint64_t h = (uint64_t)(uintptr_t)material;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return (uint16_t)h;
+}
+
+void
+draw_radix_sort(std::vector<sort_item> &items, std::vector<sort_item> &temp){
+	const size_t n = items.size();
+	if (n < 2)
+		return;
+
+	// skip the bytes which are the same in all keys, usually queue and layer bytes
+	uint64_t all_or = 0, all_and = ~0ull;
+	for (const auto &i : items){
+		all_or |= i.key;
+		all_and &= i.key;
+	}
+	const uint64_t diff = all_or ^ all_and;
+
+	temp.resize(n);
+	sort_item *src = items.data();
+	sort_item *dst = temp.data();
+	for (uint32_t shift = 0; shift < 64; shift += 8){
+		if (0 == ((diff >> shift) & 0xff))
+			continue;
+		uint32_t count[256] = {0};
+		for (size_t ii=0; ii<n; ++ii){
+			++count[(src[ii].key >> shift) & 0xff];
+		}
+		uint32_t offset = 0;
+		for (uint32_t ii=0; ii<256; ++ii){
+			const uint32_t c = count[ii];
+			count[ii] = offset;
+			offset += c;
+		}
+		for (size_t ii=0; ii<n; ++ii){
+			const auto &s = src[ii];
+			dst[count[(s.key >> shift) & 0xff]++] = s;
+		}
+		std::swap(src, dst);
+	}
+	if (src != items.data()){
+		memcpy(items.data(), src, n * sizeof(sort_item));
+	}
+}
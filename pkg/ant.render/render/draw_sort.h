@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+	64 bits draw sort key, from high to low bits:
+
+	opaque:		| queue:6 | layer:6 | 0:1 | program:15 | material:16 | depth:20 |	front to back
+	blend:		| queue:6 | layer:6 | 1:1 | ~depth:20  | program:15 | material:16 |	back to front
+
+	queue/layer keep the order of the queues and render layers, then opaque draws are
+	grouped by program and material, blended draws are sorted back to front.
+*/
+
+struct draw_sortkey_info {
+	uint8_t		queue;
+	uint32_t	layer;
+	bool		blend;
+	uint16_t	progid;
+	uint16_t	material;
+	float		depth;		// view space depth
+};
+
+uint64_t draw_sortkey(const draw_sortkey_info &info);
+
+// bgfx view use "d" mode(depth ascending) and the draws' depth is the render layer,
+// blended draws put their depth in the low bits to keep back to front order after bgfx sorted
+uint32_t draw_submit_depth(uint32_t layer, bool blend, float depth);
+
+uint16_t draw_material_hash(const void *material);
+
+struct sort_item {
+	uint64_t key;
+	uint32_t idx;
+};
+
+// LSD radix sort, stable, temp is the swap buffer
+void draw_radix_sort(std::vector<sort_item> &items, std::vector<sort_item> &temp);
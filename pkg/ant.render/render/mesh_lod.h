@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ecs/component.hpp"
+
+#include <cstdint>
+
+/*
+	The LODs of a meshbin are index buffer ranges in the same ib, they share the vertices of LOD 0.
+	LOD 0 is the ib of render_object, mesh_lod keeps the coarser ones and the LOD selected by cull
+	for each queue(2 bits, select0 for queue 0-31, select1 for queue 32-63). The submit path reads
+	the selection, it's LOD 0 for the queues never culled.
+
+	cull also keeps the projected size of the mesh(the max diameter in pixels of the queues), the submit
+	path requests the textures of the material with it, see textureman texture_request. 0 is unknown,
+	the textures are requested in the full size.
+*/
+
+static constexpr uint8_t MESH_LOD_MAX = 4;
+static constexpr uint16_t MESH_LOD_SIZE_FULL = 0xffff;
+
+// the size for texture_request
+static inline uint16_t
+mesh_lod_texture_size(const component::mesh_lod *l){
+	return (nullptr == l || 0 == l->size) ? MESH_LOD_SIZE_FULL : l->size;
+}
+
+static inline uint8_t
+mesh_lod_get(const component::mesh_lod &l, uint8_t queue){
+	const uint64_t s = (uint64_t)(queue < 32 ? l.select0 : l.select1);
+	return (uint8_t)((s >> ((queue & 31) * 2)) & 3);
+}
+
+static inline void
+mesh_lod_set(component::mesh_lod &l, uint8_t queue, uint8_t level){
+	int64_t &s = queue < 32 ? l.select0 : l.select1;
+	const uint32_t shift = (queue & 31) * 2;
+	s = (int64_t)(((uint64_t)s & ~(3ull << shift)) | ((uint64_t)(level & 3) << shift));
+}
+
+// the error of the simplified mesh, relative to the mesh extent
+static inline float
+mesh_lod_error(const component::mesh_lod &l, uint8_t level){
+	switch (level){
+	case 1: return l.error1;
+	case 2: return l.error2;
+	case 3: return l.error3;
+	default: return 0.f;
+	}
+}
+
+// start/num are the ib range of LOD 0 on input
+static inline void
+mesh_lod_range(const component::mesh_lod *l, uint8_t level, uint32_t &start, uint32_t &num){
+	if (nullptr == l || 0 == level || level > l->levels)
+		return;
+	switch (level){
+	case 1: start = l->ib_start1; num = l->ib_num1; break;
+	case 2: start = l->ib_start2; num = l->ib_num2; break;
+	case 3: start = l->ib_start3; num = l->ib_num3; break;
+	}
+}
@@ -7,11 +7,13 @@
 #include <cassert>
 
 #include "ecs/world.h"
+#include "queue.h"
 
 struct queue_node {
 	static constexpr uint8_t NUM_MASK = 1;
 	static constexpr uint16_t QUEUE_NUM = NUM_MASK * 64;
 	uint64_t masks[NUM_MASK] = {0};
+	bool dirty = false;
 
     constexpr void clear() {
         for (uint32_t ii=0; ii<NUM_MASK; ++ii){
@@ -27,16 +29,27 @@ struct queue_node {
         return 0 != (masks[eidx] & (1ull << sidx));
     }
 
-    void set(uint8_t queue, bool value){
+    // return true if the mask changed
+    bool set(uint8_t queue, bool value){
         const uint8_t eidx = queue / 64;
         assert(eidx < NUM_MASK && "Max queue is 64");
         const uint8_t sidx = queue % 64;
 
+        const uint64_t old = masks[eidx];
         if (value){
             masks[eidx] |= (1ull << sidx);
         } else {
             masks[eidx] &= ~(1ull << sidx);
         }
+        return old != masks[eidx];
+    }
+
+    // set the bits of mask to value, return true if the mask changed
+    bool set_mask(uint64_t mask, uint64_t value){
+        static_assert(NUM_MASK == 1, "set_mask only works with 64 queues");
+        const uint64_t old = masks[0];
+        masks[0] = (old & ~mask) | (value & mask);
+        return old != masks[0];
     }
 };
 
@@ -70,11 +83,33 @@ struct queue_container {
     }
 
     inline void set(int Qidx, uint8_t queue, bool value) {
-        nodes[Qidx].set(queue, value);
+        auto &node = nodes[Qidx];
+        if (node.set(queue, value) && !node.dirty){
+            node.dirty = true;
+            dirty.push_back(Qidx);
+        }
+    }
+
+    inline void set_mask(int Qidx, uint64_t mask, uint64_t value) {
+        auto &node = nodes[Qidx];
+        if (node.set_mask(mask, value) && !node.dirty){
+            node.dirty = true;
+            dirty.push_back(Qidx);
+        }
+    }
+
+    void fetch_dirty(std::vector<int> &changes){
+        for (auto Qidx : dirty){
+            nodes[Qidx].dirty = false;
+        }
+        changes.swap(dirty);
+        dirty.clear();
     }
 
     std::vector<queue_node> nodes;
     std::forward_list<int>   freelist;
+    // the nodes which masks changed since last fetch_dirty, one node only once
+    std::vector<int>        dirty;
     int n = 0;
 };
 
@@ -94,6 +129,14 @@ void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value){
     return Q->set(Qidx, queue, value);
 }
 
+void queue_set_mask(struct queue_container* Q, int Qidx, uint64_t mask, uint64_t value){
+    Q->set_mask(Qidx, mask, value);
+}
+
+void queue_fetch_dirty(struct queue_container* Q, std::vector<int> &changes){
+    Q->fetch_dirty(changes);
+}
+
 static int
 lqueue_dealloc(lua_State *L){
     auto w = getworld(L);
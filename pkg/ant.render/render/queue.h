@@ -1,10 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 struct queue_container;
 struct queue_container* queue_create();
 void queue_destroy(struct queue_container*);
 
 bool queue_check(struct queue_container* Q, int Qidx, uint8_t queue);
-void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value);
\ No newline at end of file
+void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value);
+// set all the queues in mask at once, bit n of value is the value of queue n
+void queue_set_mask(struct queue_container* Q, int Qidx, uint64_t mask, uint64_t value);
+// the Qidx which masks changed since last call, changes is cleared first
+void queue_fetch_dirty(struct queue_container* Q, std::vector<int> &changes);
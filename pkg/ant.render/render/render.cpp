@@ -11,6 +11,9 @@ extern "C"{
 }
 
 #include "queue.h"
+#include "draw_sort.h"
+#include "mesh_lod.h"
+#include "job_pool.h"
 
 #include "lua.hpp"
 #include "luabgfx.h"
@@ -24,6 +27,9 @@ extern "C"{
 #include <memory.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+
 struct transform {
 	uint32_t tid;
 	uint32_t stride;
@@ -42,71 +48,188 @@ enum queue_type{
 
 static constexpr uint8_t MAX_VISIBLE_QUEUE = 64;
 
-using obj_transforms = std::unordered_map<uint64_t, transform>;
-static inline transform
-update_transform(struct ecs_world* w, const component::render_object *ro, const math_t& hwm, obj_transforms &trans){
-	uint64_t tran_key = (uint64_t)ro ^ hwm.idx;
-	auto it = trans.find(tran_key);
-	if (it == trans.end()){
-		const math_t wm = ro->worldmat;
-		assert(math_valid(w->math3d->M, wm) && !math_isnull(wm) && "Invalid world mat");
-		const int num = math_size(w->math3d->M, wm);
-		transform t;
-		bgfx_transform_t bt;
-		t.tid = w->bgfx->encoder_alloc_transform(w->holder->encoder, &bt, (uint16_t)num);
-		t.stride = num;
-		if(hwm.idx == MATH_NULL.idx){
-			const float * v = math_value(w->math3d->M, wm);
-			memcpy(bt.data, v, sizeof(float)*16*num);
-		}
-		else{
-			math_t r = math_ref(w->math3d->M, bt.data, MATH_TYPE_MAT, t.stride);
-			math3d_mul_matrix_array(w->math3d->M, hwm, wm, r);			
+// luabgfx init bgfx with maxEncoders = 8, one of them is the main encoder(w->holder->encoder)
+static constexpr uint32_t MAX_SUBMIT_WORKER = 7;
+// draws count that each worker fetch in one time
+static constexpr uint32_t SUBMIT_BATCH = 64;
+// less than this, submit in main thread
+static constexpr uint32_t PARALLEL_SUBMIT_THRESHOLD = SUBMIT_BATCH * 4;
+
+static constexpr uint32_t INVALID_TRANSFORM = UINT32_MAX;
+// the worldmat of a skinned mesh is {world matrix, palette param[, world matrix of the last frame]}, see ant.animation/skinning.lua
+static constexpr uint32_t SKINNING_PALETTE_PARAM = 1;
+// bgfx allocates at most UINT16_MAX matrices one time
+static constexpr uint32_t MAX_TRANSFORM_BLOCK = UINT16_MAX;
+
+// the same mesh and material draws in one render_args are merged into one instanced draw
+static constexpr uint32_t INVALID_BATCH = UINT32_MAX;
+static constexpr uint32_t MIN_INSTANCE_COUNT = 2;
+// the first 3 rows of the worldmat: i_data0, i_data1, i_data2
+static constexpr uint16_t INSTANCE_STRIDE = sizeof(float) * 4 * 3;
+
+#ifdef RENDER_DEBUG
+struct submit_stat{
+	uint32_t hitch_submit;
+	uint32_t simple_submit;
+	uint32_t efk_hitch_submit;
+	uint32_t hitch_count;
+
+	// state changes between the adjacent draws in one encoder
+	uint32_t program_change;
+	uint32_t material_change;
+	uint32_t state_change;
+
+	// draw cache
+	uint32_t cache_rebuild;		// 1: rebuilt from ECS
+	uint32_t cache_replay;		// 1: nothing changed, the last draw list was replayed
+	uint32_t cache_update;		// render objects evaluated again
+
+	uint32_t transform_count;	// transforms of the draw list, one for each render object
+
+	uint32_t instance_batch;	// instanced draws
+	uint32_t instance_count;	// the draws merged into the instanced draws
+	uint32_t instance_fallback;	// the batches drawn one by one, out of instance data buffer
+
+	// bgfx calls of the material apply: state, stencil and attribs
+	uint32_t material_applied;
+	uint32_t material_skipped;
+
+	uint32_t submit_time;		// lrender_submit in microsecond
+	uint32_t sort_time;			// the radix sort of the draw list in nanosecond
+};
+#endif //RENDER_DEBUG
+
+// everything one thread needs to encode the draws, worker threads should only touch their own context
+struct submit_context {
+	bgfx_encoder_t*	encoder = nullptr;
+	const char*		err = nullptr;
+	bool			parallel = false;	// the draws of the other encoders are mixed into the bgfx sorted order
+
+	// the material kept in the encoder, and the last draw to check whether the uniforms are still in effect
+	struct material_apply_cache	mc;
+	uint16_t		last_view = UINT16_MAX;
+	uint16_t		last_prog = UINT16_MAX;
+	uint32_t		last_depth = 0;
+
+#ifdef RENDER_DEBUG
+	submit_stat stat;
+	uint64_t	time;	// in microsecond
+	struct material_sortinfo last;
+#endif //RENDER_DEBUG
+
+	void clear(){
+		encoder = nullptr;
+		err = nullptr;
+		parallel = false;
+		memset(&mc, 0, sizeof(mc));
+		forget_draw();
+#ifdef RENDER_DEBUG
+		memset(&stat, 0, sizeof(stat));
+		time = 0;
+		memset(&last, 0, sizeof(last));
+#endif //RENDER_DEBUG
+	}
+
+	// the encoder may be used by others between two render_submit, no draw matches an invalid view and program
+	void forget_draw(){
+		last_view = UINT16_MAX;
+		last_prog = UINT16_MAX;
+		last_depth = 0;
+	}
+};
+
+// r = a * b, column major
+static inline void
+mul_matrix(float *r, const float *a, const float *b){
+	for (int c=0; c<4; ++c){
+		const float *bc = b + c * 4;
+		for (int ii=0; ii<4; ++ii){
+			r[c*4+ii] = a[ii] * bc[0] + a[4+ii] * bc[1] + a[8+ii] * bc[2] + a[12+ii] * bc[3];
 		}
-		it = trans.insert(std::make_pair(tran_key, t)).first;
 	}
-	return it->second;
 }
 
+/*
+	The transforms of one frame. The draw list is scanned in the main thread before submit, each
+	render object gets one transform however many render_args draw it, so the submit workers only
+	set the cached transform. The matrices are copied into a few large bgfx blocks, no hashing.
+*/
+struct transform_arena {
+	std::vector<transform>	slots;		// draw cache slot -> transform, tid is INVALID_TRANSFORM when it's not drawn
+	std::vector<uint32_t>	used;		// the slots drawn in this frame
+
+	bgfx_transform_t	block;
+	uint32_t			block_tid = 0;
+	uint32_t			block_used = 0;
+	uint32_t			block_size = 0;
+
+	void reset(uint32_t nslot){
+		for (auto slot : used){
+			if (slot < slots.size())
+				slots[slot].tid = INVALID_TRANSFORM;
+		}
+		used.clear();
+		slots.resize(nslot, transform{INVALID_TRANSFORM, 0});
+		block_used = block_size = 0;
+	}
+
+	// left: the matrices still need to allocate in this frame, at least num
+	float* alloc(struct ecs_world *w, bgfx_encoder_t *encoder, uint32_t num, uint32_t left, uint32_t &tid){
+		assert(num <= left && num <= MAX_TRANSFORM_BLOCK);
+		if (block_used + num > block_size){
+			block_size = std::min(left, MAX_TRANSFORM_BLOCK);
+			block_tid = w->bgfx->encoder_alloc_transform(encoder, &block, (uint16_t)block_size);
+			block_used = 0;
+		}
+		tid = block_tid + block_used;
+		float *data = block.data + block_used * 16;
+		block_used += num;
+		return data;
+	}
+};
+
 #define INVALID_BUFFER_TYPE		UINT16_MAX
 #define BUFFER_TYPE(_HANDLE)	(_HANDLE >> 16) & 0xffff
 
 static inline bool indirect_draw_valid(const component::indirect_object *ido){
 	return ido && ido->draw_num != 0 && ido->draw_num != UINT32_MAX;
 }
+// lod: the ib range of the level is drawn instead of the ib of render_object, nullptr for LOD 0
 static bool
-mesh_submit(struct ecs_world* w, const component::render_object* ro,  const component::indirect_object *ido, int vid, uint8_t mat_idx){
+mesh_submit(struct ecs_world* w, bgfx_encoder_t* encoder, const component::render_object* ro,  const component::indirect_object *ido, const component::mesh_lod *lod, uint8_t level, int vid, uint8_t mat_idx){
 	if (ro->vb_num == 0 || (ido && ido->draw_num == 0))
 		return false;
 
+	uint32_t ib_start = ro->ib_start, ib_num = ro->ib_num;
+	mesh_lod_range(lod, level, ib_start, ib_num);
 	const uint16_t ibtype = BUFFER_TYPE(ro->ib_handle);
-	if (ibtype != INVALID_BUFFER_TYPE && ro->ib_num == 0)
+	if (ibtype != INVALID_BUFFER_TYPE && ib_num == 0)
 		return false;
 
 	const uint16_t vb_type = BUFFER_TYPE(ro->vb_handle);
 	
 	switch (vb_type){
-		case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(w->holder->encoder, 0, bgfx_vertex_buffer_handle_t{(uint16_t)ro->vb_handle}, ro->vb_start, ro->vb_num); break;
+		case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(encoder, 0, bgfx_vertex_buffer_handle_t{(uint16_t)ro->vb_handle}, ro->vb_start, ro->vb_num); break;
 		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER_TYPELESS:	//walk through
-		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(w->holder->encoder, 0, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)ro->vb_handle}, ro->vb_start, ro->vb_num); break;
+		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(encoder, 0, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)ro->vb_handle}, ro->vb_start, ro->vb_num); break;
 		default: assert(false && "Invalid vertex buffer type");
 	}
 
 	const uint16_t vb2_type = BUFFER_TYPE(ro->vb2_handle);
 	if((vb2_type != INVALID_BUFFER_TYPE) && ((mat_idx == qt_mat_def) || (mat_idx == qt_mat_lightmap))){
 		switch (vb2_type){
-			case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(w->holder->encoder, 1, bgfx_vertex_buffer_handle_t{(uint16_t)ro->vb2_handle}, ro->vb2_start, ro->vb2_num); break;
+			case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(encoder, 1, bgfx_vertex_buffer_handle_t{(uint16_t)ro->vb2_handle}, ro->vb2_start, ro->vb2_num); break;
 			case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER_TYPELESS:	//walk through
-			case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(w->holder->encoder, 1, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)ro->vb2_handle}, ro->vb2_start, ro->vb2_num); break;
+			case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(encoder, 1, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)ro->vb2_handle}, ro->vb2_start, ro->vb2_num); break;
 			default: assert(false && "Invalid vertex buffer type");
 		}
 	}
 
-	if (ro->ib_num > 0){
+	if (ib_num > 0){
 		switch (ibtype){
-			case BGFX_HANDLE_INDEX_BUFFER: w->bgfx->encoder_set_index_buffer(w->holder->encoder, bgfx_index_buffer_handle_t{(uint16_t)ro->ib_handle}, ro->ib_start, ro->ib_num); break;
+			case BGFX_HANDLE_INDEX_BUFFER: w->bgfx->encoder_set_index_buffer(encoder, bgfx_index_buffer_handle_t{(uint16_t)ro->ib_handle}, ib_start, ib_num); break;
 			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER:	//walk through
-			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER_32: w->bgfx->encoder_set_dynamic_index_buffer(w->holder->encoder, bgfx_dynamic_index_buffer_handle_t{(uint16_t)ro->ib_handle}, ro->ib_start, ro->ib_num); break;
+			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER_32: w->bgfx->encoder_set_dynamic_index_buffer(encoder, bgfx_dynamic_index_buffer_handle_t{(uint16_t)ro->ib_handle}, ib_start, ib_num); break;
 			default: assert(false && "Unknown index buffer type"); break;
 		}
 	}
@@ -114,11 +237,16 @@ mesh_submit(struct ecs_world* w, const component::render_object* ro,  const comp
 	if(indirect_draw_valid(ido)){
 		const auto itb = bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)ido->itb_handle};
 		assert(BGFX_HANDLE_IS_VALID(itb));
-		w->bgfx->encoder_set_instance_data_from_dynamic_vertex_buffer(w->holder->encoder, itb, 0, ido->draw_num);
+		w->bgfx->encoder_set_instance_data_from_dynamic_vertex_buffer(encoder, itb, 0, ido->draw_num);
 	}
 	return true;
 }
 
+static inline bool
+is_blend(uint64_t state){
+	return 0 != (state & BGFX_STATE_BLEND_MASK);
+}
+
 static inline struct material_instance*
 get_material(struct render_material * R, const component::render_object* ro, size_t midx){
 	assert(midx < qt_count);
@@ -132,71 +260,248 @@ get_material(struct render_material * R, const component::render_object* ro, siz
 using matrix_array = std::vector<math_t>;
 
 static inline void
-submit_draw(struct ecs_world*w, bgfx_view_id_t viewid, const component::render_object *obj, const component::indirect_object *iobj, bgfx_program_handle_t prog, uint8_t discardflags){
+submit_draw(struct ecs_world*w, bgfx_encoder_t* encoder, bgfx_view_id_t viewid, const component::indirect_object *iobj, bgfx_program_handle_t prog, uint32_t depth, uint8_t discardflags){
 	if(indirect_draw_valid(iobj)){
 		const auto idb = bgfx_indirect_buffer_handle_t{(uint16_t)iobj->idb_handle};
 		assert(BGFX_HANDLE_IS_VALID(idb));
-		w->bgfx->encoder_submit_indirect(w->holder->encoder, viewid, prog, idb, 0, iobj->draw_num, obj->render_layer, discardflags);
+		w->bgfx->encoder_submit_indirect(encoder, viewid, prog, idb, 0, iobj->draw_num, depth, discardflags);
 	}else{
-		w->bgfx->encoder_submit(w->holder->encoder, viewid, prog, obj->render_layer, discardflags);
+		w->bgfx->encoder_submit(encoder, viewid, prog, depth, discardflags);
 	}
 }
 
+// the draws of the same material share the state and the bindings, see material_apply_cache
+static constexpr uint8_t DISCARD_KEEP_MATERIAL = BGFX_DISCARD_ALL & ~(BGFX_DISCARD_STATE | BGFX_DISCARD_BINDINGS);
+
+static inline const void*
+material_of(struct material_instance *mi){
+	struct material_sortinfo si;
+	material_get_sortinfo(mi, &si);
+	return si.material;
+}
+
 static inline void
-draw_obj(lua_State *L, struct ecs_world *w, const component::render_args* ra, const component::render_object *obj, const component::indirect_object *iobj, const matrix_array *mats, obj_transforms &trans){
-	auto mi = get_material(w->R, obj, ra->material_index);
-	
-	if (nullptr == mi)
+discard_material(struct ecs_world *w, submit_context &ctx){
+	if (ctx.mc.material){
+		w->bgfx->encoder_discard(ctx.encoder, BGFX_DISCARD_ALL);
+		material_apply_cache_reset(&ctx.mc);
+	}
+}
+
+// it can run in the submit workers, so error is kept in ctx.err and raise by main thread
+// one draw for each transform, the hitch objects have more than one
+// keep: the next draw of this encoder uses the same material, keep the state and the bindings for it
+static inline void
+draw_obj(struct ecs_world *w, submit_context &ctx, const component::render_args* ra, const component::render_object *obj, const component::indirect_object *iobj, const component::mesh_lod *lod, uint8_t level, struct material_instance *mi, uint32_t depth, const transform *trans, uint32_t ntrans, bool keep){
+	const auto prog = material_prog(nullptr, mi);
+	if (!BGFX_HANDLE_IS_VALID(prog))
 		return ;
-	
-	const auto prog = material_prog(L, mi);
-	if (!BGFX_HANDLE_IS_VALID(prog) || !mesh_submit(w, obj, iobj, ra->viewid, ra->material_index))
+	if (ctx.mc.material != material_of(mi)){
+		discard_material(w, ctx);
+	}
+	if (!mesh_submit(w, ctx.encoder, obj, iobj, lod, level, ra->viewid, ra->material_index))
 		return ;
 
-	apply_material_instance(L, mi, w);
-	
-	transform t;
-	if (mats){
-		for (int i=0; i<(int)mats->size()-1; ++i) {
-			t = update_transform(w, obj, (*mats)[i], trans);
-			w->bgfx->encoder_set_transform_cached(w->holder->encoder, t.tid, t.stride);
-			submit_draw(w, ra->viewid, obj, iobj, prog, BGFX_DISCARD_TRANSFORM);
-		}
-		t = update_transform(w, obj, mats->back(), trans);
-	} else {
-		t = update_transform(w, obj, MATH_NULL, trans);
+	// bgfx sorts the draws by a key of view, blend state, program and depth(or the submit sequence), the radix sort
+	// keeps the submit order of the same keys. so the next draw of the same key in one encoder follows this one, if
+	// no other encoder submits to the view in this frame(parallel) and the uniforms set for this one are still in effect.
+	// the blend state is checked by material_apply_cached.
+	const bool uniforms = !ctx.parallel && ctx.last_view == ra->viewid && ctx.last_prog == prog.idx && ctx.last_depth == depth;
+	const char* err = material_apply_cached(mi, w, ctx.encoder, &ctx.mc, uniforms);
+	if (err){
+		ctx.err = err;
+		w->bgfx->encoder_discard(ctx.encoder, BGFX_DISCARD_ALL);
+		material_apply_cache_reset(&ctx.mc);
+		ctx.forget_draw();
+		return ;
 	}
+	material_request_textures(mi, mesh_lod_texture_size(lod));
 
-	w->bgfx->encoder_set_transform_cached(w->holder->encoder, t.tid, t.stride);
-	submit_draw(w, ra->viewid, obj, iobj, prog, BGFX_DISCARD_ALL);
+	for (uint32_t ii=0; ii<ntrans; ++ii){
+		w->bgfx->encoder_set_transform_cached(ctx.encoder, trans[ii].tid, trans[ii].stride);
+		const bool last = ii+1 == ntrans;
+		submit_draw(w, ctx.encoder, ra->viewid, iobj, prog, depth, last ? (keep ? DISCARD_KEEP_MATERIAL : BGFX_DISCARD_ALL) : BGFX_DISCARD_TRANSFORM);
+	}
+	if (!keep){
+		material_apply_cache_reset(&ctx.mc);
+	}
+	ctx.last_view	= ra->viewid;
+	ctx.last_prog	= prog.idx;
+	ctx.last_depth	= depth;
 }
 
-using group_queues = std::array<matrix_array, 64>;
-using group_collection = std::unordered_map<int, group_queues>;
-struct submit_cache{
-	obj_transforms	transforms;
+// it's drawn as one instanced draw, texture_size is the max projected size of the instances
+static inline void
+draw_instanced(struct ecs_world *w, submit_context &ctx, const component::render_args* ra, const component::render_object *obj, const component::mesh_lod *lod, uint8_t level, struct material_instance *mi, uint32_t depth, const bgfx_instance_data_buffer_t *idb, uint16_t texture_size){
+	const auto prog = material_instanced_prog(mi);
+	if (!BGFX_HANDLE_IS_VALID(prog))
+		return ;
+	discard_material(w, ctx);
+	if (!mesh_submit(w, ctx.encoder, obj, nullptr, lod, level, ra->viewid, ra->material_index))
+		return ;
+
+	const char* err = material_apply_instanced(mi, w, ctx.encoder);
+	if (err){
+		ctx.err = err;
+		w->bgfx->encoder_discard(ctx.encoder, BGFX_DISCARD_ALL);
+		return ;
+	}
+	material_request_textures(mi, texture_size);
+
+	// the transform isn't set, u_model is the identity matrix(bgfx matrix cache 0), the worldmat is in the instance data
+	w->bgfx->encoder_set_instance_data_buffer(ctx.encoder, idb, 0, idb->num);
+	w->bgfx->encoder_submit(ctx.encoder, ra->viewid, prog, depth, BGFX_DISCARD_ALL);
+}
+
+struct draw_item {
+	const component::render_object*		obj;
+	const component::indirect_object*	iobj;
+	struct material_instance*			mi;
+	uint32_t							depth;	// bgfx submit depth
+	uint32_t							slot;	// draw cache slot, for the transform
+	uint32_t							batch;	// index of submit_cache::batches, INVALID_BATCH for the single draw
+	uint8_t								raidx;	// render_args are recreated every frame, keep the index
+	uint8_t								lod;	// the LOD level of the queue, see mesh_lod.h
+};
+
+// the draws of a batch, obj/mi/depth of the draw_item come from the first one
+struct instance_batch {
+	uint32_t					first;		// index of submit_cache::batch_slots
+	uint32_t					count;
+	bool						instanced;	// false: the instance data buffer is not enough in this frame, draw them one by one
+	bgfx_instance_data_buffer_t	idb;
+};
+
+/*
+	The draw list is kept between frames, it's replayed when nothing changed.
+
+	Every render object is a slot, and a slot has one record for each render_args. Only the
+	records touched by the changes are evaluated again:
+		queue mask		: Qidx from queue_fetch_dirty, both visible_idx and cull_idx
+		material		: rm_idx from render_material_changes, instances from material_state_changes
+		transform		: scene_changed entities, their view depth
+		camera			: all the records of the render_args which viewmat changed
+		indirect draw	: every frame, draw_num is changed by the gpu driven systems
+		mesh lod		: every frame, the slots which LOD selection(by cull) changed
+	Entity create/remove(render_material alloc/dealloc) and render_args changes rebuild it from ECS,
+	because the component pointers may be moved. luaecs moves them when any entity of the components
+	is added or removed, so the pointers of the slots are checked every frame too(slots_valid).
+
+	The instancing batches are built with the draw list. A record keeps the batch key of its
+	material instance(material_state_changes reports the patches), the mesh of the batches is
+	checked every frame.
+*/
+static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+struct draw_slot {
+	const component::render_object*		obj;
+	const component::indirect_object*	iobj;
+	const component::mesh_lod*			lod;		// nullptr: LOD 0 only, the indirect objects always draw LOD 0
+	int64_t								lod_select[2];	// the selection of the records
+	bool								dirty;
+	bool								instancing;	// false: indirect object or no_instancing
+};
+
+struct draw_record {
+	struct material_instance*	mi;		// nullptr: not drawn by this render_args
+	uint64_t					key;
+	uint64_t					batch;	// hash of material_batchinfo, 0: it can't be instanced
+	uint32_t					depth;
+	uint8_t						lod;
+};
+
+using batch_key = std::array<uint64_t, 9>;
+struct batch_key_hash {
+	size_t operator()(const batch_key &k) const {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (auto v : k){
+			h = (h ^ v) * 0x100000001b3ull;
+			h ^= h >> 29;
+		}
+		return (size_t)h;
+	}
+};
+
+struct cached_args {
+	uint16_t	viewid;
+	uint8_t		queue_index;
+	uint8_t		material_index;
+	bool		has_viewmat;
+	float		viewmat[16];
+};
 
+struct draw_cache {
+	bool	enable = true;
+	bool	valid = false;
+
+	std::vector<draw_slot>		slots;
+	std::vector<draw_record>	records;		// records[slot * ra_count + raidx]
+	std::vector<uint32_t>		Q_slots;		// Qidx -> slot
+	std::vector<uint32_t>		rm_slots;		// rm_idx -> slot
+	std::vector<uint32_t>		dirty_slots;
+	std::vector<uint32_t>		indirect_slots;
+	std::vector<uint32_t>		lod_slots;
+	std::vector<int>			invalid_rm;		// invalidate from lua
+	std::vector<int>			Q_changes;
+
+	cached_args	args[MAX_VISIBLE_QUEUE];
+	uint8_t		args_count = 0;
+	uint64_t	args_rekey = 0;		// the render_args which viewmat changed
+};
+
+// the hitchs of a group visible in any queue, and the hitchs each queue draws
+struct hitch_group {
+	matrix_array							mats;
+	std::array<std::vector<uint32_t>, 64>	queues;		// index of mats
+};
+using group_collection = std::unordered_map<int, hitch_group>;
+struct submit_cache{
 	//TODO: need more fine control of the cache
 	group_collection	groups;
 
+	std::vector<draw_item>	draws;
+	std::vector<draw_item>	sorted_draws;
+	std::vector<sort_item>	sort_items;
+	std::vector<sort_item>	sort_temp;
+	bool					sort = true;
+	draw_cache				cache;
+	transform_arena			transforms;
+	std::vector<transform>	hitch_transforms;	// hitch index -> transform of the current hitch object
+	std::vector<transform>	hitch_draws;
+
+	bool					instancing = true;
+	std::vector<instance_batch>	batches;
+	std::vector<uint32_t>		batch_slots;	// the draw cache slots of the batches, adjacent for each batch
+	std::vector<uint32_t>		record_batch;	// draw cache record -> batch
+	std::unordered_map<batch_key, uint32_t, batch_key_hash>	batch_index;	// batch key -> index of batch_groups
+	std::vector<std::vector<uint32_t>>						batch_groups;	// the draw cache records of each batch key
+
+	// contexts[0] is the main thread, the others belong to the submit workers
+	submit_context	contexts[MAX_SUBMIT_WORKER+1];
+	uint32_t		context_count = 1;
+	job_pool		pool;
+
 	const component::render_args* ra[MAX_VISIBLE_QUEUE];
+	const float* viewmat[MAX_VISIBLE_QUEUE];
 	uint8_t ra_count = 0;
 
 #ifdef RENDER_DEBUG
-	struct submit_stat{
-		uint32_t hitch_submit;
-		uint32_t simple_submit;
-		uint32_t efk_hitch_submit;
-		uint32_t hitch_count;
-	};
-
 	submit_stat stat;
 #endif //RENDER_DEBUG
 
-	void clear(){
-		transforms.clear();
+	submit_context& main_context(){
+		return contexts[0];
+	}
+
+	void clear(struct ecs_world *w){
 		groups.clear();
 
+		for (auto &ctx : contexts){
+			ctx.clear();
+		}
+		contexts[0].encoder = w->holder->encoder;
+		context_count = 1;
+
 		ra_count = 0;
 
 #ifdef RENDER_DEBUG
@@ -220,6 +525,7 @@ static bool obj_queue_visible(struct queue_container* Q, const ObjType &o, uint8
 static inline void
 find_render_args(struct ecs_world *w, submit_cache &cc) {
 	for (auto& r : ecs::array<component::render_args>(w->ecs)) {
+		cc.viewmat[cc.ra_count] = math_isnull(r.viewmat) ? nullptr : math_value(w->math3d->M, r.viewmat);
 		cc.ra[cc.ra_count++] = &r;
 	}
 }
@@ -227,14 +533,14 @@ find_render_args(struct ecs_world *w, submit_cache &cc) {
 //TODO: maybe move to another c module
 static constexpr uint16_t MAX_EFK_HITCH = 256;
 static inline void
-submit_efk_obj(lua_State* L, struct ecs_world* w, const component::efk_object *eo, const matrix_array& mats){
-	for (auto m : mats){
+submit_efk_obj(lua_State* L, struct ecs_world* w, const component::efk_object *eo, const hitch_group &g, const std::vector<uint32_t> &hitchs){
+	for (auto idx : hitchs){
 		if (entity_count(w->ecs, ecs::component_id<component::efk_hitch>) >= MAX_EFK_HITCH){
 			luaL_error(L, "Too many 'efk_hitch' object");
 		}
 		auto *eh = (component::efk_hitch*)entity_component_temp(w->ecs, ecs::component_id<component::efk_hitch_tag>, ecs::component_id<component::efk_hitch>);
 		eh->handle		= eo->handle;
-		eh->hitchmat	= (uintptr_t)math_value(w->math3d->M, math3d_mul_matrix(w->math3d->M, m, eo->worldmat));
+		eh->hitchmat	= (uintptr_t)math_value(w->math3d->M, math3d_mul_matrix(w->math3d->M, g.mats[idx], eo->worldmat));
 	}
 }
 
@@ -242,47 +548,91 @@ static inline void
 build_hitch_info(struct ecs_world*w, submit_cache &cc){
 	for (auto e : ecs::select<component::hitch_visible, component::hitch, component::scene>(w->ecs)) {
 		const auto &h = e.get<component::hitch>();
+		if (h.group == 0)
+			continue;
+		hitch_group *g = nullptr;
+		uint32_t idx = 0;
 		for (uint8_t ii=0; ii<cc.ra_count; ++ii){
 			auto ra = cc.ra[ii];
 			if (obj_visible(w->Q, h, ra->queue_index)){
-				const auto &s = e.get<component::scene>();
-				if (h.group != 0){
-					cc.groups[h.group][ra->queue_index].push_back(s.worldmat);
-					#ifdef RENDER_DEBUG
-					++cc.stat.hitch_count;
-					#endif //RENDER_DEBUG
+				if (nullptr == g){
+					g = &cc.groups[h.group];
+					idx = (uint32_t)g->mats.size();
+					g->mats.push_back(e.get<component::scene>().worldmat);
 				}
+				g->queues[ra->queue_index].push_back(idx);
+				#ifdef RENDER_DEBUG
+				++cc.stat.hitch_count;
+				#endif //RENDER_DEBUG
 			}
 		}
 	}
 }
 
+// the hitch matrices multiply the object worldmat once, the queues share the transforms
+static inline void
+update_hitch_transforms(struct ecs_world* w, submit_cache &cc, const component::render_object *ro, const hitch_group &g){
+	auto M = w->math3d->M;
+	const math_t wm = ro->worldmat;
+	assert(math_valid(M, wm) && !math_isnull(wm) && "Invalid world mat");
+	const uint32_t stride = (uint32_t)math_size(M, wm);
+	const float *v = math_value(M, wm);
+	auto &arena = cc.transforms;
+	const uint32_t n = (uint32_t)g.mats.size();
+	cc.hitch_transforms.resize(n);
+	for (uint32_t ii=0; ii<n; ++ii){
+		auto &t = cc.hitch_transforms[ii];
+		t.stride = stride;
+		float *r = arena.alloc(w, cc.main_context().encoder, stride, (n - ii) * stride, t.tid);
+		const float *hwm = math_value(M, g.mats[ii]);
+		for (uint32_t jj=0; jj<stride; ++jj){
+			if (jj == SKINNING_PALETTE_PARAM)
+				memcpy(r + jj * 16, v + jj * 16, sizeof(float) * 16);
+			else
+				mul_matrix(r + jj * 16, hwm, v + jj * 16);
+		}
+	}
+}
+
 static inline void
 render_hitch_submit(lua_State *L, ecs_world* w, submit_cache &cc){
 	// draw object which hanging on hitch node
+	auto &ctx = cc.main_context();
 	ecs::clear_type<component::efk_hitch>(w->ecs);
 	for (auto const& [groupid, g] : cc.groups) {
 		int gids[] = {groupid};
 		ecs::group_enable<component::hitch_tag>(w->ecs, gids);
 		for (auto& e : ecs::select<component::hitch_tag>(w->ecs)) {
 			auto hi = e.component<component::hitch_indirect>();
+			bool transform_ready = false;
 			for (uint8_t ii=0; ii<cc.ra_count; ++ii){
 				auto ra = cc.ra[ii];
-				const auto &mats = g[ra->queue_index];
-				if (!mats.empty()){
+				const auto &hitchs = g.queues[ra->queue_index];
+				if (!hitchs.empty()){
 					auto ro = e.component<component::render_object>();
-					if (!hi && ro && obj_queue_visible(w->Q, *ro, ra->queue_index)){
-						draw_obj(L, w, ra, ro, nullptr, &mats, cc.transforms);
+					auto mi = ro ? get_material(w->R, ro, ra->material_index) : nullptr;
+					if (!hi && mi && obj_queue_visible(w->Q, *ro, ra->queue_index)){
+						if (!transform_ready){
+							update_hitch_transforms(w, cc, ro, g);
+							transform_ready = true;
+						}
+						cc.hitch_draws.clear();
+						for (auto idx : hitchs){
+							cc.hitch_draws.push_back(cc.hitch_transforms[idx]);
+						}
+						struct material_sortinfo si;
+						material_get_sortinfo(mi, &si);
+						draw_obj(w, ctx, ra, ro, nullptr, nullptr, 0, mi, draw_submit_depth(ro->render_layer, is_blend(si.state), 0.f), cc.hitch_draws.data(), (uint32_t)cc.hitch_draws.size(), false);
 						#ifdef RENDER_DEBUG
-						cc.stat.hitch_submit += (uint32_t)mats.size();
+						ctx.stat.hitch_submit += (uint32_t)hitchs.size();
 						#endif //RENDER_DEBUG
 					}
 
 					const auto eo = e.component<component::efk_object>();
 					if (eo && obj_queue_visible(w->Q, *eo, ra->queue_index)){
-						submit_efk_obj(L, w, eo, mats);
+						submit_efk_obj(L, w, eo, g, hitchs);
 						#ifdef RENDER_DEBUG
-						cc.stat.efk_hitch_submit += (uint32_t)mats.size();
+						ctx.stat.efk_hitch_submit += (uint32_t)hitchs.size();
 						#endif //RENDER_DEBUG
 					}
 				}
@@ -291,41 +641,627 @@ render_hitch_submit(lua_State *L, ecs_world* w, submit_cache &cc){
 	}
 }
 
+static inline float
+view_depth(struct ecs_world* w, const float *viewmat, const component::render_object &obj){
+	if (nullptr == viewmat)
+		return 0.f;
+	// first matrix translation, it's the root joint for skinning objects
+	const float *wm = math_value(w->math3d->M, obj.worldmat);
+	return viewmat[2] * wm[12] + viewmat[6] * wm[13] + viewmat[10] * wm[14] + viewmat[14];
+}
+
+static inline bool
+draw_visible(struct queue_container* Q, const draw_slot &s, uint8_t queue){
+	return obj_visible(Q, *s.obj, queue) || (indirect_draw_valid(s.iobj) && obj_queue_visible(Q, *s.obj, queue));
+}
+
+// 0 if the draw can't be instanced: blend(it's sorted by depth), skinning(more than one matrix) or the material has no instanced variant
+static inline uint64_t
+batch_hash(struct ecs_world* w, const draw_slot &s, struct material_instance *mi, bool blend){
+	struct material_batchinfo bi;
+	if (!s.instancing || blend || math_size(w->math3d->M, s.obj->worldmat) != 1 || !material_get_batchinfo(mi, &bi))
+		return 0;
+	const uint64_t h = batch_key_hash()(batch_key{(uint64_t)(uintptr_t)bi.material, bi.state, bi.stencil, bi.rgba});
+	return h == 0 ? 1 : h;
+}
+
+// return true if the record changed
+static inline bool
+update_record(struct ecs_world* w, submit_cache &cc, uint8_t raidx, const draw_slot &s, draw_record &r){
+	const draw_record old = r;
+	r.mi = nullptr;
+	auto ra = cc.ra[raidx];
+	const auto &obj = *s.obj;
+	if (draw_visible(w->Q, s, ra->queue_index)){
+		r.mi = get_material(w->R, &obj, ra->material_index);
+	}
+	if (nullptr == r.mi)
+		return old.mi != nullptr;
+
+	struct material_sortinfo si;
+	material_get_sortinfo(r.mi, &si);
+	const bool blend = is_blend(si.state);
+	const float depth = (cc.sort || blend) ? view_depth(w, cc.viewmat[raidx], obj) : 0.f;
+
+	r.key = 0;
+	if (cc.sort){
+		draw_sortkey_info ki;
+		ki.queue	= ra->queue_index;
+		ki.layer	= obj.render_layer;
+		ki.blend	= blend;
+		ki.progid	= (uint16_t)si.progid;
+		ki.material	= draw_material_hash(si.material);
+		ki.depth	= depth;
+		r.key = draw_sortkey(ki);
+	}
+	r.depth = draw_submit_depth(obj.render_layer, blend, depth);
+	r.batch = cc.instancing ? batch_hash(w, s, r.mi, blend) : 0;
+	r.lod = s.lod ? mesh_lod_get(*s.lod, ra->queue_index) : 0;
+	return old.mi != r.mi || old.key != r.key || old.depth != r.depth || old.batch != r.batch || old.lod != r.lod;
+}
+
+static inline bool
+update_slot(struct ecs_world* w, submit_cache &cc, uint32_t slot){
+	auto &s = cc.cache.slots[slot];
+	s.dirty = false;
+	if (s.lod){
+		s.lod_select[0] = s.lod->select0;
+		s.lod_select[1] = s.lod->select1;
+	}
+	auto records = &cc.cache.records[slot * cc.ra_count];
+	bool changed = false;
+	for (uint8_t ii=0; ii<cc.ra_count; ++ii){
+		changed = update_record(w, cc, ii, s, records[ii]) || changed;
+	}
+	return changed;
+}
+
 static inline void
-render_submit(lua_State *L, struct ecs_world* w, submit_cache &cc){
-	// draw simple objects
+mark_slot(draw_cache &c, uint32_t slot){
+	if (slot != INVALID_SLOT && !c.slots[slot].dirty){
+		c.slots[slot].dirty = true;
+		c.dirty_slots.push_back(slot);
+	}
+}
+
+static inline void
+map_slot(std::vector<uint32_t> &m, int idx, uint32_t slot){
+	if (idx < 0)
+		return;
+	if ((size_t)idx >= m.size())
+		m.resize(idx+1, INVALID_SLOT);
+	m[idx] = slot;
+}
+
+static inline uint32_t
+find_slot(const std::vector<uint32_t> &m, int idx){
+	return (0 <= idx && (size_t)idx < m.size()) ? m[idx] : INVALID_SLOT;
+}
+
+static inline void
+rebuild_slots(struct ecs_world* w, submit_cache &cc){
+	auto &c = cc.cache;
+	c.slots.clear();
+	c.dirty_slots.clear();
+	c.indirect_slots.clear();
+	c.lod_slots.clear();
+	std::fill(c.Q_slots.begin(), c.Q_slots.end(), INVALID_SLOT);
+	std::fill(c.rm_slots.begin(), c.rm_slots.end(), INVALID_SLOT);
+
+	// entity major, the draws of one entity are adjacent when the draws are not sorted
 	for (auto& e : ecs::select<component::render_object_visible, component::render_object>(w->ecs)) {
+		const auto& obj = e.get<component::render_object>();
+		const component::indirect_object* iobj = e.component<component::indirect_object>();
+		const component::mesh_lod* lod = iobj ? nullptr : e.component<component::mesh_lod>();
+		const uint32_t slot = (uint32_t)c.slots.size();
+		c.slots.push_back(draw_slot{&obj, iobj, lod, {0, 0}, false, !iobj && !e.component<component::no_instancing>()});
+		map_slot(c.Q_slots, obj.visible_idx, slot);
+		map_slot(c.Q_slots, obj.cull_idx, slot);
+		map_slot(c.rm_slots, (int)obj.rm_idx, slot);
+		if (iobj){
+			c.indirect_slots.push_back(slot);
+		}
+		if (lod){
+			c.lod_slots.push_back(slot);
+		}
+	}
+
+	c.records.resize(c.slots.size() * cc.ra_count);
+	for (auto &r : c.records){
+		r.mi = nullptr;
+	}
+	for (uint32_t slot=0; slot<(uint32_t)c.slots.size(); ++slot){
+		update_slot(w, cc, slot);
+	}
+}
+
+// the slots are in the ECS order, it's an iteration without the draws evaluated
+static bool
+slots_valid(struct ecs_world* w, const draw_cache &c){
+	size_t slot = 0;
+	for (auto& e : ecs::select<component::render_object_visible, component::render_object>(w->ecs)) {
+		if (slot >= c.slots.size())
+			return false;
+		const auto &s = c.slots[slot++];
+		const component::indirect_object* iobj = e.component<component::indirect_object>();
+		if (s.obj != &e.get<component::render_object>() || s.iobj != iobj)
+			return false;
+		if (s.lod != (iobj ? nullptr : e.component<component::mesh_lod>()))
+			return false;
+	}
+	return slot == c.slots.size();
+}
+
+// return false if the render_args changed, they are the stride of the records
+static inline bool
+update_cached_args(submit_cache &cc){
+	auto &c = cc.cache;
+	bool same = c.args_count == cc.ra_count;
+	c.args_rekey = 0;
+	for (uint8_t ii=0; ii<cc.ra_count; ++ii){
+		auto ra = cc.ra[ii];
+		auto &a = c.args[ii];
+		if (a.viewid != ra->viewid || a.queue_index != ra->queue_index || a.material_index != ra->material_index){
+			same = false;
+			a.viewid		= ra->viewid;
+			a.queue_index	= ra->queue_index;
+			a.material_index= ra->material_index;
+		}
+
+		const float *vm = cc.viewmat[ii];
+		if (vm ? (!a.has_viewmat || 0 != memcmp(a.viewmat, vm, sizeof(a.viewmat))) : a.has_viewmat){
+			c.args_rekey |= 1ull << ii;
+			a.has_viewmat = vm != nullptr;
+			if (vm){
+				memcpy(a.viewmat, vm, sizeof(a.viewmat));
+			}
+		}
+	}
+	c.args_count = cc.ra_count;
+	return same;
+}
+
+static inline batch_key
+make_batch_key(uint8_t raidx, const component::render_object &obj, const draw_record &r){
+	struct material_batchinfo bi;
+	const int ok = material_get_batchinfo(r.mi, &bi);
+	assert(ok); (void)ok;
+	return batch_key{
+		(uint64_t)(uintptr_t)bi.material, bi.state, bi.stencil,
+		bi.rgba			| ((uint64_t)obj.render_layer << 32),
+		obj.vb_handle	| ((uint64_t)obj.vb_start << 32),
+		obj.vb_num		| ((uint64_t)obj.vb2_handle << 32),
+		obj.vb2_start	| ((uint64_t)obj.vb2_num << 32),
+		obj.ib_handle	| ((uint64_t)obj.ib_start << 32),
+		obj.ib_num		| ((uint64_t)raidx << 32) | ((uint64_t)r.lod << 40),
+	};
+}
+
+static inline bool
+same_mesh(const component::render_object &a, const component::render_object &b){
+	return	a.vb_handle == b.vb_handle && a.vb_start == b.vb_start && a.vb_num == b.vb_num &&
+			a.vb2_handle == b.vb2_handle && a.vb2_start == b.vb2_start && a.vb2_num == b.vb2_num &&
+			a.ib_handle == b.ib_handle && a.ib_start == b.ib_start && a.ib_num == b.ib_num &&
+			a.render_layer == b.render_layer;
+}
+
+// group the records which can be instanced, the groups less than MIN_INSTANCE_COUNT are drawn one by one
+static inline void
+build_batches(submit_cache &cc){
+	const auto &c = cc.cache;
+	cc.batches.clear();
+	cc.batch_slots.clear();
+	cc.batch_index.clear();
+	cc.record_batch.assign(c.records.size(), INVALID_BATCH);
+	uint32_t ngroup = 0;
+	for (uint32_t slot=0; slot<(uint32_t)c.slots.size(); ++slot){
+		const auto records = &c.records[slot * cc.ra_count];
 		for (uint8_t ii=0; ii<cc.ra_count; ++ii){
-			auto ra = cc.ra[ii];
-			const auto& obj = e.get<component::render_object>();
+			const auto &r = records[ii];
+			if (nullptr == r.mi || 0 == r.batch)
+				continue;
+			auto it = cc.batch_index.try_emplace(make_batch_key(ii, *c.slots[slot].obj, r), ngroup).first;
+			if (it->second == ngroup){
+				if (ngroup == cc.batch_groups.size())
+					cc.batch_groups.emplace_back();
+				cc.batch_groups[ngroup++].clear();
+			}
+			cc.batch_groups[it->second].push_back(slot * cc.ra_count + ii);
+		}
+	}
+	for (uint32_t ii=0; ii<ngroup; ++ii){
+		const auto &g = cc.batch_groups[ii];
+		if (g.size() < MIN_INSTANCE_COUNT)
+			continue;
+		const uint32_t b = (uint32_t)cc.batches.size();
+		cc.batches.push_back(instance_batch{(uint32_t)cc.batch_slots.size(), (uint32_t)g.size(), false, {}});
+		for (auto ridx : g){
+			cc.record_batch[ridx] = b;
+			cc.batch_slots.push_back(ridx / cc.ra_count);
+		}
+	}
+}
+
+static inline void
+build_draws(submit_cache &cc){
+	const auto &c = cc.cache;
+	cc.draws.clear();
+	cc.sort_items.clear();
+	build_batches(cc);
+	for (uint32_t slot=0; slot<(uint32_t)c.slots.size(); ++slot){
+		const auto &s = c.slots[slot];
+		const auto records = &c.records[slot * cc.ra_count];
+		for (uint8_t ii=0; ii<cc.ra_count; ++ii){
+			const auto &r = records[ii];
+			if (nullptr == r.mi)
+				continue;
+			// the batch is drawn in the place of its first record
+			const uint32_t b = cc.record_batch[slot * cc.ra_count + ii];
+			if (b != INVALID_BATCH && cc.batch_slots[cc.batches[b].first] != slot)
+				continue;
+			if (cc.sort){
+				cc.sort_items.push_back(sort_item{r.key, (uint32_t)cc.draws.size()});
+			}
+			cc.draws.push_back(draw_item{s.obj, s.iobj, r.mi, r.depth, slot, b, ii, r.lod});
+		}
+	}
+}
+
+// return false if the last draw list can be replayed
+static inline bool
+update_draw_cache(struct ecs_world* w, submit_cache &cc){
+	auto &c = cc.cache;
+	bool valid = update_cached_args(cc) && c.valid && c.enable;
+
+	// drain the changes every frame, even if the cache is going to be rebuilt
+	const int *rm_changes;
+	const int rm_n = render_material_changes(w->R, &rm_changes);
+	for (int ii=0; valid && ii<rm_n; ++ii){
+		mark_slot(c, find_slot(c.rm_slots, rm_changes[ii]));
+	}
+	render_material_clear_changes(w->R);
+
+	struct material_instance* mi_changes[MATERIAL_STATE_CHANGES_MAX];
+	const int mi_n = material_state_changes(w, mi_changes);
+	queue_fetch_dirty(w->Q, c.Q_changes);
+
+	valid = valid && rm_n >= 0 && mi_n >= 0 && slots_valid(w, c);
+	c.valid = c.enable;
+	if (!valid){
+		c.invalid_rm.clear();
+		rebuild_slots(w, cc);
+		#ifdef RENDER_DEBUG
+		cc.stat.cache_rebuild = 1;
+		cc.stat.cache_update = (uint32_t)c.slots.size();
+		#endif //RENDER_DEBUG
+		return true;
+	}
+
+	for (auto idx : c.invalid_rm){
+		mark_slot(c, find_slot(c.rm_slots, idx));
+	}
+	c.invalid_rm.clear();
+	for (auto Qidx : c.Q_changes){
+		mark_slot(c, find_slot(c.Q_slots, Qidx));
+	}
+	for (auto& e : ecs::select<component::scene_changed, component::render_object>(w->ecs)) {
+		mark_slot(c, find_slot(c.rm_slots, (int)e.get<component::render_object>().rm_idx));
+	}
+	for (auto slot : c.indirect_slots){
+		mark_slot(c, slot);
+	}
+	for (auto slot : c.lod_slots){
+		const auto &s = c.slots[slot];
+		if (s.lod_select[0] != s.lod->select0 || s.lod_select[1] != s.lod->select1){
+			mark_slot(c, slot);
+		}
+	}
+	if (mi_n > 0){
+		// material state is rarely changed, just search the records
+		for (size_t ii=0; ii<c.records.size(); ++ii){
+			const auto mi = c.records[ii].mi;
+			if (mi && std::find(mi_changes, mi_changes + mi_n, mi) != mi_changes + mi_n){
+				mark_slot(c, (uint32_t)(ii / cc.ra_count));
+			}
+		}
+	}
+
+	bool changed = false;
+	#ifdef RENDER_DEBUG
+	cc.stat.cache_update = (uint32_t)c.dirty_slots.size();
+	#endif //RENDER_DEBUG
+	for (auto slot : c.dirty_slots){
+		changed = update_slot(w, cc, slot) || changed;
+	}
+	c.dirty_slots.clear();
+
+	if (c.args_rekey){
+		for (uint32_t slot=0; slot<(uint32_t)c.slots.size(); ++slot){
+			auto records = &c.records[slot * cc.ra_count];
+			for (uint8_t ii=0; ii<cc.ra_count; ++ii){
+				if (c.args_rekey & (1ull << ii)){
+					changed = update_record(w, cc, ii, c.slots[slot], records[ii]) || changed;
+				}
+			}
+		}
+		#ifdef RENDER_DEBUG
+		cc.stat.cache_update = (uint32_t)c.slots.size();
+		#endif //RENDER_DEBUG
+	}
+
+	#ifdef RENDER_DEBUG
+	cc.stat.cache_replay = changed ? 0 : 1;
+	#endif //RENDER_DEBUG
+	return changed;
+}
+
+static inline void
+sort_draws(submit_cache &cc){
+	if (!cc.sort || cc.draws.size() < 2)
+		return;
+#ifdef RENDER_DEBUG
+	const auto start = std::chrono::steady_clock::now();
+#endif //RENDER_DEBUG
+	draw_radix_sort(cc.sort_items, cc.sort_temp);
+	cc.sorted_draws.resize(cc.draws.size());
+	for (size_t ii=0; ii<cc.sort_items.size(); ++ii){
+		cc.sorted_draws[ii] = cc.draws[cc.sort_items[ii].idx];
+	}
+	cc.draws.swap(cc.sorted_draws);
 #ifdef RENDER_DEBUG
-			auto eid = e.component<component::eid>();eid;
+	cc.stat.sort_time += (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 #endif //RENDER_DEBUG
+}
 
-			const component::indirect_object* iobj = e.component<component::indirect_object>();
-			if (obj_visible(w->Q, obj, ra->queue_index) || (indirect_draw_valid(iobj) && obj_queue_visible(w->Q, obj, ra->queue_index))){
-				draw_obj(L, w, ra, &obj, iobj, nullptr, cc.transforms);
-				#ifdef RENDER_DEBUG
-				++cc.stat.simple_submit;
-				#endif //RENDER_DEBUG
+static inline void
+collect_draws(struct ecs_world* w, submit_cache &cc){
+	if (update_draw_cache(w, cc)){
+		build_draws(cc);
+		sort_draws(cc);
+	}
+}
+
+#ifdef RENDER_DEBUG
+static inline void
+count_state_change(submit_context &ctx, struct material_instance *mi){
+	struct material_sortinfo si;
+	material_get_sortinfo(mi, &si);
+	ctx.stat.program_change	+= (si.progid != ctx.last.progid) ? 1 : 0;
+	ctx.stat.material_change+= (si.material != ctx.last.material) ? 1 : 0;
+	ctx.stat.state_change	+= (si.state != ctx.last.state) ? 1 : 0;
+	ctx.last = si;
+}
+#endif //RENDER_DEBUG
+
+// the instanced draws apply the instanced variant, they don't keep the material
+static inline bool
+keep_material(const submit_cache &cc, const void *material, const draw_item *next){
+	return next && (next->batch == INVALID_BATCH || !cc.batches[next->batch].instanced) && material_of(next->mi) == material;
+}
+
+static inline uint16_t
+batch_texture_size(const submit_cache &cc, const instance_batch &b){
+	uint16_t size = 0;
+	for (uint32_t ii=0; ii<b.count; ++ii){
+		size = std::max(size, mesh_lod_texture_size(cc.cache.slots[cc.batch_slots[b.first + ii]].lod));
+	}
+	return size;
+}
+
+static inline void
+submit_range(struct ecs_world* w, const submit_cache &cc, submit_context &ctx, const draw_item *draws, uint32_t n){
+	for (uint32_t ii=0; ii<n; ++ii){
+		const auto &d = draws[ii];
+		auto ra = cc.ra[d.raidx];
+		const draw_item *next = ii+1 < n ? &draws[ii+1] : nullptr;
+		if (d.batch == INVALID_BATCH){
+			draw_obj(w, ctx, ra, d.obj, d.iobj, cc.cache.slots[d.slot].lod, d.lod, d.mi, d.depth, &cc.transforms.slots[d.slot], 1, keep_material(cc, material_of(d.mi), next));
+			#ifdef RENDER_DEBUG
+			++ctx.stat.simple_submit;
+			count_state_change(ctx, d.mi);
+			#endif //RENDER_DEBUG
+			continue;
+		}
+
+		const auto &b = cc.batches[d.batch];
+		if (b.instanced){
+			draw_instanced(w, ctx, ra, d.obj, cc.cache.slots[d.slot].lod, d.lod, d.mi, d.depth, &b.idb, batch_texture_size(cc, b));
+			#ifdef RENDER_DEBUG
+			++ctx.stat.simple_submit;
+			count_state_change(ctx, d.mi);
+			#endif //RENDER_DEBUG
+			continue;
+		}
+
+		for (uint32_t jj=0; jj<b.count; ++jj){
+			const uint32_t slot = cc.batch_slots[b.first + jj];
+			const auto &s = cc.cache.slots[slot];
+			const auto mi = cc.cache.records[slot * cc.ra_count + d.raidx].mi;
+			// the members share the material and the LOD level
+			draw_obj(w, ctx, ra, s.obj, nullptr, s.lod, d.lod, mi, d.depth, &cc.transforms.slots[slot], 1, jj+1 < b.count || keep_material(cc, material_of(mi), next));
+			#ifdef RENDER_DEBUG
+			++ctx.stat.simple_submit;
+			count_state_change(ctx, mi);
+			#endif //RENDER_DEBUG
+		}
+	}
+}
+
+// false if the mesh of a batch member changed since the draw list was built
+static inline bool
+check_batches(const submit_cache &cc){
+	for (const auto &b : cc.batches){
+		const auto &obj = *cc.cache.slots[cc.batch_slots[b.first]].obj;
+		for (uint32_t ii=1; ii<b.count; ++ii){
+			if (!same_mesh(obj, *cc.cache.slots[cc.batch_slots[b.first + ii]].obj))
+				return false;
+		}
+	}
+	return true;
+}
+
+// write the first 3 rows of the worldmat(column major) for each instance, it runs in main thread before the workers start
+static inline void
+alloc_instances(struct ecs_world* w, submit_cache &cc){
+	if (!check_batches(cc)){
+		build_draws(cc);
+		sort_draws(cc);
+	}
+
+	auto M = w->math3d->M;
+	for (auto &b : cc.batches){
+		const uint32_t avail = w->bgfx->get_avail_instance_data_buffer(b.count, INSTANCE_STRIDE);
+		b.instanced = avail >= b.count;
+		if (!b.instanced){
+			#ifdef RENDER_DEBUG
+			++cc.stat.instance_fallback;
+			#endif //RENDER_DEBUG
+			continue;
+		}
+		w->bgfx->alloc_instance_data_buffer(&b.idb, b.count, INSTANCE_STRIDE);
+		float *data = (float*)b.idb.data;
+		for (uint32_t ii=0; ii<b.count; ++ii){
+			const math_t wm = cc.cache.slots[cc.batch_slots[b.first + ii]].obj->worldmat;
+			assert(math_valid(M, wm) && !math_isnull(wm) && "Invalid world mat");
+			const float *v = math_value(M, wm);
+			for (int r=0; r<3; ++r){
+				data[0] = v[r]; data[1] = v[4+r]; data[2] = v[8+r]; data[3] = v[12+r];
+				data += 4;
+			}
+		}
+		#ifdef RENDER_DEBUG
+		++cc.stat.instance_batch;
+		cc.stat.instance_count += b.count;
+		#endif //RENDER_DEBUG
+	}
+}
+
+// the transforms of the draw list, it runs in main thread before the workers start
+static inline void
+alloc_transforms(struct ecs_world* w, submit_cache &cc){
+	auto M = w->math3d->M;
+	auto &arena = cc.transforms;
+	arena.reset((uint32_t)cc.cache.slots.size());
+	uint32_t total = 0;
+	auto add = [&](uint32_t slot){
+		auto &t = arena.slots[slot];
+		if (t.tid == INVALID_TRANSFORM){
+			const math_t wm = cc.cache.slots[slot].obj->worldmat;
+			assert(math_valid(M, wm) && !math_isnull(wm) && "Invalid world mat");
+			t.tid = 0;
+			t.stride = (uint32_t)math_size(M, wm);
+			total += t.stride;
+			arena.used.push_back(slot);
+		}
+	};
+	for (const auto &d : cc.draws){
+		if (d.batch == INVALID_BATCH){
+			add(d.slot);
+		} else if (const auto &b = cc.batches[d.batch]; !b.instanced){
+			for (uint32_t ii=0; ii<b.count; ++ii){
+				add(cc.batch_slots[b.first + ii]);
 			}
 		}
 	}
+	auto encoder = cc.main_context().encoder;
+	for (auto slot : arena.used){
+		auto &t = arena.slots[slot];
+		float *data = arena.alloc(w, encoder, t.stride, total, t.tid);
+		memcpy(data, math_value(M, cc.cache.slots[slot].obj->worldmat), sizeof(float) * 16 * t.stride);
+		total -= t.stride;
+	}
+	#ifdef RENDER_DEBUG
+	cc.stat.transform_count = (uint32_t)arena.used.size();
+	#endif //RENDER_DEBUG
+}
+
+static inline void
+render_submit(struct ecs_world* w, submit_cache &cc){
+	const uint32_t n = (uint32_t)cc.draws.size();
+	if (cc.pool.count() == 1 || n < PARALLEL_SUBMIT_THRESHOLD){
+		submit_range(w, cc, cc.main_context(), cc.draws.data(), n);
+		return;
+	}
+
+	cc.context_count = cc.pool.count();
+	for (uint32_t ii=0; ii<cc.context_count; ++ii){
+		cc.contexts[ii].parallel = true;
+	}
+	std::atomic<uint32_t> next(0);
+	cc.pool.run([w, n, &cc, &next](uint32_t idx){
+		auto &ctx = cc.contexts[idx];
+#ifdef RENDER_DEBUG
+		const auto start = std::chrono::steady_clock::now();
+#endif //RENDER_DEBUG
+		if (idx != 0){
+			ctx.encoder = w->bgfx->encoder_begin(true);
+			// out of encoders, let the other contexts do the job
+			if (nullptr == ctx.encoder)
+				return;
+		}
+		for (uint32_t b; (b = next.fetch_add(SUBMIT_BATCH)) < n; ){
+			submit_range(w, cc, ctx, cc.draws.data() + b, std::min(SUBMIT_BATCH, n - b));
+		}
+		if (idx != 0){
+			w->bgfx->encoder_end(ctx.encoder);
+			ctx.encoder = nullptr;
+		}
+#ifdef RENDER_DEBUG
+		ctx.time = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+#endif //RENDER_DEBUG
+	});
+}
+
+static inline void
+check_submit_error(lua_State *L, submit_cache &cc){
+	for (uint32_t ii=0; ii<cc.context_count; ++ii){
+		if (cc.contexts[ii].err){
+			luaL_error(L, "%s", cc.contexts[ii].err);
+		}
+	}
+}
+
+#ifdef RENDER_DEBUG
+static inline void
+merge_stat(submit_cache &cc){
+	for (uint32_t ii=0; ii<cc.context_count; ++ii){
+		const auto &s = cc.contexts[ii].stat;
+		cc.stat.hitch_submit	+= s.hitch_submit;
+		cc.stat.simple_submit	+= s.simple_submit;
+		cc.stat.efk_hitch_submit+= s.efk_hitch_submit;
+		cc.stat.program_change	+= s.program_change;
+		cc.stat.material_change	+= s.material_change;
+		cc.stat.state_change	+= s.state_change;
+		cc.stat.material_applied+= cc.contexts[ii].mc.applied;
+		cc.stat.material_skipped+= cc.contexts[ii].mc.skipped;
+	}
 }
+#endif //RENDER_DEBUG
 
 static submit_cache cc;
 
 static int
 lrender_submit(lua_State *L) {
 	auto w = getworld(L);
+#ifdef RENDER_DEBUG
+	const auto start = std::chrono::steady_clock::now();
+#endif //RENDER_DEBUG
 
-	cc.clear();
+	cc.clear(w);
 
 	find_render_args(w, cc);
 	build_hitch_info(w, cc);
-	render_submit(L, w, cc);
+	collect_draws(w, cc);
+	alloc_instances(w, cc);
+	alloc_transforms(w, cc);
+	render_submit(w, cc);
 	render_hitch_submit(L, w, cc);
-	
+
+	check_submit_error(L, cc);
+#ifdef RENDER_DEBUG
+	merge_stat(cc);
+	cc.stat.submit_time = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+#endif //RENDER_DEBUG
 	return 0;
 }
 
@@ -421,6 +1357,7 @@ lexit(lua_State *L){
 	queue_destroy(w->Q);
 	w->Q = nullptr;
 
+	cc.pool.stop();
 	return 0;
 }
 
@@ -439,6 +1376,60 @@ lsubmit_stat(lua_State *L){
 
 	lua_pushinteger(L, cc.stat.hitch_count);
 	lua_setfield(L, -2, "hitch_count");
+
+	lua_pushinteger(L, cc.stat.program_change);
+	lua_setfield(L, -2, "program_change");
+
+	lua_pushinteger(L, cc.stat.material_change);
+	lua_setfield(L, -2, "material_change");
+
+	lua_pushinteger(L, cc.stat.state_change);
+	lua_setfield(L, -2, "state_change");
+
+	lua_pushinteger(L, cc.stat.cache_rebuild);
+	lua_setfield(L, -2, "cache_rebuild");
+
+	lua_pushinteger(L, cc.stat.cache_replay);
+	lua_setfield(L, -2, "cache_replay");
+
+	lua_pushinteger(L, cc.stat.cache_update);
+	lua_setfield(L, -2, "cache_update");
+
+	lua_pushinteger(L, cc.stat.transform_count);
+	lua_setfield(L, -2, "transform_count");
+
+	lua_pushinteger(L, cc.stat.instance_batch);
+	lua_setfield(L, -2, "instance_batch");
+
+	lua_pushinteger(L, cc.stat.instance_count);
+	lua_setfield(L, -2, "instance_count");
+
+	lua_pushinteger(L, cc.stat.instance_fallback);
+	lua_setfield(L, -2, "instance_fallback");
+
+	lua_pushinteger(L, cc.stat.material_applied);
+	lua_setfield(L, -2, "material_applied");
+
+	lua_pushinteger(L, cc.stat.material_skipped);
+	lua_setfield(L, -2, "material_skipped");
+
+	lua_pushinteger(L, cc.stat.submit_time);
+	lua_setfield(L, -2, "submit_time");
+
+	lua_pushinteger(L, cc.stat.sort_time);
+	lua_setfield(L, -2, "sort_time");
+
+	lua_createtable(L, cc.context_count, 0);
+	for (uint32_t ii=0; ii<cc.context_count; ++ii){
+		const auto &ctx = cc.contexts[ii];
+		lua_createtable(L, 0, 2);
+		lua_pushinteger(L, ctx.stat.simple_submit + ctx.stat.hitch_submit);
+		lua_setfield(L, -2, "submit");
+		lua_pushinteger(L, ctx.time);
+		lua_setfield(L, -2, "time");
+		lua_seti(L, -2, ii+1);
+	}
+	lua_setfield(L, -2, "workers");
 #endif //RENDER_DEBUG
 	return 1;
 }
@@ -455,6 +1446,84 @@ luaopen_render_stat(lua_State *L){
 	return 1;
 }
 
+static int
+lsubmit_workers(lua_State *L){
+	if (!lua_isnoneornil(L, 1)){
+		const int n = (int)luaL_checkinteger(L, 1);
+		if (n < 0 || n > (int)MAX_SUBMIT_WORKER){
+			return luaL_error(L, "Invalid submit worker count: %d, should be : 0 <= n <= %d", n, MAX_SUBMIT_WORKER);
+		}
+		if ((uint32_t)n+1 != cc.pool.count()){
+			cc.pool.start(n);
+		}
+	}
+	lua_pushinteger(L, cc.pool.count()-1);
+	return 1;
+}
+
+static int
+lsubmit_sort(lua_State *L){
+	if (!lua_isnoneornil(L, 1)){
+		const bool sort = lua_toboolean(L, 1) != 0;
+		if (sort != cc.sort){
+			cc.sort = sort;
+			cc.cache.valid = false;
+		}
+	}
+	lua_pushboolean(L, cc.sort);
+	return 1;
+}
+
+static int
+lsubmit_instancing(lua_State *L){
+	if (!lua_isnoneornil(L, 1)){
+		const bool instancing = lua_toboolean(L, 1) != 0;
+		if (instancing != cc.instancing){
+			cc.instancing = instancing;
+			cc.cache.valid = false;
+		}
+	}
+	lua_pushboolean(L, cc.instancing);
+	return 1;
+}
+
+static int
+lsubmit_cache(lua_State *L){
+	if (!lua_isnoneornil(L, 1)){
+		cc.cache.enable = lua_toboolean(L, 1) != 0;
+	}
+	lua_pushboolean(L, cc.cache.enable);
+	return 1;
+}
+
+// invalidate(rm_idx) : the render object changed something the draw cache can't track, ex: render_layer
+// invalidate() : rebuild the whole draw list
+static int
+lsubmit_invalidate(lua_State *L){
+	if (lua_isnoneornil(L, 1)){
+		cc.cache.valid = false;
+	} else {
+		cc.cache.invalid_rm.push_back((int)luaL_checkinteger(L, 1));
+	}
+	return 0;
+}
+
+extern "C" int
+luaopen_render_submit(lua_State *L){
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "workers",	lsubmit_workers},
+		{ "sort",		lsubmit_sort},
+		{ "instancing",	lsubmit_instancing},
+		{ "cache",		lsubmit_cache},
+		{ "invalidate",	lsubmit_invalidate},
+		{ nullptr, 		nullptr},
+	};
+	luaL_newlibtable(L,l);
+	luaL_setfuncs(L,l,0);
+	return 1;
+}
+
 extern "C" int
 luaopen_system_render(lua_State *L){
 	luaL_checkversion(L);
@@ -2,6 +2,8 @@ local ecs   = ...
 local world = ecs.world
 local w     = world.w
 
+local submit = require "render.submit"
+
 local MAX_LAYER<const> = 64
 
 local layer_names = {
@@ -77,6 +79,7 @@ function irl.set_layer(e, layername)
     e.render_layer = layername
     e.render_object.render_layer = lidx
     w:submit(e)
+    submit.invalidate(e.render_object.rm_idx)
 end
 
 function irl.is_opacity_layer(layername)
@@ -90,6 +93,7 @@ function rl_sys:start_frame()
             local idx = irl.layeridx(e.render_layer)
             e.render_object.render_layer = idx
         end
+        submit.invalidate()
 
         opacity_layers = build_opacity_layers()
         break
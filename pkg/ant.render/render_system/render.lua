@@ -18,6 +18,8 @@ local iviewport		= ecs.require "ant.render|viewport.state"
 
 local ig 			= ecs.require "ant.group|group"
 
+local submit		= require "render.submit"
+
 local LAYER_NAMES<const> = {"foreground", "opacity", "background", "translucent", "decal_stage", "ui_stage"}
 
 local irender		= {}
@@ -38,6 +40,11 @@ function irender.stop_draw(stop)
 	STOP_DRAW = stop
 end
 
+--submit draws with n worker threads, 0 for submit in main thread only, nil to query
+function irender.submit_workers(n)
+	return submit.workers(n)
+end
+
 function irender.create_material_from_template(template_material_obj, state, cache)
 	local mo = cache[template_material_obj]
 	if nil == mo then
@@ -339,6 +346,8 @@ end
 
 function irender.mark_group_visible(gid, enable)
 	ig.filter_group_tag(gid, enable, "render_object_visible", "view_visible", "render_object")
+	-- render_object_visible changed, the cached draw list is out of date
+	submit.invalidate()
 end
 
 return irender
@@ -17,9 +17,17 @@ local itimer	= ecs.require "ant.timer|timer_system"
 local irl		= ecs.require "ant.render|render_layer.render_layer"
 local RM        = ecs.require "ant.material|material"
 
+local setting	= import_package "ant.settings"
+local SUBMIT_WORKERS<const> = setting:get "graphic/render/submit_workers" or 0
+local ENABLE_LOD<const>		= setting:get "graphic/lod/enable"
+
 local render_sys= ecs.system "render_system"
 local R			= world:clibs "render.render_material"
 
+function render_sys:init()
+	irender.submit_workers(SUBMIT_WORKERS)
+end
+
 function render_sys:start_frame()
 	assetmgr.material_check()
 end
@@ -57,6 +65,25 @@ local function update_ro(ro, m)
 	end 
 end
 
+local MAX_LOD<const> = 3
+
+-- the lod of the meshbin: { {start=, num=, error=}, ... }, the ranges are in the ib of LOD 0
+local function create_mesh_lod(lod)
+	local ml = {
+		levels	= math.min(#lod, MAX_LOD),
+		select0	= 0,
+		select1	= 0,
+		size	= 0,
+	}
+	for i=1, MAX_LOD do
+		local l = lod[i]
+		ml["ib_start"..i]	= l and l.start or 0
+		ml["ib_num"..i]		= l and l.num or 0
+		ml["error"..i]		= l and l.error or 0
+	end
+	return ml
+end
+
 local RENDER_ARGS = setmetatable({}, {__index = function (t, k)
 	local v = {
 		queue_index		= queuemgr.queue_index(k),
@@ -103,6 +130,15 @@ function render_sys:entity_init()
 		end
 	end
 
+	if ENABLE_LOD then
+		for e in w:select "INIT mesh:in render_object no_lod:absent mesh_lod?out" do
+			local lod = e.mesh.lod
+			if lod and e.mesh.ib then
+				e.mesh_lod = create_mesh_lod(lod)
+			end
+		end
+	end
+
 	for e in w:select "INIT render_layer?update render_object:update" do
 		local rl = e.render_layer
 		if not rl  then
@@ -167,7 +203,15 @@ local function add_render_arg(qe)
 	local viewid = rt.viewid
 
 	bgfx.touch(viewid)
-	qe.render_args = RENDER_ARGS[qe.queue_name]
+	local ra = RENDER_ARGS[qe.queue_name]
+	--viewmat is used to sort the draws by view depth
+	if qe.camera_ref then
+		local ce <close> = world:entity(qe.camera_ref, "camera:in")
+		ra.viewmat = ce.camera.viewmat
+	else
+		ra.viewmat = nil
+	end
+	qe.render_args = ra
 end
 
 function render_sys:commit_system_properties()
@@ -188,12 +232,12 @@ end
 function render_sys:update_render_args()
 	w:clear "render_args"
 	if irender.stop_draw() then
-		for qe in w:select "swapchain_queue queue_name:in render_target:in render_args:new" do
+		for qe in w:select "swapchain_queue queue_name:in render_target:in camera_ref?in render_args:new" do
 			add_render_arg(qe)
 		end
 		return
 	end
-	for qe in w:select "visible queue_name:in render_target:in render_args:new" do
+	for qe in w:select "visible queue_name:in render_target:in camera_ref?in render_args:new" do
 		add_render_arg(qe)
 	end
 end
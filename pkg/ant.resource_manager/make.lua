@@ -9,5 +9,10 @@ lm:lua_source "resource_manager" {
     sources = {
         "src/textureman.c",
         "src/programan.c",
-    }
+    },
+    msvc = {
+        flags = {
+            "/experimental:c11atomics"
+        },
+    },
 }
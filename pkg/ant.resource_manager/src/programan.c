@@ -3,13 +3,46 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdint.h>
-#include <stdlib.h>
+#include <stdatomic.h>
 #include "luabgfx.h"
 #include "programan.h"
 
 #define PROGRAM_MAX 0x8000
 #define REMOVE_MAX 1024
 #define INVALID_HANDLE 0xffff
+// the slots visited by the clock hand in one step
+#define CLOCK_STEP 64
+// the hand walks faster over the threshold, the programs over it are evicted in a few sets
+#define CLOCK_STEP_OVER (CLOCK_STEP * 4)
+// the hit/miss counters of the threads calling program_get, the threads more than it share the last one
+#define COUNTER_MAX 64
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/*
+	The programs are evicted by a clock: the hand walks the ids a few steps for each set and each frame,
+	a program is evicted only if it isn't used in the last frames and since the hand passed it last time
+	(second chance), so touch is a store of the timestamp and eviction is O(1) amortized.
+
+	program_get is called by the submit workers in parallel, so the timestamps and the request flag
+	it writes are relaxed atomics. The hit/miss counters are per thread(only the owner writes them, no
+	shared cache line in the hot path), program_stat sums them.
+*/
+
+struct program_counter {
+	_Atomic uint32_t hit;
+	_Atomic uint32_t miss;
+	char pad[64 - sizeof(uint32_t) * 2];
+};
+
+struct program_stat {
+	uint32_t recreate;
+	uint32_t evict;
+};
 
 struct program_manager {
 	int max;
@@ -18,14 +51,64 @@ struct program_manager {
 	int threshold_reserved;
 	int id;
 	int removed_n;
-	int request;
+	atomic_int request;
+	int hand;
 	uint32_t frame;
+	struct program_stat stat;
 	uint16_t map[PROGRAM_MAX];
 	uint16_t removed[REMOVE_MAX];
-	uint32_t timestamp[PROGRAM_MAX];
+	uint16_t removed_handle[REMOVE_MAX];
+	_Atomic uint32_t timestamp[PROGRAM_MAX];
+	uint32_t visited[PROGRAM_MAX];	// the timestamp when the hand passed
+	uint8_t pinned[PROGRAM_MAX];
+	uint8_t evicted[PROGRAM_MAX];
 };
 
 static struct program_manager g_man;
+static struct program_counter g_counter[COUNTER_MAX];
+static atomic_int g_counter_n;
+static THREAD_LOCAL struct program_counter *t_counter;
+
+static inline uint32_t
+get_timestamp(int id) {
+	return atomic_load_explicit(&g_man.timestamp[id], memory_order_relaxed);
+}
+
+static inline void
+set_timestamp(int id, uint32_t t) {
+	atomic_store_explicit(&g_man.timestamp[id], t, memory_order_relaxed);
+}
+
+static inline struct program_counter *
+thread_counter(void) {
+	struct program_counter *c = t_counter;
+	if (c == NULL) {
+		int slot = atomic_fetch_add_explicit(&g_counter_n, 1, memory_order_relaxed);
+		c = &g_counter[slot < COUNTER_MAX ? slot : COUNTER_MAX - 1];
+		t_counter = c;
+	}
+	return c;
+}
+
+// not a read-modify-write, the counter is written by one thread(but the shared last one may lose a few)
+static inline void
+counter_add(_Atomic uint32_t *counter) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// touch the program, returns the handle
+static inline uint16_t
+touch_program(int id) {
+	uint16_t h = g_man.map[id];
+	set_timestamp(id, g_man.frame);
+	if (h != INVALID_HANDLE) {
+		counter_add(&thread_counter()->hit);
+	} else {
+		counter_add(&thread_counter()->miss);
+		atomic_store_explicit(&g_man.request, 1, memory_order_relaxed);
+	}
+	return h;
+}
 
 static inline int
 checkid(lua_State *L, int index) {
@@ -79,7 +162,15 @@ lprogram_init(lua_State *L) {
 	g_man.id = 0;
 	g_man.frame = 0;
 	g_man.removed_n = 0;
-	g_man.request = 0;
+	atomic_store(&g_man.request, 0);
+	g_man.hand = 0;
+	int i;
+	for (i=0;i<COUNTER_MAX;i++) {
+		atomic_store(&g_counter[i].hit, 0);
+		atomic_store(&g_counter[i].miss, 0);
+	}
+	g_man.stat.recreate = 0;
+	g_man.stat.evict = 0;
 	return 0;
 }
 
@@ -89,46 +180,39 @@ lprogram_new(lua_State *L) {
 		return luaL_error(L, "Too many program id");
 	int id = g_man.id++;
 	g_man.map[id] = INVALID_HANDLE;
-	g_man.timestamp[id] = g_man.frame;
+	set_timestamp(id, g_man.frame);
+	g_man.visited[id] = g_man.frame;
+	g_man.pinned[id] = 0;
+	g_man.evicted[id] = 0;
 	lua_pushinteger(L, id+1);
 	return 1;
 }
 
-struct timehandle {
-	uint32_t life;
-	int id;
-};
-
-static int
-compar_timehandle(const void *a, const void *b) {
-	const struct timehandle *aa = (const struct timehandle *)a;
-	const struct timehandle *bb = (const struct timehandle *)b;
-	return (int)(bb->life - aa->life);
-}
-
 static void
-remove_old(struct program_manager *M) {
-	int n = 0;
-	struct timehandle array[PROGRAM_MAX];
-	int i;
+remove_old(struct program_manager *M, int step) {
 	uint32_t current = M->frame;
-	for (i=0;i<M->id;i++) {
-		if (M->map[i] != INVALID_HANDLE) {
-			struct timehandle *h = &array[n++];
-			h->life = current - M->timestamp[i];
-			h->id = i;
-		}
-	}
-	qsort(array, n, sizeof(struct timehandle), compar_timehandle);
-	for (i=0;i<n;i++) {
+	int i;
+	for (i=0;i<step && M->id > 0;i++) {
 		if (M->n <= M->threshold_reserved)
 			return;
 		if (M->removed_n >= REMOVE_MAX)
 			return;
-		int id = array[i].id;
-		uint16_t h = M->map[id];
+		int id = M->hand;
+		if (++M->hand >= M->id)
+			M->hand = 0;
+		if (M->map[id] == INVALID_HANDLE || M->pinned[id])
+			continue;
+		uint32_t t = get_timestamp(id);
+		if (current - t <= 1 || t != M->visited[id]) {
+			M->visited[id] = t;
+			continue;
+		}
+		M->removed[M->removed_n] = (uint16_t)id;
+		M->removed_handle[M->removed_n] = M->map[id];
+		++M->removed_n;
 		M->map[id] = INVALID_HANDLE;
-		M->removed[M->removed_n++] = h;
+		M->evicted[id] = 1;
+		++M->stat.evict;
 		--M->n;
 	}
 }
@@ -143,11 +227,24 @@ lprogram_set(lua_State *L) {
 	if (g_man.map[id] != INVALID_HANDLE)
 		return luaL_error(L, "Program id %d is already set", id + 1);
 	g_man.map[id] = handle;
+	g_man.visited[id] = get_timestamp(id);
 	++g_man.n;
-	if (g_man.n > g_man.threshold_reserved)
-		remove_old(&g_man);
-	if (g_man.n + g_man.removed_n > g_man.max)
-		return luaL_error(L, "Too many programs in memory");
+	if (g_man.evicted[id]) {
+		g_man.evicted[id] = 0;
+		++g_man.stat.recreate;
+	}
+	if (g_man.n > g_man.threshold_removed) {
+		remove_old(&g_man, CLOCK_STEP_OVER);
+	} else if (g_man.n > g_man.threshold_reserved) {
+		remove_old(&g_man, CLOCK_STEP);
+	}
+	if (g_man.n + g_man.removed_n > g_man.max) {
+		// the last resort before the error, it's never reached while the hand keeps up with the sets:
+		// two rounds, the first one may only clear the second chance
+		remove_old(&g_man, g_man.id * 2);
+		if (g_man.n + g_man.removed_n > g_man.max)
+			return luaL_error(L, "Too many programs in memory");
+	}
 	return 0;
 }
 
@@ -160,6 +257,44 @@ lprogram_reset(lua_State *L) {
 	--g_man.n;
 	lua_pushinteger(L, g_man.map[id]);
 	g_man.map[id] = INVALID_HANDLE;
+	g_man.evicted[id] = 0;
+	return 1;
+}
+
+static int
+lprogram_pin(lua_State *L) {
+	int id = checkid(L, 1);
+	g_man.pinned[id-1] = lua_toboolean(L, 2);
+	return 0;
+}
+
+static int
+lprogram_stat(lua_State *L) {
+	lua_settop(L, 1);
+	if (lua_isnil(L, 1)) {
+		lua_settop(L, 0);
+		lua_createtable(L, 0, 6);
+	} else {
+		luaL_checktype(L, 1, LUA_TTABLE);
+	}
+	lua_Integer hit = 0, miss = 0;
+	int i;
+	for (i=0;i<COUNTER_MAX;i++) {
+		hit += atomic_load_explicit(&g_counter[i].hit, memory_order_relaxed);
+		miss += atomic_load_explicit(&g_counter[i].miss, memory_order_relaxed);
+	}
+	lua_pushinteger(L, hit);
+	lua_setfield(L, 1, "hit");
+	lua_pushinteger(L, miss);
+	lua_setfield(L, 1, "miss");
+	lua_pushinteger(L, g_man.stat.recreate);
+	lua_setfield(L, 1, "recreate");
+	lua_pushinteger(L, g_man.stat.evict);
+	lua_setfield(L, 1, "evict");
+	lua_pushinteger(L, g_man.n);
+	lua_setfield(L, 1, "n");
+	lua_pushinteger(L, g_man.max);
+	lua_setfield(L, 1, "max");
 	return 1;
 }
 
@@ -174,11 +309,14 @@ lprogram_remove(lua_State *L) {
 	} else {
 		luaL_checktype(L, 1, LUA_TTABLE);
 	}
+	// id, handle pairs
 	int n = (int)lua_rawlen(L, 1);
 	int i;
 	for (i=0;i<g_man.removed_n;i++) {
-		lua_pushinteger(L, g_man.removed[i]);
-		lua_seti(L, 1, n + i + 1);
+		lua_pushinteger(L, g_man.removed[i] + 1);
+		lua_seti(L, 1, ++n);
+		lua_pushinteger(L, g_man.removed_handle[i]);
+		lua_seti(L, 1, ++n);
 	}
 	g_man.removed_n = 0;
 	return 1;
@@ -186,11 +324,12 @@ lprogram_remove(lua_State *L) {
 
 static int
 lprogram_request(lua_State *L) {
-	if (!g_man.request) {
+	if (g_man.n > g_man.threshold_reserved)
+		remove_old(&g_man, CLOCK_STEP);
+	if (!atomic_exchange_explicit(&g_man.request, 0, memory_order_relaxed)) {
 		++g_man.frame;
-		return 0;		
+		return 0;
 	}
-	g_man.request = 0;
 	lua_settop(L, 1);
 	if (lua_isnil(L, 1)) {
 		lua_settop(L, 0);
@@ -202,7 +341,7 @@ lprogram_request(lua_State *L) {
 	uint32_t frame = g_man.frame++;
 	int idx = 0;
 	for (i=0;i<g_man.id;i++) {
-		if (g_man.timestamp[i] == frame && g_man.map[i] == INVALID_HANDLE) {
+		if (get_timestamp(i) == frame && g_man.map[i] == INVALID_HANDLE) {
 			lua_pushinteger(L, i+1);
 			lua_seti(L, 1, ++idx);
 		}
@@ -213,13 +352,9 @@ lprogram_request(lua_State *L) {
 static int
 lprogram_get(lua_State *L) {
 	int id = checkid(L, 1);
-	--id;
-	uint16_t h = g_man.map[id];
-	g_man.timestamp[id] = g_man.frame;
+	uint16_t h = touch_program(id - 1);
 	int luahandle = (BGFX_HANDLE_PROGRAM << 16) | h;
 	lua_pushinteger(L, luahandle);
-	if (h != INVALID_HANDLE)
-		g_man.request = 1;
 	return 1;
 }
 
@@ -228,12 +363,7 @@ program_get(int id) {
 	bgfx_program_handle_t handle = BGFX_INVALID_HANDLE;
 	if (id <= 0 || id > g_man.id)
 		return handle;
-	--id;
-	uint16_t h = g_man.map[id];
-	g_man.timestamp[id] = g_man.frame;
-	handle.idx = h;
-	if (h != INVALID_HANDLE)
-		g_man.request = 1;
+	handle.idx = touch_program(id - 1);
 	return handle;
 }
 
@@ -259,6 +389,8 @@ luaopen_programan_server(lua_State *L) {
 		{ "program_reset", lprogram_reset },
 		{ "program_remove", lprogram_remove },
 		{ "program_request", lprogram_request },
+		{ "program_pin", lprogram_pin },
+		{ "program_stat", lprogram_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, l);	
@@ -3,6 +3,7 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include "luabgfx.h"
 #include "textureman.h"
 
@@ -11,7 +12,11 @@
 static uint16_t g_texture[TEXTURE_MAX_ID];
 static uint16_t g_texture_id = 0;
 static uint32_t g_frame = 0;
-static uint32_t g_texture_timestamp[TEXTURE_MAX_ID];
+// texture_get is called by the submit workers in parallel, the timestamps are relaxed atomics
+static _Atomic uint32_t g_texture_timestamp[TEXTURE_MAX_ID];
+// the max projected size(in pixels) requested since the last texture_size, 0 for no request.
+// texture_request is called by the submit workers too
+static _Atomic uint16_t g_texture_size[TEXTURE_MAX_ID];
 
 static int
 ltexture_create(lua_State *L) {
@@ -21,7 +26,8 @@ ltexture_create(lua_State *L) {
 	}
 	int id = g_texture_id++;
 	g_texture[id] = handle;
-	g_texture_timestamp[id] = g_frame;
+	atomic_store_explicit(&g_texture_timestamp[id], g_frame, memory_order_relaxed);
+	atomic_store_explicit(&g_texture_size[id], 0, memory_order_relaxed);
 	lua_pushinteger(L, id+1);
 	return 1;
 }
@@ -38,7 +44,7 @@ static int
 ltexture_get(lua_State *L) {
 	int id = checktextureid(L, 1);
 	uint16_t h = g_texture[id - 1];
-	g_texture_timestamp[id - 1] = g_frame;
+	atomic_store_explicit(&g_texture_timestamp[id - 1], g_frame, memory_order_relaxed);
 	int luahandle = (BGFX_HANDLE_TEXTURE << 16) | h;
 	lua_pushinteger(L, luahandle);
 	return 1;
@@ -50,7 +56,7 @@ texture_transform(int id) {
 	if (id <= 0 || id > g_texture_id)
 		return handle.idx;
 	uint16_t h = g_texture[id - 1];
-	g_texture_timestamp[id - 1] = g_frame;
+	atomic_store_explicit(&g_texture_timestamp[id - 1], g_frame, memory_order_relaxed);
 	return h;
 }
 
@@ -60,6 +66,27 @@ texture_get(int id) {
 	return handle;
 }
 
+void
+texture_request(int id, int size) {
+	if (id <= 0 || id > g_texture_id)
+		return;
+	if (size > 0xffff)
+		size = 0xffff;
+	_Atomic uint16_t *p = &g_texture_size[id - 1];
+	uint16_t last = atomic_load_explicit(p, memory_order_relaxed);
+	while (size > last) {
+		if (atomic_compare_exchange_weak_explicit(p, &last, (uint16_t)size, memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+}
+
+static int
+ltexture_request(lua_State *L) {
+	int id = checktextureid(L, 1);
+	texture_request(id, (int)luaL_checkinteger(L, 2));
+	return 0;
+}
+
 static int
 ltexture_set(lua_State *L) {
 	int id = checktextureid(L, 1);
@@ -77,7 +104,7 @@ lframe_tick(lua_State *L) {
 
 static inline uint32_t
 read_timestamp(int index) {
-	uint32_t t = g_texture_timestamp[index];
+	uint32_t t = atomic_load_explicit(&g_texture_timestamp[index], memory_order_relaxed);
 	return (uint32_t)(g_frame - t);
 }
 
@@ -103,6 +130,23 @@ ltexture_timestamp(lua_State *L) {
 	return 1;
 }
 
+// replace the ids in the table with the requested sizes, and reset them
+static int
+ltexture_size(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	int n = (int)lua_rawlen(L, 1);
+	int i;
+	for (i=1;i<=n;i++) {
+		lua_geti(L, 1, i);
+		int id = checktextureid(L, -1);
+		lua_pop(L, 1);
+		lua_pushinteger(L, atomic_exchange_explicit(&g_texture_size[id - 1], 0, memory_order_relaxed));
+		lua_seti(L, 1, i);
+	}
+	return 1;
+}
+
 static inline int
 is_invalid(int id, uint16_t* filter, size_t filter_n) {
 	for (size_t i = 0; i < filter_n; ++i) {
@@ -182,11 +226,14 @@ luaopen_textureman_client(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
 		{ "texture_get", ltexture_get },
+		{ "texture_request", ltexture_request },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, l);
 	lua_pushlightuserdata(L, texture_transform);
 	lua_setfield(L, -2, "texture_get_cfunc");
+	lua_pushlightuserdata(L, texture_request);
+	lua_setfield(L, -2, "texture_request_cfunc");
 	return 1;
 }
 
@@ -197,6 +244,7 @@ luaopen_textureman_server(lua_State *L) {
 		{ "texture_create", ltexture_create },
 		{ "texture_set", ltexture_set },
 		{ "texture_timestamp", ltexture_timestamp },
+		{ "texture_size", ltexture_size },
 		{ "frame_tick", lframe_tick },
 		{ "frame_new", lframe_new },
 		{ "frame_old", lframe_old },
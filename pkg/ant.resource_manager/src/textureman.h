@@ -4,5 +4,8 @@
 #include <bgfx/c99/bgfx.h>
 
 bgfx_texture_handle_t texture_get(int id);
+// the projected size in pixels of the texture, the texture streaming loads the mips for the max size.
+// it's thread safe, the submit workers request the textures of the draws
+void texture_request(int id, int size);
 
 #endif
@@ -3,10 +3,23 @@ local bgfx       = require "bgfx"
 local datalist   = require "datalist"
 local textureman = require "textureman.server"
 local image      = require "image"
+local fastio     = require "fastio"
 local aio        = import_package "ant.io"
+local setting    = import_package "ant.settings"
 
 local ext_service = {}
 
+-- texture streaming: the 2d textures are loaded with the low mips first(skip the top mips of bgfx.create_texture),
+-- the higher mips are loaded when they are sampled(textureman timestamp), up to the size requested by
+-- textureman.texture_request(the full size without request). The higher mips not sampled recently are
+-- evicted when the resident bytes are over the budget.
+local STREAMING <const> = setting:get "graphic/texture/streaming"
+local STREAM_BUDGET <const> = (setting:get "graphic/texture/stream_budget" or 256) * 1024 * 1024
+local STREAM_LOW_SIZE <const> = 64      -- the max width/height of the low mips
+local STREAM_INTERVAL <const> = 10      -- frames
+local STREAM_ACTIVE <const> = 30        -- sampled in the last frames
+local STREAM_MAX_PENDING <const> = 4
+
 local mem_formats <const> = {
     RGBA8 = "bbbb",
     RGBA32F = "ffff",
@@ -29,6 +42,10 @@ local function createTexture(c)
             --error "not support 3d texture right now"
             h = bgfx.create_texture3d(ti.width, ti.height, ti.depth, ti.numMips ~= 0, ti.format, c.flag, m)
         end
+    elseif c.memory then
+        local m = c.memory
+        c.memory = nil
+        h = bgfx.create_texture(bgfx.memory_buffer(fastio.wrap(m)), c.flag, c.stream and c.stream.skip)
     else
         h = bgfx.create_texture(bgfx.memory_buffer(aio.readall(c.name.."|main.bin")), c.flag)
     end
@@ -49,14 +66,43 @@ local function loadExt(protocol, path, config, name)
 	return c
 end
 
-local function loadTexture(name)
+local function stream_bytes(info, skip)
+    return info.storageSize >> (2 * skip)
+end
+
+local function stream_new(info)
+    if not STREAMING or info.cubeMap or info.depth > 1 or info.numLayers > 1 or info.numMips <= 1 then
+        return
+    end
+    local skip = 0
+    local size = math.max(info.width, info.height)
+    while size > STREAM_LOW_SIZE and skip + 1 < info.numMips do
+        size = size // 2
+        skip = skip + 1
+    end
+    if skip > 0 then
+        return {
+            lowskip = skip,
+            skip = skip,
+            lowbytes = stream_bytes(info, skip),
+            bytes = 0,  -- the texture of the higher mips, the low one is kept
+        }
+    end
+end
+
+-- priority: the priority of the async io, see ant.io
+local function loadTexture(name, priority)
 	local protocol, path, config = name:match "(%w+):(.*)%s(.*)"
 	if protocol then
 		return loadExt(protocol, path, config, name)
 	end
     local path = name.."|source.ant"
-    local c = datalist.parse(aio.readall(path))
+    local c = datalist.parse(aio.readall_async(path, priority))
     c.name = name
+    if not c.value then
+        c.memory = aio.readall_v_async(name.."|main.bin", priority)
+        c.stream = stream_new(c.info)
+    end
     return c
 end
 
@@ -170,6 +216,9 @@ local DefaultTexture = {
 
 local textureByName = {}
 local textureById = {}
+local streamTextures = {}
+local StreamResident = 0
+local StreamPending = 0
 local loadQueue = {}
 local createQueue = {}
 local destroyQueue = {}
@@ -190,6 +239,9 @@ end
 
 local function asyncCreateTexture(name, textureData)
     if createQueue[name] then
+        if textureData.memory then
+            fastio.free(textureData.memory)
+        end
         return
     end
     createQueue[name] = textureData
@@ -199,15 +251,19 @@ local function asyncCreateTexture(name, textureData)
     end
 end
 
-local function asyncLoadTexture(c)
+local function asyncLoadTexture(c, priority)
     local Token = loadQueue[c.id]
     if Token then
+        if priority == "now" then
+            -- someone is waiting for it, move the reading ahead
+            aio.prefetch(c.name.."|main.bin", priority)
+        end
         return Token
     end
     Token = {}
     loadQueue[c.id] = Token
     ltask.fork(function ()
-        local textureData = loadTexture(c.name)
+        local textureData = loadTexture(c.name, priority)
         assert(c.type == which_texture_type(textureData.info))
         c.texinfo = textureData.info
         c.sampler = textureData.sampler
@@ -230,6 +286,15 @@ local function asyncDestroyTexture(c)
 	else
 	    destroyQueue[#destroyQueue+1] = c.handle
 	end
+    local r = c.stream
+    if r then
+        if r.low ~= c.handle then
+            destroyQueue[#destroyQueue+1] = r.low
+        end
+        StreamResident = StreamResident - r.lowbytes - r.bytes
+        streamTextures[c.id] = nil
+        c.stream = nil
+    end
     textureman.texture_set(c.id, DefaultTexture[c.type])
     c.handle = nil
 end
@@ -261,7 +326,7 @@ function S.texture_create(name, type)
         textureByName[name] = c
         textureById[id] = c
     end
-    ltask.wait(asyncLoadTexture(c))
+    ltask.wait(asyncLoadTexture(c, "now"))
     return {
         id = c.id,
         texinfo = c.texinfo,
@@ -281,7 +346,7 @@ function S.texture_create_fast(name, type)
         }
         textureByName[name] = c
         textureById[id] = c
-        asyncLoadTexture(c)
+        asyncLoadTexture(c, "prefetch")
     end
     return c.id
 end
@@ -312,6 +377,13 @@ ltask.fork(function ()
             local handle = textureData.handle or createTexture(textureData)
             c.handle = handle
             c.flag   = textureData.flag
+            local r = textureData.stream
+            if r then
+                r.low = handle
+                c.stream = r
+                streamTextures[c.id] = c
+                StreamResident = StreamResident + r.lowbytes
+            end
             textureman.texture_set(c.id, handle)
             FrameLoaded = FrameLoaded + 1
             ltask.sleep(0)
@@ -319,6 +391,99 @@ ltask.fork(function ()
     end
 end)
 
+local function stream_target(info, r, size)
+    if size == 0 then
+        return 0
+    end
+    local skip = 0
+    local s = math.max(info.width, info.height)
+    while skip < r.lowskip and (s // 2) >= size do
+        s = s // 2
+        skip = skip + 1
+    end
+    return skip
+end
+
+local function stream_evict(c)
+    local r = c.stream
+    destroyQueue[#destroyQueue+1] = c.handle
+    c.handle = r.low
+    textureman.texture_set(c.id, r.low)
+    StreamResident = StreamResident - r.bytes
+    r.bytes = 0
+    r.skip = r.lowskip
+end
+
+local function stream_upgrade(c, skip)
+    local r = c.stream
+    r.upgrading = true
+    StreamPending = StreamPending + 1
+    ltask.fork(function ()
+        local m = aio.readall_v_async(c.name.."|main.bin", "prefetch")
+        local h = bgfx.create_texture(bgfx.memory_buffer(fastio.wrap(m)), c.flag, skip)
+        StreamPending = StreamPending - 1
+        r.upgrading = nil
+        if c.stream ~= r then
+            -- destroyed while loading
+            destroyQueue[#destroyQueue+1] = h
+            return
+        end
+        bgfx.set_name(h, c.name)
+        if c.handle ~= r.low then
+            destroyQueue[#destroyQueue+1] = c.handle
+        end
+        c.handle = h
+        textureman.texture_set(c.id, h)
+        local bytes = stream_bytes(c.texinfo, skip)
+        StreamResident = StreamResident - r.bytes + bytes
+        r.bytes = bytes
+        r.skip = skip
+    end)
+end
+
+local function stream_update()
+    local ids = {}
+    for id in pairs(streamTextures) do
+        ids[#ids+1] = id
+    end
+    local n = #ids
+    if n == 0 then
+        return
+    end
+    local frames = textureman.texture_timestamp(table.move(ids, 1, n, 1, {}))
+    local sizes = textureman.texture_size(table.move(ids, 1, n, 1, {}))
+    if StreamResident > STREAM_BUDGET then
+        -- evict the least recently sampled first
+        local evict = {}
+        for i = 1, n do
+            local r = streamTextures[ids[i]].stream
+            if r.bytes > 0 and not r.upgrading and frames[i] > STREAM_ACTIVE then
+                evict[#evict+1] = i
+            end
+        end
+        table.sort(evict, function (a, b) return frames[a] > frames[b] end)
+        for _, i in ipairs(evict) do
+            if StreamResident <= STREAM_BUDGET then
+                break
+            end
+            stream_evict(streamTextures[ids[i]])
+        end
+    end
+    for i = 1, n do
+        if StreamPending >= STREAM_MAX_PENDING then
+            break
+        end
+        local c = streamTextures[ids[i]]
+        local r = c.stream
+        if not r.upgrading and frames[i] <= STREAM_ACTIVE then
+            local skip = stream_target(c.texinfo, r, sizes[i])
+            if skip < r.skip and StreamResident - r.bytes + stream_bytes(c.texinfo, skip) <= STREAM_BUDGET then
+                stream_upgrade(c, skip)
+            end
+        end
+    end
+end
+
 local update; do
     local FrameNew = 0
     local FrameCur = 1
@@ -347,7 +512,7 @@ local update; do
                     local id = results[i]
                     local c = textureById[id]
                     if c then
-                        asyncLoadTexture(c)
+                        asyncLoadTexture(c, "background")
                     end
                 end
                 FrameNew = FrameCur - 1
@@ -364,6 +529,9 @@ local update; do
                 end
             end
         end
+        if STREAMING and FrameCur % STREAM_INTERVAL == 0 then
+            stream_update()
+        end
         FrameCur = FrameCur + 1
         FrameLoaded = 0
         textureman.frame_tick()
@@ -383,6 +551,24 @@ function S.texture_timestamp(rtid_table)
     return result_table -- rt_id:timestamp
 end
 
+function S.texture_stream_stat()
+    local n, high = 0, 0
+    for _, c in pairs(streamTextures) do
+        n = n + 1
+        if c.stream.bytes > 0 then
+            high = high + 1
+        end
+    end
+    return {
+        enable = STREAMING,
+        budget = STREAM_BUDGET,
+        resident = StreamResident,
+        pending = StreamPending + #createQueue,
+        textures = n,
+        high = high,
+    }
+end
+
 function S.texture_register_id()
     local rt_id = textureman.texture_create(DefaultTexture["SAMPLER2D"])
     rt_table[rt_id] = true
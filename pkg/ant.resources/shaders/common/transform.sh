@@ -38,24 +38,44 @@ void unpack_tbn_from_quat(mat3 wm3, vec4 quat, out vec3 normal, out vec3 tangent
 	to_tbn(wm3, sign(quat.w), normal, tangent, bitangent);
 }
 
-mat4 calc_bone_transform(ivec4 indices, vec4 weights)
+#ifdef GPU_SKINNING
+#include "bgfx_compute.sh"
+
+// the skinning palettes(model space) of all the skinned meshes, 4 columns for each matrix
+// u_model[0] is the world matrix, u_model[1][0][0] is the palette offset(in matrices) of the mesh
+// see ant.animation/skinning.lua
+BUFFER_RO(b_skinning_palette, vec4, 13);
+
+mat4 palette_matrix(int offset, int id)
+{
+	int idx = (offset + id) * 4;
+	return mtxFromCols(
+		b_skinning_palette[idx],
+		b_skinning_palette[idx+1],
+		b_skinning_palette[idx+2],
+		b_skinning_palette[idx+3]);
+}
+
+mat4 calc_palette_transform(int offset, ivec4 indices, vec4 weights)
 {
-	mat4 wolrdMat = mat4(
-		0, 0, 0, 0, 
-		0, 0, 0, 0, 
-		0, 0, 0, 0, 
+	mat4 m = mat4(
+		0, 0, 0, 0,
+		0, 0, 0, 0,
+		0, 0, 0, 0,
 		0, 0, 0, 0
 	);
 	for (int ii = 0; ii < 4; ++ii)
 	{
-		int id = int(indices[ii]);
-		float weight = weights[ii];
-
-		wolrdMat += u_model[id] * weight;
+		m += palette_matrix(offset, int(indices[ii])) * weights[ii];
 	}
+	return m;
+}
 
-	return wolrdMat;
+mat4 calc_bone_transform(ivec4 indices, vec4 weights)
+{
+	return mul(u_model[0], calc_palette_transform(int(u_model[1][0][0]), indices, weights));
 }
+#endif //GPU_SKINNING
 
 vec4 transform2clipspace(vec4 posWS)
 {
@@ -4,7 +4,7 @@ $input v_color0, v_texcoord0
 
 #include "common/transform.sh"
 
-SAMPLER2D(s_tex, 0);
+SAMPLER2DARRAY(s_tex, 0);
 
 uniform vec4 u_mask;
 #define u_edge_mask			u_mask.x
@@ -24,13 +24,20 @@ float smoothing_result(float dis, float mask, float range){
 	return smoothstep(mask - range, mask + range,  dis);
 }
 
+// the page of the glyph is the integer part of u
+vec3 glyph_coord(vec2 uv){
+	float page = floor(uv.x);
+	return vec3(uv.x - page, uv.y, page);
+}
+
 void main()
 {
 	#ifdef ENABLE_CLIP_RECT
 	check_clip_rotated_rect(gl_FragCoord.xy);
 	#endif //ENABLE_CLIP_RECT
 
-	float dis = texture2D(s_tex, v_texcoord0).a;
+	vec3 coord = glyph_coord(v_texcoord0);
+	float dis = texture2DArray(s_tex, coord).a;
 	vec4 color = v_color0;
 	float magicnum = 128.0;
 	float smoothing = length(fwidth(v_texcoord0)) * magicnum * u_dist_multiplier;
@@ -51,7 +58,7 @@ void main()
 
 #elif defined(SHADOW_EFFECT)
 
-	float offsetdis = texture2D(s_tex, v_texcoord0+u_shadow_offset.xy).a;
+	float offsetdis = texture2DArray(s_tex, coord + vec3(u_shadow_offset.xy, 0.0)).a;
 	float shadow_mask = u_edge_mask - (offsetdis - dis)*smoothing;
 	float alpha = smoothing_result(offsetdis, shadow_mask, smoothing);
 	color		= vec4(lerp(u_effect_color.rgb, v_color0.rgb, coloralpha), alpha * v_color0.a);
@@ -9,26 +9,12 @@ $input a_position v_cur_pos v_prev_pos
 #include "common/common.sh"
 
 #ifdef GPU_SKINNING
-	//TODO: put view projection matrix into 'u_prev_model' struct in CPU, and remove u_prev_vp
-	uniform mat4 u_prev_model[BGFX_CONFIG_MAX_BONES];
+	//TODO: put view projection matrix into u_model in CPU, and remove u_prev_vp
 	uniform mat4 u_prev_vp;
+	// u_model[2] is the world matrix of the last frame, u_model[1][1][1] is the palette offset of the last frame
 	mat4 calc_prev_bone_transform(ivec4 indices, vec4 weights)
 	{
-		mat4 wolrdMat = mat4(
-			0, 0, 0, 0, 
-			0, 0, 0, 0, 
-			0, 0, 0, 0, 
-			0, 0, 0, 0
-		);
-		for (int ii = 0; ii < 4; ++ii)
-		{
-			int id = int(indices[ii]);
-			float weight = weights[ii];
-
-			wolrdMat += u_prev_model[id] * weight;
-		}
-
-		return wolrdMat;
+		return mul(u_model[2], calc_palette_transform(int(u_model[1][1][1]), indices, weights));
 	}
 #else
 	uniform mat4 u_prev_mvp;
@@ -334,7 +334,7 @@ local function updateTexture()
     for i = 1, #q do
         local v = q[i]
         if v.id then
-            rmlui.RenderSetTexture(v.path, v.id, v.width, v.height)
+            rmlui.RenderSetTexture(v.path, v.id, v.width, v.height, v.atlas)
             for _, e in ipairs(v.elements) do
                 if e._handle then
                     rmlui.ElementDirtyImage(e._handle)
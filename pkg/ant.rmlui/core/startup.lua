@@ -62,6 +62,7 @@ S.gesture = document_manager.process_gesture
 S.touch = document_manager.process_touch
 
 local viewid = hwi.viewid_get "uiruntime"
+local atlas_viewid = hwi.viewid_get "uiatlas"
 hwi.init_bgfx()
 bgfx.init()
 
@@ -72,6 +73,7 @@ end
 
 rmlui.RmlInitialise {
     viewid = viewid,
+    atlas_viewid = atlas_viewid,
     shader = require "core.init_shader",
     callback = require "core.callback",
     font_mgr = bgfx.fontmanager(),
@@ -38,6 +38,7 @@ function m.loadTexture(doc, e, path, width, height, isRT)
                 id = info.id,
                 width = info.texinfo.width,
                 height = info.texinfo.height,
+                atlas = true,
             }
             pendQueue[path] = nil
         end)
@@ -3,7 +3,9 @@
 #include <binding/Context.h>
 #include <core/Color.h>
 #include <core/Interface.h>
+#include <util/Log.h>
 #include <memory.h>
+#include <algorithm>
 #include <cassert>
 #include <stdint.h>
 #include <lua.hpp>
@@ -147,19 +149,60 @@ private:
     Color color;
 };
 
+// the positions of the font geometries are scaled, see vs_uifont.sc
+static constexpr float FONT_POSITION_SCALE = 32768.f / FONT_POSTION_FIX_POINT;
+
 class RenderMaterial : public Material {
 public:
     virtual void    Submit(bgfx_encoder_t* encoder) = 0;
     virtual int     Program(const RenderState& state, const Shader& s) = 0;
+    // the vertex position in shader is a_position * PositionScale()
+    virtual float   PositionScale() const { return 1.f; }
+    const BatchKey& Key() const { return key; }
+protected:
+    BatchKey key;
+};
+
+enum class MaterialKind : uint8_t {
+    Texture = 1,
+    AsyncTexture,
+    Text,
+    TextStroke,
+    TextShadow,
+    Atlas,
 };
 
+static bool IsTextKind(uint8_t kind) {
+    return kind == (uint8_t)MaterialKind::Text
+        || kind == (uint8_t)MaterialKind::TextStroke
+        || kind == (uint8_t)MaterialKind::TextShadow;
+}
+
+// the first vertex of the glyph quad has the top-left of the cell, uv.x is page + u / FONT_MANAGER_TEXSIZE
+static uint32_t GlyphCell(const Point& uv) {
+    const int page = (int)uv.x;
+    const int u = (int)((uv.x - page) * FONT_MANAGER_TEXSIZE + 0.5f);
+    const int v = (int)(uv.y * FONT_MANAGER_TEXSIZE + 0.5f);
+    return (uint32_t)page << 24 | (uint32_t)u << 12 | (uint32_t)v;
+}
+
+static void TouchGlyph(struct font_manager* F, uint32_t cell) {
+    F->font_manager_touch(F, (int)(cell >> 24), (int)((cell >> 12) & 0xfff), (int)(cell & 0xfff));
+}
+
+static constexpr uint32_t ATLAS_SAMPLER_FLAGS = BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+
 class TextureMaterial: public RenderMaterial {
 public:
     TextureMaterial(Shader const& s, bgfx_texture_handle_t tex, SamplerFlag flags)
         : tex_uniform(s.find_uniform("s_tex"), tex.idx)
         , flags(getTextureFlags(flags))
         , gray(false)
-    { }
+    {
+        key.kind = (uint8_t)MaterialKind::Texture;
+        key.texture = tex.idx;
+        key.flags = this->flags;
+    }
     void Submit(bgfx_encoder_t* encoder) override {
         tex_uniform.Submit(encoder, flags);
     }
@@ -171,6 +214,7 @@ public:
     }
     bool SetGray() override {
         gray = true;
+        key.gray = 1;
         return true;
     }
 private:
@@ -185,7 +229,11 @@ public:
         : tex_uniform(s.find_uniform("s_tex"), texid)
         , flags(getTextureFlags(flags))
         , gray(false)
-    { }
+    {
+        key.kind = (uint8_t)MaterialKind::AsyncTexture;
+        key.texture = texid;
+        key.flags = this->flags;
+    }
     void Submit(bgfx_encoder_t* encoder) override {
         tex_uniform.Submit(encoder, flags);
     }
@@ -197,6 +245,7 @@ public:
     }
     bool SetGray() override {
         gray = true;
+        key.gray = 1;
         return true;
     }
 private:
@@ -212,7 +261,12 @@ public:
         , mask_uniform(s.find_uniform("u_mask"))
         , mask_0(F->font_manager_sdf_mask(F) - F->font_manager_sdf_distance(F, edgeValueOffset))
         , mask_2(width)
-    { }
+    {
+        key.kind = (uint8_t)MaterialKind::Text;
+        key.texture = texid;
+        key.params[0] = mask_0;
+        key.params[1] = mask_2;
+    }
     void Submit(bgfx_encoder_t* encoder) override {
         tex_uniform.Submit(encoder);
         const float distMultiplier = 1.f;
@@ -224,6 +278,9 @@ public:
             : s.font
             ;
     }
+    float PositionScale() const override {
+        return FONT_POSITION_SCALE;
+    }
     bool SetGray() override {
         return false;
     }
@@ -239,7 +296,10 @@ public:
     TextStrokeMaterial(const Shader& s, struct font_manager* F, uint16_t texid, int8_t edgeValueOffset, Color color, float width)
         : TextMaterial(s, F, texid, edgeValueOffset, width)
         , color_uniform(s.find_uniform("u_effect_color"), color)
-    {}
+    {
+        key.kind = (uint8_t)MaterialKind::TextStroke;
+        key.color = color;
+    }
     void Submit(bgfx_encoder_t* encoder) override {
         TextMaterial::Submit(encoder);
         color_uniform.Submit(encoder);
@@ -264,7 +324,12 @@ public:
         , color_uniform(s.find_uniform("u_effect_color"), color)
         , offset_uniform(s.find_uniform("u_shadow_offset"))
         , offset(offset)
-    {}
+    {
+        key.kind = (uint8_t)MaterialKind::TextShadow;
+        key.color = color;
+        key.params[2] = offset.x;
+        key.params[3] = offset.y;
+    }
     void Submit(bgfx_encoder_t* encoder) override {
         TextMaterial::Submit(encoder);
         color_uniform.Submit(encoder);
@@ -309,6 +374,7 @@ RenderImpl::RenderImpl(lua_State* L, int idx)
     , clip_uniform(std::make_unique<Uniform>(
         context.shader.find_uniform("u_clip_rect")
     ))
+    , atlas_sampler(context.shader.find_uniform("s_tex"))
 {
     BGFX(vertex_layout_begin)(&layout, BGFX_RENDERER_TYPE_NOOP);
     BGFX(vertex_layout_add)(&layout, BGFX_ATTRIB_POSITION, 2, BGFX_ATTRIB_TYPE_FLOAT, false, false);
@@ -323,42 +389,335 @@ RenderImpl::~RenderImpl() {
 }
 
 void RenderImpl::RenderGeometry(Vertex* vertices, size_t num_vertices, Index* indices, size_t num_indices, Material* mat) {
+    RenderMaterial* material = reinterpret_cast<RenderMaterial*>(mat);
+    auto& b = batch;
+    BatchKey key = material->Key();
+    const uint32_t texture = key.texture;
+    const AtlasEntry* entry = nullptr;
+    if (key.kind == (uint8_t)MaterialKind::AsyncTexture && key.flags == ATLAS_SAMPLER_FLAGS) {
+        entry = atlas.Find(key.texture);
+        if (entry) {
+            key.kind = (uint8_t)MaterialKind::Atlas;
+            key.texture = entry->page;
+            b.atlas_used.push_back((TextureId)texture);
+        }
+    }
+    else if (IsTextKind(key.kind)) {
+        // the geometry of the text is kept, the glyphs are not looked up again while it's drawn
+        font_manager* F = context.font_mgr;
+        for (size_t i = 0; i + 4 <= num_vertices; i += 4) {
+            const uint32_t cell = GlyphCell(vertices[i].uv);
+            TouchGlyph(F, cell);
+            b.glyph_used.push_back(cell);
+        }
+    }
+    const uint32_t vertex_first = (uint32_t)b.vertices.size();
+    const uint32_t index_first = (uint32_t)b.indices.size();
+    b.vertices.resize(vertex_first + num_vertices);
+    Vertex* dst = &b.vertices[vertex_first];
+    if (state.identity) {
+        memcpy(dst, vertices, num_vertices * sizeof(Vertex));
+    } else {
+        // as transform_screen_coord_to_ndc in shader
+        const float scale = material->PositionScale();
+        const float inv_scale = 1.f / scale;
+        for (size_t i = 0; i < num_vertices; ++i) {
+            const Vertex& v = vertices[i];
+            glm::vec4 p = state.transform * glm::vec4(v.pos.x * scale, v.pos.y * scale, 0.f, 1.f);
+            p /= p.w;
+            dst[i].pos = Point(p.x * inv_scale, p.y * inv_scale);
+            dst[i].col = v.col;
+            dst[i].uv = v.uv;
+        }
+    }
+    if (entry) {
+        // the uv of the clamped image is in [0, 1]
+        for (size_t i = 0; i < num_vertices; ++i) {
+            Point& uv = dst[i].uv;
+            uv.x = entry->offset[0] + std::clamp(uv.x, 0.f, 1.f) * entry->scale[0];
+            uv.y = entry->offset[1] + std::clamp(uv.y, 0.f, 1.f) * entry->scale[1];
+        }
+    }
+    b.indices.resize(index_first + num_indices);
+    Index* idx = &b.indices[index_first];
+    for (size_t i = 0; i < num_indices; ++i) {
+        idx[i] = indices[i] + vertex_first;
+    }
+    ++b.geometries;
+
+    const uint32_t last_texture = b.last_texture;
+    b.last_texture = texture;
+    if (b.draws.size() > b.merge_first) {
+        auto& last = b.draws.back();
+        if (last.clip == state.clip && last.key == key) {
+            last.vertex_num += (uint32_t)num_vertices;
+            last.index_num += (uint32_t)num_indices;
+            if (entry && last_texture != texture) {
+                ++b.saved;
+            }
+            return;
+        }
+    }
+    b.draws.push_back({material, key, state.clip, vertex_first, (uint32_t)num_vertices, index_first, (uint32_t)num_indices});
+}
+
+// the vertex and the index buffers are set by the caller
+void RenderImpl::submit(const RenderBatch::Draw& draw, uint16_t& scissor) {
     BGFX(encoder_set_state)(mEncoder, RENDER_STATE, 0);
-    bgfx_transient_vertex_buffer_t tvb;
-    BGFX(alloc_transient_vertex_buffer)(&tvb, (uint32_t)num_vertices, (bgfx_vertex_layout_t*)&layout);
 
-    memcpy(tvb.data, vertices, num_vertices * sizeof(Vertex));
-    BGFX(encoder_set_transient_vertex_buffer)(mEncoder, 0, &tvb, 0, (uint32_t)num_vertices);
+    state.needShaderClipRect = false;
+    switch (draw.clip.type) {
+    case ClipState::Type::None:
+        BGFX(encoder_set_scissor_cached)(mEncoder, UINT16_MAX);
+        break;
+    case ClipState::Type::Scissor:
+        if (scissor == UINT16_MAX) {
+            const auto& r = draw.clip.scissor;
+            scissor = BGFX(encoder_set_scissor)(mEncoder, r.x, r.y, r.z, r.w);
+        } else {
+            BGFX(encoder_set_scissor_cached)(mEncoder, scissor);
+        }
+        break;
+    case ClipState::Type::Shader:
+        state.needShaderClipRect = true;
+        BGFX(encoder_set_scissor_cached)(mEncoder, UINT16_MAX);
+        clip_uniform->Submit(mEncoder, const_cast<glm::vec4*>(draw.clip.shader));
+        break;
+    }
 
-    bgfx_transient_index_buffer_t tib;
-    BGFX(alloc_transient_index_buffer)(&tib, (uint32_t)num_indices, true);
+    if (draw.key.kind == (uint8_t)MaterialKind::Atlas) {
+        BGFX(encoder_set_texture)(mEncoder, 0, {atlas_sampler}, atlas.PageTexture((uint8_t)draw.key.texture), ATLAS_SAMPLER_FLAGS);
+    }
+    else {
+        draw.material->Submit(mEncoder);
+    }
+    auto prog = program_get(draw.material->Program(state, context.shader));
+    const uint8_t discard_flags = ~BGFX_DISCARD_TRANSFORM;
+    BGFX(encoder_submit)(mEncoder, context.viewid, { prog }, 0, discard_flags);
+    ++batch.submits;
+}
 
-    static_assert(sizeof(Index) == sizeof(uint32_t));
-    memcpy(tib.data, indices, num_indices * sizeof(Index));
-    BGFX(encoder_set_transient_index_buffer)(mEncoder, &tib, 0, (uint32_t)num_indices);
+// the draws from first are drawn with the buffers created for them, when the transient buffers are not enough
+// for one draw. bgfx destroys the buffers after the frame is rendered
+void RenderImpl::submitStatic(uint32_t first) {
+    auto& b = batch;
+    const uint32_t n = (uint32_t)b.draws.size();
+    const uint32_t vertex_first = b.draws[first].vertex_first;
+    const uint32_t index_first = b.draws[first].index_first;
+    const uint32_t vertex_num = (uint32_t)b.vertices.size() - vertex_first;
+    const uint32_t index_num = (uint32_t)b.indices.size() - index_first;
+    if (b.overflow == 0) {
+        Log::Message(Log::Level::Warning, "Out of the transient buffers, %u draws(%u vertices, %u indices) use the static buffers.", n - first, vertex_num, index_num);
+    }
 
-    submitScissorRect(mEncoder);
+    const bgfx_memory_t* vmem = BGFX(copy)(&b.vertices[vertex_first], vertex_num * sizeof(Vertex));
+    const bgfx_vertex_buffer_handle_t vb = BGFX(create_vertex_buffer)(vmem, &layout, BGFX_BUFFER_NONE);
+    const bgfx_memory_t* imem = BGFX(alloc)(index_num * sizeof(Index));
+    Index* idx = (Index*)imem->data;
+    for (uint32_t i = 0; i < index_num; ++i) {
+        idx[i] = b.indices[index_first + i] - vertex_first;
+    }
+    const bgfx_index_buffer_handle_t ib = BGFX(create_index_buffer)(imem, BGFX_BUFFER_INDEX32);
+
+    uint16_t scissor = UINT16_MAX;
+    for (uint32_t i = first; i < n; ++i) {
+        const auto& d = b.draws[i];
+        if (i > first && !(d.clip == b.draws[i-1].clip))
+            scissor = UINT16_MAX;
+        BGFX(encoder_set_vertex_buffer)(mEncoder, 0, vb, 0, vertex_num);
+        BGFX(encoder_set_index_buffer)(mEncoder, ib, d.index_first - index_first, d.index_num);
+        submit(d, scissor);
+    }
+    BGFX(destroy_vertex_buffer)(vb);
+    BGFX(destroy_index_buffer)(ib);
+}
 
-    RenderMaterial* material = reinterpret_cast<RenderMaterial*>(mat);
-    material->Submit(mEncoder);
+// the draws are split when the transient buffers are not enough for all of them
+void RenderImpl::flush() {
+    auto& b = batch;
+    const uint32_t n = (uint32_t)b.draws.size();
+    if (n > 0) {
+        // the vertices are transformed on CPU
+        glm::mat4 m(1.f);
+        BGFX(encoder_set_transform)(mEncoder, &m, 1);
+    }
+    bool overflow = false;
+    uint32_t first = 0;
+    while (first < n) {
+        const uint32_t vertex_first = b.draws[first].vertex_first;
+        const uint32_t index_first = b.draws[first].index_first;
+        const uint32_t vertex_avail = BGFX(get_avail_transient_vertex_buffer)((uint32_t)b.vertices.size() - vertex_first, &layout);
+        const uint32_t index_avail = BGFX(get_avail_transient_index_buffer)((uint32_t)b.indices.size() - index_first, true);
+        uint32_t last = first;
+        while (last < n) {
+            const auto& d = b.draws[last];
+            if (d.vertex_first + d.vertex_num - vertex_first > vertex_avail || d.index_first + d.index_num - index_first > index_avail)
+                break;
+            ++last;
+        }
+        if (last == first) {
+            // out of the transient buffers, the rest of the frame is drawn with the static buffers
+            submitStatic(first);
+            overflow = true;
+            break;
+        }
+        const auto& e = b.draws[last - 1];
+        const uint32_t vertex_num = e.vertex_first + e.vertex_num - vertex_first;
+        const uint32_t index_num = e.index_first + e.index_num - index_first;
+
+        bgfx_transient_vertex_buffer_t tvb;
+        BGFX(alloc_transient_vertex_buffer)(&tvb, vertex_num, &layout);
+        memcpy(tvb.data, &b.vertices[vertex_first], vertex_num * sizeof(Vertex));
+
+        bgfx_transient_index_buffer_t tib;
+        BGFX(alloc_transient_index_buffer)(&tib, index_num, true);
+        static_assert(sizeof(Index) == sizeof(uint32_t));
+        Index* idx = (Index*)tib.data;
+        for (uint32_t i = 0; i < index_num; ++i) {
+            idx[i] = b.indices[index_first + i] - vertex_first;
+        }
 
-    auto prog = program_get(material->Program(state, context.shader));
-    const uint8_t discard_flags = ~BGFX_DISCARD_TRANSFORM;
-    BGFX(encoder_submit)(mEncoder, context.viewid, { prog }, 0, discard_flags);
+        uint16_t scissor = UINT16_MAX;
+        for (uint32_t i = first; i < last; ++i) {
+            if (i > first && !(b.draws[i].clip == b.draws[i-1].clip))
+                scissor = UINT16_MAX;
+            BGFX(encoder_set_transient_vertex_buffer)(mEncoder, 0, &tvb, 0, vertex_num);
+            BGFX(encoder_set_transient_index_buffer)(mEncoder, &tib, b.draws[i].index_first - index_first, b.draws[i].index_num);
+            submit(b.draws[i], scissor);
+        }
+        first = last;
+    }
+    b.overflow = overflow ? b.overflow + 1 : 0;
+    b.vertices.clear();
+    b.indices.clear();
+    b.draws.clear();
+    b.merge_first = 0;
+    b.atlas_used.clear();
+    b.glyph_used.clear();
+    b.last_texture = UINT32_MAX;
 }
 
 void RenderImpl::Begin() {
     mEncoder = BGFX(encoder_begin)(false);
     assert(mEncoder);
+    batch.geometries = 0;
+    batch.submits = 0;
+    batch.replays = 0;
+    batch.saved = 0;
+    atlas.Update(mEncoder, context.atlas_viewid, program_get(context.shader.image).idx, atlas_sampler, &layout);
+    font_manager* F = context.font_mgr;
+    F->font_manager_flush(F);
 }
 
 void RenderImpl::End() {
+    flush();
     BGFX(encoder_end)(mEncoder);
+    mEncoder = nullptr;
+    for (auto m : batch.destroyed) {
+        delete m;
+    }
+    batch.destroyed.clear();
+}
+
+void RenderImpl::GetStat(uint32_t& geometries, uint32_t& submits, uint32_t& replays) const {
+    geometries = batch.geometries;
+    submits = batch.submits;
+    replays = batch.replays;
+}
+
+void RenderImpl::AtlasTexture(TextureId id, uint16_t width, uint16_t height) {
+    atlas.Add(id, width, height);
+}
+
+void RenderImpl::GetAtlasStat(AtlasStat& stat, uint32_t& saved) const {
+    atlas.GetStat(stat);
+    saved = batch.saved;
+}
+
+// the vertices are transformed, the indices and the draws are relative to the list
+class RenderListImpl final : public RenderList {
+public:
+    std::vector<Vertex> vertices;
+    std::vector<Index> indices;
+    std::vector<RenderBatch::Draw> draws;
+    std::vector<TextureId> atlas_used;
+    std::vector<uint32_t> glyph_used;
+    uint32_t atlas_generation = 0;
+    uint32_t saved = 0;
+};
+
+RenderList* RenderImpl::CreateRenderList() {
+    return new RenderListImpl;
+}
+
+void RenderImpl::BeginRenderList(RenderList*) {
+    auto& b = batch;
+    b.merge_first = (uint32_t)b.draws.size();
+    b.record_vertex = (uint32_t)b.vertices.size();
+    b.record_index = (uint32_t)b.indices.size();
+    b.record_atlas = (uint32_t)b.atlas_used.size();
+    b.record_glyph = (uint32_t)b.glyph_used.size();
+    b.record_saved = b.saved;
+    b.last_texture = UINT32_MAX;
+}
+
+void RenderImpl::EndRenderList(RenderList* l) {
+    auto list = static_cast<RenderListImpl*>(l);
+    auto& b = batch;
+    list->vertices.assign(b.vertices.begin() + b.record_vertex, b.vertices.end());
+    list->indices.resize(b.indices.size() - b.record_index);
+    for (size_t i = 0; i < list->indices.size(); ++i) {
+        list->indices[i] = b.indices[b.record_index + i] - b.record_vertex;
+    }
+    list->draws.assign(b.draws.begin() + b.merge_first, b.draws.end());
+    for (auto& d : list->draws) {
+        d.vertex_first -= b.record_vertex;
+        d.index_first -= b.record_index;
+    }
+    list->atlas_used.assign(b.atlas_used.begin() + b.record_atlas, b.atlas_used.end());
+    list->glyph_used.assign(b.glyph_used.begin() + b.record_glyph, b.glyph_used.end());
+    list->atlas_generation = atlas.Generation();
+    list->saved = b.saved - b.record_saved;
+}
+
+bool RenderImpl::ReplayRenderList(RenderList* l) {
+    auto list = static_cast<RenderListImpl*>(l);
+    if (list->atlas_generation != atlas.Generation()) {
+        return false;
+    }
+    if (list->draws.empty()) {
+        return true;
+    }
+    auto& b = batch;
+    const uint32_t vertex_first = (uint32_t)b.vertices.size();
+    const uint32_t index_first = (uint32_t)b.indices.size();
+    b.vertices.insert(b.vertices.end(), list->vertices.begin(), list->vertices.end());
+    b.indices.resize(index_first + list->indices.size());
+    Index* idx = &b.indices[index_first];
+    for (size_t i = 0; i < list->indices.size(); ++i) {
+        idx[i] = list->indices[i] + vertex_first;
+    }
+    for (auto d : list->draws) {
+        d.vertex_first += vertex_first;
+        d.index_first += index_first;
+        b.draws.push_back(d);
+    }
+    for (auto id : list->atlas_used) {
+        atlas.Touch(id);
+    }
+    font_manager* F = context.font_mgr;
+    for (auto cell : list->glyph_used) {
+        TouchGlyph(F, cell);
+    }
+    b.saved += list->saved;
+    b.last_texture = UINT32_MAX;
+    ++b.replays;
+    return true;
 }
 
 #ifdef _DEBUG
 void RenderImpl::drawDebugScissorRect(bgfx_encoder_t *encoder, uint16_t viewid, uint16_t progid){
-    if (!state.needShaderClipRect)
+    if (state.clip.type != ClipState::Type::Shader)
         return;
 
     glm::mat4 m(1.f);
@@ -376,7 +735,7 @@ void RenderImpl::drawDebugScissorRect(bgfx_encoder_t *encoder, uint16_t viewid,
     bgfx_transient_vertex_buffer_t tvb;
     BGFX(alloc_transient_vertex_buffer)(&tvb, 4, &debugLayout);
 
-    memcpy(tvb.data, &state.rectVerteices, sizeof(glm::vec2)*4);
+    memcpy(tvb.data, &state.clip.shader, sizeof(glm::vec2)*4);
     BGFX(encoder_set_transient_vertex_buffer)(encoder, 0, &tvb, 0, 4);
 
     bgfx_transient_index_buffer_t tib;
@@ -391,46 +750,24 @@ void RenderImpl::drawDebugScissorRect(bgfx_encoder_t *encoder, uint16_t viewid,
 }
 #endif //_DEBUG
 
-void RenderImpl::setShaderScissorRect(bgfx_encoder_t* encoder, const glm::vec4 r[2]){
-    state.needShaderClipRect = true;
-    state.lastScissorId = UINT16_MAX;
-    state.rectVerteices[0] = r[0];
-    state.rectVerteices[1] = r[1];
-    BGFX(encoder_set_scissor_cached)(encoder, UINT16_MAX);
-}
-
-void RenderImpl::setScissorRect(bgfx_encoder_t* encoder, const glm::u16vec4 *r) {
-    state.needShaderClipRect = false;
-    if (r == nullptr){
-        state.lastScissorId = UINT16_MAX;
-        BGFX(encoder_set_scissor_cached)(encoder, UINT16_MAX);
-    } else {
-        state.lastScissorId = BGFX(encoder_set_scissor)(encoder, r->x, r->y, r->z, r->w);
-    }
-}
-
-void RenderImpl::submitScissorRect(bgfx_encoder_t* encoder){
-    if (state.needShaderClipRect) {
-        clip_uniform->Submit(encoder, state.rectVerteices);
-    } else {
-        BGFX(encoder_set_scissor_cached)(encoder, state.lastScissorId);
-    }
-}
-
 void RenderImpl::SetTransform(const glm::mat4x4& transform) {
-    BGFX(encoder_set_transform)(mEncoder, &transform, 1);
+    state.transform = transform;
+    state.identity = transform == glm::mat4x4(1.f);
 }
 
 void RenderImpl::SetClipRect() {
-    setScissorRect(mEncoder, nullptr);
+    state.clip.type = ClipState::Type::None;
 }
 
 void RenderImpl::SetClipRect(const glm::u16vec4& r) {
-    setScissorRect(mEncoder, &r);
+    state.clip.type = ClipState::Type::Scissor;
+    state.clip.scissor = r;
 }
 
 void RenderImpl::SetClipRect(glm::vec4 r[2]) {
-    setShaderScissorRect(mEncoder, r);
+    state.clip.type = ClipState::Type::Shader;
+    state.clip.shader[0] = r[0];
+    state.clip.shader[1] = r[1];
 }
 
 Material* RenderImpl::CreateTextureMaterial(TextureId texture, SamplerFlag flags) {
@@ -486,7 +823,12 @@ Material* RenderImpl::CreateDefaultMaterial() {
 void RenderImpl::DestroyMaterial(Material* mat) {
     Material* material = reinterpret_cast<Material*>(mat);
     if (default_font_mat.get() != material && default_tex_mat.get() != material) {
-        delete material;
+        if (mEncoder) {
+            // it may be used by the draws not submitted
+            batch.destroyed.push_back(material);
+        } else {
+            delete material;
+        }
     }
 }
 
@@ -511,16 +853,31 @@ FontFaceHandle RenderImpl::GetFontFaceHandle(const std::string& family, Style::F
     return face.handle;
 }
 
-static struct font_glyph GetGlyph(const RendererContext& context, const FontFace& face, int codepoint, struct font_glyph* og_ = nullptr) {
+static struct font_glyph GetGlyph(const RendererContext& context, const FontFace& face, int codepoint, struct font_glyph* og_ = nullptr, GlyphStamp* stamp = nullptr) {
     struct font_glyph g, og;
     font_manager* F = context.font_mgr;
     //TODO: rasie err
-    F->font_manager_glyph(F, face.fontid, codepoint, face.pixelsize, &g, &og);
+    const int ready = F->font_manager_glyph(F, face.fontid, codepoint, face.pixelsize, &g, &og);
     if (og_)
         *og_ = og;
+    if (stamp) {
+        if (ready == 0)
+            stamp->placeholder = true;
+        else if (ready == -2)
+            stamp->busy = true;
+    }
     return g;
 }
 
+// the versions are read before the glyphs, the glyphs ready or evicted while generating change them
+static void BeginGlyphStamp(const RendererContext& context, GlyphStamp& stamp) {
+    font_manager* F = context.font_mgr;
+    stamp.ready = (uint32_t)F->font_manager_version(F);
+    stamp.evict = (uint32_t)F->font_manager_evict_version(F);
+    stamp.placeholder = false;
+    stamp.busy = false;
+}
+
 void RenderImpl::GetFontHeight(FontFaceHandle handle, int& ascent, int& descent, int& lineGap) {
     font_manager* F = context.font_mgr;
     FontFace face;
@@ -535,6 +892,27 @@ bool RenderImpl::GetUnderline(FontFaceHandle handle, float& position, float &thi
     return 0 == F->font_manager_underline(F, face.fontid, face.pixelsize, &position, &thickness);
 }
 
+bool RenderImpl::GlyphsChanged(GlyphStamp& stamp, Geometry& geometry) {
+    font_manager* F = context.font_mgr;
+    if (stamp.busy)
+        return true;
+    if (stamp.placeholder && stamp.ready != (uint32_t)F->font_manager_version(F))
+        return true;
+    const uint32_t evict = (uint32_t)F->font_manager_evict_version(F);
+    if (stamp.evict == evict)
+        return false;
+    // some cells are evicted, usually not the ones of this text: it's drawn, so its cells are touched
+    const auto& vertices = geometry.GetVertices();
+    for (size_t i = 0; i + 4 <= vertices.size(); i += 4) {
+        const uint32_t cell = GlyphCell(vertices[i].uv);
+        const uint32_t v = (uint32_t)F->font_manager_cell_evict(F, (int)(cell >> 24), (int)((cell >> 12) & 0xfff), (int)(cell & 0xfff));
+        if ((int32_t)(v - stamp.evict) > 0)
+            return true;
+    }
+    stamp.evict = evict;
+    return false;
+}
+
 float RenderImpl::GetFontWidth(FontFaceHandle handle, uint32_t codepoint) {
     FontFace face;
     face.handle = handle;
@@ -549,11 +927,12 @@ float RenderImpl::GetFontWidth(FontFaceHandle handle, uint32_t codepoint) {
 // why store in uint16 ? because bgfx not support ....
 #define MAGIC_FACTOR    32768.f
 
-void RenderImpl::GenerateString(FontFaceHandle handle, LineList& lines, const Color& color, Geometry& geometry){
+void RenderImpl::GenerateString(FontFaceHandle handle, LineList& lines, const Color& color, Geometry& geometry, GlyphStamp& stamp){
     auto& vertices = geometry.GetVertices();
     auto& indices = geometry.GetIndices();
     vertices.clear();
     indices.clear();
+    BeginGlyphStamp(context, stamp);
     for (size_t i = 0; i < lines.size(); ++i) {
         Line& line = lines[i];
         vertices.reserve(vertices.size() + line.text.size() * 4);
@@ -567,7 +946,7 @@ void RenderImpl::GenerateString(FontFaceHandle handle, LineList& lines, const Co
         for (auto codepoint : utf8::view(line.text)) {
 
             struct font_glyph og;
-            auto g = GetGlyph(context, face, codepoint, &og);
+            auto g = GetGlyph(context, face, codepoint, &og, &stamp);
 
             // Generate the geometry for the character.
             const int x0 = x + g.offset_x;
@@ -578,7 +957,7 @@ void RenderImpl::GenerateString(FontFaceHandle handle, LineList& lines, const Co
             const float scale = FONT_POSTION_FIX_POINT / MAGIC_FACTOR;
             geometry.AddRectFilled(
                 { x0 * scale, y0 * scale, g.w * scale, g.h * scale },
-                { u0 * fonttexel.x, v0 * fonttexel.y ,og.w * fonttexel.x , og.h * fonttexel.y },
+                { og.page + u0 * fonttexel.x, v0 * fonttexel.y ,og.w * fonttexel.x , og.h * fonttexel.y },
                 color
             );
 
@@ -590,11 +969,12 @@ void RenderImpl::GenerateString(FontFaceHandle handle, LineList& lines, const Co
     }
 }
 
-void RenderImpl::GenerateRichString(FontFaceHandle handle, LineList& lines, std::vector<std::vector<Rml::layout>> layouts, std::vector<uint32_t>& codepoints, Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<image>& images, int& cur_image_idx, float line_height){
+void RenderImpl::GenerateRichString(FontFaceHandle handle, LineList& lines, std::vector<std::vector<Rml::layout>> layouts, std::vector<uint32_t>& codepoints, Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<image>& images, int& cur_image_idx, float line_height, GlyphStamp& stamp){
     auto& vertices = textgeometry.GetVertices();
     auto& indices = textgeometry.GetIndices();
     vertices.clear();
     indices.clear();
+    BeginGlyphStamp(context, stamp);
     for (size_t i = 0; i < lines.size(); ++i) {
         Line& line = lines[i];
         vertices.reserve(vertices.size() + line.text.size() * 4);
@@ -634,7 +1014,7 @@ void RenderImpl::GenerateRichString(FontFaceHandle handle, LineList& lines, std:
                 else{
                     color=layout.color;
                     struct font_glyph og;
-                    auto g = GetGlyph(context, face, codepoint, &og);
+                    auto g = GetGlyph(context, face, codepoint, &og, &stamp);
 
                     const float x0 = x + g.offset_x;
                     const float y0 = y + g.offset_y;
@@ -644,7 +1024,7 @@ void RenderImpl::GenerateRichString(FontFaceHandle handle, LineList& lines, std:
                     const float scale = FONT_POSTION_FIX_POINT / MAGIC_FACTOR;
                     textgeometry.AddRectFilled(
                         { x0 * scale, y0 * scale, g.w * scale, g.h * scale },
-                        { u0 * fonttexel.x, v0 * fonttexel.y ,og.w * fonttexel.x , og.h * fonttexel.y },
+                        { og.page + u0 * fonttexel.x, v0 * fonttexel.y ,og.w * fonttexel.x , og.h * fonttexel.y },
                         color
                     );
                     x += g.advance_x;   
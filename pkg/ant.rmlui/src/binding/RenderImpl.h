@@ -3,8 +3,10 @@
 #include <core/Interface.h>
 #include <bgfx/c99/bgfx.h>
 #include <core/Interface.h>
+#include <binding/TextureAtlas.h>
 #include <map>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 struct lua_State;
@@ -45,14 +47,92 @@ struct RendererContext {
     struct font_manager* font_mgr;
     struct Shader        shader;
     uint16_t             viewid;
+    uint16_t             atlas_viewid;
+};
+
+struct ClipState {
+    enum class Type : uint8_t {
+        None,
+        Scissor,
+        Shader,
+    };
+    Type type = Type::None;
+    glm::u16vec4 scissor {0};
+    glm::vec4 shader[2] {glm::vec4(0), glm::vec4(0)};
+    bool operator==(const ClipState& rhs) const {
+        switch (type) {
+        case Type::Scissor: return rhs.type == type && rhs.scissor == scissor;
+        case Type::Shader:  return rhs.type == type && rhs.shader[0] == shader[0] && rhs.shader[1] == shader[1];
+        default:            return rhs.type == type;
+        }
+    }
 };
 
 struct RenderState {
-    glm::vec4 rectVerteices[2] {glm::vec4(0), glm::vec4(0)};
-    uint16_t lastScissorId = UINT16_MAX;
+    glm::mat4x4 transform {1.f};
+    bool identity = true;
+    ClipState clip;
     bool needShaderClipRect = false;
 };
 
+// the draws of two geometries can be merged when the keys of their materials are the same
+struct BatchKey {
+    uint8_t  kind = 0;
+    uint8_t  gray = 0;
+    uint16_t texture = UINT16_MAX;
+    uint32_t flags = 0;
+    Color    color;
+    float    params[4] = {0.f, 0.f, 0.f, 0.f};
+    bool operator==(const BatchKey& rhs) const = default;
+};
+
+class RenderMaterial;
+
+/*
+    The geometries of one frame. RenderGeometry transforms the vertices by the element transform on CPU
+    and appends them to one vertex/index array, the consecutive geometries with the same material key
+    and the same clip state are merged into one draw. End() uploads them in one transient VB/IB and
+    submits the draws in order. The materials destroyed in the frame are deleted after the submit.
+
+    The draws of a document are recorded into its RenderList, and replayed without the traversal and
+    the transform when the document is not changed.
+*/
+struct RenderBatch {
+    struct Draw {
+        RenderMaterial* material;
+        BatchKey key;
+        ClipState clip;
+        uint32_t vertex_first;
+        uint32_t vertex_num;
+        uint32_t index_first;
+        uint32_t index_num;
+    };
+    std::vector<Vertex>    vertices;
+    std::vector<Index>     indices;
+    std::vector<Draw>      draws;
+    std::vector<Material*> destroyed;
+    // the atlas images used by the draws
+    std::vector<TextureId> atlas_used;
+    // the glyph cells used by the text draws, packed page << 24 | u << 12 | v
+    std::vector<uint32_t> glyph_used;
+    // the draws before it are never merged, it's the first draw of the recording list
+    uint32_t merge_first = 0;
+    uint32_t record_vertex = 0;
+    uint32_t record_index = 0;
+    uint32_t record_atlas = 0;
+    uint32_t record_glyph = 0;
+    uint32_t record_saved = 0;
+    // the texture of the last geometry, to count the draws saved by the atlas
+    uint32_t last_texture = UINT32_MAX;
+    // the last frame
+    uint32_t geometries = 0;
+    uint32_t submits = 0;
+    uint32_t replays = 0;
+    uint32_t saved = 0;
+    // the frames in a row out of the transient buffers, it's logged in the first one
+    uint32_t overflow = 0;
+};
+
 class TextureMaterial;
 class TextMaterial;
 class Uniform;
@@ -73,18 +153,29 @@ public:
     Material* CreateFontMaterial(const TextEffect& effect) override;
     Material* CreateDefaultMaterial() override;
     void DestroyMaterial(Material* mat) override;
+    RenderList* CreateRenderList() override;
+    void BeginRenderList(RenderList* list) override;
+    void EndRenderList(RenderList* list) override;
+    bool ReplayRenderList(RenderList* list) override;
 
 	FontFaceHandle GetFontFaceHandle(const std::string& family, Style::FontStyle style, Style::FontWeight weight, uint32_t size) override;
     void GetFontHeight(FontFaceHandle handle, int& ascent, int& descent, int& lineGap) override;
 	bool GetUnderline(FontFaceHandle handle, float& position, float& thickness) override;
+    bool GlyphsChanged(GlyphStamp& stamp, Geometry& geometry) override;
     float GetFontWidth(FontFaceHandle handle, uint32_t codepoint) override;
-	void GenerateString(FontFaceHandle handle, LineList& lines, const Color& color, Geometry& geometry) override;
-    void GenerateRichString(FontFaceHandle handle, LineList& lines, std::vector<std::vector<layout>> layouts, std::vector<uint32_t>& codepoints, Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<image>& images, int& cur_image_idx, float line_height) override;
+	void GenerateString(FontFaceHandle handle, LineList& lines, const Color& color, Geometry& geometry, GlyphStamp& stamp) override;
+    void GenerateRichString(FontFaceHandle handle, LineList& lines, std::vector<std::vector<layout>> layouts, std::vector<uint32_t>& codepoints, Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<image>& images, int& cur_image_idx, float line_height, GlyphStamp& stamp) override;
     float PrepareText(FontFaceHandle handle,const std::string& string,std::vector<uint32_t>& codepoints,std::vector<int>& groupmap,std::vector<group>& groups,std::vector<image>& images,std::vector<layout>& line_layouts,int start,int num) override;
+    // geometries rendered, the draws submitted and the render lists replayed in the last frame
+    void GetStat(uint32_t& geometries, uint32_t& submits, uint32_t& replays) const;
+    // the small images are packed into the atlas
+    void AtlasTexture(TextureId id, uint16_t width, uint16_t height);
+    // saved is the draws saved by the atlas in the last frame
+    void GetAtlasStat(AtlasStat& stat, uint32_t& saved) const;
 private:
-    void submitScissorRect(bgfx_encoder_t* encoder);
-    void setScissorRect(bgfx_encoder_t* encoder, const glm::u16vec4 *r);
-    void setShaderScissorRect(bgfx_encoder_t* encoder, const glm::vec4 r[2]);
+    void flush();
+    void submitStatic(uint32_t first);
+    void submit(const RenderBatch::Draw& draw, uint16_t& scissor);
 #ifdef _DEBUG
     void drawDebugScissorRect(bgfx_encoder_t *encoder, uint16_t viewid, uint16_t progid);
 #endif
@@ -93,10 +184,13 @@ private:
     RendererContext       context;
     bgfx_encoder_t*       mEncoder;
     RenderState           state;
+    RenderBatch           batch;
+    TextureAtlas          atlas;
     bgfx_texture_handle_t default_tex;
     bgfx_vertex_layout_t  layout;
     std::unique_ptr<TextureMaterial> default_tex_mat;
     std::unique_ptr<TextMaterial> default_font_mat;
     std::unique_ptr<Uniform>      clip_uniform;
+    uint16_t                      atlas_sampler;
 };
 }
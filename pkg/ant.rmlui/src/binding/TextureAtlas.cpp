@@ -0,0 +1,365 @@
+#include <binding/TextureAtlas.h>
+#include <core/Color.h>
+#include <core/Geometry.h>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "../bgfx/bgfx_interface.h"
+
+extern "C" {
+    #include <textureman.h>
+}
+
+namespace Rml {
+
+static constexpr uint16_t ATLAS_PAGE_SIZE = 2048;
+static constexpr size_t   ATLAS_MAX_PAGES = 4;
+static constexpr uint16_t ATLAS_MAX_IMAGE = 256;    // with the border
+static constexpr uint32_t ATLAS_EVICT_FRAMES = 300; // not used in the last frames
+static constexpr uint32_t ATLAS_RETRY_FRAMES = 60;  // the interval of eviction when the atlas is full
+static constexpr uint32_t ATLAS_COPY_MAX = 32;      // images copied in one frame
+
+void SkylinePacker::Reset(uint16_t w, uint16_t h) {
+    width = w;
+    height = h;
+    skyline.clear();
+    skyline.push_back({0, 0, w});
+}
+
+// the y of the rect placed at the segment i, false if it's out of the page
+bool SkylinePacker::Fit(size_t i, uint16_t w, uint16_t h, uint16_t& y) const {
+    if ((uint32_t)skyline[i].x + w > width) {
+        return false;
+    }
+    uint32_t remain = w;
+    uint32_t top = 0;
+    for (;;) {
+        top = std::max<uint32_t>(top, skyline[i].y);
+        if (top + h > height) {
+            return false;
+        }
+        if (skyline[i].w >= remain) {
+            break;
+        }
+        remain -= skyline[i].w;
+        ++i;
+    }
+    y = (uint16_t)top;
+    return true;
+}
+
+bool SkylinePacker::Alloc(uint16_t w, uint16_t h, AtlasRect& r) {
+    size_t best = SIZE_MAX;
+    uint32_t best_top = UINT32_MAX;
+    uint32_t best_width = UINT32_MAX;
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        uint16_t y;
+        if (Fit(i, w, h, y)) {
+            const uint32_t top = (uint32_t)y + h;
+            if (top < best_top || (top == best_top && skyline[i].w < best_width)) {
+                best = i;
+                best_top = top;
+                best_width = skyline[i].w;
+            }
+        }
+    }
+    if (best == SIZE_MAX) {
+        return false;
+    }
+    r = { skyline[best].x, (uint16_t)(best_top - h), w, h };
+
+    // the new segment covers the segments under the rect
+    const Segment s { r.x, (uint16_t)best_top, w };
+    skyline.insert(skyline.begin() + best, s);
+    const uint32_t end = (uint32_t)s.x + s.w;
+    for (size_t i = best + 1; i < skyline.size();) {
+        auto& seg = skyline[i];
+        if (seg.x >= end) {
+            break;
+        }
+        const uint32_t seg_end = (uint32_t)seg.x + seg.w;
+        if (seg_end <= end) {
+            skyline.erase(skyline.begin() + i);
+            continue;
+        }
+        seg.w = (uint16_t)(seg_end - end);
+        seg.x = (uint16_t)end;
+        break;
+    }
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i+1].y) {
+            skyline[i].w += skyline[i+1].w;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else {
+            ++i;
+        }
+    }
+    return true;
+}
+
+TextureAtlas::TextureAtlas()
+{}
+
+TextureAtlas::~TextureAtlas() {
+    for (auto& p : pages) {
+        BGFX(destroy_frame_buffer)(p.fb);
+    }
+}
+
+void TextureAtlas::Add(TextureId id, uint16_t width, uint16_t height) {
+    if (width == 0 || height == 0 || width + 2 > ATLAS_MAX_IMAGE || height + 2 > ATLAS_MAX_IMAGE) {
+        return;
+    }
+    auto& e = entries[id];
+    if (e.width == width && e.height == height) {
+        return;
+    }
+    if (e.state != AtlasEntry::State::Wait) {
+        release(e);
+    }
+    e.width = width;
+    e.height = height;
+}
+
+void TextureAtlas::Touch(TextureId id) {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+        return;
+    }
+    auto& e = it->second;
+    if (e.frame != frame) {
+        e.frame = frame;
+        used.push_back(id);
+    }
+}
+
+const AtlasEntry* TextureAtlas::Find(TextureId id) {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    auto& e = it->second;
+    if (e.frame != frame) {
+        e.frame = frame;
+        used.push_back(id);
+    }
+    if (e.state == AtlasEntry::State::Ready) {
+        return &e;
+    }
+    if (e.state == AtlasEntry::State::Wait && !e.wanted) {
+        e.wanted = true;
+        wanted.push_back(id);
+    }
+    return nullptr;
+}
+
+bgfx_texture_handle_t TextureAtlas::PageTexture(uint8_t page) const {
+    return pages[page].texture;
+}
+
+void TextureAtlas::GetStat(AtlasStat& stat) const {
+    stat.pages = (uint32_t)pages.size();
+    stat.images = 0;
+    uint64_t area = 0;
+    for (auto const& p : pages) {
+        stat.images += p.images;
+        area += p.area;
+    }
+    stat.occupancy = pages.empty()
+        ? 0.f
+        : (float)((double)area / ((double)pages.size() * ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE))
+        ;
+}
+
+bool TextureAtlas::allocPage(Page& p, uint16_t w, uint16_t h, AtlasRect& r) {
+    // the best fit of the freed rects, the rest is split into two rects
+    size_t best = SIZE_MAX;
+    uint32_t best_area = UINT32_MAX;
+    for (size_t i = 0; i < p.freelist.size(); ++i) {
+        auto const& f = p.freelist[i];
+        const uint32_t area = (uint32_t)f.w * f.h;
+        if (f.w >= w && f.h >= h && area < best_area) {
+            best = i;
+            best_area = area;
+        }
+    }
+    if (best != SIZE_MAX) {
+        const AtlasRect f = p.freelist[best];
+        p.freelist.erase(p.freelist.begin() + best);
+        r = { f.x, f.y, w, h };
+        if (f.w > w) {
+            p.freelist.push_back({ (uint16_t)(f.x + w), f.y, (uint16_t)(f.w - w), f.h });
+        }
+        if (f.h > h) {
+            p.freelist.push_back({ f.x, (uint16_t)(f.y + h), w, (uint16_t)(f.h - h) });
+        }
+        return true;
+    }
+    return p.packer.Alloc(w, h, r);
+}
+
+bool TextureAtlas::alloc(AtlasEntry& e) {
+    const uint16_t w = e.width + 2;
+    const uint16_t h = e.height + 2;
+    bool ok = false;
+    for (size_t i = 0; i < pages.size() && !ok; ++i) {
+        if (allocPage(pages[i], w, h, e.rect)) {
+            e.page = (uint8_t)i;
+            ok = true;
+        }
+    }
+    if (!ok && pages.size() < ATLAS_MAX_PAGES) {
+        Page& p = pages.emplace_back();
+        p.texture = BGFX(create_texture_2d)(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, false, 1, BGFX_TEXTURE_FORMAT_RGBA8, BGFX_TEXTURE_RT | BGFX_TEXTURE_SRGB | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP, NULL);
+        p.fb = BGFX(create_frame_buffer_from_handles)(1, &p.texture, true);
+        p.packer.Reset(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        if (allocPage(p, w, h, e.rect)) {
+            e.page = (uint8_t)(pages.size() - 1);
+            ok = true;
+        }
+    }
+    if (!ok && frame >= full_frame + ATLAS_RETRY_FRAMES) {
+        // evict the least recently used images
+        std::vector<AtlasEntry*> stale;
+        for (auto& [_, s] : entries) {
+            if (s.state != AtlasEntry::State::Wait && s.frame + ATLAS_EVICT_FRAMES < frame) {
+                stale.push_back(&s);
+            }
+        }
+        std::sort(stale.begin(), stale.end(), [](auto a, auto b) {
+            return a->frame < b->frame;
+        });
+        for (auto s : stale) {
+            release(*s);
+            if (allocPage(pages[s->page], w, h, e.rect)) {
+                e.page = s->page;
+                ok = true;
+                break;
+            }
+        }
+        if (!ok) {
+            full_frame = frame;
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+    Page& p = pages[e.page];
+    p.images++;
+    p.area += (uint32_t)w * h;
+    e.offset[0] = (e.rect.x + 1) / (float)ATLAS_PAGE_SIZE;
+    e.offset[1] = (e.rect.y + 1) / (float)ATLAS_PAGE_SIZE;
+    e.scale[0] = e.width / (float)ATLAS_PAGE_SIZE;
+    e.scale[1] = e.height / (float)ATLAS_PAGE_SIZE;
+    e.state = AtlasEntry::State::Copy;
+    return true;
+}
+
+void TextureAtlas::release(AtlasEntry& e) {
+    Page& p = pages[e.page];
+    p.images--;
+    p.area -= (uint32_t)e.rect.w * e.rect.h;
+    if (p.images == 0) {
+        p.packer.Reset(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        p.freelist.clear();
+    }
+    else {
+        p.freelist.push_back(e.rect);
+    }
+    e.state = AtlasEntry::State::Wait;
+    e.source = UINT16_MAX;
+    ++generation;
+}
+
+void TextureAtlas::copy(bgfx_encoder_t* encoder, uint16_t viewid, uint16_t program, uint16_t sampler, const bgfx_vertex_layout_t* layout, AtlasEntry& e, bgfx_texture_handle_t source) {
+    // the border is the clamped edge of the image
+    const float x0 = e.rect.x;
+    const float y0 = e.rect.y;
+    const float x1 = x0 + e.rect.w;
+    const float y1 = y0 + e.rect.h;
+    const float u0 = -1.f / e.width;
+    const float v0 = -1.f / e.height;
+    const float u1 = 1.f - u0;
+    const float v1 = 1.f - v0;
+    const Color white = Color::FromSRGB(255, 255, 255, 255);
+
+    bgfx_transient_vertex_buffer_t tvb;
+    BGFX(alloc_transient_vertex_buffer)(&tvb, 4, layout);
+    Vertex* v = (Vertex*)tvb.data;
+    v[0] = { Point(x0, y0), white, Point(u0, v0) };
+    v[1] = { Point(x1, y0), white, Point(u1, v0) };
+    v[2] = { Point(x1, y1), white, Point(u1, v1) };
+    v[3] = { Point(x0, y1), white, Point(u0, v1) };
+
+    bgfx_transient_index_buffer_t tib;
+    BGFX(alloc_transient_index_buffer)(&tib, 6, false);
+    uint16_t* idx = (uint16_t*)tib.data;
+    idx[0] = 0; idx[1] = 1; idx[2] = 2;
+    idx[3] = 0; idx[4] = 2; idx[5] = 3;
+
+    glm::mat4 m(1.f);
+    BGFX(encoder_set_transform)(encoder, &m, 1);
+    BGFX(encoder_set_state)(encoder, BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A, 0);
+    BGFX(encoder_set_transient_vertex_buffer)(encoder, 0, &tvb, 0, 4);
+    BGFX(encoder_set_transient_index_buffer)(encoder, &tib, 0, 6);
+    BGFX(encoder_set_texture)(encoder, 0, {sampler}, source, BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP);
+    BGFX(encoder_submit)(encoder, viewid, {program}, 0, BGFX_DISCARD_ALL);
+}
+
+void TextureAtlas::Update(bgfx_encoder_t* encoder, uint16_t viewid, uint16_t program, uint16_t sampler, const bgfx_vertex_layout_t* layout) {
+    // the texture manager changed the handle of the images used in the last frame
+    for (auto id : used) {
+        auto& e = entries[id];
+        if (e.state == AtlasEntry::State::Ready && texture_get(id).idx != e.source) {
+            e.state = AtlasEntry::State::Copy;
+            copying.push_back(id);
+        }
+    }
+    used.clear();
+    ++frame;
+
+    for (auto id : wanted) {
+        auto& e = entries[id];
+        if (e.wanted) {
+            e.wanted = false;
+            if (e.state == AtlasEntry::State::Wait && alloc(e)) {
+                copying.push_back(id);
+            }
+        }
+    }
+    wanted.clear();
+
+    // the view has one frame buffer in a frame, so only the images of one page are copied
+    int page = -1;
+    uint32_t n = 0;
+    size_t keep = 0;
+    for (size_t i = 0; i < copying.size(); ++i) {
+        const TextureId id = copying[i];
+        auto& e = entries[id];
+        if (e.state != AtlasEntry::State::Copy) {
+            continue;
+        }
+        if (n >= ATLAS_COPY_MAX || (page >= 0 && page != e.page)) {
+            copying[keep++] = id;
+            continue;
+        }
+        const bgfx_texture_handle_t source = texture_get(id);
+        if (source.idx == UINT16_MAX) {
+            release(e);
+            continue;
+        }
+        if (page < 0) {
+            page = e.page;
+            BGFX(set_view_frame_buffer)(viewid, pages[page].fb);
+            BGFX(set_view_rect)(viewid, 0, 0, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        }
+        copy(encoder, viewid, program, sampler, layout, e, source);
+        e.source = source.idx;
+        e.state = AtlasEntry::State::Ready;
+        ++generation;
+        ++n;
+    }
+    copying.resize(keep);
+}
+
+}
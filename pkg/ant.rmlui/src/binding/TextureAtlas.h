@@ -0,0 +1,110 @@
+#pragma once
+
+#include <bgfx/c99/bgfx.h>
+#include <core/Interface.h>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace Rml {
+
+/*
+    The small images of UI are copied into the shared atlas pages, so the geometries of different images
+    are merged into one draw. The uv of the geometries is remapped to the atlas when they are appended to
+    the batch.
+
+    An image is allocated when it's drawn the first time, and it's copied by the GPU(a draw into the page
+    in the atlas view, before the UI view) at the next frame. The images not drawn recently are evicted
+    when there is no space for the new one. The image is copied again when the texture manager changed
+    the handle of it(the texture streaming loaded the higher mips).
+
+    The generation is changed when the uv of an image is changed, the retained render lists with the old
+    uv are recorded again.
+*/
+
+struct AtlasRect {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+};
+
+// skyline bottom-left packer, the rects are never freed, the page is reset when it's empty
+class SkylinePacker {
+public:
+    void Reset(uint16_t width, uint16_t height);
+    bool Alloc(uint16_t w, uint16_t h, AtlasRect& r);
+private:
+    struct Segment {
+        uint16_t x;
+        uint16_t y;
+        uint16_t w;
+    };
+    bool Fit(size_t i, uint16_t w, uint16_t h, uint16_t& y) const;
+    std::vector<Segment> skyline;
+    uint16_t width = 0;
+    uint16_t height = 0;
+};
+
+struct AtlasEntry {
+    enum class State : uint8_t {
+        Wait,   // not allocated
+        Copy,   // allocated, not copied
+        Ready,
+    };
+    State     state = State::Wait;
+    bool      wanted = false;
+    uint8_t   page = 0;
+    uint16_t  source = UINT16_MAX;  // the bgfx handle copied
+    uint16_t  width = 0;
+    uint16_t  height = 0;
+    AtlasRect rect {};              // with 1 pixel border
+    uint32_t  frame = 0;            // the last frame used
+    // uv in atlas = offset + uv * scale
+    float     offset[2] {};
+    float     scale[2] {};
+};
+
+struct AtlasStat {
+    uint32_t pages;
+    uint32_t images;
+    float    occupancy;
+};
+
+class TextureAtlas {
+public:
+    TextureAtlas();
+    ~TextureAtlas();
+    void Add(TextureId id, uint16_t width, uint16_t height);
+    // the ready entry of the texture, it's allocated later if it's not ready
+    const AtlasEntry* Find(TextureId id);
+    void Touch(TextureId id);
+    // allocate the wanted images and copy them into the page, call it in the frame
+    void Update(bgfx_encoder_t* encoder, uint16_t viewid, uint16_t program, uint16_t sampler, const bgfx_vertex_layout_t* layout);
+    bgfx_texture_handle_t PageTexture(uint8_t page) const;
+    uint32_t Generation() const { return generation; }
+    void GetStat(AtlasStat& stat) const;
+private:
+    struct Page {
+        bgfx_texture_handle_t     texture;
+        bgfx_frame_buffer_handle_t fb;
+        SkylinePacker             packer;
+        std::vector<AtlasRect>    freelist;
+        uint32_t                  images = 0;
+        uint32_t                  area = 0;
+    };
+    bool alloc(AtlasEntry& e);
+    bool allocPage(Page& p, uint16_t w, uint16_t h, AtlasRect& r);
+    void release(AtlasEntry& e);
+    void copy(bgfx_encoder_t* encoder, uint16_t viewid, uint16_t program, uint16_t sampler, const bgfx_vertex_layout_t* layout, AtlasEntry& e, bgfx_texture_handle_t source);
+    std::unordered_map<TextureId, AtlasEntry> entries;
+    std::vector<Page> pages;
+    std::vector<TextureId> wanted;
+    std::vector<TextureId> used;
+    std::vector<TextureId> copying;
+    uint32_t frame = 1;
+    uint32_t full_frame = 0;
+    uint32_t generation = 0;
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include <binding/Context.h>
 #include <binding/ContextImpl.h>
+#include <binding/RenderImpl.h>
 #include <core/Document.h>
 #include <core/Element.h>
 #include <core/Text.h>
@@ -607,6 +608,33 @@ lRenderFrame(lua_State* L) {
     return 0;
 }
 
+static int
+lRenderStat(lua_State* L) {
+	uint32_t geometries, submits, replays;
+	static_cast<Rml::RenderImpl*>(Rml::GetRender())->GetStat(geometries, submits, replays);
+	lua_pushinteger(L, geometries);
+	lua_pushinteger(L, submits);
+	lua_pushinteger(L, replays);
+	return 3;
+}
+
+static int
+lRenderAtlasStat(lua_State* L) {
+	Rml::AtlasStat stat;
+	uint32_t saved;
+	static_cast<Rml::RenderImpl*>(Rml::GetRender())->GetAtlasStat(stat, saved);
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, stat.pages);
+	lua_setfield(L, -2, "pages");
+	lua_pushinteger(L, stat.images);
+	lua_setfield(L, -2, "images");
+	lua_pushnumber(L, stat.occupancy);
+	lua_setfield(L, -2, "occupancy");
+	lua_pushinteger(L, saved);
+	lua_setfield(L, -2, "saved");
+	return 1;
+}
+
 static int
 lRenderSetTexture(lua_State* L) {
 	Rml::TextureData data;
@@ -614,6 +642,9 @@ lRenderSetTexture(lua_State* L) {
 		data.handle = (Rml::TextureId)luaL_checkinteger(L, 2);
 		data.dimensions.w = (float)luaL_checkinteger(L, 3);
 		data.dimensions.h = (float)luaL_checkinteger(L, 4);
+		if (lua_toboolean(L, 5)) {
+			static_cast<Rml::RenderImpl*>(Rml::GetRender())->AtlasTexture(data.handle, (uint16_t)data.dimensions.w, (uint16_t)data.dimensions.h);
+		}
 	}
 	Rml::Texture::Set(lua_checkstdstring(L, 1), std::move(data));
     return 0;
@@ -685,6 +716,8 @@ luaopen_rmlui(lua_State* L) {
 		{ "TextDelete", lTextDelete },
 		{ "RenderBegin", lRenderBegin },
 		{ "RenderFrame", lRenderFrame },
+		{ "RenderStat", lRenderStat },
+		{ "RenderAtlasStat", lRenderAtlasStat },
 		{ "RenderSetTexture", lRenderSetTexture },
 		{ "RmlInitialise", lRmlInitialise },
 		{ "RmlShutdown", lRmlShutdown },
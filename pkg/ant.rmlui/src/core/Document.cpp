@@ -11,6 +11,7 @@ namespace Rml {
 Document::Document(const Size& _dimensions)
 	: body(this, "body")
 	, dimensions(_dimensions)
+	, render_list(GetRender()->CreateRenderList())
 { }
 
 Document::~Document() {
@@ -91,7 +92,9 @@ const Size& Document::GetDimensions() {
 void Document::Flush() {
 	body.Update();
 	UpdateLayout();
-	body.UpdateRender();
+	if (body.UpdateRender()) {
+		dirty_render = true;
+	}
 }
 
 void Document::Update(float delta) {
@@ -99,13 +102,23 @@ void Document::Update(float delta) {
 	body.UpdateAnimations(delta);
 	Style::Instance().Flush();//TODO
 	UpdateLayout();
-	body.Render();
+	if (body.PrepareRender()) {
+		dirty_render = true;
+	}
+	auto render = GetRender();
+	if (dirty_render || !render->ReplayRenderList(render_list.get())) {
+		dirty_render = false;
+		render->BeginRenderList(render_list.get());
+		body.Render();
+		render->EndRenderList(render_list.get());
+	}
 	removednodes.clear();
 }
 
 void Document::UpdateLayout() {
 	if (dirty_dimensions || body.GetLayout().IsDirty()) {
 		dirty_dimensions = false;
+		dirty_render = true;
 		body.GetLayout().CalculateLayout(dimensions);
 #if 0
 		printf("%s\n", body.GetLayout().ToString().c_str());
@@ -9,6 +9,7 @@ namespace Rml {
 
 class Text;
 class RichText;
+class RenderList;
 class StyleSheet;
 class Factory;
 struct HtmlElement;
@@ -47,7 +48,9 @@ private:
 	std::deque<std::unique_ptr<Node>> removednodes;
 	Element body;
 	Size dimensions;
+	std::unique_ptr<RenderList> render_list;
 	bool dirty_dimensions = false;
+	bool dirty_render = true;
 };
 
 }
@@ -112,16 +112,40 @@ void Element::UpdateAnimations(float delta) {
 	}
 }
 
-void Element::Render() {
+bool Element::PrepareRender() {
 	if (!IsVisible()) {
-		return;
+		return false;
 	}
+	bool changed = dirty.contains(Dirty::Transform)
+		|| dirty.contains(Dirty::Perspective)
+		|| dirty.contains(Dirty::Clip)
+		|| dirty.contains(Dirty::Background)
+		|| dirty.contains(Dirty::StackingContext);
 	UpdateTransform();
 	UpdatePerspective();
 	UpdateClip();
 	UpdateGeometry();
 	UpdateStackingContext();
 
+	for (auto& child: children_under_render) {
+		if (child->PrepareRender()) {
+			changed = true;
+		}
+	}
+	if (clip.Test(aabb.content)) {
+		for (auto& child: children_upper_render) {
+			if (child->PrepareRender()) {
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
+void Element::Render() {
+	if (!IsVisible()) {
+		return;
+	}
 	for (auto& child: children_under_render) {
 		child->Render();
 	}
@@ -1012,13 +1036,19 @@ void Element::UpdateGeometry() {
 	}
 }
 
-void Element::UpdateRender() {
+bool Element::UpdateRender() {
+	bool changed = dirty.contains(Dirty::Transform)
+		|| dirty.contains(Dirty::Perspective)
+		|| dirty.contains(Dirty::Clip);
 	UpdateTransform();
 	UpdatePerspective();
 	UpdateClip();
 	for (auto& child : children) {
-		child->UpdateRender();
+		if (child->UpdateRender()) {
+			changed = true;
+		}
 	}
+	return changed;
 }
 
 void Element::CalculateLayout() {
@@ -94,7 +94,7 @@ public:
 	void GetElementsByClassName(const std::string& class_name, std::function<void(Element*)> func);
 
 	void Update();
-	void UpdateRender();
+	bool UpdateRender();
 	bool SetRenderStatus();
 
 	Size GetScrollOffset() const;
@@ -140,6 +140,7 @@ public:
 	void SetParentNode(Element* parent) override;
 	Node* Clone(bool deep = true) const override;
 	void CalculateLayout() override;
+	bool PrepareRender() override;
 	void Render() override;
 	float GetZIndex() const override;
 	Element* ElementFromPoint(Point point) override;
@@ -52,6 +52,20 @@ struct TextureData {
 	}
 };
 
+// the glyphs of a text geometry when it's generated, see Render::GlyphsChanged
+struct GlyphStamp {
+	uint32_t ready = 0;			// the glyph version, the placeholders are ready when it's changed
+	uint32_t evict = 0;			// the evict version, the cells may be evicted when it's changed
+	bool placeholder = false;	// some glyphs are rasterizing
+	bool busy = false;			// some glyphs have no cell in this frame, try again in the next frame
+};
+
+// the draws of a document retained between frames, it's replayed when the document is not changed
+class RenderList {
+public:
+	virtual ~RenderList() {};
+};
+
 class Render {
 public:
 	virtual void Begin() = 0;
@@ -66,13 +80,20 @@ public:
 	virtual Material* CreateFontMaterial(const TextEffect& effect) = 0;
 	virtual Material* CreateDefaultMaterial() = 0;
 	virtual void DestroyMaterial(Material* mat) = 0;
+	virtual RenderList* CreateRenderList() = 0;
+	virtual void BeginRenderList(RenderList* list) = 0;
+	virtual void EndRenderList(RenderList* list) = 0;
+	// return false if the list is out of date
+	virtual bool ReplayRenderList(RenderList* list) = 0;
 
 	virtual FontFaceHandle GetFontFaceHandle(const std::string& family, Style::FontStyle style, Style::FontWeight weight, uint32_t size) = 0;
 	virtual void GetFontHeight(Rml::FontFaceHandle handle, int& ascent, int& descent, int& lineGap) = 0;
 	virtual bool GetUnderline(FontFaceHandle handle, float& position, float &thickness) = 0;
+	// true if the text geometry should be generated again: its placeholders are ready or its glyph cells are evicted
+	virtual bool GlyphsChanged(Rml::GlyphStamp& stamp, Rml::Geometry& geometry) = 0;
 	virtual float GetFontWidth(Rml::FontFaceHandle handle, uint32_t codepoint) = 0;
-	virtual void GenerateString(Rml::FontFaceHandle handle, Rml::LineList& lines, const Rml::Color& color, Rml::Geometry& geometry) =0;
-	virtual void GenerateRichString(Rml::FontFaceHandle handle, Rml::LineList& lines, std::vector<std::vector<Rml::layout>> layouts, std::vector<uint32_t>& codepoints, Rml::Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<Rml::image>& images, int& cur_image_idx, float line_height)=0;
+	virtual void GenerateString(Rml::FontFaceHandle handle, Rml::LineList& lines, const Rml::Color& color, Rml::Geometry& geometry, Rml::GlyphStamp& stamp) =0;
+	virtual void GenerateRichString(Rml::FontFaceHandle handle, Rml::LineList& lines, std::vector<std::vector<Rml::layout>> layouts, std::vector<uint32_t>& codepoints, Rml::Geometry& textgeometry, std::vector<std::unique_ptr<Geometry>> & imagegeometries, std::vector<Rml::image>& images, int& cur_image_idx, float line_height, Rml::GlyphStamp& stamp)=0;
 	virtual float PrepareText(FontFaceHandle handle,const std::string& string,std::vector<uint32_t>& codepoints,std::vector<int>& groupmap,std::vector<group>& groups,std::vector<Rml::image>& images,std::vector<layout>& line_layouts,int start,int num)=0;
 };
 
@@ -46,6 +46,8 @@ namespace Rml {
 		const Rect& GetBounds() const;
 		void InsertChild(const LayoutNode* child, size_t index);
 		void RemoveChild(const LayoutNode* child);
+		// update the render data before Render(), return true if the output of Render() is changed
+		virtual bool PrepareRender() = 0;
 		virtual void Render() = 0;
 		virtual float GetZIndex() const = 0;
 		virtual Element* ElementFromPoint(Point point) = 0;
@@ -33,15 +33,26 @@ Property Text::GetComputedProperty(PropertyId id) {
 	return GetParentNode()->GetComputedProperty(id);
 }
 
-void Text::Render() {
+bool Text::PrepareRender() {
+	if (!dirty.contains(Dirty::Geometry) && GetRender()->GlyphsChanged(glyph_stamp, geometry)) {
+		dirty.insert(Dirty::Geometry);
+	}
+	bool changed = dirty.contains(Dirty::Font)
+		|| dirty.contains(Dirty::Effects)
+		|| dirty.contains(Dirty::Geometry)
+		|| dirty.contains(Dirty::Decoration);
 	FontFaceHandle font_face_handle = GetFontFaceHandle();
 	if (font_face_handle == 0)
-		return;
-
+		return changed;
 	UpdateTextEffects();
 	UpdateGeometry(font_face_handle);
 	UpdateDecoration(font_face_handle);
+	return changed;
+}
 
+void Text::Render() {
+	if (GetFontFaceHandle() == 0)
+		return;
 	if (GetParentNode()->SetRenderStatus()) {
 		if (decoration_under) {
 			decoration.Render();
@@ -191,7 +202,7 @@ void Text::UpdateGeometry(const FontFaceHandle font_face_handle) {
 	dirty.erase(Dirty::Geometry);
 	Color color = GetTextColor();
 	color.ApplyOpacity(GetParentNode()->GetOpacity());
-	GetRender()->GenerateString(font_face_handle, lines, color, geometry);
+	GetRender()->GenerateString(font_face_handle, lines, color, geometry, glyph_stamp);
 	if (GetParentNode()->IsGray()) {
 		geometry.SetGray();
 	}
@@ -513,10 +524,11 @@ void RichText::UpdateGeometry(const FontFaceHandle font_face_handle) {
 	dirty.erase(Dirty::Geometry);
 	cur_image_idx = 0;
 	float line_height = GetLineHeight();
-	GetRender()->GenerateRichString(font_face_handle, lines, layouts, codepoints, geometry, imagegeometries, images, cur_image_idx, line_height);
+	GetRender()->GenerateRichString(font_face_handle, lines, layouts, codepoints, geometry, imagegeometries, images, cur_image_idx, line_height, glyph_stamp);
 	if (GetParentNode()->IsGray()) {
 		geometry.SetGray();
 	}
+	UpdateImageMaterials();
 }
 
 void RichText::UpdateImageMaterials() {
@@ -528,13 +540,8 @@ void RichText::UpdateImageMaterials() {
 }
 
 void RichText::Render() {
-	FontFaceHandle font_face_handle = GetFontFaceHandle();
-	if (font_face_handle == 0)
+	if (GetFontFaceHandle() == 0)
 		return;
-	UpdateTextEffects();
-	UpdateImageMaterials();
-	UpdateDecoration(font_face_handle);
-	UpdateGeometry(font_face_handle);
 	if (GetParentNode()->SetRenderStatus()) {
 		if (decoration_under) {
 			decoration.Render();
@@ -36,6 +36,7 @@ protected:
 
 	Node* Clone(bool deep = true) const override;
 	void CalculateLayout() override;
+	bool PrepareRender() override;
 	void Render() override;
 	float GetZIndex() const override;
 	Element* ElementFromPoint(Point point) override;
@@ -69,6 +70,7 @@ protected:
 		Geometry,
 	};
 	EnumSet<Dirty> dirty;
+	GlyphStamp glyph_stamp;
 	bool decoration_under = false;
 };
 
@@ -6,6 +6,7 @@ lm:lua_source "scene" {
         lm.AntDir .. "/3rd/math3d",
         lm.AntDir .. "/3rd/luaecs",
         lm.AntDir .. "/3rd/glm",
+        lm.AntDir .. "/clibs/foundation",
     },
     sources = {
         "scene.cpp"
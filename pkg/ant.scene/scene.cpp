@@ -2,9 +2,13 @@
 #include "ecs/select.h"
 #include "ecs/component.hpp"
 #include "flatmap.h"
+#include "aabb_tree.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 
 extern "C" {
 	#include "math3d.h"
@@ -179,25 +183,112 @@ scene_remove(lua_State *L) {
 
 	entity_propagate_tag(w->ecs, ecs::component_id<component::scene>, ecs::component_id<component::REMOVED>);
 
+	if (w->aabb_tree) {
+		for (auto& e : ecs::select<component::REMOVED, component::bounding, component::eid>(w->ecs)) {
+			w->aabb_tree->remove(e.get<component::eid>());
+		}
+	}
+
+	return 0;
+}
+
+static int
+scene_init(lua_State *L) {
+	auto w = getworld(L);
+	w->aabb_tree = new struct aabb_tree;
+	return 0;
+}
+
+static int
+scene_exit(lua_State *L) {
+	auto w = getworld(L);
+	delete w->aabb_tree;
+	w->aabb_tree = nullptr;
 	return 0;
 }
 
+// the spatial index is refitted with the moved entities only
 static int
 bounding_update(lua_State *L){
 	auto w = getworld(L);
 	auto math3d = w->math3d->M;
 	math3d_checkpoint cp(math3d);
-	for (auto& e : ecs::select<component::scene_changed, component::bounding, component::scene>(w->ecs)){
+	for (auto& e : ecs::select<component::scene_changed, component::bounding, component::scene, component::eid>(w->ecs)){
 		auto &b = e.get<component::bounding>();
 		if (math_isnull(b.aabb))
 			continue;
 		const auto &s = e.get<component::scene>();
 		const math_t aabb = math3d_aabb_transform(math3d, s.worldmat, b.aabb);
 		math3d_update(math3d, b.scene_aabb, aabb);
+		if (w->aabb_tree) {
+			w->aabb_tree->update(e.get<component::eid>(), math_value(math3d, b.scene_aabb));
+		}
 	}
 	return 0;
 }
 
+// raycast(origin, dir [, maxdist]) : the eids whose scene_aabb is hit by the ray, front to back. and the distances
+static int
+lraycast(lua_State *L) {
+	auto w = getworld(L);
+	auto math3d = w->math3d->M;
+	const float *o = math_value(math3d, math3d_from_lua_id(L, w->math3d, 1));
+	const float *d = math_value(math3d, math3d_from_lua_id(L, w->math3d, 2));
+	const float maxdist = (float)luaL_optnumber(L, 3, 1e30);
+	const float origin[3] = { o[0], o[1], o[2] };
+	float dir[3] = { d[0], d[1], d[2] };
+	const float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	if (len == 0) {
+		return luaL_error(L, "Invalid ray direction");
+	}
+	for (auto& v : dir) {
+		v /= len;
+	}
+
+	struct hit {
+		float t;
+		uint64_t eid;
+	};
+	std::vector<hit> hits;
+	if (w->aabb_tree) {
+		w->aabb_tree->raycast(origin, dir, maxdist, [&hits](uint64_t eid, uint32_t, float t){
+			hits.push_back(hit{t, eid});
+		});
+	}
+	std::sort(hits.begin(), hits.end(), [](const hit &a, const hit &b){ return a.t < b.t; });
+
+	const int n = (int)hits.size();
+	lua_createtable(L, n, 0);
+	lua_createtable(L, n, 0);
+	for (int ii=0; ii<n; ++ii) {
+		lua_pushinteger(L, (lua_Integer)hits[ii].eid);
+		lua_rawseti(L, -3, ii+1);
+		lua_pushnumber(L, hits[ii].t);
+		lua_rawseti(L, -2, ii+1);
+	}
+	return 2;
+}
+
+static int
+lspatial_stat(lua_State *L) {
+	auto w = getworld(L);
+	lua_createtable(L, 0, 5);
+	if (w->aabb_tree) {
+		const auto &t = *w->aabb_tree;
+		lua_pushinteger(L, t.size());
+		lua_setfield(L, -2, "leaves");
+		lua_pushinteger(L, t.node_count());
+		lua_setfield(L, -2, "nodes");
+		lua_pushinteger(L, t.height());
+		lua_setfield(L, -2, "height");
+		lua_pushinteger(L, t.stat.refit);
+		lua_setfield(L, -2, "refit");
+		lua_pushinteger(L, t.stat.reinsert);
+		lua_setfield(L, -2, "reinsert");
+	}
+	return 1;
+}
+
 extern "C" int
 luaopen_system_scene(lua_State *L) {
 	luaL_checkversion(L);
@@ -207,6 +298,22 @@ luaopen_system_scene(lua_State *L) {
 		{ "end_frame", end_frame },
 		{ "scene_remove", scene_remove },
 		{ "bounding_update", bounding_update},
+		{ "init", scene_init },
+		{ "exit", scene_exit },
+		{ NULL, NULL },
+	};
+	luaL_newlibtable(L,l);
+	lua_pushnil(L);
+	luaL_setfuncs(L,l,1);
+	return 1;
+}
+
+extern "C" int
+luaopen_scene_core(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "raycast", lraycast },
+		{ "stat", lspatial_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlibtable(L,l);
@@ -53,6 +53,7 @@ int luaopen_render_material(lua_State *L);
 int luaopen_render_queue(lua_State *L);
 int luaopen_system_render(lua_State *L);
 int luaopen_render_stat(lua_State *L);
+int luaopen_render_submit(lua_State *L);
 int luaopen_motion_sampler(lua_State *L);
 int luaopen_motion_tween(lua_State *L);
 int luaopen_image(lua_State* L);
@@ -70,8 +71,10 @@ int luaopen_bee_filewatch(lua_State* L);
 int luaopen_bee_subprocess(lua_State* L);
 int luaopen_filedialog(lua_State* L);
 int luaopen_imgui_widgets(lua_State* L);
+int luaopen_meshopt(lua_State* L);
 #endif
 int luaopen_system_scene(lua_State* L);
+int luaopen_scene_core(lua_State* L);
 int luaopen_system_cull(lua_State* L);
 int luaopen_zip(lua_State* L);
 int luaopen_httpc(lua_State *L);
@@ -127,6 +130,7 @@ void ant_loadmodules(lua_State* L) {
         { "render.queue",           luaopen_render_queue},
         { "system.render",      luaopen_system_render},
         { "render.stat",        luaopen_render_stat},
+        { "render.submit",      luaopen_render_submit},
         { "motion.sampler",     luaopen_motion_sampler},
         { "motion.tween",       luaopen_motion_tween},
         { "image", luaopen_image },
@@ -144,8 +148,10 @@ void ant_loadmodules(lua_State* L) {
         { "bee.subprocess", luaopen_bee_subprocess },
         { "filedialog", luaopen_filedialog },
         { "imgui.widgets", luaopen_imgui_widgets },
+        { "meshopt", luaopen_meshopt },
 #endif
         { "system.scene", luaopen_system_scene },
+        { "scene.core", luaopen_scene_core },
         { "cull.core", luaopen_system_cull},
         { "zip", luaopen_zip },
         { "httpc", luaopen_httpc },
@@ -6,6 +6,7 @@ local runtime = false
 local RuntimeBacklist <const> = {
     filedialog = true,
     effekseer = true,
+    meshopt = true,
 }
 
 local EditorBacklist <const> = {
@@ -0,0 +1,188 @@
+// compare with testing all the boxes: frustum query, refit of the moved boxes and raycast
+
+#include "aabb_tree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+template<typename Func>
+static double
+time_ms(Func &&f, int loop){
+	const auto start = std::chrono::steady_clock::now();
+	for (int ii=0; ii<loop; ++ii)
+		f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / loop;
+}
+
+static bool
+out_of_frustum(const float *aabb, const float *planes){
+	for (int ii=0; ii<6; ++ii){
+		const float *p = planes + ii * 4;
+		float v[3];
+		for (int jj=0; jj<3; ++jj)
+			v[jj] = p[jj] > 0 ? aabb[4+jj] : aabb[jj];
+		if (p[0] * v[0] + p[1] * v[1] + p[2] * v[2] + p[3] < 0)
+			return true;
+	}
+	return false;
+}
+
+static bool
+ray_hit(const float *aabb, const float o[3], const float d[3], float maxt){
+	float tmin = 0, tmax = maxt;
+	for (int ii=0; ii<3; ++ii){
+		const float t1 = (aabb[ii] - o[ii]) / d[ii], t2 = (aabb[4+ii] - o[ii]) / d[ii];
+		tmin = std::max(tmin, std::min(t1, t2));
+		tmax = std::min(tmax, std::max(t1, t2));
+	}
+	return tmin <= tmax;
+}
+
+// 90 degrees fov camera at (x, 0, z) looks at yaw
+static void
+make_frustum(float *planes, float x, float z, float yaw, float n, float f){
+	const float s = 1.f / std::sqrt(2.f);
+	const float local[6][4] = {
+		{ s, 0, s, 0},	{-s, 0, s, 0},
+		{ 0, s, s, 0},	{ 0,-s, s, 0},
+		{ 0, 0, 1, -n},	{ 0, 0,-1, f},
+	};
+	const float c = std::cos(yaw), sn = std::sin(yaw);
+	for (int ii=0; ii<6; ++ii){
+		float *p = planes + ii * 4;
+		p[0] = local[ii][0] * c + local[ii][2] * sn;
+		p[1] = local[ii][1];
+		p[2] = -local[ii][0] * sn + local[ii][2] * c;
+		p[3] = local[ii][3] - (p[0] * x + p[2] * z);
+	}
+}
+
+int
+main(){
+	{
+		// the stack of a degenerate tree spills to the heap
+		aabb_tree::traverse_stack<int32_t> stack;
+		for (int32_t ii=0; ii<1000; ++ii)
+			stack.push(ii);
+		for (int32_t ii=999; ii>=0; --ii){
+			const int32_t v = stack.pop();
+			if (v != ii){
+				printf("traverse_stack: %d != %d\n", v, ii);
+				return 1;
+			}
+		}
+		assert(stack.empty());
+	}
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> pos(-1000.f, 1000.f), ext(0.5f, 3.f), unit(-1.f, 1.f);
+
+	for (uint32_t n : {1000u, 10000u, 100000u}){
+		std::vector<float> boxes(n * 8);
+		auto set_box = [&](uint32_t ii, float x, float y, float z){
+			float *b = &boxes[ii * 8];
+			const float e[3] = {ext(rng), ext(rng), ext(rng)};
+			b[0] = x - e[0]; b[1] = y - e[1]; b[2] = z - e[2]; b[3] = 0;
+			b[4] = x + e[0]; b[5] = y + e[1]; b[6] = z + e[2]; b[7] = 0;
+		};
+		for (uint32_t ii=0; ii<n; ++ii)
+			set_box(ii, pos(rng), pos(rng) * 0.05f, pos(rng));
+
+		aabb_tree tree;
+		const double build_ms = time_ms([&](){
+			tree.clear();
+			for (uint32_t ii=0; ii<n; ++ii){
+				tree.update(ii, &boxes[ii * 8]);
+				tree.set_user(ii, ii);
+			}
+		}, 1);
+
+		// main camera + 2 shadow cascades
+		const uint32_t nfrustum = 3;
+		float planes[nfrustum * 24];
+		make_frustum(planes, 0, 0, 0.3f, 0.1f, 300.f);
+		make_frustum(planes + 24, 0, 0, 0.3f, 0.1f, 50.f);
+		make_frustum(planes + 48, 0, 0, 0.3f, 50.f, 150.f);
+
+		std::vector<uint64_t> brute(n), culled(n);
+		const uint64_t all = (1ull << nfrustum) - 1;
+		const int loop = n >= 100000 ? 20 : 200;
+		const double brute_ms = time_ms([&](){
+			for (uint32_t ii=0; ii<n; ++ii){
+				uint64_t m = 0;
+				for (uint32_t f=0; f<nfrustum; ++f){
+					if (out_of_frustum(&boxes[ii * 8], planes + f * 24))
+						m |= 1ull << f;
+				}
+				brute[ii] = m;
+			}
+		}, loop);
+
+		const double tree_ms = time_ms([&](){
+			std::fill(culled.begin(), culled.end(), all);
+			tree.query_frustums(planes, nfrustum, [&](uint64_t, uint32_t user, uint64_t visible, uint64_t inside){
+				uint64_t m = all & ~inside;
+				for (uint64_t t = visible & ~inside; t; t &= t - 1){
+					const uint32_t f = (uint32_t)std::countr_zero(t);
+					if (!out_of_frustum(&boxes[user * 8], planes + f * 24))
+						m &= ~(1ull << f);
+				}
+				culled[user] = m;
+			});
+		}, loop);
+
+		uint32_t mismatch = 0, visible = 0;
+		for (uint32_t ii=0; ii<n; ++ii){
+			mismatch += brute[ii] != culled[ii] ? 1 : 0;
+			visible += (brute[ii] & 1) ? 0 : 1;
+		}
+		printf("%6u boxes: build %.2fms, height %d, frustum brute %.3fms, tree %.3fms, x%.1f, main visible %u, mismatch %u\n",
+			n, build_ms, tree.height(), brute_ms, tree_ms, brute_ms / tree_ms, visible, mismatch);
+
+		// 10% boxes move a little every frame
+		const uint32_t nmove = n / 10;
+		const double move_ms = time_ms([&](){
+			for (uint32_t ii=0; ii<nmove; ++ii){
+				const uint32_t idx = (uint32_t)(rng() % n);
+				float *b = &boxes[idx * 8];
+				const float d[3] = {unit(rng) * 0.5f, 0, unit(rng) * 0.5f};
+				for (int jj=0; jj<3; ++jj){
+					b[jj] += d[jj];
+					b[4+jj] += d[jj];
+				}
+				tree.update(idx, b);
+			}
+		}, 20);
+		printf("        move %u: %.3fms, refit %u, reinsert %u, height %d\n",
+			nmove, move_ms, tree.stat.refit, tree.stat.reinsert, tree.height());
+
+		uint32_t ray_mismatch = 0;
+		double ray_brute_ms = 0, ray_tree_ms = 0;
+		for (int r=0; r<100; ++r){
+			const float o[3] = {pos(rng), 10.f, pos(rng)};
+			const float d[3] = {unit(rng), -0.05f, unit(rng)};
+			std::vector<uint32_t> a, b;
+			ray_brute_ms += time_ms([&](){
+				a.clear();
+				for (uint32_t ii=0; ii<n; ++ii){
+					if (ray_hit(&boxes[ii * 8], o, d, 1000.f))
+						a.push_back(ii);
+				}
+			}, 1);
+			ray_tree_ms += time_ms([&](){
+				b.clear();
+				tree.raycast(o, d, 1000.f, [&](uint64_t key, uint32_t, float){
+					b.push_back((uint32_t)key);
+				});
+			}, 1);
+			std::sort(b.begin(), b.end());
+			ray_mismatch += a != b ? 1 : 0;
+		}
+		printf("        raycast brute %.4fms, tree %.4fms, x%.1f, mismatch %u\n",
+			ray_brute_ms / 100, ray_tree_ms / 100, ray_brute_ms / ray_tree_ms, ray_mismatch);
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+// compare with the old path: one math3d_frustum_intersect_aabb call per entity per frustum through
+// the math3d handle, then one queue_set per queue
+
+#include "frustum_cull.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+struct old_aabb {
+	float v[8];
+};
+
+#if defined(_MSC_VER)
+#	define NOINLINE __declspec(noinline)
+#else
+#	define NOINLINE __attribute__((noinline))
+#endif
+
+// as math3d_frustum_intersect_aabb, < 0 : outside
+static NOINLINE int
+old_intersect(const cull_frustum &f, const old_aabb &aabb){
+	int r = 1;
+	for (const auto &p : f.planes){
+		float vmin[3], vmax[3];
+		for (int ii=0; ii<3; ++ii){
+			const bool pos = p[ii] > 0.f;
+			vmin[ii] = pos ? aabb.v[ii] : aabb.v[4+ii];
+			vmax[ii] = pos ? aabb.v[4+ii] : aabb.v[ii];
+		}
+		if (p[0] * vmax[0] + p[1] * vmax[1] + p[2] * vmax[2] + p[3] < 0.f)
+			return -1;
+		if (p[0] * vmin[0] + p[1] * vmin[1] + p[2] * vmin[2] + p[3] < 0.f)
+			r = 0;
+	}
+	return r;
+}
+
+static NOINLINE void
+old_queue_set(uint64_t *masks, int idx, uint8_t queue, bool value){
+	masks[idx] = value ? (masks[idx] | (1ull << queue)) : (masks[idx] & ~(1ull << queue));
+}
+
+static void
+make_frustum(cull_frustum &f, float n, float fa){
+	const float s = 1.f / std::sqrt(2.f);
+	const float planes[6][4] = {
+		{ s, 0, s, 0},	{-s, 0, s, 0},
+		{ 0, s, s, 0},	{ 0,-s, s, 0},
+		{ 0, 0, 1, -n},	{ 0, 0,-1, fa},
+	};
+	memcpy(f.planes, planes, sizeof(planes));
+}
+
+template<typename Func>
+static double
+time_ms(Func &&f, int loop){
+	const auto start = std::chrono::steady_clock::now();
+	for (int ii=0; ii<loop; ++ii)
+		f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / loop;
+}
+
+int
+main(){
+	// main camera + 4 csm cascades, each frustum has 2 queues(ex: main_queue & pre_depth_queue)
+	cull_frustum frustums[5];
+	make_frustum(frustums[0], 0.1f, 200.f);
+	make_frustum(frustums[1], 0.1f, 10.f);
+	make_frustum(frustums[2], 10.f, 30.f);
+	make_frustum(frustums[3], 30.f, 70.f);
+	make_frustum(frustums[4], 70.f, 150.f);
+	const uint32_t nfrustum = 5;
+	const uint8_t queues[nfrustum][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {8, 9}};
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> pos(-200.f, 200.f), ext(0.5f, 3.f);
+
+	printf("simd: %s\n", frustum_cull_simd());
+	for (uint32_t n : {1000u, 10000u, 100000u}){
+		std::vector<old_aabb> handles(n);
+		std::vector<uint32_t> ids(n);		// entity -> math3d handle
+		cull_bounds b;
+		b.resize(n);
+		for (uint32_t ii=0; ii<n; ++ii){
+			const float c[3] = {pos(rng), pos(rng) * 0.25f, pos(rng) + 50.f};
+			const float e[3] = {ext(rng), ext(rng), ext(rng)};
+			old_aabb a = {{c[0]-e[0], c[1]-e[1], c[2]-e[2], 0.f, c[0]+e[0], c[1]+e[1], c[2]+e[2], 0.f}};
+			ids[ii] = (ii * 7919) % n;
+			handles[ids[ii]] = a;
+			b.set(ii, a.v);
+		}
+
+		std::vector<uint64_t> old_masks(n, 0), new_masks(n, 0), culled(n);
+		uint64_t frustum_queues[nfrustum], all_queues = 0;
+		for (uint32_t f=0; f<nfrustum; ++f){
+			frustum_queues[f] = (1ull << queues[f][0]) | (1ull << queues[f][1]);
+			all_queues |= frustum_queues[f];
+		}
+
+		const int loop = n >= 100000 ? 20 : 200;
+		const double old_ms = time_ms([&](){
+			for (uint32_t ii=0; ii<n; ++ii){
+				for (uint32_t f=0; f<nfrustum; ++f){
+					const bool isculled = old_intersect(frustums[f], handles[ids[ii]]) < 0;
+					for (auto q : queues[f]){
+						old_queue_set(old_masks.data(), ii, q, isculled);
+					}
+				}
+			}
+		}, loop);
+
+		const double new_ms = time_ms([&](){
+			frustum_cull(b, 0, n, frustums, nfrustum, culled.data());
+			for (uint32_t ii=0; ii<n; ++ii){
+				uint64_t m = 0;
+				for (uint32_t f=0; f<nfrustum; ++f){
+					if (culled[ii] & (1ull << f))
+						m |= frustum_queues[f];
+				}
+				new_masks[ii] = (new_masks[ii] & ~all_queues) | m;
+			}
+		}, loop);
+
+		uint32_t mismatch = 0, visible = 0;
+		for (uint32_t ii=0; ii<n; ++ii){
+			mismatch += old_masks[ii] != new_masks[ii] ? 1 : 0;
+			visible += (old_masks[ii] & 1) ? 0 : 1;
+		}
+		printf("%6u objects: old %.3fms, new %.3fms, x%.1f, main visible %u, mismatch %u\n",
+			n, old_ms, new_ms, old_ms / new_ms, visible, mismatch);
+	}
+	return 0;
+}
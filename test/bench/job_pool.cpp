@@ -0,0 +1,55 @@
+// the pool is restarted with different worker counts between the runs, as irender.submit_workers and the
+// animation workers do. every run must call f(idx) once for each idx of the pool, and the fork/join time
+// of an empty run is printed for each worker count
+
+#include "job_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static uint32_t
+check_run(job_pool &pool, uint32_t loop){
+	uint32_t wrong = 0;
+	for (uint32_t ii=0; ii<loop; ++ii){
+		std::vector<uint32_t> called(pool.count());
+		std::atomic<uint32_t> sum(0);
+		pool.run([&](uint32_t idx){
+			++called[idx];
+			sum.fetch_add(idx + 1, std::memory_order_relaxed);
+		});
+		const uint32_t n = pool.count();
+		for (uint32_t idx=0; idx<n; ++idx)
+			wrong += called[idx] == 1 ? 0 : 1;
+		wrong += sum.load() == n * (n + 1) / 2 ? 0 : 1;
+	}
+	return wrong;
+}
+
+static double
+run_us(job_pool &pool, uint32_t loop){
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t ii=0; ii<loop; ++ii)
+		pool.run([](uint32_t){});
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / loop;
+}
+
+int
+main(){
+	job_pool pool;
+	uint32_t wrong = check_run(pool, 100);
+	// 0 restarts the caller only pool, the same count restarts the workers too
+	const uint32_t workers[] = {3, 1, 3, 0, 7, 7, 2};
+	for (uint32_t n : workers){
+		pool.start(n);
+		// the workers are started between the frames, they are idle before the next run
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		const uint32_t w = check_run(pool, 1000);
+		printf("%u workers: run %.2fus, wrong %u\n", n, run_us(pool, 1000), w);
+		wrong += w;
+	}
+	pool.stop();
+	wrong += check_run(pool, 100);
+	printf("wrong %u\n", wrong);
+	return wrong == 0 ? 0 : 1;
+}
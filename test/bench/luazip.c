@@ -0,0 +1,161 @@
+// loads TEST_FILES small files from one archive by "archive.zip|index". the old path opens the archive
+// with minizip and walks the central directory to the index for every file, luazip_open parses the
+// central directory once and reads by offset
+
+#include "lua.h"
+#include "zlib-ng.h"
+#include "mz_compat.h"
+#include "luazip.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ZLIB_UTF8_FLAG (1<<11)
+#define TEST_FILES 10000
+#define TEST_MAXSIZE 1024
+
+static double
+test_now() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static size_t
+test_content(int idx, uint8_t *buf) {
+	uint32_t seed = idx * 2654435761u + 1;
+	size_t sz = 64 + (seed >> 8) % (TEST_MAXSIZE - 64);
+	size_t i;
+	for (i = 0; i < sz; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)((seed >> 16) % 26 + 'a');
+	}
+	return sz;
+}
+
+static int
+test_create(const char *filename, int n) {
+	zipFile zf = zipOpen(filename, 0);
+	if (zf == NULL)
+		return 0;
+	uint8_t buf[TEST_MAXSIZE];
+	int i;
+	for (i = 0; i < n; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "file%05d.txt", i);
+		// half stored, half deflated
+		const int deflate = i & 1;
+		if (zipOpenNewFileInZip4(zf, name, NULL, NULL, 0, NULL, 0, NULL,
+			deflate ? Z_DEFLATED : 0,
+			deflate ? Z_DEFAULT_COMPRESSION : 0,
+			0, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
+			NULL, 0, 0, ZLIB_UTF8_FLAG) != ZIP_OK) {
+			zipClose(zf, NULL);
+			return 0;
+		}
+		size_t sz = test_content(i, buf);
+		zipWriteInFileInZip(zf, buf, (unsigned)sz);
+		zipCloseFileInZip(zf);
+	}
+	zipClose(zf, NULL);
+	return 1;
+}
+
+// the old path of luazip_open("archive.zip|index")
+static struct zip_reader_cache *
+old_read(const char *filename, int idx) {
+	unzFile uzf = unzOpen2(filename, 0);
+	if (uzf == NULL)
+		return NULL;
+	int err = unzGoToFirstFile(uzf);
+	int i;
+	for (i = 0; i < idx && err == UNZ_OK; i++) {
+		err = unzGoToNextFile(uzf);
+	}
+	unz_file_info info;
+	if (err == UNZ_OK)
+		err = unzGetCurrentFileInfo(uzf, &info, NULL, 0, NULL, 0, NULL, 0);
+	if (err == UNZ_OK)
+		err = unzOpenCurrentFile(uzf);
+	if (err != UNZ_OK) {
+		unzClose(uzf);
+		return NULL;
+	}
+	struct zip_reader_cache * c = luazip_new(info.uncompressed_size, NULL);
+	void * data = luazip_data(c, NULL);
+	if (info.uncompressed_size != 0) {
+		int bytes = unzReadCurrentFile(uzf, data, info.uncompressed_size);
+		if (bytes != info.uncompressed_size) {
+			luazip_close(c);
+			unzClose(uzf);
+			return NULL;
+		}
+	}
+	unzClose(uzf);
+	return c;
+}
+
+static int
+test_check(int idx, struct zip_reader_cache *c) {
+	uint8_t buf[TEST_MAXSIZE];
+	if (c == NULL)
+		return 0;
+	size_t sz = test_content(idx, buf);
+	size_t len;
+	void *data = luazip_data(c, &len);
+	int ok = len == sz && memcmp(data, buf, sz) == 0;
+	luazip_close(c);
+	return ok;
+}
+
+int
+main(int argc, char *argv[]) {
+	const char *filename = argc > 1 ? argv[1] : "luazip_test.zip";
+	if (!test_create(filename, TEST_FILES)) {
+		printf("Can't create %s\n", filename);
+		return 1;
+	}
+	char path[4096];
+	int i, fail = 0;
+	double t = test_now();
+	for (i = 0; i < TEST_FILES; i++) {
+		fail += !test_check(i, old_read(filename, i));
+	}
+	printf("old         : %d files %.2fms, fail %d\n", TEST_FILES, test_now() - t, fail);
+
+	fail = 0;
+	t = test_now();
+	for (i = 0; i < TEST_FILES; i++) {
+		snprintf(path, sizeof(path), "%s|%d", filename, i);
+		fail += !test_check(i, luazip_open(path));
+	}
+	printf("luazip_open : %d files %.2fms(include the index), fail %d\n", TEST_FILES, test_now() - t, fail);
+
+	fail = 0;
+	t = test_now();
+	for (i = 0; i < TEST_FILES; i++) {
+		snprintf(path, sizeof(path), "%s|%d", filename, i);
+		fail += !test_check(i, luazip_open(path));
+	}
+	printf("luazip_open : %d files %.2fms(cached), fail %d\n", TEST_FILES, test_now() - t, fail);
+
+	// replace the archive with the first half of the files, the cached archive is reopened
+	remove(filename);
+	if (!test_create(filename, TEST_FILES / 2)) {
+		printf("Can't create %s\n", filename);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s|%d", filename, TEST_FILES / 2 - 1);
+	fail = !test_check(TEST_FILES / 2 - 1, luazip_open(path));
+	snprintf(path, sizeof(path), "%s|%d", filename, TEST_FILES / 2);
+	struct zip_reader_cache *c = luazip_open(path);
+	if (c) {
+		luazip_close(c);
+		++fail;
+	}
+	printf("luazip_open : replaced archive, fail %d\n", fail);
+	remove(filename);
+	return 0;
+}
@@ -0,0 +1,81 @@
+local lm = require "luamake"
+
+-- the benchmarks of the engine modules, each one compares the new path with the old one and checks the results.
+-- luamake bench, then run bin/<plat>/<mode>/bench_*, the timings are meaningful in release mode
+
+lm:exe "bench_frustum_cull" {
+    includes = {
+        lm.AntDir .. "/pkg/ant.render/cull",
+    },
+    sources = {
+        "frustum_cull.cpp",
+        lm.AntDir .. "/pkg/ant.render/cull/frustum_cull.cpp",
+    },
+}
+
+lm:exe "bench_aabb_tree" {
+    includes = {
+        lm.AntDir .. "/clibs/foundation",
+    },
+    sources = {
+        "aabb_tree.cpp",
+        lm.AntDir .. "/clibs/foundation/aabb_tree.cpp",
+    },
+}
+
+lm:exe "bench_occlusion_cull" {
+    includes = {
+        lm.AntDir .. "/pkg/ant.render/cull",
+    },
+    sources = {
+        "occlusion_cull.cpp",
+        lm.AntDir .. "/pkg/ant.render/cull/occlusion_cull.cpp",
+    },
+}
+
+lm:exe "bench_luazip" {
+    deps = {
+        "zip",
+        "lua_source",
+    },
+    includes = {
+        lm.AntDir .. "/clibs/zip",
+        lm.AntDir .. "/3rd/bee.lua/3rd/lua",
+        lm.AntDir .. "/3rd/minizip-ng",
+        lm.AntDir .. "/3rd/zlib-ng",
+        "$builddir/gen-zlib",
+    },
+    sources = {
+        "luazip.c",
+    },
+}
+
+lm:exe "bench_meshopt" {
+    includes = {
+        lm.AntDir .. "/clibs/meshopt",
+    },
+    sources = {
+        "meshopt.cpp",
+        lm.AntDir .. "/clibs/meshopt/meshopt.cpp",
+    },
+}
+
+lm:exe "bench_job_pool" {
+    includes = {
+        lm.AntDir .. "/clibs/foundation",
+    },
+    sources = {
+        "job_pool.cpp",
+    },
+}
+
+lm:phony "bench" {
+    deps = {
+        "bench_frustum_cull",
+        "bench_aabb_tree",
+        "bench_occlusion_cull",
+        "bench_luazip",
+        "bench_meshopt",
+        "bench_job_pool",
+    }
+}
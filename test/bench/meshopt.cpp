@@ -0,0 +1,87 @@
+// the model compiler steps on a shuffled sphere: the ACMR after each step, the unique vertices and the LODs
+
+#include "meshopt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// a sphere of stacks * slices quads, the triangles are shuffled as the bad exported meshes
+static void
+make_sphere(std::vector<float> &positions, std::vector<uint32_t> &indices, uint32_t stacks, uint32_t slices) {
+	for (uint32_t ii=0; ii<=stacks; ++ii) {
+		const float theta = 3.14159265f * ii / stacks;
+		for (uint32_t jj=0; jj<=slices; ++jj) {
+			const float phi = 2.f * 3.14159265f * jj / slices;
+			positions.push_back(sinf(theta) * cosf(phi));
+			positions.push_back(cosf(theta));
+			positions.push_back(sinf(theta) * sinf(phi));
+		}
+	}
+	for (uint32_t ii=0; ii<stacks; ++ii) {
+		for (uint32_t jj=0; jj<slices; ++jj) {
+			const uint32_t a = ii * (slices + 1) + jj, b = a + slices + 1;
+			const uint32_t quad[6] = {a, b, a + 1, a + 1, b, b + 1};
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+	const size_t face_count = indices.size() / 3;
+	for (size_t f=face_count-1; f>0; --f) {
+		const size_t r = (size_t)rand() % (f + 1);
+		for (int ii=0; ii<3; ++ii) {
+			std::swap(indices[f * 3 + ii], indices[r * 3 + ii]);
+		}
+	}
+}
+
+template<typename Func>
+static double
+bench(Func &&f){
+	auto t0 = std::chrono::high_resolution_clock::now();
+	f();
+	auto t1 = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int
+main() {
+	srand(1);
+	std::vector<float> positions;
+	std::vector<uint32_t> indices;
+	make_sphere(positions, indices, 256, 512);
+	const size_t vertex_count = positions.size() / 3;
+	const size_t index_count = indices.size();
+	const size_t stride = sizeof(float) * 3;
+	printf("%zu vertices, %zu triangles\n", vertex_count, index_count / 3);
+	printf("input acmr: %.3f\n", meshopt_acmr(indices.data(), index_count, vertex_count, MESHOPT_CACHE_SIZE));
+
+	std::vector<uint32_t> vcache(index_count);
+	double ms = bench([&](){ meshopt_optimize_vertex_cache(vcache.data(), indices.data(), index_count, vertex_count); });
+	printf("vertex cache: %.3f, %.2fms\n", meshopt_acmr(vcache.data(), index_count, vertex_count, MESHOPT_CACHE_SIZE), ms);
+
+	std::vector<uint32_t> overdraw(index_count);
+	ms = bench([&](){ meshopt_optimize_overdraw(overdraw.data(), vcache.data(), index_count, positions.data(), stride, vertex_count, 1.05f); });
+	printf("overdraw: %.3f, %.2fms\n", meshopt_acmr(overdraw.data(), index_count, vertex_count, MESHOPT_CACHE_SIZE), ms);
+
+	std::vector<uint32_t> remap(vertex_count);
+	const size_t unique = meshopt_optimize_vertex_fetch_remap(remap.data(), overdraw.data(), index_count, vertex_count);
+	printf("vertex fetch: %zu unique vertices\n", unique);
+
+	std::vector<uint32_t> sorted(indices);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<uint32_t> check(overdraw);
+	std::sort(check.begin(), check.end());
+	printf("same vertices: %s\n", sorted == check ? "yes" : "no");
+
+	for (float ratio : {0.5f, 0.25f, 0.1f}) {
+		std::vector<uint32_t> lod(index_count);
+		float error = 0.f;
+		size_t n = 0;
+		ms = bench([&](){ n = meshopt_simplify(lod.data(), overdraw.data(), index_count, positions.data(), stride, vertex_count, (size_t)(index_count * ratio) / 3 * 3, 0.05f, &error); });
+		printf("simplify %.2f: %zu triangles, error %.5f, %.2fms\n", ratio, n / 3, error, ms);
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+// a city block: a grid of buildings as the occluders, small props on the streets. the checksums
+// must be the same for all the instruction sets(build with -mavx or -DCULL_NO_SIMD to compare).
+// the occluded props are checked by rays from the eye
+
+#include "occlusion_cull.h"
+#include "cull_simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// as occlusion_cull.cpp, the points nearer than it are never occluded
+static constexpr float NEAR_W = 1e-3f;
+
+struct clip_vertex {
+	float x, y, w;
+};
+
+static inline clip_vertex
+transform(const float *m, float x, float y, float z){
+	return clip_vertex {
+		m[0] * x + m[4] * y + m[8]  * z + m[12],
+		m[1] * x + m[5] * y + m[9]  * z + m[13],
+		m[3] * x + m[7] * y + m[11] * z + m[15],
+	};
+}
+
+static inline void
+box_corner(const float *aabb, int ii, float v[3]){
+	v[0] = aabb[(ii & 1) ? 4 : 0];
+	v[1] = aabb[(ii & 2) ? 5 : 1];
+	v[2] = aabb[(ii & 4) ? 6 : 2];
+}
+
+template<typename Func>
+static double
+time_ms(Func &&f, int loop){
+	const auto start = std::chrono::steady_clock::now();
+	for (int ii=0; ii<loop; ++ii)
+		f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / loop;
+}
+
+// left hand, look at +z from eye, w is the view depth
+static void
+make_viewproj(float *m, const float eye[3], float fovy, float aspect, float n, float f){
+	const float t = 1.f / std::tan(fovy * 0.5f);
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = t / aspect;
+	m[5] = t;
+	m[10] = f / (f - n);
+	m[11] = 1.f;
+	m[12] = -eye[0] * m[0];
+	m[13] = -eye[1] * m[5];
+	m[14] = -eye[2] * m[10] - n * f / (f - n);
+	m[15] = -eye[2];
+}
+
+static void
+make_translate(float *m, float x, float y, float z){
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = m[5] = m[10] = m[15] = 1.f;
+	m[12] = x; m[13] = y; m[14] = z;
+}
+
+static bool
+segment_hit(const float *aabb, const float o[3], const float p[3]){
+	float tmin = 0.f, tmax = 1.f;
+	for (int ii=0; ii<3; ++ii){
+		const float d = p[ii] - o[ii];
+		if (std::fabs(d) < 1e-12f){
+			if (o[ii] < aabb[ii] || o[ii] > aabb[4+ii])
+				return false;
+			continue;
+		}
+		float t1 = (aabb[ii] - o[ii]) / d, t2 = (aabb[4+ii] - o[ii]) / d;
+		if (t1 > t2) std::swap(t1, t2);
+		tmin = std::max(tmin, t1);
+		tmax = std::min(tmax, t2);
+		if (tmin > tmax)
+			return false;
+	}
+	return true;
+}
+
+int
+main(){
+	// 20x20 buildings, 8m x 8m, 10 ~ 40m high, the streets are 8m wide
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> height(10.f, 40.f), unit(0.f, 1.f);
+	struct building { float worldmat[16]; float local[8]; float world[8]; };
+	std::vector<building> buildings;
+	for (int ix=0; ix<20; ++ix){
+		for (int iz=0; iz<20; ++iz){
+			building b;
+			const float x = (ix - 10) * 16.f + 8.f, z = iz * 16.f;
+			const float h = height(rng);
+			make_translate(b.worldmat, x, 0.f, z);
+			const float local[8] = {-4.f, 0.f, -4.f, 0.f, 4.f, h, 4.f, 0.f};
+			memcpy(b.local, local, sizeof(local));
+			const float world[8] = {x-4.f, 0.f, z-4.f, 0.f, x+4.f, h, z+4.f, 0.f};
+			memcpy(b.world, world, sizeof(world));
+			buildings.push_back(b);
+		}
+	}
+
+	// props on the streets and in the yards
+	const uint32_t nprop = 100000;
+	std::vector<float> props(nprop * 8), centers(nprop * 3), extents(nprop * 3);
+	for (uint32_t ii=0; ii<nprop; ++ii){
+		const float x = (unit(rng) - 0.5f) * 320.f, z = unit(rng) * 320.f - 8.f;
+		const float s = 0.25f + unit(rng);
+		const float p[8] = {x-s, 0.f, z-s, 0.f, x+s, 2.f*s, z+s, 0.f};
+		memcpy(&props[ii*8], p, sizeof(p));
+		const float c[3] = {x, s, z}, e[3] = {s, s, s};
+		memcpy(&centers[ii*3], c, sizeof(c));
+		memcpy(&extents[ii*3], e, sizeof(e));
+	}
+
+	const char *simd =
+#ifdef CULL_SIMD
+		CULL_SIMD;
+#else
+		"scalar";
+#endif
+	printf("simd: %s, %ux%u\n", simd, OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+	// in front of the city, on a street 1cm from a wall(the walls are clipped by the near plane), and above it
+	const float eyes[][3] = {
+		{0.f, 1.7f, -60.f},
+		{3.99f, 1.7f, 0.f},
+		{-60.f, 30.f, -20.f},
+	};
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (const auto &eye : eyes){
+		float viewproj[16];
+		make_viewproj(viewproj, eye, 1.0f, 16.f / 9.f, 0.1f, 1000.f);
+
+		occlusion_buffer ob;
+		const double raster_ms = time_ms([&](){
+			ob.begin(viewproj);
+			for (const auto &b : buildings)
+				ob.rasterize_box(b.worldmat, b.local);
+			ob.end();
+		}, 50);
+
+		std::vector<uint8_t> occluded(nprop);
+		const double test_ms = time_ms([&](){
+			for (uint32_t ii=0; ii<nprop; ++ii)
+				occluded[ii] = ob.test(&centers[ii*3], &extents[ii*3]) ? 1 : 0;
+		}, 10);
+
+		h = (h ^ ob.checksum()) * 0x100000001b3ull;
+		uint32_t noccluded = 0;
+		for (uint32_t ii=0; ii<nprop; ++ii){
+			h = (h ^ occluded[ii]) * 0x100000001b3ull;
+			noccluded += occluded[ii];
+		}
+
+		// every ray from the eye to the corners and the center of an occluded prop must hit a building,
+		// but the points out of the frustum, they aren't on the screen
+		uint32_t wrong = 0;
+		for (uint32_t ii=0; ii<nprop; ++ii){
+			if (!occluded[ii])
+				continue;
+			const float *a = &props[ii*8];
+			bool hidden = true;
+			for (int c=0; c<9 && hidden; ++c){
+				float p[3];
+				if (c < 8)
+					box_corner(a, c, p);
+				else
+					for (int jj=0; jj<3; ++jj) p[jj] = (a[jj] + a[4+jj]) * 0.5f;
+				const clip_vertex cv = transform(viewproj, p[0], p[1], p[2]);
+				if (cv.w < NEAR_W || std::fabs(cv.x) > cv.w || std::fabs(cv.y) > cv.w)
+					continue;
+				bool hit = false;
+				for (const auto &b : buildings){
+					if (segment_hit(b.world, eye, p)){
+						hit = true;
+						break;
+					}
+				}
+				hidden = hit;
+			}
+			wrong += hidden ? 0 : 1;
+		}
+
+		printf("eye(%g, %g, %g) %u occluders(%u faces): %.3fms, %u props: %.3fms, occluded %u(%.1f%%), wrong %u\n",
+			eye[0], eye[1], eye[2], ob.stat.occluders, ob.stat.faces, raster_ms, nprop, test_ms, noccluded, noccluded * 100.f / nprop, wrong);
+	}
+	printf("checksum: %016llx\n", (unsigned long long)h);
+	return 0;
+}
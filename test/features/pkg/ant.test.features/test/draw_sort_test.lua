@@ -0,0 +1,193 @@
+local ecs   = ...
+local world = ecs.world
+local w     = world.w
+
+local math3d    = require "math3d"
+local rs        = require "render.stat"
+local submit    = require "render.submit"
+
+local common    = ecs.require "common"
+local util      = ecs.require "util"
+local PC        = util.proxy_creator()
+
+local iom       = ecs.require "ant.objcontroller|obj_motion"
+
+local ds_test_sys = common.test_system "draw_sort"
+
+-- interleave the meshes/materials, so ECS order is the worst case for state changes
+local PREFABS<const> = {
+    "/pkg/ant.resources.binary/meshes/base/cube.glb|mesh.prefab",
+    "/pkg/ant.resources.binary/meshes/base/cone.glb|mesh.prefab",
+    "/pkg/ant.resources.binary/meshes/base/cylinder.glb|mesh.prefab",
+    "/pkg/ant.resources.binary/meshes/base/sphere.glb|mesh.prefab",
+    "/pkg/ant.resources.binary/meshes/base/ring.glb|mesh.prefab",
+}
+
+local MATERIALS<const> = {
+    "/pkg/ant.test.features/assets/pbr_test.material",
+    "/pkg/ant.test.features/assets/texture_test.material",
+    "/pkg/ant.test.features/assets/render_layer_test.material",
+}
+
+local GRID_SIZE<const> = 40
+local STEP<const> = 3
+
+local function create_entities()
+    local cube_mesh = "/pkg/ant.resources.binary/meshes/base/cube.glb|meshes/Cube_P1.meshbin"
+    for i=0, GRID_SIZE-1 do
+        for j=0, GRID_SIZE-1 do
+            local idx = i * GRID_SIZE + j
+            local pos = math3d.vector((i - GRID_SIZE//2) * STEP, 0, (j - GRID_SIZE//2) * STEP)
+            if idx % 2 == 0 then
+                PC:create_instance {
+                    prefab = PREFABS[(idx//2) % #PREFABS + 1],
+                    on_ready = function (e)
+                        local ee <close> = world:entity(e.tag['*'][1], "scene:update")
+                        iom.set_position(ee, pos)
+                    end
+                }
+            else
+                local m = MATERIALS[(idx//2) % #MATERIALS + 1]
+                PC:create_entity {
+                    policy = {
+                        "ant.render|render",
+                    },
+                    data = {
+                        mesh = cube_mesh,
+                        material = m,
+                        render_layer = m:match "render_layer_test" and "translucent" or nil,
+                        visible_state = "main_view",
+                        scene = {t = pos},
+                    },
+                }
+            end
+        end
+    end
+end
+
+function ds_test_sys:init()
+    create_entities()
+    -- the first report is unsorted, see check_sort
+    submit.sort(false)
+end
+
+-- time the submit of the draws in ECS order(as before the draw sort) and radix sorted, the draw cache is off,
+-- so the draws are collected(and sorted) in every frame. the times are RENDER_DEBUG stats of the last frame
+local TIME_MODES<const> = {false, true}
+local TIME_WARMUP<const> = 10
+local TIME_FRAMES<const> = 120
+local timing
+
+local function start_timing()
+    timing = {cache = submit.cache(), sort = submit.sort(), mode = 1, frame = 0, result = {}}
+    submit.cache(false)
+    submit.sort(TIME_MODES[1])
+end
+
+local function update_timing(ss)
+    local t = timing
+    t.frame = t.frame + 1
+    if t.frame <= TIME_WARMUP then
+        return
+    end
+    local r = t.result[t.mode]
+    if not r then
+        r = {submit = 0, sort = 0, frames = 0}
+        t.result[t.mode] = r
+    end
+    r.submit = r.submit + ss.submit_time
+    r.sort = r.sort + ss.sort_time
+    r.frames = r.frames + 1
+    if r.frames < TIME_FRAMES then
+        return
+    end
+    if t.mode < #TIME_MODES then
+        t.mode = t.mode + 1
+        t.frame = 0
+        submit.sort(TIME_MODES[t.mode])
+        return
+    end
+    local ecs_order, sorted = t.result[1], t.result[2]
+    assert(ecs_order.sort == 0, "draw sort: the draws are sorted when sort is off")
+    assert(sorted.sort > 0, "draw sort: the draws are not sorted")
+    print(("draw sort time, %d draws, %d frames: submit %.3fms in ECS order, %.3fms sorted, radix sort %.1fus"):format(
+        ss.simple_submit, TIME_FRAMES, ecs_order.submit / ecs_order.frames / 1000, sorted.submit / sorted.frames / 1000, sorted.sort / sorted.frames / 1000))
+    submit.cache(t.cache)
+    submit.sort(t.sort)
+    timing = false
+end
+
+-- compare an unsorted frame with a sorted frame of the same draws, sorting must not add program/material changes
+local unsorted
+local sort_checked = false
+local function check_sort(ss)
+    if sort_checked then
+        return
+    end
+    if unsorted == nil then
+        unsorted = {draws = ss.simple_submit, program = ss.program_change, material = ss.material_change}
+        submit.sort(true)
+        return
+    end
+    if unsorted.draws ~= ss.simple_submit then
+        -- the prefabs were not all ready, measure again
+        unsorted = nil
+        submit.sort(false)
+        return
+    end
+    sort_checked = true
+    assert(ss.program_change <= unsorted.program, ("draw sort: program change %d > unsorted %d"):format(ss.program_change, unsorted.program))
+    assert(ss.material_change <= unsorted.material, ("draw sort: material change %d > unsorted %d"):format(ss.material_change, unsorted.material))
+    print(("draw sort check passed, program change:%d->%d, material change:%d->%d"):format(
+        unsorted.program, ss.program_change, unsorted.material, ss.material_change))
+    start_timing()
+end
+
+local kb_mb = world:sub {"keyboard"}
+
+local FRAME<const> = 60
+local frame = 0
+function ds_test_sys:data_changed()
+    for _, key, press in kb_mb:unpack() do
+        if key == "T" and press == 0 then
+            local sort = not submit.sort()
+            submit.sort(sort)
+            print("draw sort:", sort)
+        elseif key == "C" and press == 0 then
+            local cache = not submit.cache()
+            submit.cache(cache)
+            print("draw cache:", cache)
+        elseif key == "I" and press == 0 then
+            local instancing = not submit.instancing()
+            submit.instancing(instancing)
+            print("instancing:", instancing)
+        end
+    end
+
+    if timing then
+        local ss = rs.submit_stat()
+        if next(ss) then
+            update_timing(ss)
+        end
+        return
+    end
+
+    frame = frame + 1
+    if frame % FRAME == 0 then
+        local ss = rs.submit_stat()
+        if next(ss) then
+            print(("draw sort:%s, draws:%d, program change:%d, material change:%d, state change:%d"):format(
+                submit.sort(), ss.simple_submit, ss.program_change, ss.material_change, ss.state_change))
+            print(("draw cache:%s, rebuild:%d, replay:%d, update:%d, transforms:%d"):format(
+                submit.cache(), ss.cache_rebuild, ss.cache_replay, ss.cache_update, ss.transform_count))
+            print(("instancing:%s, batches:%d, instances:%d, fallback:%d"):format(
+                submit.instancing(), ss.instance_batch, ss.instance_count, ss.instance_fallback))
+            print(("material apply:%d, skipped:%d"):format(ss.material_applied, ss.material_skipped))
+            check_sort(ss)
+        end
+    end
+end
+
+function ds_test_sys:exit()
+    PC:clear()
+end
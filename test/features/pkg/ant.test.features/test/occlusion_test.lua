@@ -0,0 +1,101 @@
+local ecs   = ...
+local world = ecs.world
+local w     = world.w
+
+local math3d    = require "math3d"
+
+local common    = ecs.require "common"
+local util      = ecs.require "util"
+local PC        = util.proxy_creator()
+
+local icull     = ecs.require "ant.render|cull.cull_system"
+
+local occ_test_sys = common.test_system "occlusion"
+
+-- a city block: the buildings are the occluders, most of the props behind them are culled
+local CUBE_MESH<const>  = "/pkg/ant.resources.binary/meshes/base/cube.glb|meshes/Cube_P1.meshbin"
+local MATERIAL<const>   = "/pkg/ant.test.features/assets/pbr_test.material"
+
+local BUILDING_GRID<const>  = 10
+local BUILDING_STEP<const>  = 12
+local PROP_GRID<const>      = 100
+local PROP_STEP<const>      = 1.2
+
+local function create_entities()
+    local half = BUILDING_GRID * BUILDING_STEP * 0.5
+    for i=0, BUILDING_GRID-1 do
+        for j=0, BUILDING_GRID-1 do
+            local h = 6 + (i * 7 + j * 3) % 10
+            PC:create_entity {
+                policy = {
+                    "ant.render|render",
+                    "ant.render|occluder",
+                },
+                data = {
+                    mesh = CUBE_MESH,
+                    material = MATERIAL,
+                    visible_state = "main_view",
+                    -- the cube mesh is [-0.5, 0.5], it's a box so the inner box is the mesh itself
+                    occluder = {
+                        aabb = {{-0.5, -0.5, -0.5}, {0.5, 0.5, 0.5}},
+                    },
+                    scene = {
+                        s = {8, h, 8},
+                        t = {i * BUILDING_STEP - half, h * 0.5, j * BUILDING_STEP - half},
+                    },
+                },
+            }
+        end
+    end
+
+    local phalf = PROP_GRID * PROP_STEP * 0.5
+    for i=0, PROP_GRID-1 do
+        for j=0, PROP_GRID-1 do
+            PC:create_entity {
+                policy = {
+                    "ant.render|render",
+                },
+                data = {
+                    mesh = CUBE_MESH,
+                    material = MATERIAL,
+                    visible_state = "main_view",
+                    scene = {
+                        s = 0.3,
+                        t = math3d.vector(i * PROP_STEP - phalf, 0.15, j * PROP_STEP - phalf),
+                    },
+                },
+            }
+        end
+    end
+end
+
+local enable_occlusion
+function occ_test_sys:init()
+    enable_occlusion = icull.occlusion()
+    icull.occlusion(true)
+    create_entities()
+end
+
+local kb_mb = world:sub {"keyboard"}
+
+local FRAME<const> = 60
+local frame = 0
+function occ_test_sys:data_changed()
+    for _, key, press in kb_mb:unpack() do
+        if key == "O" and press == 0 then
+            print("occlusion cull:", icull.occlusion(not icull.occlusion()))
+        end
+    end
+
+    frame = frame + 1
+    if frame % FRAME == 0 and icull.occlusion() then
+        local s = icull.occlusion_stat()
+        print(("occlusion cull, occluders:%d, faces:%d, tested:%d, occluded:%d"):format(
+            s.occluders, s.faces, s.tested, s.occluded))
+    end
+end
+
+function occ_test_sys:exit()
+    icull.occlusion(enable_occlusion)
+    PC:clear()
+end